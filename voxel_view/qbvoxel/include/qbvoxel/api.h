@@ -74,6 +74,10 @@ enum qbvoxel_error {
    * @note This code not emitted directly by this library.
    */
   QBVoxel_ErrMatrixCount = 10,
+  /**
+   * @brief Matrix data overruns the matrix bounds.
+   */
+  QBVoxel_ErrData = 11,
   /**
    * @brief First error code guaranteed unused by this library.
    * @note This code not emitted directly by this library.
@@ -231,6 +235,24 @@ typedef struct qbvoxel_i {
     ( void* p, unsigned long int i,
       unsigned long int x,unsigned long int y,unsigned long int z,
       struct qbvoxel_voxel const* v);
+  /**
+   * @brief Write a run of consecutive voxels (optional).
+   * @param p this instance
+   * @param i a matrix array index
+   * @param x matrix-local x-coordinate of the first voxel
+   * @param y matrix-local y-coordinate of the first voxel
+   * @param z matrix-local z-coordinate of the first voxel
+   * @param n number of voxels
+   * @param v array of `n` voxel structures providing channel data
+   * @return 0 on success, nonzero otherwise
+   * @note Voxels follow increasing x, then increasing y; a span may wrap
+   *   past the end of a row but never leaves its z-slice.
+   * @note When NULL, voxels are written one at a time with `write_voxel`.
+   */
+  int (*write_span)
+    ( void* p, unsigned long int i,
+      unsigned long int x,unsigned long int y,unsigned long int z,
+      unsigned long int n, struct qbvoxel_voxel const* v);
 } qbvoxel_i;
 
 /**
@@ -39,6 +39,19 @@ QBVoxel_API
 unsigned int qbvoxel_parse_do
   (struct qbvoxel_state *s, unsigned int sz, unsigned char const* buf);
 
+/**
+ * @brief Point a state at the start of a matrix.
+ * @param s parser state that has finished parsing a header
+ * @param i index of the matrix to parse next
+ * @return zero on success, nonzero if `s` is not between matrices or `i`
+ *   is out of range
+ * @note The next bytes given to `qbvoxel_parse_do` must start at the
+ *   matrix name length of matrix `i`. With a copy of the header state per
+ *   thread, matrices of an uncompressed file can be parsed in parallel.
+ */
+QBVoxel_API
+int qbvoxel_parse_seek(struct qbvoxel_state *s, unsigned long int i);
+
 #if defined(__cplusplus)
 };
 #endif /*__cplusplus*/
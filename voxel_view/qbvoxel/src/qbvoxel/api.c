@@ -11,7 +11,7 @@
 #include <string.h>
 
 char const* qbvoxel_api_version(void) {
-  return "0.4";
+  return "0.5";
 }
 
 unsigned long int qbvoxel_api_from_u32(unsigned char const* b) {
@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: Unlicense */
+/**
+ * @file qbvoxel/gen.c
+ * @brief Generator backend for the Qubicle parser library
+ */
+#define QBVoxel_API_Impl
+#include "qbvoxel/gen.h"
+#include <string.h>
+#include <stddef.h>
+
+/* run length encoding control words */
+enum qbvoxel_gen_rle {
+  QBVoxel_RLECode = 2u,
+  QBVoxel_RLENextSlice = 6u
+};
+
+static int qbvoxel_gen_read
+  (struct qbvoxel_state *s, unsigned long int x, unsigned long int y,
+    unsigned char* out);
+static void qbvoxel_gen_end_matrix(struct qbvoxel_state *s);
+static void qbvoxel_gen_rle_token(struct qbvoxel_state *s);
+
+int qbvoxel_gen_init(struct qbvoxel_state *s, struct qbvoxel_i* cb) {
+  s->last_error = 0;
+  s->state = 0u;
+  s->flags = 0u;
+  s->pos = 0u;
+  s->i = 0lu;
+  s->x = 0u;
+  s->y = 0u;
+  s->z = 0u;
+  s->width = 0u;
+  s->height = 0u;
+  s->depth = 0u;
+  memset(s->buffer, 0, sizeof(unsigned char)*32);
+  s->cb = cb;
+  memset(s->name_buffer, 0, sizeof(unsigned char)*256);
+  return 0;
+}
+
+void qbvoxel_gen_clear(struct qbvoxel_state *s) {
+  s->last_error = 0;
+  s->state = 0u;
+  s->flags = 0u;
+  s->pos = 0u;
+  s->i = 0lu;
+  s->x = 0u;
+  s->y = 0u;
+  s->z = 0u;
+  s->width = 0u;
+  s->height = 0u;
+  s->depth = 0u;
+  memset(s->buffer, 0, sizeof(unsigned char)*32);
+  s->cb = NULL;
+  memset(s->name_buffer, 0, sizeof(unsigned char)*256);
+  return;
+}
+
+/* encode the voxel at (x, y, s->z) of the current matrix */
+int qbvoxel_gen_read
+  (struct qbvoxel_state *s, unsigned long int x, unsigned long int y,
+    unsigned char* out)
+{
+  struct qbvoxel_voxel v = {0, 0, 0, 0};
+  int const res = (*s->cb->read_voxel)(s->cb->p, s->i, x, y, s->z, &v);
+  if (s->flags & QBVoxel_FlagBGRA) {
+    out[0] = v.b; out[1] = v.g; out[2] = v.r;
+  } else {
+    out[0] = v.r; out[1] = v.g; out[2] = v.b;
+  }
+  out[3] = v.a;
+  return res;
+}
+
+/* go to next matrix, or done if this was the last matrix */
+void qbvoxel_gen_end_matrix(struct qbvoxel_state *s) {
+  unsigned long int const matrix_count =
+    qbvoxel_api_from_u32(s->buffer+24);
+  s->i += 1u;
+  s->pos = 0u;
+  s->state = (s->i >= matrix_count) ? 255u : 1u;
+  return;
+}
+
+/*
+ * build the next compressed word(s) in buffer[0..11], length in
+ * buffer[28], and move the slice cursor past the voxels they cover
+ */
+void qbvoxel_gen_rle_token(struct qbvoxel_state *s) {
+  if (s->y >= s->height) {
+    qbvoxel_api_to_u32(s->buffer, QBVoxel_RLENextSlice);
+    s->buffer[28] = 4u;
+    s->x = 0u;
+    s->y = 0u;
+    s->z += 1u;
+  } else {
+    unsigned char v[4];
+    unsigned char next[4];
+    unsigned long int n = 1u;
+    unsigned long int word;
+    s->last_error = qbvoxel_gen_read(s, s->x, s->y, v);
+    /* extend the run through the rest of the slice */
+    for (;;) {
+      s->x += 1u;
+      if (s->x >= s->width) {
+        s->x = 0u;
+        s->y += 1u;
+      }
+      if (s->y >= s->height || s->last_error != 0)
+        break;
+      s->last_error = qbvoxel_gen_read(s, s->x, s->y, next);
+      if (memcmp(next, v, 4) != 0)
+        break;
+      n += 1u;
+    }
+    word = qbvoxel_api_from_u32(v);
+    if (n == 1u && word != QBVoxel_RLECode && word != QBVoxel_RLENextSlice) {
+      memcpy(s->buffer, v, 4);
+      s->buffer[28] = 4u;
+    } else {
+      /* runs, and single voxels that look like control words */
+      qbvoxel_api_to_u32(s->buffer, QBVoxel_RLECode);
+      qbvoxel_api_to_u32(s->buffer+4, n);
+      memcpy(s->buffer+8, v, 4);
+      s->buffer[28] = 12u;
+    }
+  }
+  return;
+}
+
+unsigned int qbvoxel_gen_do
+  (struct qbvoxel_state *s, unsigned int sz, unsigned char* buf)
+{
+  /* states:
+   * 0    - header
+   * 1    - matrix name length
+   * 2    - matrix name
+   * 3    - matrix bounds
+   * 4    - uncompressed matrix data
+   * 5    - compressed matrix data
+   * 255  - end of stream
+   */
+  unsigned int i = 0u;
+  while (i < sz && s->last_error == 0 && s->state != 255u) {
+    switch (s->state) {
+    case 0:
+      if (s->pos == 0u) {
+        unsigned long int const matrix_count =
+          (s->cb != NULL) ? (*s->cb->size)(s->cb->p) : 0u;
+        s->buffer[0] = 1u;
+        s->buffer[1] = 1u;
+        s->buffer[2] = 0u;
+        s->buffer[3] = 0u;
+        qbvoxel_api_to_u32(s->buffer+4, (s->flags & QBVoxel_FlagBGRA) ? 1 : 0);
+        qbvoxel_api_to_u32(s->buffer+8,
+          (s->flags & QBVoxel_FlagRightHand) ? 1 : 0);
+        qbvoxel_api_to_u32(s->buffer+12, (s->flags & QBVoxel_FlagRLE) ? 1 : 0);
+        qbvoxel_api_to_u32(s->buffer+16,
+          (s->flags & QBVoxel_FlagSideMasks) ? 1 : 0);
+        qbvoxel_api_to_u32(s->buffer+20, matrix_count);
+        /* save the matrix size */{
+          memmove(s->buffer+24, s->buffer+20, 4);
+        }
+      }
+      buf[i++] = s->buffer[s->pos];
+      s->pos += 1u;
+      if (s->pos >= 24u) {
+        s->pos = 0u;
+        s->i = 0u;
+        s->state = (qbvoxel_api_from_u32(s->buffer+24) == 0u) ? 255u : 1u;
+      } break;
+    case 1:
+      /* matrix name length */{
+        struct qbvoxel_matrix_info mi;
+        size_t len;
+        memset(&mi, 0, sizeof(mi));
+        s->last_error = (*s->cb->get_matrix)(s->cb->p, s->i, &mi);
+        if (s->last_error != 0)
+          break;
+        mi.name[255] = '\0';
+        len = strlen(mi.name);
+        memcpy(s->name_buffer, mi.name, len+1);
+        qbvoxel_api_to_u32(s->buffer+0, mi.size_x);
+        qbvoxel_api_to_u32(s->buffer+4, mi.size_y);
+        qbvoxel_api_to_u32(s->buffer+8, mi.size_z);
+        qbvoxel_api_to_i32(s->buffer+12, mi.pos_x);
+        qbvoxel_api_to_i32(s->buffer+16, mi.pos_y);
+        qbvoxel_api_to_i32(s->buffer+20, mi.pos_z);
+        s->width = mi.size_x;
+        s->height = mi.size_y;
+        s->depth = mi.size_z;
+        s->z = (unsigned long int)len;
+        buf[i++] = (unsigned char)len;
+        s->pos = 0u;
+        s->state = (s->z > 0) ? 2 : 3;
+      } break;
+    case 2:
+      /* matrix name */{
+        unsigned long int n = s->z - s->pos;
+        if (n > sz - i)
+          n = sz - i;
+        memcpy(buf+i, s->name_buffer+s->pos, n);
+        i += (unsigned int)n;
+        s->pos += (unsigned short)n;
+      }
+      if (s->pos >= s->z) {
+        s->pos = 0u;
+        s->state = 3;
+      } break;
+    case 3:
+      /* matrix bounds */{
+        unsigned long int n = 24u - s->pos;
+        if (n > sz - i)
+          n = sz - i;
+        memcpy(buf+i, s->buffer+s->pos, n);
+        i += (unsigned int)n;
+        s->pos += (unsigned short)n;
+      }
+      if (s->pos >= 24u) {
+        s->x = 0;
+        s->y = 0;
+        s->z = 0;
+        s->pos = 0u;
+        s->buffer[28] = 0u;
+        s->state = (s->flags & QBVoxel_FlagRLE) ? 5u : 4u;
+        if (s->depth == 0u) {
+          /* empty matrix has no slices */
+          qbvoxel_gen_end_matrix(s);
+        } else if (s->state == 4u && (s->width == 0u || s->height == 0u)) {
+          /* empty uncompressed matrix has no voxels */
+          qbvoxel_gen_end_matrix(s);
+        }
+      } break;
+    case 4: /* uncompressed matrix data */
+      if (s->pos == 0u && sz-i >= 4u) {
+        /* whole voxels straight into the output */
+        s->last_error = qbvoxel_gen_read(s, s->x, s->y, buf+i);
+        i += 4u;
+      } else {
+        if (s->pos == 0u)
+          s->last_error = qbvoxel_gen_read(s, s->x, s->y, s->buffer);
+        buf[i++] = s->buffer[s->pos];
+        s->pos += 1u;
+        if (s->pos < 4u)
+          break;
+        s->pos = 0u;
+      }
+      s->x += 1u;
+      if (s->x >= s->width) {
+        s->x = 0u;
+        s->y += 1u;
+      }
+      if (s->y >= s->height) {
+        s->y = 0u;
+        s->z += 1u;
+      }
+      if (s->z >= s->depth) {
+        qbvoxel_gen_end_matrix(s);
+      } break;
+    case 5: /* compressed matrix data */
+      if (s->pos == 0u)
+        qbvoxel_gen_rle_token(s);
+      /* */{
+        unsigned long int n = s->buffer[28] - s->pos;
+        if (n > sz - i)
+          n = sz - i;
+        memcpy(buf+i, s->buffer+s->pos, n);
+        i += (unsigned int)n;
+        s->pos += (unsigned short)n;
+      }
+      if (s->pos >= s->buffer[28]) {
+        s->pos = 0u;
+        if (s->z >= s->depth)
+          qbvoxel_gen_end_matrix(s);
+      } break;
+    }
+  }
+  return i;
+}
@@ -7,6 +7,31 @@
 #include "qbvoxel/parse.h"
 #include <string.h>
 #include <stddef.h>
+#include <limits.h>
+
+/* run length encoding control words */
+enum qbvoxel_parse_rle {
+  QBVoxel_RLECode = 2u,
+  QBVoxel_RLENextSlice = 6u
+};
+
+/* voxels per span when channels must be rewritten */
+enum { QBVoxel_SpanMax = 256 };
+
+/* raw RGBA matrix bytes are handed out as voxel structures */
+typedef char qbvoxel_parse_voxel_size
+  [(sizeof(struct qbvoxel_voxel) == 4u) ? 1 : -1];
+
+static unsigned long int qbvoxel_parse_slice_left
+  (struct qbvoxel_state const* s);
+static void qbvoxel_parse_emit
+  (struct qbvoxel_state *s, struct qbvoxel_voxel const* v, unsigned long int n);
+static void qbvoxel_parse_emit_raw
+  (struct qbvoxel_state *s, unsigned char const* raw, unsigned long int n);
+static void qbvoxel_parse_end_matrix(struct qbvoxel_state *s);
+static void qbvoxel_parse_run
+  (struct qbvoxel_state *s, unsigned char const* raw, unsigned long int n);
+static void qbvoxel_parse_next_slice(struct qbvoxel_state *s);
 
 int qbvoxel_parse_init(struct qbvoxel_state *s, struct qbvoxel_i* cb) {
   s->last_error = 0;
@@ -44,6 +69,141 @@ void qbvoxel_parse_clear(struct qbvoxel_state *s) {
   return;
 }
 
+int qbvoxel_parse_seek(struct qbvoxel_state *s, unsigned long int i) {
+  unsigned long int const matrix_count =
+    qbvoxel_api_from_u32(s->buffer+24);
+  if (s->last_error != 0)
+    return s->last_error;
+  else if (s->state != 1u && s->state != 255u)
+    return QBVoxel_ErrOutOfRange;
+  else if (i >= matrix_count)
+    return QBVoxel_ErrOutOfRange;
+  s->i = i;
+  s->pos = 0u;
+  s->state = 1u;
+  return 0;
+}
+
+/* voxels left in the current slice, saturating on overflow */
+unsigned long int qbvoxel_parse_slice_left(struct qbvoxel_state const* s) {
+  unsigned long int rows;
+  unsigned long int const row_left = s->width - s->x;
+  if (s->y >= s->height || s->x >= s->width)
+    return 0u;
+  rows = s->height - s->y - 1u;
+  if (rows > 0u && rows > (ULONG_MAX - row_left) / s->width)
+    return ULONG_MAX;
+  return row_left + rows*s->width;
+}
+
+/*
+ * hand `n` voxels to the callbacks at the slice cursor and advance it;
+ * `n` must not exceed `qbvoxel_parse_slice_left`
+ */
+void qbvoxel_parse_emit
+  (struct qbvoxel_state *s, struct qbvoxel_voxel const* v, unsigned long int n)
+{
+  if (s->cb == NULL) {
+    /* no callbacks */
+  } else if (s->cb->write_span != NULL) {
+    s->last_error = (*s->cb->write_span)(
+      s->cb->p, s->i, s->x, s->y, s->z, n, v);
+  } else {
+    unsigned long int x = s->x, y = s->y, k;
+    for (k = 0u; k < n && s->last_error == 0; ++k) {
+      s->last_error = (*s->cb->write_voxel)(s->cb->p, s->i, x, y, s->z, v+k);
+      x += 1u;
+      if (x >= s->width) {
+        x = 0u;
+        y += 1u;
+      }
+    }
+  }
+  s->x += n % s->width;
+  s->y += n / s->width;
+  if (s->x >= s->width) {
+    s->x -= s->width;
+    s->y += 1u;
+  }
+  return;
+}
+
+/* hand `n` voxels encoded as raw channel bytes to the callbacks */
+void qbvoxel_parse_emit_raw
+  (struct qbvoxel_state *s, unsigned char const* raw, unsigned long int n)
+{
+  if (!(s->flags & QBVoxel_FlagBGRA)) {
+    /* RGBA bytes already match the voxel structure */
+    qbvoxel_parse_emit(s, (struct qbvoxel_voxel const*)raw, n);
+  } else {
+    struct qbvoxel_voxel tmp[QBVoxel_SpanMax];
+    while (n > 0u && s->last_error == 0) {
+      unsigned long int const count = (n < QBVoxel_SpanMax) ? n : QBVoxel_SpanMax;
+      unsigned long int k;
+      for (k = 0u; k < count; ++k, raw += 4) {
+        tmp[k].r = raw[2];
+        tmp[k].g = raw[1];
+        tmp[k].b = raw[0];
+        tmp[k].a = raw[3];
+      }
+      qbvoxel_parse_emit(s, tmp, count);
+      n -= count;
+    }
+  }
+  return;
+}
+
+/*
+ * write `n` copies of a voxel at the slice cursor, up to
+ * `QBVoxel_SpanMax` at a time; each batch is one `write_span` call, or
+ * one `write_voxel` call per voxel when there is no `write_span`
+ */
+void qbvoxel_parse_run
+  (struct qbvoxel_state *s, unsigned char const* raw, unsigned long int n)
+{
+  struct qbvoxel_voxel tmp[QBVoxel_SpanMax];
+  unsigned long int k;
+  unsigned long int const fill = (n < QBVoxel_SpanMax) ? n : QBVoxel_SpanMax;
+  if (n > qbvoxel_parse_slice_left(s)) {
+    s->last_error = QBVoxel_ErrData;
+    return;
+  }
+  for (k = 0u; k < fill; ++k) {
+    if (s->flags & QBVoxel_FlagBGRA) {
+      tmp[k].r = raw[2]; tmp[k].g = raw[1]; tmp[k].b = raw[0];
+    } else {
+      tmp[k].r = raw[0]; tmp[k].g = raw[1]; tmp[k].b = raw[2];
+    }
+    tmp[k].a = raw[3];
+  }
+  while (n > 0u && s->last_error == 0) {
+    unsigned long int const count = (n < QBVoxel_SpanMax) ? n : QBVoxel_SpanMax;
+    qbvoxel_parse_emit(s, tmp, count);
+    n -= count;
+  }
+  return;
+}
+
+/* finish a compressed slice; go to next matrix after the last slice */
+void qbvoxel_parse_next_slice(struct qbvoxel_state *s) {
+  s->x = 0u;
+  s->y = 0u;
+  s->z += 1u;
+  if (s->z >= s->depth)
+    qbvoxel_parse_end_matrix(s);
+  else s->state = 5u;
+  return;
+}
+
+/* go to next matrix, or done if this was the last matrix */
+void qbvoxel_parse_end_matrix(struct qbvoxel_state *s) {
+  unsigned long int const matrix_count =
+    qbvoxel_api_from_u32(s->buffer+24);
+  s->i += 1u;
+  s->state = (s->i >= matrix_count) ? 255u : 1u;
+  return;
+}
+
 unsigned int qbvoxel_parse_do
   (struct qbvoxel_state *s, unsigned int sz, unsigned char const* buf)
 {
@@ -53,6 +213,9 @@ unsigned int qbvoxel_parse_do
    * 2    - matrix name
    * 3    - matrix bounds
    * 4    - uncompressed matrix data
+   * 5    - compressed matrix data: voxel or control word
+   * 6    - compressed matrix data: run length
+   * 7    - compressed matrix data: run voxel
    * 255  - end of stream
    */
   unsigned int i;
@@ -152,45 +315,86 @@ unsigned int qbvoxel_parse_do
         }
         s->pos = 0u;
         s->state = (s->flags & QBVoxel_FlagRLE) ? 5u : 4u;
+        if (s->depth == 0u) {
+          /* empty matrix has no slices */
+          qbvoxel_parse_end_matrix(s);
+        } else if (s->state == 4u && (s->width == 0u || s->height == 0u)) {
+          /* empty uncompressed matrix has no voxels */
+          qbvoxel_parse_end_matrix(s);
+        }
       } break;
     case 4: /* uncompressed matrix data */
-      if (s->pos < 4u) {
+      if (s->pos == 0u && sz-i >= 4u) {
+        /* whole voxels in the input go out as one span */
+        unsigned long int n = (sz-i)/4u;
+        unsigned long int const left = qbvoxel_parse_slice_left(s);
+        if (n > left)
+          n = left;
+        qbvoxel_parse_emit_raw(s, buf+i, n);
+        i += (unsigned int)(n*4u - 1u);
+      } else {
         s->buffer[s->pos] = buf[i];
         s->pos += 1u;
-      }
-      if (s->pos >= 4u) {
-        s->pos = 0u;
-        if (s->cb != NULL) {
-          if (s->flags & QBVoxel_FlagBGRA) {
-            struct qbvoxel_voxel const bgra = {
-                s->buffer[2], s->buffer[1], s->buffer[0], s->buffer[3]
-              };
-            s->last_error = (*s->cb->write_voxel)(
-              s->cb->p, s->i, s->x, s->y, s->z, &bgra);
-          } else /*RGBA */{
-            struct qbvoxel_voxel const rgba = {
-                s->buffer[0], s->buffer[1], s->buffer[2], s->buffer[3]
-              };
-            s->last_error = (*s->cb->write_voxel)(
-              s->cb->p, s->i, s->x, s->y, s->z, &rgba);
-          }
+        if (s->pos >= 4u) {
+          s->pos = 0u;
+          qbvoxel_parse_emit_raw(s, s->buffer, 1u);
         }
-        s->x += 1u;
-      }
-      if (s->x >= s->width) {
-        s->x = 0u;
-        s->y += 1u;
       }
       if (s->y >= s->height) {
         s->y = 0u;
         s->z += 1u;
       }
       if (s->z >= s->depth) {
-        /* go to next matrix, or done if this was the last matrix */
-        unsigned long int const matrix_count =
-          qbvoxel_api_from_u32(s->buffer+24);
-        s->i += 1u;
-        s->state = (s->i >= matrix_count) ? 255u : 1u;
+        qbvoxel_parse_end_matrix(s);
+      } break;
+    case 5: /* compressed matrix data: voxel or control word */
+      if (s->pos == 0u && sz-i >= 4u) {
+        /* plain voxel words in the input go out as one span */
+        unsigned long int const left = qbvoxel_parse_slice_left(s);
+        unsigned long int n = 0u;
+        while (n < left && sz-i-n*4u >= 4u) {
+          unsigned long int const word = qbvoxel_api_from_u32(buf+i+n*4u);
+          if (word == QBVoxel_RLECode || word == QBVoxel_RLENextSlice)
+            break;
+          n += 1u;
+        }
+        if (n > 0u) {
+          qbvoxel_parse_emit_raw(s, buf+i, n);
+          i += (unsigned int)(n*4u - 1u);
+          break;
+        }
+      }
+      if (s->pos < 4u) {
+        s->buffer[s->pos] = buf[i];
+        s->pos += 1u;
+      }
+      if (s->pos >= 4u) {
+        unsigned long int const word = qbvoxel_api_from_u32(s->buffer);
+        s->pos = 0u;
+        if (word == QBVoxel_RLECode) {
+          s->state = 6u;
+        } else if (word == QBVoxel_RLENextSlice) {
+          qbvoxel_parse_next_slice(s);
+        } else qbvoxel_parse_run(s, s->buffer, 1u);
+      } break;
+    case 6: /* compressed matrix data: run length */
+      if (s->pos < 4u) {
+        s->buffer[4u+s->pos] = buf[i];
+        s->pos += 1u;
+      }
+      if (s->pos >= 4u) {
+        s->pos = 0u;
+        s->state = 7u;
+      } break;
+    case 7: /* compressed matrix data: run voxel */
+      if (s->pos < 4u) {
+        s->buffer[s->pos] = buf[i];
+        s->pos += 1u;
+      }
+      if (s->pos >= 4u) {
+        s->pos = 0u;
+        s->state = 5u;
+        qbvoxel_parse_run(s, s->buffer, qbvoxel_api_from_u32(s->buffer+4));
       } break;
     }
   }
@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: Unlicense */
+/*
+ * Decode throughput of the per-voxel and span callbacks.
+ *
+ * usage: qbvoxel_bench [edge [rounds]]
+ */
+#include "qbvoxel/api.h"
+#include "qbvoxel/parse.h"
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct bench_matrix {
+  unsigned long int width, height, depth;
+  struct qbvoxel_voxel *data;
+};
+
+static int bench_resize(void* p, unsigned long int n);
+static int bench_set_matrix
+  (void* p, unsigned long int i, struct qbvoxel_matrix_info const* mi);
+static int bench_write_voxel
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    struct qbvoxel_voxel const* v);
+static int bench_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, struct qbvoxel_voxel const* v);
+static unsigned char* bench_make
+  (unsigned long int edge, int rle, unsigned long int* len);
+static double bench_run
+  ( struct qbvoxel_i* cb, unsigned char const* qb, unsigned long int len,
+    unsigned int chunk, unsigned int rounds);
+
+
+int bench_resize(void* p, unsigned long int n) {
+  (void)p;
+  return n == 1 ? 0 : QBVoxel_ErrMatrixCount;
+}
+int bench_set_matrix
+  (void* p, unsigned long int i, struct qbvoxel_matrix_info const* mi)
+{
+  struct bench_matrix* const m = (struct bench_matrix*)p;
+  size_t const sz = mi->size_x * mi->size_y * mi->size_z;
+  (void)i;
+  if (m->data == NULL
+  ||  sz != m->width * m->height * m->depth)
+    return QBVoxel_ErrMemory;
+  return 0;
+}
+int bench_write_voxel
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    struct qbvoxel_voxel const* v)
+{
+  struct bench_matrix* const m = (struct bench_matrix*)p;
+  if (i != 0 || x >= m->width || y >= m->height || z >= m->depth)
+    return QBVoxel_ErrOutOfRange;
+  m->data[x + (y + z*m->height)*m->width] = *v;
+  return 0;
+}
+int bench_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, struct qbvoxel_voxel const* v)
+{
+  struct bench_matrix* const m = (struct bench_matrix*)p;
+  size_t const pos = x + (y + z*m->height)*m->width;
+  if (i != 0 || x >= m->width || y >= m->height || z >= m->depth)
+    return QBVoxel_ErrOutOfRange;
+  if (n > m->width*m->height*m->depth - pos)
+    return QBVoxel_ErrOutOfRange;
+  memcpy(m->data+pos, v, n*sizeof(struct qbvoxel_voxel));
+  return 0;
+}
+
+/* cube of `edge` voxels: hills of solid color over empty space */
+unsigned char* bench_make
+  (unsigned long int edge, int rle, unsigned long int* len)
+{
+  unsigned long int const count = edge*edge*edge;
+  /* worst case RLE output is one word per voxel plus slice ends */
+  unsigned long int const cap = 24 + 2 + 24 + count*4 + edge*4;
+  unsigned char* const qb = (unsigned char*)malloc(cap);
+  unsigned char* p = qb;
+  unsigned long int x, y, z;
+  if (qb == NULL)
+    return NULL;
+  memset(p, 0, 24);
+  p[0] = 1; p[1] = 1;
+  p[12] = rle ? 1 : 0;
+  p[20] = 1;
+  p += 24;
+  *p++ = 1;
+  *p++ = 'B';
+  qbvoxel_api_to_u32(p, edge);
+  qbvoxel_api_to_u32(p+4, edge);
+  qbvoxel_api_to_u32(p+8, edge);
+  memset(p+12, 0, 12);
+  p += 24;
+  for (z = 0; z < edge; ++z) {
+    unsigned char run[4] = {0,0,0,0};
+    unsigned long int run_len = 0;
+    for (y = 0; y < edge; ++y) {
+      for (x = 0; x < edge; ++x) {
+        unsigned long int const top = edge/4 + ((x/8 + z/8) % (edge/2+1));
+        unsigned char v[4] = {0,0,0,0};
+        if (y < top) {
+          v[0] = (unsigned char)(64 + (y*4)%128);
+          v[1] = 160;
+          v[2] = (unsigned char)(32 + (x/8)%4);
+          v[3] = 255;
+        }
+        if (!rle) {
+          memcpy(p, v, 4);
+          p += 4;
+        } else if (run_len > 0 && memcmp(run, v, 4) == 0) {
+          run_len += 1;
+        } else {
+          if (run_len == 1) {
+            memcpy(p, run, 4);
+            p += 4;
+          } else if (run_len > 1) {
+            qbvoxel_api_to_u32(p, 2);
+            qbvoxel_api_to_u32(p+4, run_len);
+            memcpy(p+8, run, 4);
+            p += 12;
+          }
+          memcpy(run, v, 4);
+          run_len = 1;
+        }
+      }
+    }
+    if (rle) {
+      if (run_len == 1) {
+        memcpy(p, run, 4);
+        p += 4;
+      } else if (run_len > 1) {
+        qbvoxel_api_to_u32(p, 2);
+        qbvoxel_api_to_u32(p+4, run_len);
+        memcpy(p+8, run, 4);
+        p += 12;
+      }
+      qbvoxel_api_to_u32(p, 6);
+      p += 4;
+    }
+  }
+  *len = (unsigned long int)(p - qb);
+  return qb;
+}
+
+/* seconds per decode of the whole stream, fed `chunk` bytes at a time */
+double bench_run
+  ( struct qbvoxel_i* cb, unsigned char const* qb, unsigned long int len,
+    unsigned int chunk, unsigned int rounds)
+{
+  unsigned int r;
+  clock_t const start = clock();
+  for (r = 0; r < rounds; ++r) {
+    qbvoxel_state st;
+    unsigned long int off = 0;
+    qbvoxel_parse_init(&st, cb);
+    while (off < len) {
+      unsigned int const n = (unsigned int)
+        ((len - off < chunk) ? (len - off) : chunk);
+      if (qbvoxel_parse_do(&st, n, qb+off) < n)
+        break;
+      off += n;
+    }
+    if (qbvoxel_api_get_error(&st) != 0) {
+      fprintf(stderr, "decode error %d\n", qbvoxel_api_get_error(&st));
+      qbvoxel_parse_clear(&st);
+      return -1.0;
+    }
+    qbvoxel_parse_clear(&st);
+  }
+  return ((double)(clock() - start) / CLOCKS_PER_SEC) / rounds;
+}
+
+int main(int argc, char **argv) {
+  unsigned long int const edge = (argc > 1) ? strtoul(argv[1], NULL, 10) : 128;
+  unsigned int const rounds = (argc > 2) ? (unsigned int)atoi(argv[2]) : 5;
+  double const voxels = (double)edge*edge*edge;
+  static unsigned int const chunks[2] = { 256u, 0xFFFFFFFFu };
+  struct bench_matrix m;
+  struct qbvoxel_i cb_voxel = {
+      NULL, bench_resize, NULL, NULL, bench_set_matrix,
+      NULL, bench_write_voxel, NULL
+    };
+  struct qbvoxel_i cb_span = {
+      NULL, bench_resize, NULL, NULL, bench_set_matrix,
+      NULL, bench_write_voxel, bench_write_span
+    };
+  int rle;
+  if (edge < 4 || rounds == 0) {
+    fprintf(stderr, "usage: %s [edge>=4 [rounds]]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  m.width = m.height = m.depth = edge;
+  m.data = (struct qbvoxel_voxel*)calloc
+    ((size_t)voxels, sizeof(struct qbvoxel_voxel));
+  if (m.data == NULL)
+    return EXIT_FAILURE;
+  cb_voxel.p = &m;
+  cb_span.p = &m;
+  printf("%lu^3 voxels, %u rounds\n", edge, rounds);
+  for (rle = 0; rle < 2; ++rle) {
+    unsigned long int len;
+    unsigned char* const qb = bench_make(edge, rle, &len);
+    unsigned int c;
+    if (qb == NULL) {
+      free(m.data);
+      return EXIT_FAILURE;
+    }
+    for (c = 0; c < 2; ++c) {
+      double const t_voxel = bench_run(&cb_voxel, qb, len, chunks[c], rounds);
+      double const t_span = bench_run(&cb_span, qb, len, chunks[c], rounds);
+      if (t_voxel < 0.0 || t_span < 0.0) {
+        free(qb);
+        free(m.data);
+        return EXIT_FAILURE;
+      }
+      printf("%s %10s  write_voxel %9.1f Mvoxel/s  write_span %9.1f Mvoxel/s\n",
+        rle ? "rle" : "raw", c ? "whole" : "256 bytes",
+        voxels / (t_voxel > 0.0 ? t_voxel : 1e-9) / 1e6,
+        voxels / (t_span > 0.0 ? t_span : 1e-9) / 1e6);
+    }
+    free(qb);
+  }
+  free(m.data);
+  return EXIT_SUCCESS;
+}
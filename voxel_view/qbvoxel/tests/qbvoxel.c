@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: Unlicense */
 #include "qbvoxel/api.h"
 #include "qbvoxel/parse.h"
+#include "qbvoxel/gen.h"
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
@@ -19,6 +20,18 @@ static int test_arrayresize(void*);
 static int test_flags(void*);
 static int test_addmatrix(void*);
 static int test_fillmatrix(void*);
+static int test_rle(void*);
+static int test_rlebytes(void*);
+static int test_rleoverrun(void*);
+static int test_fillvoxel(void*);
+static int test_rlevoxel(void*);
+static int test_bgra(void*);
+static int test_twomatrix(void*);
+static int test_seek(void*);
+static int test_genraw(void*);
+static int test_genrle(void*);
+static int test_genbytes(void*);
+static int test_genunpack(void*);
 
 struct cb_matrix {
   unsigned int width, height, depth;
@@ -45,6 +58,10 @@ static int cb_write_voxel
   ( void* p, unsigned long int i,
     unsigned long int x,unsigned long int y,unsigned long int z,
     struct qbvoxel_voxel const* v);
+static int cb_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, struct qbvoxel_voxel const* v);
 
 /* sample Qubicle file */
 static unsigned char const three_qb[] = {
@@ -64,6 +81,26 @@ static unsigned char const three_qb[] = {
   0x99,0xe5,0x50,0xff,0x6a,0xbe,0x30,0xff
 };
 
+/* run length encoded 4x2x2 matrix; runs wrap rows */
+static unsigned char const rle_qb[] = {
+  0x01,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,0x00,
+  0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,0x00,
+  0x01,0x52,0x04,0x00,0x00,0x00,0x02,0x00,0x00,0x00,0x02,0x00,
+  0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+  0x00,0x00,0x02,0x00,0x00,0x00,0x06,0x00,0x00,0x00,0x10,0x20,
+  0x30,0xff,0x40,0x50,0x60,0xff,0x70,0x80,0x90,0xff,0x06,0x00,
+  0x00,0x00,0x02,0x00,0x00,0x00,0x07,0x00,0x00,0x00,0x00,0x00,
+  0x00,0x00,0xaa,0xbb,0xcc,0xff,0x06,0x00,0x00,0x00
+};
+
+static int check_rle_matrix(struct cb_matrix_array const* qma);
+static void make_two_matrix(unsigned char* out);
+static int parse_whole
+  (struct qbvoxel_i* qi, unsigned char const* qb, unsigned int len);
+static unsigned int gen_whole
+  ( struct qbvoxel_i* qi, unsigned char flags, unsigned char* out,
+    unsigned int sz, unsigned int chunk);
+
 static struct {
   char const* nm;
   test_cb cb;
@@ -78,7 +115,19 @@ static struct {
   { "arrayresize", test_arrayresize },
   { "flags", test_flags },
   { "addmatrix", test_addmatrix},
-  { "fillmatrix", test_fillmatrix}
+  { "fillmatrix", test_fillmatrix},
+  { "rle", test_rle },
+  { "rlebytes", test_rlebytes },
+  { "rleoverrun", test_rleoverrun },
+  { "fillvoxel", test_fillvoxel },
+  { "rlevoxel", test_rlevoxel },
+  { "bgra", test_bgra },
+  { "twomatrix", test_twomatrix },
+  { "seek", test_seek },
+  { "genraw", test_genraw },
+  { "genrle", test_genrle },
+  { "genbytes", test_genbytes },
+  { "genunpack", test_genunpack }
 };
 
 int test_u32(void* p) {
@@ -319,6 +368,325 @@ int test_fillmatrix(void* q) {
 }
 
 
+int check_rle_matrix(struct cb_matrix_array const* qma) {
+  static struct qbvoxel_voxel const a = { 0x10, 0x20, 0x30, 0xff };
+  static struct qbvoxel_voxel const b = { 0x40, 0x50, 0x60, 0xff };
+  static struct qbvoxel_voxel const c = { 0x70, 0x80, 0x90, 0xff };
+  static struct qbvoxel_voxel const e = { 0, 0, 0, 0 };
+  static struct qbvoxel_voxel const f = { 0xaa, 0xbb, 0xcc, 0xff };
+  struct qbvoxel_voxel const* expect[16];
+  size_t i;
+  if (qma->count != 1 || qma->matrices[0].data == NULL)
+    return EXIT_FAILURE;
+  if (qma->matrices[0].width != 4 || qma->matrices[0].height != 2
+  ||  qma->matrices[0].depth != 2)
+    return EXIT_FAILURE;
+  for (i = 0; i < 6; ++i)
+    expect[i] = &a;
+  expect[6] = &b;
+  expect[7] = &c;
+  for (i = 8; i < 15; ++i)
+    expect[i] = &e;
+  expect[15] = &f;
+  for (i = 0; i < 16; ++i) {
+    if (memcmp(qma->matrices[0].data+i, expect[i], sizeof(qbvoxel_voxel)) != 0)
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int test_rle(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  struct cb_matrix_array *const qma = (struct cb_matrix_array *)(qi->p);
+  unsigned int const len = (unsigned int)sizeof(rle_qb);
+  qbvoxel_state st;
+  int res = EXIT_FAILURE;
+  qbvoxel_parse_init(&st, qi);
+  do {
+    if (qbvoxel_parse_do(&st, len, rle_qb) != len)
+      break;
+    if (qbvoxel_api_get_error(&st) != 0)
+      break;
+    if (st.state != 255u)
+      break;
+    if (!(st.flags & QBVoxel_FlagRLE))
+      break;
+    res = check_rle_matrix(qma);
+  } while (0);
+  qbvoxel_parse_clear(&st);
+  return res;
+}
+
+int test_rlebytes(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  struct cb_matrix_array *const qma = (struct cb_matrix_array *)(qi->p);
+  unsigned int const len = (unsigned int)sizeof(rle_qb);
+  unsigned int i;
+  qbvoxel_state st;
+  int res = EXIT_FAILURE;
+  qbvoxel_parse_init(&st, qi);
+  /* feed one byte at a time */do {
+    for (i = 0; i < len; ++i) {
+      if (qbvoxel_parse_do(&st, 1, rle_qb+i) != 1)
+        break;
+    }
+    if (i < len)
+      break;
+    if (qbvoxel_api_get_error(&st) != 0)
+      break;
+    if (st.state != 255u)
+      break;
+    res = check_rle_matrix(qma);
+  } while (0);
+  qbvoxel_parse_clear(&st);
+  return res;
+}
+
+int test_rleoverrun(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  unsigned int const len = (unsigned int)sizeof(rle_qb);
+  unsigned char bad[sizeof(rle_qb)];
+  qbvoxel_state st;
+  int res = EXIT_FAILURE;
+  memcpy(bad, rle_qb, len);
+  /* first run is now nine voxels long, one past the slice */
+  bad[54] = 0x09;
+  qbvoxel_parse_init(&st, qi);
+  qbvoxel_parse_do(&st, len, bad);
+  if (qbvoxel_api_get_error(&st) == QBVoxel_ErrData)
+    res = EXIT_SUCCESS;
+  qbvoxel_parse_clear(&st);
+  return res;
+}
+
+int test_fillvoxel(void* q) {
+  /* same as fillmatrix, one voxel per callback */
+  struct qbvoxel_i vi = *(struct qbvoxel_i *)q;
+  vi.write_span = NULL;
+  return test_fillmatrix(&vi);
+}
+
+int test_rlevoxel(void* q) {
+  /* same as rle, one voxel per callback */
+  struct qbvoxel_i vi = *(struct qbvoxel_i *)q;
+  vi.write_span = NULL;
+  return test_rle(&vi);
+}
+
+int test_bgra(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  struct cb_matrix_array *const qma = (struct cb_matrix_array *)(qi->p);
+  unsigned int const len = (unsigned int)sizeof(three_qb);
+  unsigned char bgra_qb[sizeof(three_qb)];
+  qbvoxel_state st;
+  int res = EXIT_FAILURE;
+  memcpy(bgra_qb, three_qb, len);
+  bgra_qb[4] = 1;
+  qbvoxel_parse_init(&st, qi);
+  do {
+    if (qbvoxel_parse_do(&st, len, bgra_qb) != len)
+      break;
+    if (qbvoxel_api_get_error(&st) != 0)
+      break;
+    if (qma->count != 1 || qma->matrices[0].data == NULL)
+      break;
+    /* */{
+      struct qbvoxel_voxel const vxl1 = { 57, 60, 50, 255 };
+      if (memcmp(qma->matrices[0].data+0, &vxl1, sizeof(qbvoxel_voxel)) != 0)
+        break;
+    }
+    /* */{
+      struct qbvoxel_voxel const vxl2 = { 48, 190, 106, 255 };
+      if (memcmp(qma->matrices[0].data+26, &vxl2, sizeof(qbvoxel_voxel)) != 0)
+        break;
+    }
+    res = EXIT_SUCCESS;
+  } while (0);
+  qbvoxel_parse_clear(&st);
+  return res;
+}
+
+/* three.qb with its matrix stored twice; second one shifted in x */
+void make_two_matrix(unsigned char* out) {
+  unsigned int const len = (unsigned int)sizeof(three_qb);
+  memcpy(out, three_qb, len);
+  memcpy(out+len, three_qb+24, len-24);
+  out[20] = 2;
+  qbvoxel_api_to_i32(out+len+1+7+12, 4);
+}
+
+int test_twomatrix(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  struct cb_matrix_array *const qma = (struct cb_matrix_array *)(qi->p);
+  unsigned char two_qb[sizeof(three_qb)*2-24];
+  unsigned int const len = (unsigned int)sizeof(two_qb);
+  qbvoxel_state st;
+  int res = EXIT_FAILURE;
+  make_two_matrix(two_qb);
+  qbvoxel_parse_init(&st, qi);
+  do {
+    if (qbvoxel_parse_do(&st, len, two_qb) != len)
+      break;
+    if (qbvoxel_api_get_error(&st) != 0 || st.state != 255u)
+      break;
+    if (qma->count != 2)
+      break;
+    if (qma->matrices[0].data == NULL || qma->matrices[1].data == NULL)
+      break;
+    if (qma->matrices[0].x != -5 || qma->matrices[1].x != 4)
+      break;
+    if (memcmp(qma->matrices[0].data, qma->matrices[1].data,
+          27*sizeof(qbvoxel_voxel)) != 0)
+      break;
+    res = EXIT_SUCCESS;
+  } while (0);
+  qbvoxel_parse_clear(&st);
+  return res;
+}
+
+int test_seek(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  struct cb_matrix_array *const qma = (struct cb_matrix_array *)(qi->p);
+  unsigned char two_qb[sizeof(three_qb)*2-24];
+  unsigned int const second = (unsigned int)sizeof(three_qb);
+  unsigned int const len = (unsigned int)sizeof(two_qb) - second;
+  qbvoxel_state st;
+  int res = EXIT_FAILURE;
+  make_two_matrix(two_qb);
+  qbvoxel_parse_init(&st, qi);
+  do {
+    if (qbvoxel_parse_do(&st, 24, two_qb) != 24)
+      break;
+    if (qbvoxel_parse_seek(&st, 2) == 0)
+      break;
+    if (qbvoxel_parse_seek(&st, 1) != 0)
+      break;
+    if (qbvoxel_parse_do(&st, len, two_qb+second) != len)
+      break;
+    if (qbvoxel_api_get_error(&st) != 0 || st.state != 255u)
+      break;
+    if (qma->count != 2)
+      break;
+    if (qma->matrices[0].data != NULL || qma->matrices[1].data == NULL)
+      break;
+    if (qma->matrices[1].x != 4)
+      break;
+    /* */{
+      struct qbvoxel_voxel const vxl2 = { 106, 190, 48, 255 };
+      if (memcmp(qma->matrices[1].data+26, &vxl2, sizeof(qbvoxel_voxel)) != 0)
+        break;
+    }
+    res = EXIT_SUCCESS;
+  } while (0);
+  qbvoxel_parse_clear(&st);
+  return res;
+}
+
+
+int parse_whole
+  (struct qbvoxel_i* qi, unsigned char const* qb, unsigned int len)
+{
+  qbvoxel_state st;
+  int res = EXIT_FAILURE;
+  qbvoxel_parse_init(&st, qi);
+  if (qbvoxel_parse_do(&st, len, qb) == len
+  &&  qbvoxel_api_get_error(&st) == 0 && st.state == 255u)
+    res = EXIT_SUCCESS;
+  qbvoxel_parse_clear(&st);
+  return res;
+}
+
+/* generate `chunk` bytes at a time; returns zero on error */
+unsigned int gen_whole
+  ( struct qbvoxel_i* qi, unsigned char flags, unsigned char* out,
+    unsigned int sz, unsigned int chunk)
+{
+  qbvoxel_state st;
+  unsigned int len = 0u;
+  qbvoxel_gen_init(&st, qi);
+  qbvoxel_api_set_flags(&st, flags);
+  while (len < sz) {
+    unsigned int const n = (sz - len < chunk) ? (sz - len) : chunk;
+    unsigned int const got = qbvoxel_gen_do(&st, n, out+len);
+    len += got;
+    if (got < n)
+      break;
+  }
+  if (qbvoxel_api_get_error(&st) != 0 || st.state != 255u)
+    len = 0u;
+  qbvoxel_gen_clear(&st);
+  return len;
+}
+
+int test_genraw(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  unsigned int const len = (unsigned int)sizeof(three_qb);
+  unsigned char out[sizeof(three_qb)+16];
+  if (parse_whole(qi, three_qb, len) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  if (gen_whole(qi, QBVoxel_FlagRightHand, out, sizeof(out), sizeof(out))
+      != len)
+    return EXIT_FAILURE;
+  return memcmp(out, three_qb, len) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int test_genrle(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  unsigned int const len = (unsigned int)sizeof(rle_qb);
+  unsigned char out[sizeof(rle_qb)+16];
+  if (parse_whole(qi, rle_qb, len) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  if (gen_whole(qi, QBVoxel_FlagRightHand|QBVoxel_FlagRLE,
+        out, sizeof(out), sizeof(out)) != len)
+    return EXIT_FAILURE;
+  return memcmp(out, rle_qb, len) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int test_genbytes(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  unsigned char two_qb[sizeof(three_qb)*2-24];
+  unsigned char out[sizeof(two_qb)];
+  unsigned int const len = (unsigned int)sizeof(two_qb);
+  unsigned int chunk;
+  make_two_matrix(two_qb);
+  if (parse_whole(qi, two_qb, len) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  /* every split of the output must give the same stream */
+  for (chunk = 1u; chunk <= 13u; ++chunk) {
+    memset(out, 0, len);
+    if (gen_whole(qi, QBVoxel_FlagRightHand, out, len, chunk) != len)
+      return EXIT_FAILURE;
+    if (memcmp(out, two_qb, len) != 0)
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int test_genunpack(void* q) {
+  struct qbvoxel_i* const qi = (struct qbvoxel_i *)q;
+  struct cb_matrix_array *const qma = (struct cb_matrix_array *)(qi->p);
+  unsigned char raw_qb[24+2+24+16*4];
+  unsigned char bgra_qb[sizeof(rle_qb)+16];
+  unsigned int len;
+  if (parse_whole(qi, rle_qb, (unsigned int)sizeof(rle_qb)) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  /* compressed to uncompressed, then back through the parser */
+  len = gen_whole(qi, QBVoxel_FlagRightHand, raw_qb, sizeof(raw_qb), 5u);
+  if (len != sizeof(raw_qb) || raw_qb[12] != 0)
+    return EXIT_FAILURE;
+  if (parse_whole(qi, raw_qb, len) != EXIT_SUCCESS
+  ||  check_rle_matrix(qma) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  /* compressed with swapped channels */
+  len = gen_whole(qi,
+      QBVoxel_FlagRightHand|QBVoxel_FlagBGRA|QBVoxel_FlagRLE,
+      bgra_qb, sizeof(bgra_qb), 7u);
+  if (len != sizeof(rle_qb) || bgra_qb[4] != 1 || bgra_qb[58] != 0x30)
+    return EXIT_FAILURE;
+  if (parse_whole(qi, bgra_qb, len) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  return check_rle_matrix(qma);
+}
 
 
 
@@ -428,6 +796,25 @@ int cb_write_voxel
     return 0;
   }
 }
+int cb_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, struct qbvoxel_voxel const* v)
+{
+  struct cb_matrix_array *const qma = (struct cb_matrix_array *)p;
+  if (i >= qma->count)
+    return QBVoxel_ErrOutOfRange;
+  else {
+    struct cb_matrix* const m = qma->matrices+i;
+    size_t const pos = x + (y + z*m->height)*m->width;
+    if (x >= m->width || y >= m->height || z >= m->depth)
+      return QBVoxel_ErrOutOfRange;
+    if (n > (size_t)(m->width*m->height*m->depth) - pos)
+      return QBVoxel_ErrOutOfRange;
+    memcpy(m->data+pos, v, n*sizeof(struct qbvoxel_voxel));
+    return 0;
+  }
+}
 
 
 
@@ -440,7 +827,7 @@ int main(int argc, char **argv) {
   struct cb_matrix_array qma = {0};
   struct qbvoxel_i p = {
       &qma, cb_resize, cb_size, cb_get_matrix, cb_set_matrix,
-      cb_read_voxel, cb_write_voxel
+      cb_read_voxel, cb_write_voxel, cb_write_span
     };
   fprintf(stderr,"1..%u\n", (unsigned int)test_count);
   for (test_i = 0; test_i < test_count; ++test_i) {
@@ -0,0 +1,37 @@
+#version 150
+
+// Packed vertices, or float vertices that carry a face id instead of a
+// normal
+in  vec4 vPosition;   // lattice point in xyz, face id in w
+in  vec4 vColor;      // normalized RGBA8, or float RGB
+
+uniform mat4 ModelView;
+uniform mat4 Projection;
+uniform mat4 NormalMatrix;
+
+out vec4 pos;
+out vec4 N;
+out vec4 color;
+
+// Indexed by face id: axis*2 + (negative ? 1 : 0)
+const vec3 face_normals[6] = vec3[6](
+  vec3( 1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0),
+  vec3( 0.0, 1.0, 0.0), vec3( 0.0,-1.0, 0.0),
+  vec3( 0.0, 0.0, 1.0), vec3( 0.0, 0.0,-1.0));
+
+
+void main()
+{
+  // Send through the vertex color
+  color = vec4(vColor.rgb,1);
+  
+  // Transform face normal into eye coordinates
+  int face = clamp(int(vPosition.w + 0.5), 0, 5);
+  N = NormalMatrix*vec4(face_normals[face], 0.0); N.w = 0.0;
+  N = normalize(N);
+  
+  // Transform vertex position into eye coordinates
+  pos = ModelView * vec4(vPosition.xyz, 1.0);
+  gl_Position = Projection * pos;
+  
+}
@@ -8,8 +8,18 @@
 
 bool VoxelGrid::loadVoxels(const char * path){
 
-  //decode
-  unsigned error = voxelgrid_decode(volume, width, height, depth, path);
+  //decode every matrix, then merge them into one volume
+  unsigned error = voxelgrid_decode_scene(matrices, path, options.threads);
+  if (!error && matrices.empty())
+    error = 10/* matrix count */;
+  if (!error)
+    error = voxelgrid_flatten(matrices, volume, origin, options.threads,
+                              options.layout);
+  if (!error && !voxeloccupancy_build(occupancy, volume, options.threads))
+    error = 7/* out of memory */;
+  width = volume.width;
+  height = volume.height;
+  depth = volume.depth;
 
   //if there's an error, display it
   if(error){
@@ -18,10 +28,33 @@ bool VoxelGrid::loadVoxels(const char * path){
     return false;}
     
   
-  std::cout << "Volume loaded: " << width << " x " << height << " x " << depth << std::endl;
-  std::cout << (width*height*depth) << " voxels.\n";
-  std::cout << "Volume has " << volume.size()/(width*height*depth) << "color values per voxel.\n";
+  if (options.verbose) {
+    std::cout << "Volume loaded: " << width << " x " << height << " x " << depth << std::endl;
+    if (matrices.size() > 1) {
+      std::cout << matrices.size() << " matrices:\n";
+      for (std::size_t i = 0; i < matrices.size(); ++i) {
+        std::cout << "\t" << matrices[i].name << " at (" << matrices[i].pos_x
+                  << ", " << matrices[i].pos_y << ", " << matrices[i].pos_z
+                  << ")\n";
+      }
+    }
+    std::cout << (width*height*depth) << " voxels.\n";
+    voxelbricks_stats bricks = voxelbricks_measure(volume);
+    std::cout << bricks.dense_bricks << " dense, " << bricks.uniform_bricks
+              << " uniform and " << bricks.empty_bricks << " empty bricks, "
+              << bricks.colors << " colors at " << bricks.index_bytes
+              << " byte(s) per voxel (" << bricks.bytes << " bytes).\n";
+    std::cout << "Occupancy: " << voxeloccupancy_bytes(occupancy)
+              << " bytes.\n";
+  }
 
+  centerModel();
+  return true;
+
+}
+
+//Scale the model to a unit cube about the origin
+void VoxelGrid::centerModel(){
   vec3 center = vec3(-(float)width/2.0, -(float)height/2.0, -(float)depth/2.0);
   double max_dim = (std::max)(width, (std::max)(height, depth));
 
@@ -30,34 +63,384 @@ bool VoxelGrid::loadVoxels(const char * path){
                      1.0/max_dim,
                      1.0/max_dim)*
                      Translate(center);  //Orient Model About Center
+}
 
+//Map the mesh cache of the model at `path`. Fails when there is none, or
+//when it was made from other file contents or is damaged; the grid is
+//then left as it was.
+bool VoxelGrid::loadMeshCache(const char * path){
+  if (!options.indexed || !options.packed)
+    return false;
+  unsigned long long hash;
+  if (voxelcache_hash_file(path, hash) != 0)
+    return false;
+  std::string cache_path = voxelcache_path(path);
+  unsigned error = voxelcache_map(cache, cache_path.c_str(), hash);
+  if (error) {
+    if (options.verbose && error != 8/* file not found */)
+      std::cout << "Mesh cache " << cache_path << " is stale or damaged; "
+                << "rebuilding.\n";
+    return false;
+  }
+  width = cache.width;
+  height = cache.height;
+  depth = cache.depth;
+  for (unsigned int a = 0; a < 3; ++a)
+    origin[a] = cache.origin[a];
+  packed_mesh = true;
+  cached_mesh = true;
+  centerModel();
+  createDrawChunks();
+  if (options.verbose) {
+    std::cout << "Mesh cache loaded: " << width << " x " << height << " x "
+              << depth << ", " << cache.vertex_count << " packed vertices, "
+              << cache.index_count << " uint" << cache.index_size*8
+              << " indices.\n";
+  }
   return true;
+}
 
+//Write the packed mesh to the cache file of the model at `path`, with
+//indices already in their upload width.
+bool VoxelGrid::saveMeshCache(const char * path){
+  if (!packed_mesh || cached_mesh)
+    return false;
+  voxelcache out;
+  voxelcache_init(out);
+  if (voxelcache_hash_file(path, out.source_hash) != 0)
+    return false;
+  out.width = width;
+  out.height = height;
+  out.depth = depth;
+  for (unsigned int a = 0; a < 3; ++a)
+    out.origin[a] = origin[a];
+  out.vertices = packed.empty() ? NULL : &packed[0];
+  out.vertex_count = packed.size();
+  out.index_size = indexSize();
+  out.index_count = indices.size();
+  std::vector<unsigned short> short_indices;
+  if (out.index_size == 2) {
+    short_indices.assign(indices.begin(), indices.end());
+    out.indices = short_indices.empty() ? NULL : &short_indices[0];
+  } else {
+    out.indices = indices.empty() ? NULL : &indices[0];
+  }
+  std::string cache_path = voxelcache_path(path);
+  if (voxelcache_save(out, cache_path.c_str()) != 0) {
+    if (options.verbose)
+      std::cout << "Could not write mesh cache " << cache_path << ".\n";
+    return false;
+  }
+  return true;
 }
 
 
 //Create a single triangulated cube at the given position and add it
-//to the vertices array. You may want to use this function (or add
-//similar functions to the VoxelGrid class) to organize your code.
+//to the vertices array. Faces are appended as unit quads, so the cube
+//picks up normals and colors like any other part of the mesh.
 void VoxelGrid::addCube(vec3 pos) {
+  unsigned int x = static_cast<unsigned int>(pos.x);
+  unsigned int y = static_cast<unsigned int>(pos.y);
+  unsigned int z = static_cast<unsigned int>(pos.z);
+  if (x >= width || y >= height || z >= depth)
+    return;
+  const unsigned int voxel = voxelbricks_get(volume, x, y, z);
+
+  for (unsigned int face = 0; face < 6; ++face) {
+    voxelmesh_quad q;
+    q.x = x + ((face == VoxelMesh_PosX) ? 1 : 0);
+    q.y = y + ((face == VoxelMesh_PosY) ? 1 : 0);
+    q.z = z + ((face == VoxelMesh_PosZ) ? 1 : 0);
+    q.du = 1;
+    q.dv = 1;
+    q.face = static_cast<unsigned char>(face);
+    q.r = static_cast<unsigned char>(voxel&255);
+    q.g = static_cast<unsigned char>((voxel>>8)&255);
+    q.b = static_cast<unsigned char>((voxel>>16)&255);
+    quads.push_back(q);
 
+    float corners[4][3];
+    voxelmesh_quad_corners(q, corners);
+    static const unsigned int tri[6] = {0, 1, 2, 0, 2, 3};
+    if (packed_mesh) {
+      unsigned int base = static_cast<unsigned int>(packed.size());
+      for (unsigned int c = 0; c < 4; ++c) {
+        voxelmesh_packed_vertex v;
+        v.x = static_cast<unsigned short>(corners[c][0]);
+        v.y = static_cast<unsigned short>(corners[c][1]);
+        v.z = static_cast<unsigned short>(corners[c][2]);
+        v.face = q.face;
+        v.r = q.r;
+        v.g = q.g;
+        v.b = q.b;
+        v.a = 255;
+        packed.push_back(v);
+      }
+      for (unsigned int t = 0; t < 6; ++t)
+        indices.push_back(base + tri[t]);
+      continue;
+    }
+    const GLfloat w = faceIds() ? q.face : 1.0f;
+    if (options.indexed) {
+      unsigned int base = static_cast<unsigned int>(vertices.size());
+      for (unsigned int c = 0; c < 4; ++c) {
+        vertices.push_back(vec4(corners[c][0], corners[c][1], corners[c][2],
+                                w));
+        vertex_quads.push_back(static_cast<unsigned int>(quads.size()-1));
+      }
+      for (unsigned int t = 0; t < 6; ++t)
+        indices.push_back(base + tri[t]);
+      continue;
+    }
+    for (unsigned int t = 0; t < 6; ++t) {
+      const float* c = corners[tri[t]];
+      vertices.push_back(vec4(c[0], c[1], c[2], w));
+    }
+  }
 }
 
-//TODO
 //Create a triangulated version of the voxel grid for rendering and populate
-//the vertices array.
+//the vertices array. Faces between two solid voxels are dropped and the
+//remaining coplanar faces of equal color are merged into rectangles. In
+//indexed mode each distinct corner is stored once and `indices` holds
+//the triangles; packed mode stores those corners in `packed`.
 void VoxelGrid::createMesh(){
-    
+  voxellod_clear(lod);
+  vertices.clear();
+  indices.clear();
+  vertex_quads.clear();
+  packed.clear();
+  chunked_mesh = options.editable && options.indexed && options.packed
+    && voxelchunks_build(chunks, volume, occupancy, packed, indices,
+                         options.threads);
+  if (chunked_mesh) {
+    //slots of every chunk take the place of one quad list
+    quads.clear();
+    packed_mesh = true;
+    mesh_stats.naive_triangles = 0;
+    for (std::size_t b = 0; b < volume.uniform.size(); ++b)
+      mesh_stats.naive_triangles += voxelbricks_solid(volume, b)*12;
+    mesh_stats.culled_triangles = chunks.faces*2;
+    mesh_stats.merged_triangles = chunks.quads*2;
+  } else {
+    voxelmesh_build(volume, occupancy, quads, &mesh_stats, options.threads);
+    packed_mesh = options.indexed && options.packed
+      && voxelmesh_pack(quads, packed, indices);
+  }
+  if (packed_mesh) {
+    //normals and colors come from the face id and color of each vertex
+  } else if (options.indexed) {
+    std::vector<voxelmesh_vertex> corners;
+    voxelmesh_index(quads, corners, indices);
+    vertices.reserve(corners.size());
+    vertex_quads.reserve(corners.size());
+    for (std::size_t i = 0; i < corners.size(); ++i) {
+      const GLfloat w = faceIds() ? quads[corners[i].quad].face : 1.0f;
+      vertices.push_back(vec4(corners[i].x, corners[i].y, corners[i].z, w));
+      vertex_quads.push_back(corners[i].quad);
+    }
+  } else {
+    vertices.reserve(quads.size()*6);
+    for (std::size_t i = 0; i < quads.size(); ++i) {
+      float corners[4][3];
+      voxelmesh_quad_corners(quads[i], corners);
+      static const unsigned int tri[6] = {0, 1, 2, 0, 2, 3};
+      const GLfloat w = faceIds() ? quads[i].face : 1.0f;
+      for (unsigned int t = 0; t < 6; ++t) {
+        const float* c = corners[tri[t]];
+        vertices.push_back(vec4(c[0], c[1], c[2], w));
+      }
+    }
+  }
+  createDrawChunks();
+  createOccluders();
+
+  if (!options.verbose)
+    return;
+  std::cout << "Mesh triangles: " << mesh_stats.naive_triangles << " naive, "
+            << mesh_stats.culled_triangles << " after face culling, "
+            << mesh_stats.merged_triangles << " after merging";
+  if (mesh_stats.naive_triangles > 0) {
+    std::cout << " (" << (100.0 - 100.0*mesh_stats.merged_triangles
+                                  / mesh_stats.naive_triangles)
+              << "% fewer)";
+  }
+  std::cout << std::endl;
+
+  if (options.indexed) {
+    //Triangle soup stores position, normal and color for every corner of
+    //every triangle.
+    std::size_t soup = indices.size()*(sizeof(vec4) + 2*sizeof(vec3));
+    std::size_t bytes = meshBytes();
+    std::cout << "Indexed mesh: " << getNumVertices()
+              << (packed_mesh ? " packed" : "") << " vertices, "
+              << indices.size() << " uint" << indexSize()*8 << " indices, "
+              << bytes/1024.0 << " KiB vs " << soup/1024.0
+              << " KiB as triangle soup";
+    if (soup > 0)
+      std::cout << " (" << (100.0 - 100.0*bytes/soup) << "% saved)";
+    std::cout << std::endl;
+  }
+  if (chunked_mesh) {
+    std::cout << "Chunked mesh: " << chunks.slots.size() << " chunks, "
+              << chunks.live_vertices << " of " << packed.size()
+              << " vertex slots in use.\n";
+  }
 }
 
-//TODO
-//Populate the normal array with vertice normals for the triangle mesh
+//Populate the normal array with vertice normals for the triangle mesh;
+//left empty when the vertices carry face ids
 void VoxelGrid::createNormals(){
-
+  normals.clear();
+  if (faceIds())
+    return;
+  if (options.indexed) {
+    normals.reserve(vertex_quads.size());
+    for (std::size_t i = 0; i < vertex_quads.size(); ++i) {
+      float n[3];
+      voxelmesh_face_normal(quads[vertex_quads[i]].face, n);
+      normals.push_back(vec3(n[0], n[1], n[2]));
+    }
+    return;
+  }
+  normals.reserve(quads.size()*6);
+  for (std::size_t i = 0; i < quads.size(); ++i) {
+    float n[3];
+    voxelmesh_face_normal(quads[i].face, n);
+    normals.insert(normals.end(), 6, vec3(n[0], n[1], n[2]));
+  }
 }
 
-//TODO
 //Populate the color array with vertice colors for the triangle mesh
 void VoxelGrid::createColors(){
+  colors.clear();
+  if (options.indexed) {
+    colors.reserve(vertex_quads.size());
+    for (std::size_t i = 0; i < vertex_quads.size(); ++i) {
+      const voxelmesh_quad& q = quads[vertex_quads[i]];
+      colors.push_back(vec3(q.r/255.0, q.g/255.0, q.b/255.0));
+    }
+    return;
+  }
+  colors.reserve(quads.size()*6);
+  for (std::size_t i = 0; i < quads.size(); ++i) {
+    const voxelmesh_quad& q = quads[i];
+    colors.insert(colors.end(), 6,
+                  vec3(q.r/255.0, q.g/255.0, q.b/255.0));
+  }
+}
+
+//Find the index run of each mesh chunk. A chunked mesh takes them from
+//its slots; other packed meshes are scanned, as the mesher writes one
+//chunk after another.
+void VoxelGrid::createDrawChunks(){
+  draw_chunks.clear();
+  if (chunked_mesh) {
+    const unsigned int dims[3] = {width, height, depth};
+    voxelcull_slots(chunks, dims, draw_chunks);
+  } else if (cached_mesh) {
+    voxelcull_scan(cache.vertices, cache.indices, cache.index_count,
+                   cache.index_size, draw_chunks);
+  } else if (packed_mesh && !indices.empty()) {
+    voxelcull_scan(&packed[0], &indices[0], indices.size(),
+                   sizeof(unsigned int), draw_chunks);
+  }
+}
+
+//Cover the solid voxels of each mesh chunk with boxes, the occluders of
+//voxelocclude_cull.
+void VoxelGrid::createOccluders(){
+  voxelocclude_occluders_clear(occluders);
+  if (packed_mesh && !cached_mesh)
+    voxelocclude_occluders_build(occluders, occupancy, options.threads);
+}
+
+//Mesh `lod_levels` coarser copies of the volume after the full-detail
+//mesh, each half as wide as the one before, for drawing far chunks with
+//fewer triangles. Only plain packed meshes get levels.
+bool VoxelGrid::createLevels(){
+  voxellod_clear(lod);
+  if (options.lod_levels == 0 || !packed_mesh || chunked_mesh || cached_mesh)
+    return false;
+  if (!voxellod_build(lod, volume, occupancy, draw_chunks, options.lod_levels,
+                      packed, indices, options.threads)) {
+    std::cout << "lod error: out of memory" << std::endl;
+    return false;
+  }
+  if (options.verbose) {
+    for (std::size_t k = 0; k < lod.levels.size(); ++k) {
+      const voxellod_level& level = lod.levels[k];
+      std::cout << "LOD " << k << ": " << level.index_count/3
+                << " triangles, " << level.runs.size() << " chunks, "
+                << level.mesh_bytes/1024.0 << " KiB mesh, "
+                << level.volume_bytes/1024.0 << " KiB voxels.\n";
+    }
+  }
+  return true;
+}
+
+//Build the sparse octree of the volume; uniform regions become single
+//leaves, so sparse models take far fewer nodes than voxels.
+bool VoxelGrid::createOctree(){
+  if (!voxeloctree_build(octree, volume, options.threads)) {
+    std::cout << "octree error: volume too large" << std::endl;
+    return false;
+  }
+  if (options.verbose) {
+    std::cout << "Octree: " << octree.count << " nodes, "
+              << voxeloctree_bytes(octree) << " bytes, edge "
+              << octree.edge << ".\n";
+  }
+  return true;
+}
+
+bool VoxelGrid::setVoxel(unsigned int x, unsigned int y, unsigned int z,
+                         unsigned int v){
+  const unsigned int lo[3] = {x, y, z};
+  const unsigned int hi[3] = {x+1, y+1, z+1};
+  return fillBox(lo, hi, v);
+}
+
+bool VoxelGrid::clearVoxel(unsigned int x, unsigned int y, unsigned int z){
+  return setVoxel(x, y, z, 0);
+}
+
+//Write the voxels, then the occupancy bits, so both agree before any
+//chunk is remeshed. Only the naive triangle count changes here.
+bool VoxelGrid::fillBox(const unsigned int lo[3], const unsigned int hi[3],
+                        unsigned int v){
+  if (!chunked_mesh)
+    return false;
+  const unsigned int dims[3] = {width, height, depth};
+  unsigned int box_hi[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    box_hi[a] = (std::min)(hi[a], dims[a]);
+    if (lo[a] >= box_hi[a])
+      return false;
+  }
+  if ((v >> 24) == 0)
+    v = 0;
+  if (!voxelbricks_fill(volume, lo, box_hi, v))
+    return false;
+  const long long change = voxeloccupancy_fill(occupancy, lo, box_hi, v != 0);
+  mesh_stats.naive_triangles = static_cast<unsigned long long>(
+    static_cast<long long>(mesh_stats.naive_triangles) + change*12);
+  voxelchunks_mark(chunks, lo, box_hi);
+  voxelocclude_occluders_update(occluders, occupancy, lo, box_hi);
+  return true;
+}
 
+std::size_t VoxelGrid::remesh(std::vector<voxelchunks_range>& vertex_ranges,
+                              std::vector<voxelchunks_range>& index_ranges){
+  vertex_ranges.clear();
+  index_ranges.clear();
+  if (!chunked_mesh)
+    return 0;
+  std::size_t count = voxelchunks_update(chunks, volume, occupancy, packed,
+    indices, vertex_ranges, index_ranges, options.threads);
+  mesh_stats.culled_triangles = chunks.faces*2;
+  mesh_stats.merged_triangles = chunks.quads*2;
+  if (count > 0)
+    createDrawChunks();
+  return count;
 }
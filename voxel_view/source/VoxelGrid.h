@@ -7,33 +7,238 @@
 
 using namespace Angel;
 
+//Knobs for loading and meshing a VoxelGrid
+struct VoxelGridOptions{
+  //Threads used for meshing, including the calling thread. Zero uses one
+  //per core; the mesh is the same for every setting.
+  unsigned int threads;
+
+  //Print load and mesh summaries to std::cout. Errors are always printed.
+  bool verbose;
+
+  //Share corners between triangles: `vertices` holds each distinct corner
+  //once and `indices` lists three per triangle. Off gives three vertices
+  //per triangle and no indices.
+  bool indexed;
+
+  //With `indexed`, write 12-byte `packed` vertices instead of float
+  //vertices, normals and colors. Volumes wider than 65535 voxels fall
+  //back to floats.
+  bool packed;
+
+  //Voxel order inside dense bricks of `volume`, a voxelbricks_layout
+  unsigned int layout;
+
+  //Load packed meshes from a cache file next to the model when its
+  //content hash matches, and write one after meshing otherwise. A cached
+  //grid has a mesh but no voxels.
+  bool mesh_cache;
+
+  //With `indexed` and `packed`, lay the mesh out chunk by chunk so that
+  //setVoxel, clearVoxel and fillBox followed by remesh only redo the
+  //chunks they touch. Indices are then always 32-bit, and no mesh cache
+  //is read or written.
+  bool editable;
+
+  //With `indexed` and `packed`, build this many coarser levels of detail
+  //after meshing; their meshes follow the full-detail one in `packed` and
+  //`indices`. Ignored for editable meshes, and no mesh cache is read or
+  //written.
+  unsigned int lod_levels;
+
+  //Float meshes only: fill `normals` with a vec3 per vertex. Off leaves
+  //it empty and stores the face id in the w of each vertex instead, as
+  //packed vertices do, for vshader_packed.glsl; 12 fewer bytes a vertex.
+  bool normals;
+
+  VoxelGridOptions()
+    : threads(0), verbose(true), indexed(true), packed(true),
+      layout(VoxelBricks_Linear), mesh_cache(false), editable(false),
+      lod_levels(0), normals(true) {}
+};
+
 class VoxelGrid{
 public:
   unsigned int width, height, depth;
-  std::vector<unsigned char> volume;
+  //Voxels in bricks; empty bricks cost no voxel storage
+  voxelbricks volume;
+
+  //One bit per voxel of `volume`, built by loadVoxels; the mesher takes
+  //exposed faces from it
+  voxeloccupancy occupancy;
+
+  //Sparse octree of `volume`, for lookups and ray casts; empty until
+  //createOctree runs
+  voxeloctree octree;
+
+  //Matrices of the source file; their voxels are merged into `volume`,
+  //whose (0,0,0) sits at `origin` in scene space.
+  std::vector<voxelgrid_matrix> matrices;
+  long int origin[3];
   
+  //Float mode only; w is 1, or the face id when `options.normals` is off
   std::vector < vec4 > vertices;
   std::vector < vec3 > normals;
   std::vector < vec3 > colors;
+
+  //Indexed mode only: triangle corners, and the quad each vertex came from
+  std::vector < unsigned int > indices;
+  std::vector < unsigned int > vertex_quads;
+
+  //Packed mode only: the vertices, drawn with vshader_packed.glsl
+  std::vector < voxelmesh_packed_vertex > packed;
+  bool packed_mesh;
+
+  //Mapped mesh cache; when `cached_mesh` is set the packed vertices and
+  //indices live there, in their upload format, instead of `packed` and
+  //`indices`
+  voxelcache cache;
+  bool cached_mesh;
+
+  //Editable mode only: slot of each chunk in `packed` and `indices`
+  voxelchunks chunks;
+  bool chunked_mesh;
+
+  //Packed mode only: index runs of each mesh chunk with their bounds,
+  //for frustum culling
+  std::vector < voxelcull_chunk > draw_chunks;
+
+  //Solid boxes of each mesh chunk, for occlusion culling; none for a
+  //mesh loaded from the cache, which has no voxels
+  voxelocclude_occluders occluders;
+
+  //Levels of detail, level 0 spanning `draw_chunks`; empty unless
+  //`lod_levels` is set and createLevels has run
+  voxellod lod;
+
+  std::vector < voxelmesh_quad > quads;
+  voxelmesh_stats mesh_stats;
   
   mat4 model_view;
+
+  VoxelGridOptions options;
   
-  VoxelGrid(const char * path) : model_view(){
+  VoxelGrid(const char * path,
+            const VoxelGridOptions& opt = VoxelGridOptions())
+    : packed_mesh(false), cached_mesh(false), chunked_mesh(false),
+      mesh_stats(), model_view(), options(opt){
+    voxeloctree_init(octree);
+    voxelcache_init(cache);
+    voxelchunks_clear(chunks);
+    voxelocclude_occluders_clear(occluders);
+    voxellod_clear(lod);
+    if(options.mesh_cache && !options.editable && options.lod_levels == 0
+       && loadMeshCache(path))
+      return;
     if(loadVoxels(path)){
       createMesh();
       createNormals();
       createColors();
+      createLevels();
+      if(options.mesh_cache && !chunked_mesh && lod.levels.empty())
+        saveMeshCache(path);
     }
   }
+
+  //Empty grid; run loadVoxels and the create* steps one at a time.
+  explicit VoxelGrid(const VoxelGridOptions& opt)
+    : width(0), height(0), depth(0), packed_mesh(false), cached_mesh(false),
+      chunked_mesh(false), mesh_stats(), model_view(), options(opt){
+    origin[0] = origin[1] = origin[2] = 0;
+    voxeloctree_init(octree);
+    voxelcache_init(cache);
+    voxelchunks_clear(chunks);
+    voxelocclude_occluders_clear(occluders);
+    voxellod_clear(lod);
+  }
   
-  unsigned int getNumTri(){ return vertices.size()/3; }
+  //Triangles of the full-detail mesh
+  unsigned int getNumTri(){
+    if (chunked_mesh)
+      return chunks.live_indices/3;
+    if (!lod.levels.empty())
+      return lod.levels[0].index_count/3;
+    return options.indexed ? getNumIndices()/3 : vertices.size()/3;
+  }
+
+  //Bytes per index on upload: 16-bit while every vertex fits, else 32-bit.
+  //A chunked mesh stays 32-bit, as edits can add vertices.
+  unsigned int indexSize() const {
+    if (cached_mesh)
+      return cache.index_size;
+    if (chunked_mesh)
+      return 4;
+    return getNumVertices() <= 65536 ? 2 : 4;
+  }
+
+  std::size_t getNumVertices() const {
+    if (cached_mesh)
+      return cache.vertex_count;
+    return packed_mesh ? packed.size() : vertices.size();
+  }
+
+  std::size_t getNumIndices() const {
+    return cached_mesh ? cache.index_count : indices.size();
+  }
+
+  //Packed mode only: the packed vertices and indices, wherever they
+  //live, with the width of the stored indices. False without them.
+  bool packedMeshData(const voxelmesh_packed_vertex*& vertex_data,
+                      const void*& index_data, unsigned int& index_size) const {
+    if (cached_mesh) {
+      vertex_data = cache.vertices;
+      index_data = cache.indices;
+      index_size = cache.index_size;
+      return cache.index_count > 0;
+    }
+    if (!packed_mesh || indices.empty())
+      return false;
+    vertex_data = &packed[0];
+    index_data = &indices[0];
+    index_size = sizeof(unsigned int);
+    return true;
+  }
+
+  //Float mode only: whether each vertex carries its face id in w
+  //instead of a normal
+  bool faceIds() const {
+    return !packed_mesh && !options.normals;
+  }
+
+  //Bytes of vertex attributes plus uploaded indices
+  std::size_t meshBytes() const {
+    std::size_t vertex_bytes = packed_mesh ? sizeof(voxelmesh_packed_vertex)
+      : sizeof(vec4) + (faceIds() ? 1 : 2)*sizeof(vec3);
+    return getNumVertices()*vertex_bytes + getNumIndices()*indexSize();
+  }
 
   bool loadVoxels(const char * path);
+  void centerModel();
+  bool loadMeshCache(const char * path);
+  bool saveMeshCache(const char * path);
   
   void addCube(vec3 pos);
   void createMesh();
   void createNormals();
   void createColors();
+  bool createOctree();
+  void createDrawChunks();
+  void createOccluders();
+  bool createLevels();
+
+  //Edits of a chunked mesh; `v` is a voxelbricks_pack value, zero for
+  //empty. Each marks the chunks it touches for remesh. The octree is not
+  //updated. False when the mesh is not chunked, the box misses the
+  //volume, or memory runs out. Occluders are updated at once.
+  bool setVoxel(unsigned int x, unsigned int y, unsigned int z, unsigned int v);
+  bool clearVoxel(unsigned int x, unsigned int y, unsigned int z);
+  bool fillBox(const unsigned int lo[3], const unsigned int hi[3], unsigned int v);
+
+  //Remesh the chunks edited since the last call and patch `packed` and
+  //`indices`. The entries that changed are listed for upload. Returns
+  //the number of chunks remeshed.
+  std::size_t remesh(std::vector<voxelchunks_range>& vertex_ranges,
+                     std::vector<voxelchunks_range>& index_ranges);
 
   
   friend std::ostream& operator << ( std::ostream& os, const VoxelGrid& v ) {
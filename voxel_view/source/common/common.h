@@ -20,8 +20,16 @@
 #include <string.h>
 #include <algorithm>
 
+#ifdef VOXEL_VIEW_HEADLESS
+//Builds without a window (voxel_bench) only need the GL scalar types
+typedef float GLfloat;
+typedef int GLint;
+typedef unsigned int GLuint;
+typedef void GLvoid;
+#else
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#endif //VOXEL_VIEW_HEADLESS
 
 
 //  Define M_PI in the case it's not defined in the math header file
@@ -61,6 +69,7 @@ namespace Angel {
 #include "u8names.h"
 #endif //_WIN32
 
+#ifndef VOXEL_VIEW_HEADLESS
 static char*
 readShaderSource(const char* shaderFile)
 {
@@ -121,10 +130,18 @@ static void check_program_link(GLuint program){
   }
   
 }
+#endif //VOXEL_VIEW_HEADLESS
 
 
 #include "Trackball.h"
 #include "readvoxel.h"
+#include "voxelmesh.h"
+#include "voxeloctree.h"
+#include "voxelcache.h"
+#include "voxelchunks.h"
+#include "voxelcull.h"
+#include "voxelocclude.h"
+#include "voxellod.h"
 #include "VoxelGrid.h"
 
 #endif /* common_h */
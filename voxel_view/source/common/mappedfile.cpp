@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- mappedfile.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "mappedfile.h"
+#include <cerrno>
+#ifdef _WIN32
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN 1
+#  endif
+#  include <windows.h>
+#  include "u8names.h"
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif //_WIN32
+
+static
+void mapped_file_reset(mapped_file& mf) {
+  mf.data = NULL;
+  mf.size = 0;
+#ifdef _WIN32
+  mf.file = NULL;
+  mf.mapping = NULL;
+#else
+  mf.fd = -1;
+#endif //_WIN32
+}
+
+#ifdef _WIN32
+unsigned int mapped_file_open(mapped_file& mf, const char* path) {
+  mapped_file_reset(mf);
+  std::wstring wcpath;
+  if (u8names_towc(path, wcpath) != 0)
+    return 9/* other io */;
+  HANDLE file = CreateFileW(wcpath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+    NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    DWORD err = GetLastError();
+    return (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND)
+      ? 8/* file not found */ : 9/* other io */;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)
+  ||  static_cast<unsigned long long>(size.QuadPart)
+        > static_cast<std::size_t>(-1)) {
+    CloseHandle(file);
+    return 9/* other io */;
+  }
+  mf.file = file;
+  mf.size = static_cast<std::size_t>(size.QuadPart);
+  if (mf.size == 0)
+    return 0;
+  HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    mapped_file_close(mf);
+    return 9/* other io */;
+  }
+  mf.mapping = mapping;
+  mf.data = static_cast<const unsigned char*>(
+    MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (mf.data == NULL) {
+    mapped_file_close(mf);
+    return 9/* other io */;
+  }
+  return 0;
+}
+
+void mapped_file_close(mapped_file& mf) {
+  if (mf.data != NULL)
+    UnmapViewOfFile(mf.data);
+  if (mf.mapping != NULL)
+    CloseHandle(mf.mapping);
+  if (mf.file != NULL)
+    CloseHandle(mf.file);
+  mapped_file_reset(mf);
+}
+#else
+unsigned int mapped_file_open(mapped_file& mf, const char* path) {
+  mapped_file_reset(mf);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+#ifdef ENOENT
+    return errno == ENOENT ? 8/* file not found */ : 9/* other io */;
+#else
+    return 9/* other io */;
+#endif //ENOENT
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return 9/* other io */;
+  }
+  mf.fd = fd;
+  mf.size = static_cast<std::size_t>(st.st_size);
+  if (mf.size == 0)
+    return 0;
+  void* p = mmap(NULL, mf.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    mapped_file_close(mf);
+    return 9/* other io */;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(p, mf.size, MADV_SEQUENTIAL);
+#endif //MADV_SEQUENTIAL
+  mf.data = static_cast<const unsigned char*>(p);
+  return 0;
+}
+
+void mapped_file_close(mapped_file& mf) {
+  if (mf.data != NULL)
+    munmap(const_cast<unsigned char*>(mf.data), mf.size);
+  if (mf.fd >= 0)
+    close(mf.fd);
+  mapped_file_reset(mf);
+}
+#endif //_WIN32
@@ -0,0 +1,47 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- mappedfile.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_MAPPEDFILE_h_
+#define hg_MAPPEDFILE_h_
+
+#include <cstddef>
+
+/**
+ * @brief Read-only view of a whole file mapped into memory.
+ */
+struct mapped_file {
+  /**
+   * @brief First byte of the file, NULL for an empty or closed file.
+   */
+  const unsigned char* data;
+  /**
+   * @brief File size in bytes.
+   */
+  std::size_t size;
+#ifdef _WIN32
+  void* file;
+  void* mapping;
+#else
+  int fd;
+#endif //_WIN32
+};
+
+/**
+ * @brief Map a file for reading.
+ * @param[out] mf mapping to fill; left closed on failure
+ * @param path UTF-8 path of the file to map
+ * @return zero on success, 8 if the file does not exist, 9 if it could
+ *   not be opened or mapped
+ */
+unsigned int mapped_file_open(mapped_file& mf, const char* path);
+
+/**
+ * @brief Unmap a file and close it.
+ * @param mf mapping to close; safe to call on a closed mapping
+ */
+void mapped_file_close(mapped_file& mf);
+
+#endif //hg_MAPPEDFILE_h_
@@ -8,6 +8,13 @@
 #define __ANGEL_MAT_H__
 
 #include "vec.h"
+#include <cstddef>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif //__SSE2__
+#ifdef __AVX__
+#  include <immintrin.h>
+#endif //__AVX__
 
 namespace Angel {
   
@@ -376,6 +383,143 @@ mat3 transpose( const mat3& A ) {
 		 A[0][2], A[1][2], A[2][2] );
 }
 
+//----------------------------------------------------------------------------
+//
+//  mat4 kernels - row-major 4x4 floats, loaded unaligned so that vec4
+//    and mat4 keep their layout. Without SSE2 the mat4 operators use
+//    their scalar loops.
+//
+
+#ifdef __SSE2__
+
+#define ANGEL_SHUFFLE( a, b, x, y, z, w ) \
+    _mm_shuffle_ps( (a), (b), _MM_SHUFFLE( (w), (z), (y), (x) ) )
+#define ANGEL_SWIZZLE( a, x, y, z, w ) ANGEL_SHUFFLE( a, a, x, y, z, w )
+
+// out = a * b; out may be a or b
+inline
+void mat4Multiply( const GLfloat* a, const GLfloat* b, GLfloat* out )
+{
+    const __m128 b0 = _mm_loadu_ps( b ),     b1 = _mm_loadu_ps( b + 4 );
+    const __m128 b2 = _mm_loadu_ps( b + 8 ), b3 = _mm_loadu_ps( b + 12 );
+    __m128 r[4];
+    for ( int i = 0; i < 4; ++i ) {
+	const __m128 row = _mm_loadu_ps( a + 4*i );
+	r[i] = _mm_add_ps(
+	    _mm_add_ps( _mm_mul_ps( ANGEL_SWIZZLE( row, 0, 0, 0, 0 ), b0 ),
+			_mm_mul_ps( ANGEL_SWIZZLE( row, 1, 1, 1, 1 ), b1 ) ),
+	    _mm_add_ps( _mm_mul_ps( ANGEL_SWIZZLE( row, 2, 2, 2, 2 ), b2 ),
+			_mm_mul_ps( ANGEL_SWIZZLE( row, 3, 3, 3, 3 ), b3 ) ) );
+    }
+    for ( int i = 0; i < 4; ++i )
+	_mm_storeu_ps( out + 4*i, r[i] );
+}
+
+// Columns of a row-major matrix, for transforming vectors
+inline
+void mat4Columns( const GLfloat* m, __m128 c[4] )
+{
+    c[0] = _mm_loadu_ps( m );     c[1] = _mm_loadu_ps( m + 4 );
+    c[2] = _mm_loadu_ps( m + 8 ); c[3] = _mm_loadu_ps( m + 12 );
+    _MM_TRANSPOSE4_PS( c[0], c[1], c[2], c[3] );
+}
+
+inline
+__m128 mat4Apply( const __m128 c[4], const __m128 v )
+{
+    return _mm_add_ps(
+	_mm_add_ps( _mm_mul_ps( c[0], ANGEL_SWIZZLE( v, 0, 0, 0, 0 ) ),
+		    _mm_mul_ps( c[1], ANGEL_SWIZZLE( v, 1, 1, 1, 1 ) ) ),
+	_mm_add_ps( _mm_mul_ps( c[2], ANGEL_SWIZZLE( v, 2, 2, 2, 2 ) ),
+		    _mm_mul_ps( c[3], ANGEL_SWIZZLE( v, 3, 3, 3, 3 ) ) ) );
+}
+
+// out = transpose(m); out may be m
+inline
+void mat4Transpose( const GLfloat* m, GLfloat* out )
+{
+    __m128 c[4];
+    mat4Columns( m, c );
+    for ( int i = 0; i < 4; ++i )
+	_mm_storeu_ps( out + 4*i, c[i] );
+}
+
+// 2x2 blocks held row-major in one register: a*b, adj(a)*b and a*adj(b)
+inline
+__m128 mat2Multiply( const __m128 a, const __m128 b )
+{
+    return _mm_add_ps( _mm_mul_ps( a, ANGEL_SWIZZLE( b, 0, 3, 0, 3 ) ),
+		       _mm_mul_ps( ANGEL_SWIZZLE( a, 1, 0, 3, 2 ),
+				   ANGEL_SWIZZLE( b, 2, 1, 2, 1 ) ) );
+}
+
+inline
+__m128 mat2AdjMultiply( const __m128 a, const __m128 b )
+{
+    return _mm_sub_ps( _mm_mul_ps( ANGEL_SWIZZLE( a, 3, 3, 0, 0 ), b ),
+		       _mm_mul_ps( ANGEL_SWIZZLE( a, 1, 1, 2, 2 ),
+				   ANGEL_SWIZZLE( b, 2, 3, 0, 1 ) ) );
+}
+
+inline
+__m128 mat2MultiplyAdj( const __m128 a, const __m128 b )
+{
+    return _mm_sub_ps( _mm_mul_ps( a, ANGEL_SWIZZLE( b, 3, 0, 3, 0 ) ),
+		       _mm_mul_ps( ANGEL_SWIZZLE( a, 1, 0, 3, 2 ),
+				   ANGEL_SWIZZLE( b, 2, 1, 2, 1 ) ) );
+}
+
+// out = inverse of m by 2x2 blocks; out may be m. A singular m gives
+// infinities or NaNs, as the scalar cofactor version does.
+inline
+void mat4Invert( const GLfloat* m, GLfloat* out )
+{
+    const __m128 r0 = _mm_loadu_ps( m ),     r1 = _mm_loadu_ps( m + 4 );
+    const __m128 r2 = _mm_loadu_ps( m + 8 ), r3 = _mm_loadu_ps( m + 12 );
+    // blocks [A B; C D]
+    const __m128 A = _mm_movelh_ps( r0, r1 ), B = _mm_movehl_ps( r1, r0 );
+    const __m128 C = _mm_movelh_ps( r2, r3 ), D = _mm_movehl_ps( r3, r2 );
+
+    // (|A| |B| |C| |D|)
+    const __m128 det = _mm_sub_ps(
+	_mm_mul_ps( ANGEL_SHUFFLE( r0, r2, 0, 2, 0, 2 ),
+		    ANGEL_SHUFFLE( r1, r3, 1, 3, 1, 3 ) ),
+	_mm_mul_ps( ANGEL_SHUFFLE( r0, r2, 1, 3, 1, 3 ),
+		    ANGEL_SHUFFLE( r1, r3, 0, 2, 0, 2 ) ) );
+    const __m128 detA = ANGEL_SWIZZLE( det, 0, 0, 0, 0 );
+    const __m128 detB = ANGEL_SWIZZLE( det, 1, 1, 1, 1 );
+    const __m128 detC = ANGEL_SWIZZLE( det, 2, 2, 2, 2 );
+    const __m128 detD = ANGEL_SWIZZLE( det, 3, 3, 3, 3 );
+
+    const __m128 DC = mat2AdjMultiply( D, C );
+    const __m128 AB = mat2AdjMultiply( A, B );
+    __m128 X = _mm_sub_ps( _mm_mul_ps( detD, A ), mat2Multiply( B, DC ) );
+    __m128 W = _mm_sub_ps( _mm_mul_ps( detA, D ), mat2Multiply( C, AB ) );
+    __m128 Y = _mm_sub_ps( _mm_mul_ps( detB, C ), mat2MultiplyAdj( D, AB ) );
+    __m128 Z = _mm_sub_ps( _mm_mul_ps( detC, B ), mat2MultiplyAdj( A, DC ) );
+
+    // |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+    __m128 tr = _mm_mul_ps( AB, ANGEL_SWIZZLE( DC, 0, 2, 1, 3 ) );
+    tr = _mm_add_ps( tr, ANGEL_SWIZZLE( tr, 1, 0, 3, 2 ) );
+    tr = _mm_add_ps( tr, ANGEL_SWIZZLE( tr, 2, 3, 0, 1 ) );
+    const __m128 detM = _mm_sub_ps(
+	_mm_add_ps( _mm_mul_ps( detA, detD ), _mm_mul_ps( detB, detC ) ), tr );
+    const __m128 scale = _mm_div_ps( _mm_setr_ps( 1.0f, -1.0f, -1.0f, 1.0f ),
+				     detM );
+    X = _mm_mul_ps( X, scale );
+    Y = _mm_mul_ps( Y, scale );
+    Z = _mm_mul_ps( Z, scale );
+    W = _mm_mul_ps( W, scale );
+
+    // adjugate of each block, put back in rows
+    _mm_storeu_ps( out,      ANGEL_SHUFFLE( X, Y, 3, 1, 3, 1 ) );
+    _mm_storeu_ps( out + 4,  ANGEL_SHUFFLE( X, Y, 2, 0, 2, 0 ) );
+    _mm_storeu_ps( out + 8,  ANGEL_SHUFFLE( Z, W, 3, 1, 3, 1 ) );
+    _mm_storeu_ps( out + 12, ANGEL_SHUFFLE( Z, W, 2, 0, 2, 0 ) );
+}
+
+#endif //__SSE2__
+
 //----------------------------------------------------------------------------
 //
 //  mat4.h - 4D square matrix
@@ -458,6 +602,10 @@ class mat4 {
 	{ return m * s; }
 	
     mat4 operator * ( const mat4& m ) const {
+#ifdef __SSE2__
+	mat4  a;
+	mat4Multiply( *this, m, a );
+#else
 	mat4  a( 0.0 );
 
 	for ( int i = 0; i < 4; ++i ) {
@@ -467,6 +615,7 @@ class mat4 {
 		}
 	    }
 	}
+#endif //__SSE2__
 
 	return a;
     }
@@ -491,6 +640,10 @@ class mat4 {
     }
 
     mat4& operator *= ( const mat4& m ) {
+#ifdef __SSE2__
+	mat4Multiply( *this, m, *this );
+	return *this;
+#else
 	mat4  a( 0.0 );
 
 	for ( int i = 0; i < 4; ++i ) {
@@ -502,6 +655,7 @@ class mat4 {
 	}
 
 	return *this = a;
+#endif //__SSE2__
     }
 
     mat4& operator /= ( const GLfloat s ) {
@@ -522,11 +676,19 @@ class mat4 {
     //
 
     vec4 operator * ( const vec4& v ) const {  // m * v
+#ifdef __SSE2__
+	__m128 c[4];
+	mat4Columns( *this, c );
+	vec4 r;
+	_mm_storeu_ps( &r.x, mat4Apply( c, _mm_loadu_ps( &v.x ) ) );
+	return r;
+#else
 	return vec4( _m[0][0]*v.x + _m[0][1]*v.y + _m[0][2]*v.z + _m[0][3]*v.w,
 		     _m[1][0]*v.x + _m[1][1]*v.y + _m[1][2]*v.z + _m[1][3]*v.w,
 		     _m[2][0]*v.x + _m[2][1]*v.y + _m[2][2]*v.z + _m[2][3]*v.w,
 		     _m[3][0]*v.x + _m[3][1]*v.y + _m[3][2]*v.z + _m[3][3]*v.w
 	    );
+#endif //__SSE2__
     }
 	
     //
@@ -570,10 +732,58 @@ mat4 matrixCompMult( const mat4& A, const mat4& B ) {
 
 inline
 mat4 transpose( const mat4& A ) {
+#ifdef __SSE2__
+    mat4 T;
+    mat4Transpose( A, T );
+    return T;
+#else
     return mat4( A[0][0], A[1][0], A[2][0], A[3][0],
 		 A[0][1], A[1][1], A[2][1], A[3][1],
 		 A[0][2], A[1][2], A[2][2], A[3][2],
 		 A[0][3], A[1][3], A[2][3], A[3][3] );
+#endif //__SSE2__
+}
+
+//
+//  --- Batch transforms ---
+//
+
+// dst[i] = m * src[i] for `count` vectors; dst may be src
+inline
+void transform( const mat4& m, const vec4* src, vec4* dst, std::size_t count )
+{
+    std::size_t i = 0;
+#ifdef __SSE2__
+    __m128 c[4];
+    mat4Columns( m, c );
+#ifdef __AVX__
+    // two vectors per register, one in each 128-bit lane
+    __m256 c2[4];
+    for ( int k = 0; k < 4; ++k )
+	c2[k] = _mm256_insertf128_ps( _mm256_castps128_ps256( c[k] ), c[k], 1 );
+    for ( ; i + 2 <= count; i += 2 ) {
+	const __m256 v = _mm256_loadu_ps( &src[i].x );
+	const __m256 r = _mm256_add_ps(
+	    _mm256_add_ps( _mm256_mul_ps( c2[0], _mm256_permute_ps( v, 0x00 ) ),
+			   _mm256_mul_ps( c2[1], _mm256_permute_ps( v, 0x55 ) ) ),
+	    _mm256_add_ps( _mm256_mul_ps( c2[2], _mm256_permute_ps( v, 0xAA ) ),
+			   _mm256_mul_ps( c2[3], _mm256_permute_ps( v, 0xFF ) ) ) );
+	_mm256_storeu_ps( &dst[i].x, r );
+    }
+#endif //__AVX__
+    for ( ; i < count; ++i )
+	_mm_storeu_ps( &dst[i].x, mat4Apply( c, _mm_loadu_ps( &src[i].x ) ) );
+#else
+    for ( ; i < count; ++i )
+	dst[i] = m * src[i];
+#endif //__SSE2__
+}
+
+inline
+void transform( const mat4& m, std::vector<vec4>& v )
+{
+    if ( !v.empty() )
+	transform( m, &v[0], &v[0], v.size() );
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -811,7 +1021,8 @@ mat3 Normal( const mat4& c)
   }
   
   
-  inline mat4 invert(mat4 m) {
+  //Cofactor inverse, the portable path of invert
+  inline mat4 invertCofactor(mat4 m) {
     mat4 output;
     output[0][0] = m[2][1]*m[3][2]*m[1][3] - m[3][1]*m[2][2]*m[1][3] + m[3][1]*m[1][2]*m[2][3] - m[1][1]*m[3][2]*m[2][3] - m[2][1]*m[1][2]*m[3][3] + m[1][1]*m[2][2]*m[3][3];
     output[1][0] = m[3][0]*m[2][2]*m[1][3] - m[2][0]*m[3][2]*m[1][3] - m[3][0]*m[1][2]*m[2][3] + m[1][0]*m[3][2]*m[2][3] + m[2][0]*m[1][2]*m[3][3] - m[1][0]*m[2][2]*m[3][3];
@@ -832,6 +1043,15 @@ mat3 Normal( const mat4& c)
     
     return (1.0/determinant(m))*output;
   }
+  
+  inline mat4 invert(mat4 m) {
+#ifdef __SSE2__
+    mat4Invert(m, m);
+    return m;
+#else
+    return invertCofactor(m);
+#endif //__SSE2__
+  }
 
 
 //----------------------------------------------------------------------------
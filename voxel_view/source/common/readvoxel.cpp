@@ -1,18 +1,32 @@
 
 #include "readvoxel.h"
+#include "mappedfile.h"
 #include "u8names.h"
+#include "workpool.h"
 #include <qbvoxel/parse.h>
+#include <qbvoxel/gen.h>
 #include <cstdio>
+#include <cstring>
 #include <cerrno>
+#include <algorithm>
 #include <limits>
 #include <new>
 
 struct voxelgrid_cb_data {
-  std::vector<unsigned char>* image;
-  unsigned int width;
-  unsigned int height;
-  unsigned int depth;
+  voxelbricks* image;
 };
+struct voxelgrid_scene_cb_data {
+  std::vector<voxelgrid_matrix>* matrices;
+  unsigned long int max_matrices;
+};
+static
+int voxelgrid_matrix_bytes(const qbvoxel_matrix_info* mi, size_t& bytes);
+static
+bool voxelgrid_init_bricks(voxelbricks& vb, const qbvoxel_matrix_info* mi);
+static
+int voxelgrid_write_bricks(voxelbricks& vb,
+  unsigned long int x, unsigned long int y, unsigned long int z,
+  unsigned long int n, const qbvoxel_voxel* v);
 static
 int voxelgrid_cb_resize(void* p, unsigned long int n);
 static
@@ -23,8 +37,80 @@ int voxelgrid_cb_write_voxel
   ( void* p, unsigned long int i,
     unsigned long int x,unsigned long int y,unsigned long int z,
     const qbvoxel_voxel* v);
+static
+int voxelgrid_cb_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, const qbvoxel_voxel* v);
+static
+int voxelgrid_scene_cb_resize(void* p, unsigned long int n);
+static
+int voxelgrid_scene_cb_set_matrix
+  (void* p, unsigned long int i, const qbvoxel_matrix_info* mi);
+static
+int voxelgrid_scene_cb_write_voxel
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    const qbvoxel_voxel* v);
+static
+int voxelgrid_scene_cb_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, const qbvoxel_voxel* v);
+static
+unsigned long int voxelgrid_encode_cb_size(const void* p);
+static
+int voxelgrid_encode_cb_get_matrix
+  (const void* p, unsigned long int i, qbvoxel_matrix_info* mi);
+static
+int voxelgrid_encode_cb_read_voxel
+  ( const void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    qbvoxel_voxel* v);
 
 
+int voxelgrid_matrix_bytes(const qbvoxel_matrix_info* mi, size_t& bytes) {
+  const size_t max_voxels = (std::numeric_limits<size_t>::max()/4);
+  if (mi->size_x == 0 || mi->size_y == 0 || mi->size_z == 0) {
+    bytes = 0;
+  } else if (mi->size_x > max_voxels){
+    return QBVoxel_ErrMemory;
+  } else if (mi->size_y > max_voxels/mi->size_x){
+    return QBVoxel_ErrMemory;
+  } else if (mi->size_z > (max_voxels/mi->size_x)/mi->size_y){
+    return QBVoxel_ErrMemory;
+  } else {
+    bytes = static_cast<size_t>(mi->size_x)
+        * static_cast<size_t>(mi->size_y)
+        * static_cast<size_t>(mi->size_z) * 4;
+  }
+  return QBVoxel_Ok;
+}
+
+bool voxelgrid_init_bricks(voxelbricks& vb, const qbvoxel_matrix_info* mi) {
+  const unsigned long int max_size = std::numeric_limits<unsigned int>::max();
+  if (mi->size_x > max_size || mi->size_y > max_size || mi->size_z > max_size)
+    return false;
+  return voxelbricks_init(vb, static_cast<unsigned int>(mi->size_x),
+    static_cast<unsigned int>(mi->size_y), static_cast<unsigned int>(mi->size_z));
+}
+
+//Store a span from the parser; spans never leave their z-slice.
+int voxelgrid_write_bricks(voxelbricks& vb,
+  unsigned long int x, unsigned long int y, unsigned long int z,
+  unsigned long int n, const qbvoxel_voxel* v)
+{
+  if (x >= vb.width || y >= vb.height || z >= vb.depth)
+    return QBVoxel_ErrOutOfRange;
+  else if (n > (vb.width - x) + static_cast<size_t>(vb.height - y - 1)*vb.width)
+    return QBVoxel_ErrOutOfRange;
+  else if (!voxelbricks_write_span(vb, static_cast<unsigned int>(x),
+             static_cast<unsigned int>(y), static_cast<unsigned int>(z), n,
+             &v->r, false))
+    return QBVoxel_ErrMemory;
+  return QBVoxel_Ok;
+}
+
 int voxelgrid_cb_resize(void* , unsigned long int n) {
   return n == 1 ? QBVoxel_Ok : /*matrix count*/10;
 }
@@ -33,65 +119,153 @@ int voxelgrid_cb_set_matrix
   (void* p, unsigned long int i, const qbvoxel_matrix_info* mi)
 {
   voxelgrid_cb_data* data = static_cast<voxelgrid_cb_data*>(p);
-  const size_t max_voxels = (std::numeric_limits<size_t>::max()/4);
-  size_t space_needed = 0;
   if (i != 0)
     return QBVoxel_ErrOutOfRange;
-  else if (mi->size_x == 0 || mi->size_y == 0 || mi->size_z == 0) {
-    space_needed = 0;
-  } else if (mi->size_x > max_voxels){
-    return QBVoxel_ErrMemory;
-  } else if (mi->size_y > max_voxels/mi->size_x){
+  else if (!voxelgrid_init_bricks(*data->image, mi))
     return QBVoxel_ErrMemory;
-  } else if (mi->size_z > (max_voxels/mi->size_x)/mi->size_y){
+  return QBVoxel_Ok;
+}
+
+int voxelgrid_cb_write_voxel
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    const qbvoxel_voxel* v)
+{
+  return voxelgrid_cb_write_span(p, i, x, y, z, 1, v);
+}
+
+int voxelgrid_cb_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, const qbvoxel_voxel* v)
+{
+  voxelgrid_cb_data* data = static_cast<voxelgrid_cb_data*>(p);
+  if (i != 0)
+    return QBVoxel_ErrOutOfRange;
+  return voxelgrid_write_bricks(*data->image, x, y, z, n, v);
+}
+
+int voxelgrid_scene_cb_resize(void* p, unsigned long int n) {
+  voxelgrid_scene_cb_data* data = static_cast<voxelgrid_scene_cb_data*>(p);
+  if (n > data->max_matrices)
+    return /*matrix count*/10;
+  try {
+    data->matrices->clear();
+    data->matrices->resize(n);
+  } catch (const std::bad_alloc& ){
     return QBVoxel_ErrMemory;
-  } else {
-    space_needed = static_cast<size_t>(mi->size_x)
-        * static_cast<size_t>(mi->size_y)
-        * static_cast<size_t>(mi->size_z) * 4;
   }
+  return QBVoxel_Ok;
+}
+
+int voxelgrid_scene_cb_set_matrix
+  (void* p, unsigned long int i, const qbvoxel_matrix_info* mi)
+{
+  voxelgrid_scene_cb_data* data = static_cast<voxelgrid_scene_cb_data*>(p);
+  if (i >= data->matrices->size())
+    return QBVoxel_ErrOutOfRange;
+  voxelgrid_matrix& m = (*data->matrices)[i];
   try {
-    data->image->resize(space_needed);
+    m.name = mi->name;
   } catch (const std::bad_alloc& ){
     return QBVoxel_ErrMemory;
   }
-  data->width = static_cast<unsigned int>(mi->size_x);
-  data->height = static_cast<unsigned int>(mi->size_y);
-  data->depth = static_cast<unsigned int>(mi->size_z);
+  if (!voxelgrid_init_bricks(m.voxels, mi))
+    return QBVoxel_ErrMemory;
+  m.pos_x = mi->pos_x;
+  m.pos_y = mi->pos_y;
+  m.pos_z = mi->pos_z;
+  m.width = static_cast<unsigned int>(mi->size_x);
+  m.height = static_cast<unsigned int>(mi->size_y);
+  m.depth = static_cast<unsigned int>(mi->size_z);
   return QBVoxel_Ok;
 }
 
-int voxelgrid_cb_write_voxel
+int voxelgrid_scene_cb_write_voxel
   ( void* p, unsigned long int i,
     unsigned long int x,unsigned long int y,unsigned long int z,
     const qbvoxel_voxel* v)
 {
-  voxelgrid_cb_data* data = static_cast<voxelgrid_cb_data*>(p);
-  if (i != 0)
+  return voxelgrid_scene_cb_write_span(p, i, x, y, z, 1, v);
+}
+
+int voxelgrid_scene_cb_write_span
+  ( void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    unsigned long int n, const qbvoxel_voxel* v)
+{
+  voxelgrid_scene_cb_data* data = static_cast<voxelgrid_scene_cb_data*>(p);
+  if (i >= data->matrices->size())
     return QBVoxel_ErrOutOfRange;
-  else if (x >= data->width)
+  return voxelgrid_write_bricks((*data->matrices)[i].voxels, x, y, z, n, v);
+}
+
+unsigned long int voxelgrid_encode_cb_size(const void* p) {
+  const std::vector<voxelgrid_matrix>* matrices =
+    static_cast<const std::vector<voxelgrid_matrix>*>(p);
+  return static_cast<unsigned long int>(matrices->size());
+}
+
+int voxelgrid_encode_cb_get_matrix
+  (const void* p, unsigned long int i, qbvoxel_matrix_info* mi)
+{
+  const std::vector<voxelgrid_matrix>* matrices =
+    static_cast<const std::vector<voxelgrid_matrix>*>(p);
+  if (i >= matrices->size())
     return QBVoxel_ErrOutOfRange;
-  else if (y >= data->height)
+  const voxelgrid_matrix& m = (*matrices)[i];
+  if (m.voxels.width != m.width || m.voxels.height != m.height
+  ||  m.voxels.depth != m.depth)
     return QBVoxel_ErrOutOfRange;
-  else if (z >= data->depth)
+  std::memset(mi->name, 0, sizeof(mi->name));
+  std::strncpy(mi->name, m.name.c_str(), sizeof(mi->name)-1);
+  mi->pos_x = m.pos_x;
+  mi->pos_y = m.pos_y;
+  mi->pos_z = m.pos_z;
+  mi->size_x = m.width;
+  mi->size_y = m.height;
+  mi->size_z = m.depth;
+  return QBVoxel_Ok;
+}
+
+int voxelgrid_encode_cb_read_voxel
+  ( const void* p, unsigned long int i,
+    unsigned long int x,unsigned long int y,unsigned long int z,
+    qbvoxel_voxel* v)
+{
+  const std::vector<voxelgrid_matrix>* matrices =
+    static_cast<const std::vector<voxelgrid_matrix>*>(p);
+  if (i >= matrices->size())
     return QBVoxel_ErrOutOfRange;
-  else {
-    size_t pos = x + (y + static_cast<size_t>(z)*data->height) * data->width;
-    std::vector<unsigned char>& voxels = (*data->image);
-    voxels[pos*4] = v->r;
-    voxels[pos*4+1] = v->g;
-    voxels[pos*4+2] = v->b;
-    voxels[pos*4+3] = v->a;
-    return QBVoxel_Ok;
-  }
+  const voxelgrid_matrix& m = (*matrices)[i];
+  if (x >= m.width || y >= m.height || z >= m.depth)
+    return QBVoxel_ErrOutOfRange;
+  const unsigned int packed = voxelbricks_get(m.voxels,
+    static_cast<unsigned int>(x), static_cast<unsigned int>(y),
+    static_cast<unsigned int>(z));
+  v->r = static_cast<unsigned char>(packed&255);
+  v->g = static_cast<unsigned char>((packed>>8)&255);
+  v->b = static_cast<unsigned char>((packed>>16)&255);
+  v->a = static_cast<unsigned char>(packed>>24);
+  return QBVoxel_Ok;
 }
 
 
-unsigned int
-voxelgrid_decode(std::vector<unsigned char>& image,
-  unsigned int& width, unsigned int& height, unsigned int &depth,
-  const char* path)
+//Map a file, or read it whole into `copy` when it cannot be mapped.
+static
+unsigned int voxelgrid_load_bytes(const char* path, mapped_file& mf,
+  std::vector<unsigned char>& copy,
+  const unsigned char*& bytes, std::size_t& size)
 {
+  unsigned int map_error = mapped_file_open(mf, path);
+  if (map_error == 0) {
+    bytes = mf.data;
+    size = mf.size;
+    return 0;
+  } else if (map_error == 8/* file not found */) {
+    return map_error;
+  }
+
 #ifdef _WIN32
   std::FILE* fp ;
   /* */{
@@ -104,27 +278,19 @@ voxelgrid_decode(std::vector<unsigned char>& image,
   std::FILE* fp = std::fopen(path, "rb");
 #endif //_WIN32
   if (fp != NULL) {
-    unsigned int error_code = 0;
-    unsigned char buf[256];
+    unsigned char buf[65536];
     std::size_t readsize;
-    voxelgrid_cb_data data = {&image, 0,0,0};
-    qbvoxel_i cb = {&data, voxelgrid_cb_resize, NULL, NULL,
-      &voxelgrid_cb_set_matrix, NULL, &voxelgrid_cb_write_voxel };
-    qbvoxel_state state = {0};
-    qbvoxel_parse_init(&state, &cb);
-    while ((readsize = std::fread(buf, 1, 256, fp)) > 0) {
-      unsigned int len =
-        qbvoxel_parse_do(&state, static_cast<unsigned int>(readsize), buf);
-      if (len < readsize)
-        break;
+    try {
+      while ((readsize = std::fread(buf, 1, sizeof(buf), fp)) > 0)
+        copy.insert(copy.end(), buf, buf+readsize);
+    } catch (const std::bad_alloc& ){
+      std::fclose(fp);
+      return QBVoxel_ErrMemory;
     }
-    error_code = qbvoxel_api_get_error(&state);
-    qbvoxel_parse_clear(&state);
     std::fclose(fp);
-    width = data.width;
-    height = data.height;
-    depth = data.depth;
-    return error_code;
+    bytes = copy.empty() ? NULL : &copy[0];
+    size = copy.size();
+    return 0;
   } else {
 #ifdef ENOENT
     return errno == ENOENT ? 8/* file not found */ : 9/* other io */;
@@ -134,6 +300,238 @@ voxelgrid_decode(std::vector<unsigned char>& image,
   }
 }
 
+//Feed a whole buffer to the parser; qbvoxel_parse_do takes at most
+//UINT_MAX bytes per call.
+static
+void voxelgrid_parse_all(qbvoxel_state& state,
+  const unsigned char* data, std::size_t size)
+{
+  const std::size_t max_chunk = std::numeric_limits<unsigned int>::max();
+  while (size > 0) {
+    std::size_t chunk = size < max_chunk ? size : max_chunk;
+    unsigned int len =
+      qbvoxel_parse_do(&state, static_cast<unsigned int>(chunk), data);
+    if (len < chunk)
+      break;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+//Byte offset of each matrix in an uncompressed file, from the name
+//lengths and bounds alone. Returns false if the file is truncated.
+static
+bool voxelgrid_matrix_offsets(const unsigned char* bytes, std::size_t size,
+  unsigned long int count, std::vector<std::size_t>& offsets)
+{
+  std::size_t off = 24;
+  offsets.clear();
+  for (unsigned long int k = 0; k < count; ++k) {
+    offsets.push_back(off);
+    if (size - off < 1)
+      return false;
+    off += 1 + bytes[off];
+    if (off > size || size - off < 24)
+      return false;
+    qbvoxel_matrix_info mi;
+    mi.size_x = qbvoxel_api_from_u32(bytes+off);
+    mi.size_y = qbvoxel_api_from_u32(bytes+off+4);
+    mi.size_z = qbvoxel_api_from_u32(bytes+off+8);
+    off += 24;
+    std::size_t data_bytes = 0;
+    if (voxelgrid_matrix_bytes(&mi, data_bytes) != QBVoxel_Ok
+    ||  data_bytes > size - off)
+      return false;
+    off += data_bytes;
+  }
+  offsets.push_back(off);
+  return true;
+}
+
+unsigned int
+voxelgrid_decode(voxelbricks& image, const char* path)
+{
+  voxelgrid_cb_data data = {&image};
+  qbvoxel_i cb = {&data, voxelgrid_cb_resize, NULL, NULL,
+    &voxelgrid_cb_set_matrix, NULL, &voxelgrid_cb_write_voxel,
+    &voxelgrid_cb_write_span };
+  qbvoxel_state state = qbvoxel_state();
+  unsigned int error_code = 0;
+
+  //Parse the whole mapped file in one pass. Uncompressed RGBA slices
+  //then reach voxelgrid_cb_write_span as single spans and are copied
+  //into the bricks a row at a time.
+  mapped_file mf;
+  std::vector<unsigned char> copy;
+  const unsigned char* bytes = NULL;
+  std::size_t size = 0;
+  error_code = voxelgrid_load_bytes(path, mf, copy, bytes, size);
+  if (error_code != 0)
+    return error_code;
+  qbvoxel_parse_init(&state, &cb);
+  voxelgrid_parse_all(state, bytes, size);
+  error_code = qbvoxel_api_get_error(&state);
+  qbvoxel_parse_clear(&state);
+  mapped_file_close(mf);
+  if (error_code == 0)
+    voxelbricks_compact(image);
+  return error_code;
+}
+
+unsigned int
+voxelgrid_decode_scene(std::vector<voxelgrid_matrix>& matrices,
+  const char* path, unsigned int threads)
+{
+  matrices.clear();
+  mapped_file mf;
+  std::vector<unsigned char> copy;
+  const unsigned char* bytes = NULL;
+  std::size_t size = 0;
+  unsigned int error_code = voxelgrid_load_bytes(path, mf, copy, bytes, size);
+  if (error_code != 0)
+    return error_code;
+
+  //Every matrix takes at least 25 bytes of name length and bounds.
+  voxelgrid_scene_cb_data data = {&matrices, size/25 + 1};
+  qbvoxel_i cb = {&data, voxelgrid_scene_cb_resize, NULL, NULL,
+    &voxelgrid_scene_cb_set_matrix, NULL, &voxelgrid_scene_cb_write_voxel,
+    &voxelgrid_scene_cb_write_span };
+  qbvoxel_state state = qbvoxel_state();
+  qbvoxel_parse_init(&state, &cb);
+  std::size_t header = size < 24 ? size : 24;
+  voxelgrid_parse_all(state, bytes, header);
+
+  std::vector<std::size_t> offsets;
+  if (qbvoxel_api_get_error(&state) == 0 && state.state == 1u
+  &&  !(state.flags & QBVoxel_FlagRLE) && matrices.size() > 1
+  &&  voxelgrid_matrix_offsets(bytes, size, matrices.size(), offsets))
+  {
+    //Uncompressed matrices sit at known offsets: parse each one from a
+    //copy of the header state. Every worker writes only its own matrix.
+    std::vector<unsigned int> errors(matrices.size(), 0);
+    workpool_shared().parallel_for(matrices.size(), [&](std::size_t k) {
+      qbvoxel_state local = state;
+      errors[k] = qbvoxel_parse_seek(&local, static_cast<unsigned long>(k));
+      if (errors[k] == 0) {
+        voxelgrid_parse_all(local, bytes + offsets[k], offsets[k+1]-offsets[k]);
+        errors[k] = qbvoxel_api_get_error(&local);
+      }
+    }, threads);
+    for (std::size_t k = 0; k < errors.size() && error_code == 0; ++k)
+      error_code = errors[k];
+  } else {
+    voxelgrid_parse_all(state, bytes + header, size - header);
+    error_code = qbvoxel_api_get_error(&state);
+  }
+  qbvoxel_parse_clear(&state);
+  mapped_file_close(mf);
+  return error_code;
+}
+
+unsigned int
+voxelgrid_flatten(std::vector<voxelgrid_matrix>& matrices,
+  voxelbricks& voxels, long int origin[3], unsigned int threads,
+  unsigned int layout)
+{
+  voxelbricks_clear(voxels);
+  origin[0] = origin[1] = origin[2] = 0;
+  if (matrices.empty())
+    return QBVoxel_Ok;
+  if (matrices.size() == 1) {
+    voxelgrid_matrix& m = matrices[0];
+    std::swap(voxels, m.voxels);
+    voxelbricks_clear(m.voxels);
+    origin[0] = m.pos_x;
+    origin[1] = m.pos_y;
+    origin[2] = m.pos_z;
+    voxelbricks_compact(voxels);
+    return voxelbricks_set_layout(voxels, layout)
+      ? QBVoxel_Ok : QBVoxel_ErrMemory;
+  }
+
+  long long lo[3], hi[3];
+  for (std::size_t k = 0; k < matrices.size(); ++k) {
+    const voxelgrid_matrix& m = matrices[k];
+    const long long pos[3] = {m.pos_x, m.pos_y, m.pos_z};
+    const long long dim[3] = {m.width, m.height, m.depth};
+    for (int a = 0; a < 3; ++a) {
+      if (k == 0 || pos[a] < lo[a])
+        lo[a] = pos[a];
+      if (k == 0 || pos[a] + dim[a] > hi[a])
+        hi[a] = pos[a] + dim[a];
+    }
+  }
+  for (int a = 0; a < 3; ++a) {
+    if (hi[a] - lo[a] > static_cast<long long>(
+          std::numeric_limits<unsigned int>::max()))
+      return QBVoxel_ErrMemory;
+  }
+  if (!voxelbricks_init(voxels, static_cast<unsigned int>(hi[0] - lo[0]),
+        static_cast<unsigned int>(hi[1] - lo[1]),
+        static_cast<unsigned int>(hi[2] - lo[2]), layout))
+    return QBVoxel_ErrMemory;
+  for (int a = 0; a < 3; ++a)
+    origin[a] = static_cast<long int>(lo[a]);
+
+  //Matrices go in file order so later ones win where solid voxels
+  //overlap; the bricks of one matrix are copied in parallel.
+  for (std::size_t k = 0; k < matrices.size(); ++k) {
+    voxelgrid_matrix& m = matrices[k];
+    const unsigned int offset[3] = {
+      static_cast<unsigned int>(m.pos_x - lo[0]),
+      static_cast<unsigned int>(m.pos_y - lo[1]),
+      static_cast<unsigned int>(m.pos_z - lo[2])};
+    if (!voxelbricks_merge(voxels, m.voxels, offset, threads))
+      return QBVoxel_ErrMemory;
+    voxelbricks_clear(m.voxels);
+  }
+  voxelbricks_compact(voxels);
+  return QBVoxel_Ok;
+}
+
+unsigned int
+voxelgrid_encode(const std::vector<voxelgrid_matrix>& matrices,
+  const char* path, unsigned int flags)
+{
+#ifdef _WIN32
+  std::FILE* fp ;
+  /* */{
+    std::wstring wcpath;
+    if (u8names_towc(path, wcpath) != 0)
+      return 9/* other io */;
+    fp = _wfopen(wcpath.c_str(), L"wb");
+  }
+#else
+  std::FILE* fp = std::fopen(path, "wb");
+#endif //_WIN32
+  if (fp == NULL)
+    return 9/* other io */;
+
+  qbvoxel_i cb = {const_cast<std::vector<voxelgrid_matrix>*>(&matrices),
+    NULL, &voxelgrid_encode_cb_size, &voxelgrid_encode_cb_get_matrix, NULL,
+    &voxelgrid_encode_cb_read_voxel, NULL, NULL };
+  qbvoxel_state state = qbvoxel_state();
+  qbvoxel_gen_init(&state, &cb);
+  qbvoxel_api_set_flags(&state, flags);
+  unsigned int error_code = 0;
+  unsigned char buf[65536];
+  for (;;) {
+    unsigned int len = qbvoxel_gen_do(&state, sizeof(buf), buf);
+    if (std::fwrite(buf, 1, len, fp) != len) {
+      error_code = 9/* other io */;
+      break;
+    }
+    if (len < sizeof(buf)) {
+      error_code = qbvoxel_api_get_error(&state);
+      break;
+    }
+  }
+  qbvoxel_gen_clear(&state);
+  if (std::fclose(fp) != 0 && error_code == 0)
+    error_code = 9/* other io */;
+  return error_code;
+}
+
 char const* voxelgrid_error_text(unsigned err) {
   switch (err) {
   case QBVoxel_Ok: return "Success";
@@ -147,6 +545,7 @@ char const* voxelgrid_error_text(unsigned err) {
   case 8: return "File not found";
   case 9: return "Input/output error";
   case 10: return "Unsupported matrix count";
+  case QBVoxel_ErrData: return "Matrix data out of bounds";
   default: return "Unknown error";
   }
 }
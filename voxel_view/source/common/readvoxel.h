@@ -1,20 +1,76 @@
 #ifndef hg_READVOXEL_h_
 #define hg_READVOXEL_h_
 
+#include "voxelbricks.h"
+#include <string>
 #include <vector>
 
 /**
- * @brief Convert an error code to a string.
- * @param[out] voxels buffer to hold voxel data
- * @param[out] width x-axis size of voxel grid
- * @param[out] height y-axis size of voxel grid
- * @param[out] depth z-axis size of voxel grid
+ * @brief One named matrix of a Qubicle scene.
+ */
+struct voxelgrid_matrix {
+  /**
+   * @brief Matrix name.
+   */
+  std::string name;
+  /**
+   * @brief Position of the matrix's lowest corner in scene space.
+   */
+  long int pos_x, pos_y, pos_z;
+  /**
+   * @brief Matrix size in voxels.
+   */
+  unsigned int width, height, depth;
+  /**
+   * @brief Voxel data, `width` x `height` x `depth` bricks.
+   */
+  voxelbricks voxels;
+};
+
+/**
+ * @brief Decode a single-matrix `.qb` file.
+ * @param[out] voxels bricks to hold voxel data
+ * @param path path to `.qb` file to load
+ * @return zero on success, nonzero error code otherwise
+ */
+unsigned int voxelgrid_decode(voxelbricks& voxels, const char* path);
+
+/**
+ * @brief Decode every matrix of a `.qb` file.
+ * @param[out] matrices one entry per matrix, in file order
  * @param path path to `.qb` file to load
+ * @param threads threads to decode with, zero for one per core
+ * @return zero on success, nonzero error code otherwise
+ * @note Matrices of uncompressed files are decoded in parallel.
+ */
+unsigned int voxelgrid_decode_scene(std::vector<voxelgrid_matrix>& matrices,
+  const char* path, unsigned int threads = 0);
+
+/**
+ * @brief Merge scene matrices into one volume spanning their bounds.
+ * @param matrices decoded matrices; their voxel data is released
+ * @param[out] voxels bricks to hold voxel data
+ * @param[out] origin scene position of voxel (0,0,0)
+ * @param threads threads to copy with, zero for one per core
+ * @param layout voxel order of the dense bricks, a `voxelbricks_layout`
+ *   value
+ * @return zero on success, nonzero error code otherwise
+ * @note Where solid voxels of two matrices overlap, the later matrix wins.
+ * @note Bricks whose voxels all match are stored as uniform bricks.
+ */
+unsigned int voxelgrid_flatten(std::vector<voxelgrid_matrix>& matrices,
+  voxelbricks& voxels, long int origin[3], unsigned int threads = 0,
+  unsigned int layout = VoxelBricks_Linear);
+
+/**
+ * @brief Write matrices to a `.qb` file.
+ * @param matrices matrices to write, in file order
+ * @param path path to `.qb` file to create
+ * @param flags `QBVoxel_Flag*` encode flags; `QBVoxel_FlagRLE` compresses
  * @return zero on success, nonzero error code otherwise
  */
-unsigned int voxelgrid_decode(std::vector<unsigned char>& voxels,
-  unsigned int& width, unsigned int& height, unsigned int &depth,
-  const char* path);
+unsigned int voxelgrid_encode(const std::vector<voxelgrid_matrix>& matrices,
+  const char* path, unsigned int flags);
 
 /**
  * @brief Convert an error code to a string.
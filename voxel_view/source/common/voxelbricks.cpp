@@ -0,0 +1,662 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelbricks.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelbricks.h"
+#include "workpool.h"
+#include <algorithm>
+#include <limits>
+#include <new>
+
+//Voxels converted per call when writing RGBA bytes
+static const std::size_t VoxelBricks_SpanChunk = 256;
+
+static
+void voxelbricks_extent(const voxelbricks& vb, std::size_t b,
+  unsigned int lo[3], unsigned int hi[3]);
+static
+void voxelbricks_store(voxelbricks& vb, std::size_t b, std::size_t i,
+  std::size_t n, const unsigned int* v, bool solid_only);
+static
+void voxelbricks_store_row(voxelbricks& vb, std::size_t b, unsigned int x,
+  unsigned int y, unsigned int z, std::size_t n, const unsigned int* v,
+  bool solid_only);
+static
+bool voxelbricks_make_dense(voxelbricks& vb, std::size_t b);
+static
+bool voxelbricks_widen(voxelbricks& vb, unsigned int bytes);
+static
+bool voxelbricks_intern(voxelbricks& vb, unsigned int v, unsigned int& index);
+static
+bool voxelbricks_write_row(voxelbricks& vb, unsigned int x, unsigned int y,
+  unsigned int z, std::size_t n, const unsigned int* v, bool solid_only);
+static
+bool voxelbricks_fill_index(voxelbricks& vb, const unsigned int lo[3],
+  const unsigned int hi[3], unsigned int index);
+
+
+//Voxel range of brick `b` that lies inside the volume.
+void voxelbricks_extent(const voxelbricks& vb, std::size_t b,
+  unsigned int lo[3], unsigned int hi[3])
+{
+  const unsigned int dims[3] = {vb.width, vb.height, vb.depth};
+  const std::size_t cell[3] = {b % vb.count[0], (b / vb.count[0]) % vb.count[1],
+    b / (static_cast<std::size_t>(vb.count[0])*vb.count[1])};
+  for (unsigned int a = 0; a < 3; ++a) {
+    lo[a] = static_cast<unsigned int>(cell[a]) << VoxelBricks_Shift;
+    hi[a] = (dims[a] - lo[a] < VoxelBricks_Edge)
+      ? dims[a] : lo[a] + VoxelBricks_Edge;
+  }
+}
+
+template <typename T>
+static
+void voxelbricks_store_as(unsigned char* d, std::size_t i, std::size_t n,
+  const unsigned int* v, bool solid_only)
+{
+  T* out = reinterpret_cast<T*>(d) + i;
+  for (std::size_t k = 0; k < n; ++k) {
+    if (!solid_only || v[k] != 0)
+      out[k] = static_cast<T>(v[k]);
+  }
+}
+
+//Write `n` indices into dense brick `b` from entry `i` on.
+void voxelbricks_store(voxelbricks& vb, std::size_t b, std::size_t i,
+  std::size_t n, const unsigned int* v, bool solid_only)
+{
+  unsigned char* d = &vb.dense[b][0];
+  switch (vb.index_bytes) {
+  case 1: voxelbricks_store_as<unsigned char>(d, i, n, v, solid_only); break;
+  case 2: voxelbricks_store_as<unsigned short>(d, i, n, v, solid_only); break;
+  default: voxelbricks_store_as<unsigned int>(d, i, n, v, solid_only); break;
+  }
+}
+
+template <typename T>
+static
+void voxelbricks_store_morton(unsigned char* d, unsigned int x,
+  unsigned int y, unsigned int z, std::size_t n, const unsigned int* v,
+  bool solid_only)
+{
+  const unsigned int m = VoxelBricks_Edge-1;
+  T* out = reinterpret_cast<T*>(d);
+  const unsigned int yz = voxelbricks_morton(0, y&m, z&m);
+  for (std::size_t k = 0; k < n; ++k) {
+    if (!solid_only || v[k] != 0) {
+      out[yz | voxelbricks_morton((x + static_cast<unsigned int>(k))&m, 0, 0)]
+        = static_cast<T>(v[k]);
+    }
+  }
+}
+
+//Write `n` indices along x into dense brick `b`, starting at voxel
+//(x, y, z); the run stays inside the brick.
+void voxelbricks_store_row(voxelbricks& vb, std::size_t b, unsigned int x,
+  unsigned int y, unsigned int z, std::size_t n, const unsigned int* v,
+  bool solid_only)
+{
+  if (vb.layout != VoxelBricks_Morton) {
+    voxelbricks_store(vb, b, voxelbricks_entry(vb, x, y, z), n, v,
+      solid_only);
+    return;
+  }
+  unsigned char* d = &vb.dense[b][0];
+  switch (vb.index_bytes) {
+  case 1: voxelbricks_store_morton<unsigned char>(d, x, y, z, n, v,
+    solid_only); break;
+  case 2: voxelbricks_store_morton<unsigned short>(d, x, y, z, n, v,
+    solid_only); break;
+  default: voxelbricks_store_morton<unsigned int>(d, x, y, z, n, v,
+    solid_only); break;
+  }
+}
+
+//Make brick `b` dense, filled with its uniform index. Voxels outside the
+//volume stay empty.
+bool voxelbricks_make_dense(voxelbricks& vb, std::size_t b) {
+  std::vector<unsigned char>& d = vb.dense[b];
+  if (!d.empty())
+    return true;
+  try {
+    d.assign(static_cast<std::size_t>(VoxelBricks_Size)*vb.index_bytes, 0);
+  } catch (const std::bad_alloc& ) {
+    return false;
+  }
+  const unsigned int u = vb.uniform[b];
+  if (u != 0) {
+    unsigned int lo[3], hi[3];
+    voxelbricks_extent(vb, b, lo, hi);
+    const std::vector<unsigned int> row(hi[0]-lo[0], u);
+    for (unsigned int z = lo[2]; z < hi[2]; ++z)
+    for (unsigned int y = lo[1]; y < hi[1]; ++y)
+      voxelbricks_store_row(vb, b, lo[0], y, z, row.size(), &row[0], false);
+  }
+  return true;
+}
+
+//Rewrite every dense brick with wider indices.
+bool voxelbricks_widen(voxelbricks& vb, unsigned int bytes) {
+  std::vector<unsigned int> values;
+  try {
+    values.resize(VoxelBricks_Size);
+  } catch (const std::bad_alloc& ) {
+    return false;
+  }
+  for (std::size_t b = 0; b < vb.dense.size(); ++b) {
+    if (vb.dense[b].empty())
+      continue;
+    for (std::size_t i = 0; i < VoxelBricks_Size; ++i)
+      values[i] = voxelbricks_load(vb, b, i);
+    std::vector<unsigned char> wide;
+    try {
+      wide.resize(static_cast<std::size_t>(VoxelBricks_Size)*bytes);
+    } catch (const std::bad_alloc& ) {
+      //bricks before `b` are wide already; put them back
+      for (std::size_t k = 0; k < b; ++k) {
+        if (vb.dense[k].empty())
+          continue;
+        for (std::size_t i = 0; i < VoxelBricks_Size; ++i) {
+          values[i] = (bytes == 2)
+            ? reinterpret_cast<const unsigned short*>(&vb.dense[k][0])[i]
+            : reinterpret_cast<const unsigned int*>(&vb.dense[k][0])[i];
+        }
+        vb.dense[k].resize(
+          static_cast<std::size_t>(VoxelBricks_Size)*vb.index_bytes);
+        voxelbricks_store(vb, k, 0, VoxelBricks_Size, &values[0], false);
+      }
+      return false;
+    }
+    vb.dense[b].swap(wide);
+    if (bytes == 2)
+      voxelbricks_store_as<unsigned short>(&vb.dense[b][0], 0,
+        VoxelBricks_Size, &values[0], false);
+    else
+      voxelbricks_store_as<unsigned int>(&vb.dense[b][0], 0,
+        VoxelBricks_Size, &values[0], false);
+  }
+  vb.index_bytes = bytes;
+  return true;
+}
+
+//Palette index of a packed voxel, adding it to the palette if new.
+bool voxelbricks_intern(voxelbricks& vb, unsigned int v, unsigned int& index) {
+  if ((v>>24) == 0) {
+    index = 0;
+    return true;
+  }
+  std::unordered_map<unsigned int, unsigned int>::const_iterator found =
+    vb.lookup.find(v);
+  if (found != vb.lookup.end()) {
+    index = found->second;
+    return true;
+  }
+  const std::size_t next = vb.palette.size();
+  if (next > std::numeric_limits<unsigned int>::max())
+    return false;
+  const unsigned int bytes = (next >= 65536) ? 4 : (next >= 256) ? 2 : 1;
+  if (bytes > vb.index_bytes && !voxelbricks_widen(vb, bytes))
+    return false;
+  try {
+    vb.palette.push_back(v);
+    vb.lookup.insert(std::make_pair(v, static_cast<unsigned int>(next)));
+  } catch (const std::bad_alloc& ) {
+    vb.palette.resize(next);
+    return false;
+  }
+  index = static_cast<unsigned int>(next);
+  return true;
+}
+
+//Write `n` palette indices along x, all within one row.
+bool voxelbricks_write_row(voxelbricks& vb, unsigned int x, unsigned int y,
+  unsigned int z, std::size_t n, const unsigned int* v, bool solid_only)
+{
+  const unsigned int m = VoxelBricks_Edge-1;
+  while (n > 0) {
+    const std::size_t b = voxelbricks_index(vb, x, y, z);
+    const std::size_t seg = (std::min)(n,
+      static_cast<std::size_t>(VoxelBricks_Edge - (x&m)));
+    bool dense = !vb.dense[b].empty();
+    if (!dense) {
+      //A uniform brick stays uniform while the run matches it
+      const unsigned int u = vb.uniform[b];
+      std::size_t i = 0;
+      while (i < seg && (v[i] == u || (solid_only && v[i] == 0)))
+        ++i;
+      if (i < seg) {
+        if (!voxelbricks_make_dense(vb, b))
+          return false;
+        dense = true;
+      }
+    }
+    if (dense)
+      voxelbricks_store_row(vb, b, x, y, z, seg, v, solid_only);
+    x += static_cast<unsigned int>(seg);
+    v += seg;
+    n -= seg;
+  }
+  return true;
+}
+
+bool voxelbricks_init(voxelbricks& vb,
+  unsigned int width, unsigned int height, unsigned int depth,
+  unsigned int layout)
+{
+  voxelbricks_clear(vb);
+  const unsigned int dims[3] = {width, height, depth};
+  std::size_t total = 1;
+  unsigned int count[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    count[a] = (dims[a] >> VoxelBricks_Shift)
+      + ((dims[a] & (VoxelBricks_Edge-1)) ? 1 : 0);
+    if (count[a] != 0 && total > std::numeric_limits<std::size_t>::max()
+          / sizeof(std::vector<unsigned char>) / count[a])
+      return false;
+    total *= count[a];
+  }
+  try {
+    vb.palette.assign(1, 0);
+    vb.uniform.assign(total, 0);
+    vb.dense.resize(total);
+  } catch (const std::bad_alloc& ) {
+    voxelbricks_clear(vb);
+    return false;
+  }
+  vb.width = width;
+  vb.height = height;
+  vb.depth = depth;
+  vb.layout = layout;
+  for (unsigned int a = 0; a < 3; ++a)
+    vb.count[a] = count[a];
+  return true;
+}
+
+bool voxelbricks_set_layout(voxelbricks& vb, unsigned int layout) {
+  if (layout == vb.layout)
+    return true;
+  std::vector<unsigned int> values;
+  try {
+    values.resize(VoxelBricks_Size);
+  } catch (const std::bad_alloc& ) {
+    return false;
+  }
+  for (std::size_t b = 0; b < vb.dense.size(); ++b) {
+    if (vb.dense[b].empty())
+      continue;
+    for (std::size_t i = 0; i < VoxelBricks_Size; ++i) {
+      unsigned int p[3];
+      voxelbricks_entry_coords(vb, i, p);
+      const std::size_t to = (layout == VoxelBricks_Morton)
+        ? voxelbricks_morton(p[0], p[1], p[2])
+        : p[0] + (p[1] + p[2]*VoxelBricks_Edge)*VoxelBricks_Edge;
+      values[to] = voxelbricks_load(vb, b, i);
+    }
+    voxelbricks_store(vb, b, 0, VoxelBricks_Size, &values[0], false);
+  }
+  vb.layout = layout;
+  return true;
+}
+
+void voxelbricks_clear(voxelbricks& vb) {
+  vb.width = vb.height = vb.depth = 0;
+  vb.count[0] = vb.count[1] = vb.count[2] = 0;
+  vb.index_bytes = 1;
+  vb.layout = VoxelBricks_Linear;
+  std::vector<unsigned int>().swap(vb.palette);
+  std::unordered_map<unsigned int, unsigned int>().swap(vb.lookup);
+  std::vector<unsigned int>().swap(vb.uniform);
+  std::vector<std::vector<unsigned char> >().swap(vb.dense);
+}
+
+bool voxelbricks_set(voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z, unsigned int v)
+{
+  unsigned int index;
+  if (x >= vb.width || y >= vb.height || z >= vb.depth)
+    return false;
+  if (!voxelbricks_intern(vb, v, index))
+    return false;
+  return voxelbricks_write_row(vb, x, y, z, 1, &index, false);
+}
+
+bool voxelbricks_write_span(voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z, std::size_t n,
+  const unsigned char* rgba, bool solid_only)
+{
+  if (z >= vb.depth)
+    return false;
+  unsigned int indices[VoxelBricks_SpanChunk];
+  unsigned int last_value = 0, last_index = 0;
+  while (n > 0) {
+    if (x >= vb.width || y >= vb.height)
+      return false;
+    std::size_t row = (std::min)(n, static_cast<std::size_t>(vb.width - x));
+    row = (std::min)(row, VoxelBricks_SpanChunk);
+    for (std::size_t i = 0; i < row; ++i, rgba += 4) {
+      //runs of one color are common, so skip the lookup for repeats
+      const unsigned int v =
+        voxelbricks_pack(rgba[0], rgba[1], rgba[2], rgba[3]);
+      if (v != last_value) {
+        if (!voxelbricks_intern(vb, v, last_index))
+          return false;
+        last_value = v;
+      }
+      indices[i] = last_index;
+    }
+    if (!voxelbricks_write_row(vb, x, y, z, row, indices, solid_only))
+      return false;
+    n -= row;
+    x += static_cast<unsigned int>(row);
+    if (x >= vb.width) {
+      x = 0;
+      y += 1;
+    }
+  }
+  return true;
+}
+
+//Set every voxel of a box to one palette index.
+bool voxelbricks_fill_index(voxelbricks& vb, const unsigned int lo[3],
+  const unsigned int hi[3], unsigned int index)
+{
+  const unsigned int dims[3] = {vb.width, vb.height, vb.depth};
+  unsigned int box_lo[3], box_hi[3], brick_lo[3], brick_hi[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    box_lo[a] = lo[a];
+    box_hi[a] = (std::min)(hi[a], dims[a]);
+    if (box_lo[a] >= box_hi[a])
+      return true;
+    brick_lo[a] = box_lo[a] >> VoxelBricks_Shift;
+    brick_hi[a] = ((box_hi[a]-1) >> VoxelBricks_Shift) + 1;
+  }
+  const std::vector<unsigned int> row(VoxelBricks_Edge, index);
+  for (unsigned int bz = brick_lo[2]; bz < brick_hi[2]; ++bz)
+  for (unsigned int by = brick_lo[1]; by < brick_hi[1]; ++by)
+  for (unsigned int bx = brick_lo[0]; bx < brick_hi[0]; ++bx) {
+    const std::size_t b = bx + (by + static_cast<std::size_t>(bz)
+      *vb.count[1])*vb.count[0];
+    unsigned int in_lo[3], in_hi[3], cut_lo[3], cut_hi[3];
+    voxelbricks_extent(vb, b, in_lo, in_hi);
+    bool whole = true;
+    for (unsigned int a = 0; a < 3; ++a) {
+      cut_lo[a] = (std::max)(in_lo[a], box_lo[a]);
+      cut_hi[a] = (std::min)(in_hi[a], box_hi[a]);
+      whole = whole && cut_lo[a] == in_lo[a] && cut_hi[a] == in_hi[a];
+    }
+    if (whole) {
+      std::vector<unsigned char>().swap(vb.dense[b]);
+      vb.uniform[b] = index;
+      continue;
+    }
+    if (vb.dense[b].empty() && vb.uniform[b] == index)
+      continue;
+    if (!voxelbricks_make_dense(vb, b))
+      return false;
+    for (unsigned int z = cut_lo[2]; z < cut_hi[2]; ++z)
+    for (unsigned int y = cut_lo[1]; y < cut_hi[1]; ++y) {
+      voxelbricks_store_row(vb, b, cut_lo[0], y, z, cut_hi[0]-cut_lo[0],
+        &row[0], false);
+    }
+  }
+  return true;
+}
+
+bool voxelbricks_fill(voxelbricks& vb, const unsigned int lo[3],
+  const unsigned int hi[3], unsigned int v)
+{
+  unsigned int index;
+  if (!voxelbricks_intern(vb, v, index))
+    return false;
+  return voxelbricks_fill_index(vb, lo, hi, index);
+}
+
+bool voxelbricks_merge(voxelbricks& dst, const voxelbricks& src,
+  const unsigned int offset[3], unsigned int threads)
+{
+  const unsigned int dst_dims[3] = {dst.width, dst.height, dst.depth};
+  const unsigned int src_dims[3] = {src.width, src.height, src.depth};
+  for (unsigned int a = 0; a < 3; ++a) {
+    if (offset[a] > dst_dims[a] || src_dims[a] > dst_dims[a] - offset[a])
+      return false;
+  }
+  if (src.uniform.empty() || dst.uniform.empty())
+    return true;
+
+  //Palette first, so the copy below never grows or widens `dst`
+  std::vector<unsigned int> remap;
+  try {
+    remap.resize(src.palette.size());
+  } catch (const std::bad_alloc& ) {
+    return false;
+  }
+  for (std::size_t i = 0; i < src.palette.size(); ++i) {
+    if (!voxelbricks_intern(dst, src.palette[i], remap[i]))
+      return false;
+  }
+
+  //One task per layer of destination bricks, so no two tasks write the
+  //same brick. Within a task, source bricks go in order.
+  std::vector<char> ok(dst.count[2], 1);
+  workpool_shared().parallel_for(dst.count[2], [&](std::size_t layer) {
+    const unsigned int z_lo = static_cast<unsigned int>(layer)
+      << VoxelBricks_Shift;
+    const unsigned int z_hi = (dst.depth - z_lo < VoxelBricks_Edge)
+      ? dst.depth : z_lo + VoxelBricks_Edge;
+    unsigned int row[VoxelBricks_Edge];
+    for (std::size_t b = 0; b < src.uniform.size(); ++b) {
+      if (src.dense[b].empty() && src.uniform[b] == 0)
+        continue;
+      unsigned int lo[3], hi[3];
+      voxelbricks_extent(src, b, lo, hi);
+      //source z range that lands in this layer
+      unsigned int sz_lo = (std::max)(lo[2] + offset[2], z_lo);
+      unsigned int sz_hi = (std::min)(hi[2] + offset[2], z_hi);
+      if (sz_lo >= sz_hi)
+        continue;
+      if (src.dense[b].empty()) {
+        unsigned int box_lo[3] = {lo[0]+offset[0], lo[1]+offset[1], sz_lo};
+        unsigned int box_hi[3] = {hi[0]+offset[0], hi[1]+offset[1], sz_hi};
+        if (!voxelbricks_fill_index(dst, box_lo, box_hi,
+              remap[src.uniform[b]]))
+          ok[layer] = 0;
+        continue;
+      }
+      for (unsigned int dz = sz_lo; dz < sz_hi; ++dz) {
+        const unsigned int z = dz - offset[2];
+        for (unsigned int y = lo[1]; y < hi[1]; ++y) {
+          for (unsigned int x = 0; x < hi[0]-lo[0]; ++x) {
+            row[x] = remap[voxelbricks_load(src, b,
+              voxelbricks_entry(src, lo[0]+x, y, z))];
+          }
+          if (!voxelbricks_write_row(dst, lo[0]+offset[0], y+offset[1], dz,
+                hi[0]-lo[0], row, true))
+            ok[layer] = 0;
+        }
+      }
+    }
+  }, threads);
+  return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+bool voxelbricks_downsample(voxelbricks& dst, const voxelbricks& src,
+  unsigned int threads)
+{
+  if (!voxelbricks_init(dst, (src.width + 1)/2, (src.height + 1)/2,
+        (src.depth + 1)/2, src.layout))
+    return false;
+  if (src.uniform.empty())
+    return true;
+  try {
+    dst.palette = src.palette;
+    dst.lookup = src.lookup;
+  } catch (const std::bad_alloc& ) {
+    voxelbricks_clear(dst);
+    return false;
+  }
+  dst.index_bytes = src.index_bytes;
+
+  //The eight children of a voxel share one source brick, as bricks have
+  //an even edge. The palette is shared too, so each task only writes its
+  //own brick.
+  const std::size_t bricks = dst.uniform.size();
+  std::vector<char> ok(bricks, 1);
+  workpool_shared().parallel_for(bricks, [&](std::size_t b) {
+    const unsigned int m = VoxelBricks_Edge-1;
+    unsigned int lo[3], hi[3];
+    voxelbricks_extent(dst, b, lo, hi);
+    unsigned int values[VoxelBricks_Size];
+    unsigned int first = 0;
+    bool same = true;
+    for (unsigned int z = lo[2]; z < hi[2]; ++z)
+    for (unsigned int y = lo[1]; y < hi[1]; ++y)
+    for (unsigned int x = lo[0]; x < hi[0]; ++x) {
+      const std::size_t sb = voxelbricks_index(src, 2*x, 2*y, 2*z);
+      unsigned int v = src.uniform[sb];
+      if (!src.dense[sb].empty()) {
+        unsigned int child[8], votes[8];
+        unsigned int n = 0;
+        for (unsigned int c = 0; c < 8; ++c) {
+          const unsigned int cx = 2*x + (c&1), cy = 2*y + ((c>>1)&1);
+          const unsigned int cz = 2*z + ((c>>2)&1);
+          if (cx >= src.width || cy >= src.height || cz >= src.depth)
+            continue;
+          const unsigned int i = voxelbricks_load(src, sb,
+            voxelbricks_entry(src, cx, cy, cz));
+          if (i == 0)
+            continue;
+          unsigned int k = 0;
+          while (k < n && child[k] != i)
+            ++k;
+          if (k == n) {
+            child[n] = i;
+            votes[n++] = 0;
+          }
+          votes[k] += 1;
+        }
+        v = 0;
+        unsigned int best = 0;
+        for (unsigned int k = 0; k < n; ++k) {
+          if (votes[k] > best) {
+            best = votes[k];
+            v = child[k];
+          }
+        }
+      }
+      values[(x&m) + ((y&m) + (z&m)*VoxelBricks_Edge)*VoxelBricks_Edge] = v;
+      if (x == lo[0] && y == lo[1] && z == lo[2])
+        first = v;
+      same = same && v == first;
+    }
+    if (same) {
+      dst.uniform[b] = first;
+      return;
+    }
+    try {
+      dst.dense[b].assign(
+        static_cast<std::size_t>(VoxelBricks_Size)*dst.index_bytes, 0);
+    } catch (const std::bad_alloc& ) {
+      ok[b] = 0;
+      return;
+    }
+    for (unsigned int z = lo[2]; z < hi[2]; ++z)
+    for (unsigned int y = lo[1]; y < hi[1]; ++y) {
+      voxelbricks_store_row(dst, b, lo[0], y, z, hi[0]-lo[0],
+        &values[(lo[0]&m) + ((y&m) + (z&m)*VoxelBricks_Edge)
+          *VoxelBricks_Edge], false);
+    }
+  }, threads);
+  if (std::find(ok.begin(), ok.end(), 0) != ok.end()) {
+    voxelbricks_clear(dst);
+    return false;
+  }
+  return true;
+}
+
+void voxelbricks_compact(voxelbricks& vb) {
+  for (std::size_t b = 0; b < vb.dense.size(); ++b) {
+    if (vb.dense[b].empty())
+      continue;
+    unsigned int lo[3], hi[3];
+    voxelbricks_extent(vb, b, lo, hi);
+    const unsigned int first = voxelbricks_load(vb, b,
+      voxelbricks_entry(vb, lo[0], lo[1], lo[2]));
+    bool same = true;
+    for (unsigned int z = lo[2]; z < hi[2] && same; ++z)
+    for (unsigned int y = lo[1]; y < hi[1] && same; ++y)
+    for (unsigned int x = lo[0]; x < hi[0] && same; ++x)
+      same = (voxelbricks_load(vb, b, voxelbricks_entry(vb, x, y, z)) == first);
+    if (same) {
+      std::vector<unsigned char>().swap(vb.dense[b]);
+      vb.uniform[b] = first;
+    }
+  }
+}
+
+void voxelbricks_read_brick(const voxelbricks& vb, std::size_t b,
+  unsigned int* out)
+{
+  if (vb.dense[b].empty()) {
+    //uniform: only the part inside the volume takes the value
+    const unsigned int m = VoxelBricks_Edge-1;
+    const unsigned int v = vb.palette[vb.uniform[b]];
+    std::fill(out, out + VoxelBricks_Size, 0u);
+    if (v == 0)
+      return;
+    unsigned int lo[3], hi[3];
+    voxelbricks_extent(vb, b, lo, hi);
+    for (unsigned int z = lo[2]; z < hi[2]; ++z)
+    for (unsigned int y = lo[1]; y < hi[1]; ++y) {
+      unsigned int* row = out + ((y&m) + (z&m)*VoxelBricks_Edge)
+        *VoxelBricks_Edge;
+      std::fill(row + (lo[0]&m), row + (lo[0]&m) + (hi[0]-lo[0]), v);
+    }
+    return;
+  }
+  if (vb.layout != VoxelBricks_Morton) {
+    for (std::size_t i = 0; i < VoxelBricks_Size; ++i)
+      out[i] = vb.palette[voxelbricks_load(vb, b, i)];
+    return;
+  }
+  for (std::size_t i = 0; i < VoxelBricks_Size; ++i) {
+    unsigned int p[3];
+    voxelbricks_unmorton(static_cast<unsigned int>(i), p);
+    out[p[0] + (p[1] + p[2]*VoxelBricks_Edge)*VoxelBricks_Edge] =
+      vb.palette[voxelbricks_load(vb, b, i)];
+  }
+}
+
+std::size_t voxelbricks_solid(const voxelbricks& vb, std::size_t b) {
+  if (vb.dense[b].empty()) {
+    if (vb.uniform[b] == 0)
+      return 0;
+    unsigned int lo[3], hi[3];
+    voxelbricks_extent(vb, b, lo, hi);
+    return static_cast<std::size_t>(hi[0]-lo[0])*(hi[1]-lo[1])*(hi[2]-lo[2]);
+  }
+  //voxels outside the volume are always empty
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < VoxelBricks_Size; ++i)
+    n += (voxelbricks_load(vb, b, i) != 0) ? 1 : 0;
+  return n;
+}
+
+voxelbricks_stats voxelbricks_measure(const voxelbricks& vb) {
+  voxelbricks_stats s = {0, 0, 0, 0, vb.index_bytes, 0};
+  for (std::size_t b = 0; b < vb.dense.size(); ++b) {
+    if (!vb.dense[b].empty())
+      s.dense_bricks += 1;
+    else if (vb.uniform[b] != 0)
+      s.uniform_bricks += 1;
+    else
+      s.empty_bricks += 1;
+  }
+  s.colors = vb.palette.empty() ? 0 : vb.palette.size()-1;
+  s.bytes = vb.uniform.size()*sizeof(unsigned int)
+    + vb.dense.size()*sizeof(std::vector<unsigned char>)
+    + s.dense_bricks*VoxelBricks_Size*vb.index_bytes
+    + vb.palette.size()*sizeof(unsigned int);
+  return s;
+}
@@ -0,0 +1,475 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelbricks.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELBRICKS_h_
+#define hg_VOXELBRICKS_h_
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+#ifdef __BMI2__
+#  include <immintrin.h>
+#endif //__BMI2__
+
+/**
+ * @brief Brick edge, in voxels, as a power of two.
+ */
+static const unsigned int VoxelBricks_Shift = 4;
+/**
+ * @brief Brick edge, in voxels.
+ */
+static const unsigned int VoxelBricks_Edge = 1u << VoxelBricks_Shift;
+/**
+ * @brief Voxels per brick.
+ */
+static const unsigned int VoxelBricks_Size =
+  VoxelBricks_Edge*VoxelBricks_Edge*VoxelBricks_Edge;
+
+/**
+ * @brief Order of the voxels inside a dense brick.
+ */
+enum voxelbricks_layout {
+  /**
+   * @brief Entry `x + (y + z*Edge)*Edge`: rows along x.
+   */
+  VoxelBricks_Linear = 0,
+  /**
+   * @brief Morton (Z-order) entry: the bits of x, y and z interleaved,
+   *   x lowest, so all six neighbors of a voxel tend to be close by.
+   */
+  VoxelBricks_Morton = 1
+};
+
+/**
+ * @brief Voxel volume stored as fixed-size bricks of palette indices.
+ * @note Voxels are RGBA packed into one `unsigned int` as
+ *   `r | g<<8 | b<<16 | a<<24`. Every voxel with zero alpha is stored as
+ *   zero, the empty voxel.
+ * @note Each distinct voxel value is stored once in `palette`; bricks hold
+ *   indices into it, `index_bytes` wide. Index zero is the empty voxel.
+ * @note A brick is either uniform, holding one index for all of its voxels
+ *   (zero for an empty brick), or dense, holding `VoxelBricks_Size`
+ *   indices ordered by `layout`. Voxels of edge bricks that lie outside
+ *   the volume read as empty.
+ */
+struct voxelbricks {
+  /**
+   * @brief Volume size in voxels.
+   */
+  unsigned int width, height, depth;
+  /**
+   * @brief Bricks along each axis.
+   */
+  unsigned int count[3];
+  /**
+   * @brief Packed voxel of each palette index; entry zero is empty.
+   * @note Entries stay in the palette after their last voxel is
+   *   overwritten.
+   */
+  std::vector<unsigned int> palette;
+  /**
+   * @brief Palette index of each packed voxel value in `palette`.
+   */
+  std::unordered_map<unsigned int, unsigned int> lookup;
+  /**
+   * @brief Bytes per index in dense bricks: 1 up to 256 palette entries,
+   *   2 up to 65536, else 4. Bricks widen as the palette grows.
+   */
+  unsigned int index_bytes;
+  /**
+   * @brief Voxel order of dense bricks, a `voxelbricks_layout` value.
+   */
+  unsigned int layout;
+  /**
+   * @brief Index of each uniform brick, `bx + (by + bz*count[1])*count[0]`
+   *   ordered; ignored for dense bricks.
+   */
+  std::vector<unsigned int> uniform;
+  /**
+   * @brief Indices of each dense brick, `VoxelBricks_Size*index_bytes`
+   *   bytes; empty for uniform bricks.
+   */
+  std::vector<std::vector<unsigned char> > dense;
+};
+
+/**
+ * @brief Brick use, for reporting.
+ */
+struct voxelbricks_stats {
+  std::size_t empty_bricks;
+  std::size_t uniform_bricks;
+  std::size_t dense_bricks;
+  /**
+   * @brief Palette entries, not counting the empty voxel.
+   */
+  std::size_t colors;
+  /**
+   * @brief Bytes per index in dense bricks.
+   */
+  unsigned int index_bytes;
+  /**
+   * @brief Bytes held by the brick table, dense bricks and palette.
+   */
+  std::size_t bytes;
+};
+
+/**
+ * @brief Pack an RGBA voxel.
+ * @return the packed voxel, zero when `a` is zero
+ */
+inline unsigned int voxelbricks_pack(unsigned char r, unsigned char g,
+  unsigned char b, unsigned char a)
+{
+  if (a == 0)
+    return 0;
+  return r | (static_cast<unsigned int>(g)<<8)
+    | (static_cast<unsigned int>(b)<<16) | (static_cast<unsigned int>(a)<<24);
+}
+
+/**
+ * @brief Reset to an empty volume.
+ * @param vb brick volume
+ * @param width x-axis size of voxel grid
+ * @param height y-axis size of voxel grid
+ * @param depth z-axis size of voxel grid
+ * @param layout voxel order of dense bricks, a `voxelbricks_layout` value
+ * @return false when the brick table cannot be allocated
+ */
+bool voxelbricks_init(voxelbricks& vb,
+  unsigned int width, unsigned int height, unsigned int depth,
+  unsigned int layout = VoxelBricks_Linear);
+
+/**
+ * @brief Reorder the dense bricks of a volume.
+ * @param layout new voxel order, a `voxelbricks_layout` value
+ * @return false when out of memory; the volume is then unchanged
+ */
+bool voxelbricks_set_layout(voxelbricks& vb, unsigned int layout);
+
+/**
+ * @brief Release all storage, leaving a 0x0x0 volume.
+ */
+void voxelbricks_clear(voxelbricks& vb);
+
+/**
+ * @brief Index of the brick holding a voxel.
+ */
+inline std::size_t voxelbricks_index(const voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z)
+{
+  return (x>>VoxelBricks_Shift) + ((y>>VoxelBricks_Shift)
+    + static_cast<std::size_t>(z>>VoxelBricks_Shift)*vb.count[1])*vb.count[0];
+}
+
+/**
+ * @brief Morton entry of a voxel inside a brick.
+ * @param x,y,z coordinates within the brick, below `VoxelBricks_Edge`
+ */
+inline unsigned int voxelbricks_morton(unsigned int x, unsigned int y,
+  unsigned int z)
+{
+#ifdef __BMI2__
+  return _pdep_u32(x, 0x249u) | _pdep_u32(y, 0x492u) | _pdep_u32(z, 0x924u);
+#else
+  //spread four bits three apart: 0b1111 -> 0b001001001001
+  unsigned int p[3] = {x, y, z};
+  for (unsigned int a = 0; a < 3; ++a) {
+    p[a] = (p[a] | (p[a] << 4)) & 0x0C3u;
+    p[a] = (p[a] | (p[a] << 2)) & 0x249u;
+  }
+  return p[0] | (p[1] << 1) | (p[2] << 2);
+#endif //__BMI2__
+}
+
+/**
+ * @brief Coordinates within a brick of a Morton entry.
+ */
+inline void voxelbricks_unmorton(unsigned int i, unsigned int p[3]) {
+#ifdef __BMI2__
+  p[0] = _pext_u32(i, 0x249u);
+  p[1] = _pext_u32(i, 0x492u);
+  p[2] = _pext_u32(i, 0x924u);
+#else
+  for (unsigned int a = 0; a < 3; ++a) {
+    unsigned int v = (i >> a) & 0x249u;
+    v = (v | (v >> 2)) & 0x0C3u;
+    p[a] = (v | (v >> 4)) & 0x00Fu;
+  }
+#endif //__BMI2__
+}
+
+static_assert(VoxelBricks_Shift == 4, "Morton masks assume 16^3 bricks");
+
+/**
+ * @brief Entry of a voxel in its dense brick.
+ * @param x,y,z voxel coordinates in the volume
+ */
+inline std::size_t voxelbricks_entry(const voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z)
+{
+  const unsigned int m = VoxelBricks_Edge-1;
+  if (vb.layout == VoxelBricks_Morton)
+    return voxelbricks_morton(x&m, y&m, z&m);
+  return (x&m) + ((y&m) + (z&m)*VoxelBricks_Edge)*VoxelBricks_Edge;
+}
+
+/**
+ * @brief Coordinates within a brick of a dense brick entry.
+ */
+inline void voxelbricks_entry_coords(const voxelbricks& vb, std::size_t i,
+  unsigned int p[3])
+{
+  if (vb.layout == VoxelBricks_Morton) {
+    voxelbricks_unmorton(static_cast<unsigned int>(i), p);
+    return;
+  }
+  const unsigned int m = VoxelBricks_Edge-1;
+  p[0] = static_cast<unsigned int>(i) & m;
+  p[1] = static_cast<unsigned int>(i >> VoxelBricks_Shift) & m;
+  p[2] = static_cast<unsigned int>(i >> (2*VoxelBricks_Shift)) & m;
+}
+
+/**
+ * @brief Read entry `i` of a dense brick.
+ */
+inline unsigned int voxelbricks_load(const voxelbricks& vb, std::size_t b,
+  std::size_t i)
+{
+  const unsigned char* d = &vb.dense[b][0];
+  switch (vb.index_bytes) {
+  case 1: return d[i];
+  case 2: return reinterpret_cast<const unsigned short*>(d)[i];
+  default: return reinterpret_cast<const unsigned int*>(d)[i];
+  }
+}
+
+/**
+ * @brief Read the palette index of one voxel.
+ * @return the index; zero outside the volume
+ */
+inline unsigned int voxelbricks_get_index(const voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z)
+{
+  if (x >= vb.width || y >= vb.height || z >= vb.depth)
+    return 0;
+  const std::size_t b = voxelbricks_index(vb, x, y, z);
+  if (vb.dense[b].empty())
+    return vb.uniform[b];
+  return voxelbricks_load(vb, b, voxelbricks_entry(vb, x, y, z));
+}
+
+/**
+ * @brief Read one voxel.
+ * @return the packed voxel; zero outside the volume
+ */
+inline unsigned int voxelbricks_get(const voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z)
+{
+  if (x >= vb.width || y >= vb.height || z >= vb.depth)
+    return 0;
+  return vb.palette[voxelbricks_get_index(vb, x, y, z)];
+}
+
+/**
+ * @brief A voxel position with its brick and entry worked out, for
+ *   walking from voxel to neighboring voxel.
+ * @note A cursor keeps a pointer into its brick; writing to the volume
+ *   leaves it stale.
+ */
+struct voxelbricks_cursor {
+  unsigned int x, y, z;
+  std::size_t brick;
+  std::size_t entry;
+  /**
+   * @brief Indices of a dense brick, or NULL for a uniform one.
+   */
+  const unsigned char* data;
+  /**
+   * @brief Index of a uniform brick.
+   */
+  unsigned int uniform;
+};
+
+/**
+ * @brief Place a cursor on a voxel inside the volume.
+ */
+inline void voxelbricks_cursor_at(const voxelbricks& vb, unsigned int x,
+  unsigned int y, unsigned int z, voxelbricks_cursor& c)
+{
+  c.x = x;
+  c.y = y;
+  c.z = z;
+  c.brick = voxelbricks_index(vb, x, y, z);
+  c.entry = voxelbricks_entry(vb, x, y, z);
+  c.data = vb.dense[c.brick].empty() ? NULL : &vb.dense[c.brick][0];
+  c.uniform = vb.uniform[c.brick];
+}
+
+/**
+ * @brief Move a cursor to entry `i` of its brick, to walk a brick in
+ *   storage order.
+ * @return false when that voxel lies outside the volume
+ */
+inline bool voxelbricks_cursor_seek(const voxelbricks& vb,
+  voxelbricks_cursor& c, std::size_t i)
+{
+  const unsigned int m = VoxelBricks_Edge-1;
+  unsigned int p[3];
+  voxelbricks_entry_coords(vb, i, p);
+  c.x = (c.x & ~m) + p[0];
+  c.y = (c.y & ~m) + p[1];
+  c.z = (c.z & ~m) + p[2];
+  c.entry = i;
+  return c.x < vb.width && c.y < vb.height && c.z < vb.depth;
+}
+
+/**
+ * @brief Palette index of the voxel under a cursor.
+ */
+inline unsigned int voxelbricks_cursor_index(const voxelbricks& vb,
+  const voxelbricks_cursor& c)
+{
+  if (c.data == NULL)
+    return c.uniform;
+  switch (vb.index_bytes) {
+  case 1: return c.data[c.entry];
+  case 2: return reinterpret_cast<const unsigned short*>(c.data)[c.entry];
+  default: return reinterpret_cast<const unsigned int*>(c.data)[c.entry];
+  }
+}
+
+/**
+ * @brief Move a cursor to the neighboring voxel across one face.
+ * @param face `axis*2 + (negative ? 1 : 0)`, as `voxelmesh_face`
+ * @return false, leaving the cursor alone, when the neighbor is outside
+ *   the volume
+ * @note Steps inside a brick only adjust the entry; in Morton order that
+ *   is a masked add on the axis bits.
+ */
+inline bool voxelbricks_cursor_step(const voxelbricks& vb,
+  voxelbricks_cursor& c, unsigned int face)
+{
+  const unsigned int axis = face >> 1;
+  const bool negative = (face & 1) != 0;
+  const unsigned int m = VoxelBricks_Edge-1;
+  unsigned int& p = (axis == 0) ? c.x : (axis == 1) ? c.y : c.z;
+  if (negative) {
+    if (p == 0)
+      return false;
+    p -= 1;
+    if ((p & m) == m) {
+      voxelbricks_cursor_at(vb, c.x, c.y, c.z, c);
+      return true;
+    }
+  } else {
+    const unsigned int dim = (axis == 0) ? vb.width
+      : (axis == 1) ? vb.height : vb.depth;
+    if (p + 1 >= dim)
+      return false;
+    p += 1;
+    if ((p & m) == 0) {
+      voxelbricks_cursor_at(vb, c.x, c.y, c.z, c);
+      return true;
+    }
+  }
+  if (vb.layout == VoxelBricks_Morton) {
+    const std::size_t bits = static_cast<std::size_t>(0x249u) << axis;
+    const std::size_t along = negative ? ((c.entry & bits) - 1)
+      : ((c.entry | ~bits) + 1);
+    c.entry = (along & bits) | (c.entry & ~bits);
+  } else {
+    const std::size_t stride = static_cast<std::size_t>(1)
+      << (axis*VoxelBricks_Shift);
+    c.entry = negative ? c.entry - stride : c.entry + stride;
+  }
+  return true;
+}
+
+/**
+ * @brief Write one voxel.
+ * @param v packed voxel, see `voxelbricks_pack`
+ * @return false when outside the volume or out of memory
+ * @note A uniform brick turns dense when written with a different value.
+ */
+bool voxelbricks_set(voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z, unsigned int v);
+
+/**
+ * @brief Write a run of RGBA voxels.
+ * @param x, y, z first voxel of the run
+ * @param n voxel count; the run continues on the next rows of the same
+ *   z-slice
+ * @param rgba `n` voxels of 4 bytes each
+ * @param solid_only skip voxels with zero alpha instead of writing them
+ * @return false when the run leaves the slice or memory runs out
+ */
+bool voxelbricks_write_span(voxelbricks& vb,
+  unsigned int x, unsigned int y, unsigned int z, std::size_t n,
+  const unsigned char* rgba, bool solid_only);
+
+/**
+ * @brief Set every voxel of a box to one value.
+ * @param lo first corner, inclusive
+ * @param hi last corner, exclusive
+ * @param v packed voxel
+ * @return false when out of memory
+ * @note Bricks covered whole become uniform.
+ */
+bool voxelbricks_fill(voxelbricks& vb, const unsigned int lo[3],
+  const unsigned int hi[3], unsigned int v);
+
+/**
+ * @brief Copy the solid voxels of one volume into another.
+ * @param dst destination volume
+ * @param src source volume
+ * @param offset position of the source's (0,0,0) in `dst`
+ * @param threads threads to copy with, zero for one per core
+ * @return false when `src` does not fit in `dst` or memory runs out
+ * @note The palette of `src` is added to `dst` first, then the bricks
+ *   are copied index to index.
+ */
+bool voxelbricks_merge(voxelbricks& dst, const voxelbricks& src,
+  const unsigned int offset[3], unsigned int threads = 0);
+
+/**
+ * @brief Halve a volume along every axis.
+ * @param[out] dst the coarse volume, `(width+1)/2` voxels across and so
+ *   on, with the layout and palette of `src`
+ * @param src fine volume
+ * @param threads threads to work with, zero for one per core
+ * @return false when out of memory; `dst` is then left empty
+ * @note A coarse voxel is solid when any of its eight children is, so
+ *   thin parts never vanish. It takes the color most of its solid
+ *   children share, the first of them on a tie.
+ */
+bool voxelbricks_downsample(voxelbricks& dst, const voxelbricks& src,
+  unsigned int threads = 0);
+
+/**
+ * @brief Turn dense bricks whose voxels all match back into uniform ones.
+ */
+void voxelbricks_compact(voxelbricks& vb);
+
+/**
+ * @brief Unpack one brick.
+ * @param b brick index
+ * @param[out] out `VoxelBricks_Size` packed voxels in
+ *   `VoxelBricks_Linear` order, whatever the layout of `vb`
+ */
+void voxelbricks_read_brick(const voxelbricks& vb, std::size_t b,
+  unsigned int* out);
+
+/**
+ * @brief Count the solid voxels of one brick.
+ */
+std::size_t voxelbricks_solid(const voxelbricks& vb, std::size_t b);
+
+/**
+ * @brief Count bricks and bytes in use.
+ */
+voxelbricks_stats voxelbricks_measure(const voxelbricks& vb);
+
+#endif //hg_VOXELBRICKS_h_
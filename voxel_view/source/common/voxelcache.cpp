@@ -0,0 +1,229 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelcache.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelcache.h"
+#include "u8names.h"
+#include <qbvoxel/api.h>
+#include <cstdio>
+#include <cstring>
+
+//File header: magic, version, vertex and index size, volume size,
+//origin, source hash, vertex and index counts, then a checksum of the
+//header before it and the payload
+static const unsigned char VoxelCache_Magic[4] = {'V', 'X', 'M', 'C'};
+static const unsigned long int VoxelCache_Version = 2;
+static const std::size_t VoxelCache_ChecksumAt = 56;
+
+static
+bool voxelcache_little_endian();
+static
+void voxelcache_put_u64(unsigned char* p, unsigned long long v);
+static
+unsigned long long voxelcache_get_u64(const unsigned char* p);
+static
+unsigned long long voxelcache_checksum(const unsigned char* header,
+  const voxelcache& cache);
+
+
+//The payload is raw host memory, so caches are only written and read on
+//little-endian hosts with the expected vertex layout.
+bool voxelcache_little_endian() {
+  const unsigned int one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 1 && sizeof(voxelmesh_packed_vertex) == 12;
+}
+
+void voxelcache_put_u64(unsigned char* p, unsigned long long v) {
+  qbvoxel_api_to_u32(p, static_cast<unsigned long int>(v & 0xFFFFFFFFul));
+  qbvoxel_api_to_u32(p+4, static_cast<unsigned long int>(v >> 32));
+}
+
+unsigned long long voxelcache_get_u64(const unsigned char* p) {
+  return qbvoxel_api_from_u32(p)
+    | (static_cast<unsigned long long>(qbvoxel_api_from_u32(p+4)) << 32);
+}
+
+//Covers the bounds and counts of the header as well as the arrays, so a
+//damaged size or origin is caught like a damaged vertex.
+unsigned long long voxelcache_checksum(const unsigned char* header,
+  const voxelcache& cache)
+{
+  unsigned long long h = voxelcache_hash(header, VoxelCache_ChecksumAt);
+  h = voxelcache_hash(reinterpret_cast<const unsigned char*>(cache.vertices),
+    cache.vertex_count*sizeof(voxelmesh_packed_vertex), h);
+  return voxelcache_hash(reinterpret_cast<const unsigned char*>(cache.indices),
+    cache.index_count*cache.index_size, h);
+}
+
+void voxelcache_init(voxelcache& cache) {
+  cache.width = cache.height = cache.depth = 0;
+  cache.origin[0] = cache.origin[1] = cache.origin[2] = 0;
+  cache.source_hash = 0;
+  cache.vertices = NULL;
+  cache.vertex_count = 0;
+  cache.indices = NULL;
+  cache.index_count = 0;
+  cache.index_size = 0;
+  cache.file.data = NULL;
+  cache.file.size = 0;
+#ifdef _WIN32
+  cache.file.file = NULL;
+  cache.file.mapping = NULL;
+#else
+  cache.file.fd = -1;
+#endif //_WIN32
+}
+
+void voxelcache_close(voxelcache& cache) {
+  mapped_file_close(cache.file);
+  voxelcache_init(cache);
+}
+
+unsigned long long voxelcache_hash(const unsigned char* data,
+  std::size_t size, unsigned long long seed)
+{
+  unsigned long long h = seed;
+  for (std::size_t i = 0; i < size; ++i) {
+    h ^= data[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+unsigned int voxelcache_hash_file(const char* path, unsigned long long& hash) {
+  mapped_file mf;
+  unsigned int error = mapped_file_open(mf, path);
+  if (error != 0)
+    return error;
+  hash = voxelcache_hash(mf.data, mf.size);
+  mapped_file_close(mf);
+  return 0;
+}
+
+std::string voxelcache_path(const char* model_path) {
+  return std::string(model_path) + ".meshcache";
+}
+
+unsigned int voxelcache_save(const voxelcache& cache, const char* path) {
+  if (!voxelcache_little_endian()
+  ||  (cache.index_size != 2 && cache.index_size != 4)
+  ||  cache.vertex_count > 0xFFFFFFFFul || cache.index_count > 0xFFFFFFFFul)
+    return 9/* other io */;
+#ifdef _WIN32
+  std::FILE* fp ;
+  /* */{
+    std::wstring wcpath;
+    if (u8names_towc(path, wcpath) != 0)
+      return 9/* other io */;
+    fp = _wfopen(wcpath.c_str(), L"wb");
+  }
+#else
+  std::FILE* fp = std::fopen(path, "wb");
+#endif //_WIN32
+  if (fp == NULL)
+    return 9/* other io */;
+
+  unsigned char header[VoxelCache_HeaderSize];
+  std::memset(header, 0, sizeof(header));
+  std::memcpy(header, VoxelCache_Magic, 4);
+  qbvoxel_api_to_u32(header+4, VoxelCache_Version);
+  qbvoxel_api_to_u32(header+8, sizeof(voxelmesh_packed_vertex));
+  qbvoxel_api_to_u32(header+12, cache.index_size);
+  qbvoxel_api_to_u32(header+16, cache.width);
+  qbvoxel_api_to_u32(header+20, cache.height);
+  qbvoxel_api_to_u32(header+24, cache.depth);
+  for (unsigned int a = 0; a < 3; ++a) {
+    qbvoxel_api_to_u32(header+28+a*4,
+      static_cast<unsigned long int>(cache.origin[a]) & 0xFFFFFFFFul);
+  }
+  voxelcache_put_u64(header+40, cache.source_hash);
+  qbvoxel_api_to_u32(header+48,
+    static_cast<unsigned long int>(cache.vertex_count));
+  qbvoxel_api_to_u32(header+52,
+    static_cast<unsigned long int>(cache.index_count));
+  voxelcache_put_u64(header+VoxelCache_ChecksumAt,
+    voxelcache_checksum(header, cache));
+
+  const std::size_t vertex_bytes =
+    cache.vertex_count*sizeof(voxelmesh_packed_vertex);
+  const std::size_t index_bytes = cache.index_count*cache.index_size;
+  bool ok = std::fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+  if (ok && vertex_bytes > 0)
+    ok = std::fwrite(cache.vertices, 1, vertex_bytes, fp) == vertex_bytes;
+  if (ok && index_bytes > 0)
+    ok = std::fwrite(cache.indices, 1, index_bytes, fp) == index_bytes;
+  if (std::fclose(fp) != 0)
+    ok = false;
+  if (!ok)
+    std::remove(path);
+  return ok ? 0 : 9/* other io */;
+}
+
+unsigned int voxelcache_map(voxelcache& cache, const char* path,
+  unsigned long long source_hash)
+{
+  voxelcache_close(cache);
+  unsigned int error = mapped_file_open(cache.file, path);
+  if (error != 0)
+    return error;
+  const unsigned char* bytes = cache.file.data;
+  const std::size_t size = cache.file.size;
+  if (!voxelcache_little_endian()
+  ||  size < VoxelCache_HeaderSize || std::memcmp(bytes, VoxelCache_Magic, 4)
+  ||  qbvoxel_api_from_u32(bytes+4) != VoxelCache_Version
+  ||  qbvoxel_api_from_u32(bytes+8) != sizeof(voxelmesh_packed_vertex)
+  ||  voxelcache_get_u64(bytes+40) != source_hash)
+  {
+    voxelcache_close(cache);
+    return QBVoxel_ErrData;
+  }
+  const unsigned long int index_size = qbvoxel_api_from_u32(bytes+12);
+  const std::size_t vertex_count = qbvoxel_api_from_u32(bytes+48);
+  const std::size_t index_count = qbvoxel_api_from_u32(bytes+52);
+  const std::size_t payload = size - VoxelCache_HeaderSize;
+  bool ok = (index_size == 2 || index_size == 4)
+    && vertex_count <= payload/sizeof(voxelmesh_packed_vertex)
+    && index_count*index_size
+      == payload - vertex_count*sizeof(voxelmesh_packed_vertex)
+    && index_count%3 == 0;
+  if (!ok) {
+    voxelcache_close(cache);
+    return QBVoxel_ErrData;
+  }
+  cache.width = static_cast<unsigned int>(qbvoxel_api_from_u32(bytes+16));
+  cache.height = static_cast<unsigned int>(qbvoxel_api_from_u32(bytes+20));
+  cache.depth = static_cast<unsigned int>(qbvoxel_api_from_u32(bytes+24));
+  for (unsigned int a = 0; a < 3; ++a) {
+    const long long v = qbvoxel_api_from_u32(bytes+28+a*4);
+    cache.origin[a] = static_cast<long int>(v >= 0x80000000ll
+      ? v - 0x100000000ll : v);
+  }
+  cache.source_hash = source_hash;
+  cache.vertices = reinterpret_cast<const voxelmesh_packed_vertex*>(
+    bytes + VoxelCache_HeaderSize);
+  cache.vertex_count = vertex_count;
+  cache.indices = bytes + VoxelCache_HeaderSize
+    + vertex_count*sizeof(voxelmesh_packed_vertex);
+  cache.index_count = index_count;
+  cache.index_size = static_cast<unsigned int>(index_size);
+
+  //A torn write or a flipped bit shows up here; an index past the
+  //vertices would make the GPU read out of bounds.
+  ok = voxelcache_checksum(bytes, cache)
+    == voxelcache_get_u64(bytes+VoxelCache_ChecksumAt);
+  for (std::size_t i = 0; i < index_count && ok; ++i) {
+    const std::size_t v = (index_size == 2)
+      ? static_cast<const unsigned short*>(cache.indices)[i]
+      : static_cast<const unsigned int*>(cache.indices)[i];
+    ok = v < vertex_count;
+  }
+  if (!ok) {
+    voxelcache_close(cache);
+    return QBVoxel_ErrData;
+  }
+  return 0;
+}
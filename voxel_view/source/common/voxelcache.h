@@ -0,0 +1,111 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelcache.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELCACHE_h_
+#define hg_VOXELCACHE_h_
+
+#include "voxelmesh.h"
+#include "mappedfile.h"
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Byte offset of the vertex array in a cache file.
+ */
+static const std::size_t VoxelCache_HeaderSize = 64;
+
+/**
+ * @brief A packed, indexed mesh ready for upload, saved next to its
+ *   source model.
+ * @note The vertex and index arrays point into the mapped file and stay
+ *   valid until `voxelcache_close`. A mapped cache must not be copied and
+ *   then closed twice.
+ */
+struct voxelcache {
+  /**
+   * @brief Size of the source volume in voxels.
+   */
+  unsigned int width, height, depth;
+  /**
+   * @brief Scene position of voxel (0,0,0) of the source volume.
+   */
+  long int origin[3];
+  /**
+   * @brief Content hash of the source file, see `voxelcache_hash`.
+   */
+  unsigned long long source_hash;
+  /**
+   * @brief Packed vertices, `vertex_count` of them.
+   */
+  const voxelmesh_packed_vertex* vertices;
+  std::size_t vertex_count;
+  /**
+   * @brief Triangle corners, `index_count` of them, each `index_size`
+   *   bytes (2 or 4).
+   */
+  const void* indices;
+  std::size_t index_count;
+  unsigned int index_size;
+  /**
+   * @brief Mapping of the cache file.
+   */
+  mapped_file file;
+};
+
+/**
+ * @brief Set up an empty cache.
+ */
+void voxelcache_init(voxelcache& cache);
+
+/**
+ * @brief Unmap the file, leaving an empty cache.
+ */
+void voxelcache_close(voxelcache& cache);
+
+/**
+ * @brief 64-bit FNV-1a hash of a byte range.
+ * @param seed hash of the bytes before this range, or the FNV offset
+ *   basis `14695981039346656037` to start
+ */
+unsigned long long voxelcache_hash(const unsigned char* data,
+  std::size_t size,
+  unsigned long long seed = 14695981039346656037ull);
+
+/**
+ * @brief Hash the contents of a file.
+ * @param path UTF-8 path of the file
+ * @param[out] hash `voxelcache_hash` of the whole file
+ * @return zero on success, 8 if the file does not exist, 9 on I/O error
+ */
+unsigned int voxelcache_hash_file(const char* path, unsigned long long& hash);
+
+/**
+ * @brief Path of the cache file for a model.
+ */
+std::string voxelcache_path(const char* model_path);
+
+/**
+ * @brief Write a cache file.
+ * @param cache bounds, source hash and arrays to write; `file` is unused
+ * @param path UTF-8 path of the cache file
+ * @return zero on success, 9 on I/O error or on big-endian hosts
+ */
+unsigned int voxelcache_save(const voxelcache& cache, const char* path);
+
+/**
+ * @brief Map a cache file written by `voxelcache_save`.
+ * @param[out] cache cache to fill
+ * @param path UTF-8 path of the cache file
+ * @param source_hash expected hash of the source model
+ * @return zero on success, 8 if the file does not exist, 9 on I/O error,
+ *   `QBVoxel_ErrData` for a stale or corrupt file
+ * @note The checksum of the header and payload and every index are
+ *   checked once here, so the arrays can go to the GPU as they are.
+ */
+unsigned int voxelcache_map(voxelcache& cache, const char* path,
+  unsigned long long source_hash);
+
+#endif //hg_VOXELCACHE_h_
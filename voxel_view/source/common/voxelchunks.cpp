@@ -0,0 +1,282 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelchunks.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelchunks.h"
+#include "workpool.h"
+#include <algorithm>
+
+struct voxelchunks_task {
+  std::size_t chunk;
+  unsigned long long faces;
+  std::size_t quads;
+  std::vector<voxelmesh_packed_vertex> vertices;
+  std::vector<unsigned int> indices;
+};
+
+static
+void voxelchunks_mesh(const voxelchunks& mesh, const voxelbricks& voxels,
+  const voxeloccupancy& occupancy, voxelchunks_task& t);
+static
+void voxelchunks_reserve(voxelchunks_slot& slot,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices);
+static
+void voxelchunks_store(voxelchunks_slot& slot, const voxelchunks_task& t,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices);
+static
+void voxelchunks_compact(voxelchunks& mesh,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices);
+static
+void voxelchunks_merge(std::vector<voxelchunks_range>& ranges);
+
+
+//Mesh one chunk into its own packed vertices and local indices.
+void voxelchunks_mesh(const voxelchunks& mesh, const voxelbricks& voxels,
+  const voxeloccupancy& occupancy, voxelchunks_task& t)
+{
+  unsigned int chunk[3];
+  chunk[0] = static_cast<unsigned int>(t.chunk % mesh.count[0]);
+  chunk[1] = static_cast<unsigned int>((t.chunk / mesh.count[0])
+    % mesh.count[1]);
+  chunk[2] = static_cast<unsigned int>(t.chunk
+    / (static_cast<std::size_t>(mesh.count[0])*mesh.count[1]));
+  std::vector<voxelmesh_quad> quads;
+  t.faces = voxelmesh_build_chunk(voxels, occupancy, chunk, quads);
+  t.quads = quads.size();
+  voxelmesh_pack(quads, t.vertices, t.indices);
+}
+
+//Give a slot room for its counts plus a quarter, at the end of the
+//arrays. Index room stays a whole number of triangles.
+void voxelchunks_reserve(voxelchunks_slot& slot,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices)
+{
+  if (slot.vertex_count == 0) {
+    slot.vertex_first = vertices.size();
+    slot.index_first = indices.size();
+    slot.vertex_capacity = slot.index_capacity = 0;
+    return;
+  }
+  slot.vertex_capacity = slot.vertex_count + slot.vertex_count/4 + 4;
+  slot.index_capacity = slot.index_count + (slot.index_count/24 + 1)*6;
+  slot.vertex_first = vertices.size();
+  slot.index_first = indices.size();
+  vertices.resize(vertices.size() + slot.vertex_capacity);
+  indices.resize(indices.size() + slot.index_capacity, 0);
+}
+
+//Copy a meshed chunk into its slot, which has room for it.
+void voxelchunks_store(voxelchunks_slot& slot, const voxelchunks_task& t,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices)
+{
+  std::copy(t.vertices.begin(), t.vertices.end(),
+    vertices.begin() + slot.vertex_first);
+  const unsigned int base = static_cast<unsigned int>(slot.vertex_first);
+  for (std::size_t i = 0; i < t.indices.size(); ++i)
+    indices[slot.index_first + i] = base + t.indices[i];
+  std::fill(indices.begin() + slot.index_first + t.indices.size(),
+    indices.begin() + slot.index_first + slot.index_capacity, 0u);
+  slot.vertex_count = t.vertices.size();
+  slot.index_count = t.indices.size();
+  slot.faces = t.faces;
+  slot.quads = t.quads;
+}
+
+//Lay every slot out afresh, in chunk order, with new spare room.
+void voxelchunks_compact(voxelchunks& mesh,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices)
+{
+  std::vector<voxelmesh_packed_vertex> old_vertices;
+  std::vector<unsigned int> old_indices;
+  old_vertices.swap(vertices);
+  old_indices.swap(indices);
+  vertices.reserve(mesh.live_vertices + mesh.live_vertices/4);
+  indices.reserve(mesh.live_indices + mesh.live_indices/4);
+  for (std::size_t c = 0; c < mesh.slots.size(); ++c) {
+    voxelchunks_slot& slot = mesh.slots[c];
+    const std::size_t old_vertex = slot.vertex_first;
+    const std::size_t old_index = slot.index_first;
+    voxelchunks_reserve(slot, vertices, indices);
+    std::copy(old_vertices.begin() + old_vertex,
+      old_vertices.begin() + old_vertex + slot.vertex_count,
+      vertices.begin() + slot.vertex_first);
+    for (std::size_t i = 0; i < slot.index_count; ++i) {
+      indices[slot.index_first + i] = static_cast<unsigned int>(
+        old_indices[old_index + i] - old_vertex + slot.vertex_first);
+    }
+  }
+}
+
+//Sort ranges and join the ones that touch or overlap.
+void voxelchunks_merge(std::vector<voxelchunks_range>& ranges) {
+  std::sort(ranges.begin(), ranges.end(),
+    [](const voxelchunks_range& a, const voxelchunks_range& b) {
+      return a.first < b.first;
+    });
+  std::size_t out = 0;
+  for (std::size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i].count == 0)
+      continue;
+    if (out > 0 && ranges[i].first
+        <= ranges[out-1].first + ranges[out-1].count) {
+      const std::size_t end = (std::max)(ranges[out-1].first
+        + ranges[out-1].count, ranges[i].first + ranges[i].count);
+      ranges[out-1].count = end - ranges[out-1].first;
+    } else {
+      ranges[out++] = ranges[i];
+    }
+  }
+  ranges.resize(out);
+}
+
+void voxelchunks_clear(voxelchunks& mesh) {
+  mesh.count[0] = mesh.count[1] = mesh.count[2] = 0;
+  std::vector<voxelchunks_slot>().swap(mesh.slots);
+  std::vector<std::size_t>().swap(mesh.dirty);
+  std::vector<char>().swap(mesh.is_dirty);
+  mesh.live_vertices = mesh.live_indices = 0;
+  mesh.faces = mesh.quads = 0;
+}
+
+bool voxelchunks_build(voxelchunks& mesh, const voxelbricks& voxels,
+  const voxeloccupancy& occupancy,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices, unsigned int threads)
+{
+  voxelchunks_clear(mesh);
+  vertices.clear();
+  indices.clear();
+  const unsigned int dims[3] = {voxels.width, voxels.height, voxels.depth};
+  for (unsigned int a = 0; a < 3; ++a) {
+    //packed corners reach one past the last voxel
+    if (dims[a] > 65535)
+      return false;
+    mesh.count[a] = dims[a]/VoxelMesh_ChunkEdge
+      + ((dims[a]%VoxelMesh_ChunkEdge) ? 1 : 0);
+  }
+  const std::size_t chunks = static_cast<std::size_t>(mesh.count[0])
+    *mesh.count[1]*mesh.count[2];
+  if (voxels.uniform.empty() || occupancy.width != voxels.width
+  ||  occupancy.height != voxels.height || occupancy.depth != voxels.depth)
+    return chunks == 0;
+
+  std::vector<voxelchunks_task> tasks(chunks);
+  workpool_shared().parallel_for(chunks, [&](std::size_t c) {
+    tasks[c].chunk = c;
+    voxelchunks_mesh(mesh, voxels, occupancy, tasks[c]);
+  }, threads);
+
+  mesh.slots.resize(chunks);
+  mesh.is_dirty.assign(chunks, 0);
+  for (std::size_t c = 0; c < chunks; ++c) {
+    voxelchunks_slot& slot = mesh.slots[c];
+    slot.vertex_count = tasks[c].vertices.size();
+    slot.index_count = tasks[c].indices.size();
+    voxelchunks_reserve(slot, vertices, indices);
+    voxelchunks_store(slot, tasks[c], vertices, indices);
+    mesh.live_vertices += slot.vertex_count;
+    mesh.live_indices += slot.index_count;
+    mesh.faces += slot.faces;
+    mesh.quads += slot.quads;
+  }
+  return true;
+}
+
+void voxelchunks_mark(voxelchunks& mesh, const unsigned int lo[3],
+  const unsigned int hi[3])
+{
+  unsigned int first[3], last[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    if (hi[a] <= lo[a] || mesh.count[a] == 0)
+      return;
+    first[a] = (lo[a] > 0 ? lo[a]-1 : 0)/VoxelMesh_ChunkEdge;
+    last[a] = (std::min)(hi[a]/VoxelMesh_ChunkEdge, mesh.count[a]-1);
+    if (first[a] > last[a])
+      return;
+  }
+  for (unsigned int cz = first[2]; cz <= last[2]; ++cz)
+  for (unsigned int cy = first[1]; cy <= last[1]; ++cy)
+  for (unsigned int cx = first[0]; cx <= last[0]; ++cx) {
+    const std::size_t c = cx + (cy + static_cast<std::size_t>(cz)
+      *mesh.count[1])*mesh.count[0];
+    if (!mesh.is_dirty[c]) {
+      mesh.is_dirty[c] = 1;
+      mesh.dirty.push_back(c);
+    }
+  }
+}
+
+std::size_t voxelchunks_update(voxelchunks& mesh, const voxelbricks& voxels,
+  const voxeloccupancy& occupancy,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices,
+  std::vector<voxelchunks_range>& vertex_ranges,
+  std::vector<voxelchunks_range>& index_ranges, unsigned int threads)
+{
+  vertex_ranges.clear();
+  index_ranges.clear();
+  const std::size_t count = mesh.dirty.size();
+  if (count == 0)
+    return 0;
+
+  std::vector<voxelchunks_task> tasks(count);
+  workpool_shared().parallel_for(count, [&](std::size_t ti) {
+    tasks[ti].chunk = mesh.dirty[ti];
+    voxelchunks_mesh(mesh, voxels, occupancy, tasks[ti]);
+  }, threads);
+
+  //Slots are placed one after another so moves append in a fixed order.
+  for (std::size_t ti = 0; ti < count; ++ti) {
+    const voxelchunks_task& t = tasks[ti];
+    voxelchunks_slot& slot = mesh.slots[t.chunk];
+    mesh.live_vertices -= slot.vertex_count;
+    mesh.live_indices -= slot.index_count;
+    mesh.faces -= slot.faces;
+    mesh.quads -= slot.quads;
+    if (t.vertices.size() > slot.vertex_capacity
+    ||  t.indices.size() > slot.index_capacity)
+    {
+      //the old slot draws nothing from now on
+      std::fill(indices.begin() + slot.index_first,
+        indices.begin() + slot.index_first + slot.index_capacity, 0u);
+      voxelchunks_range old = {slot.index_first, slot.index_capacity};
+      index_ranges.push_back(old);
+      slot.vertex_count = t.vertices.size();
+      slot.index_count = t.indices.size();
+      voxelchunks_reserve(slot, vertices, indices);
+    }
+    voxelchunks_store(slot, t, vertices, indices);
+    voxelchunks_range v = {slot.vertex_first, slot.vertex_count};
+    voxelchunks_range i = {slot.index_first, slot.index_capacity};
+    vertex_ranges.push_back(v);
+    index_ranges.push_back(i);
+    mesh.live_vertices += slot.vertex_count;
+    mesh.live_indices += slot.index_count;
+    mesh.faces += slot.faces;
+    mesh.quads += slot.quads;
+    mesh.is_dirty[t.chunk] = 0;
+  }
+  mesh.dirty.clear();
+
+  if (indices.size() > 2*mesh.live_indices + 4096) {
+    voxelchunks_compact(mesh, vertices, indices);
+    vertex_ranges.clear();
+    index_ranges.clear();
+    voxelchunks_range all_vertices = {0, vertices.size()};
+    voxelchunks_range all_indices = {0, indices.size()};
+    vertex_ranges.push_back(all_vertices);
+    index_ranges.push_back(all_indices);
+    return count;
+  }
+  voxelchunks_merge(vertex_ranges);
+  voxelchunks_merge(index_ranges);
+  return count;
+}
@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelchunks.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELCHUNKS_h_
+#define hg_VOXELCHUNKS_h_
+
+#include "voxelmesh.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Where one chunk's mesh lives in the shared vertex and index
+ *   arrays.
+ * @note Indices past `index_count` up to `index_capacity` are zero, so
+ *   they draw as degenerate triangles.
+ */
+struct voxelchunks_slot {
+  std::size_t vertex_first, vertex_count, vertex_capacity;
+  std::size_t index_first, index_count, index_capacity;
+  /**
+   * @brief Exposed voxel faces and merged quads of the chunk.
+   */
+  unsigned long long faces, quads;
+};
+
+/**
+ * @brief A run of array entries that changed.
+ */
+struct voxelchunks_range {
+  std::size_t first, count;
+};
+
+/**
+ * @brief Packed, indexed mesh laid out chunk by chunk, so one chunk can
+ *   be remeshed and patched without touching the others.
+ * @note Chunks are `VoxelMesh_ChunkEdge` voxels wide. Each slot keeps some
+ *   spare room; a chunk that outgrows its slot moves to the end of the
+ *   arrays, and the arrays are compacted once more than half of them is
+ *   unused.
+ * @note Corners are only shared within a chunk, and indices are absolute.
+ */
+struct voxelchunks {
+  /**
+   * @brief Chunks along each axis.
+   */
+  unsigned int count[3];
+  /**
+   * @brief One slot per chunk, `cx + (cy + cz*count[1])*count[0]` ordered.
+   */
+  std::vector<voxelchunks_slot> slots;
+  /**
+   * @brief Chunks to remesh on the next `voxelchunks_update`, each once.
+   */
+  std::vector<std::size_t> dirty;
+  std::vector<char> is_dirty;
+  /**
+   * @brief Vertices and indices in use by all slots.
+   */
+  std::size_t live_vertices, live_indices;
+  /**
+   * @brief Exposed faces and merged quads over all chunks.
+   */
+  unsigned long long faces, quads;
+};
+
+/**
+ * @brief Release the layout, leaving no chunks.
+ */
+void voxelchunks_clear(voxelchunks& mesh);
+
+/**
+ * @brief Mesh every chunk of a volume.
+ * @param[out] mesh chunk layout
+ * @param voxels brick volume
+ * @param occupancy `voxeloccupancy_build` of `voxels`
+ * @param[out] vertices packed vertices of all slots
+ * @param[out] indices triangle corners of all slots
+ * @param threads threads to mesh with, zero for one per core
+ * @return false when the volume is wider than 65535 voxels; the outputs
+ *   are then empty
+ */
+bool voxelchunks_build(voxelchunks& mesh, const voxelbricks& voxels,
+  const voxeloccupancy& occupancy,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices, unsigned int threads = 0);
+
+/**
+ * @brief Mark the chunks an edit of a box can change.
+ * @param lo first corner, inclusive
+ * @param hi last corner, exclusive
+ * @note The box grows by one voxel on each side first, since an edit also
+ *   exposes or hides the faces of its neighbors.
+ */
+void voxelchunks_mark(voxelchunks& mesh, const unsigned int lo[3],
+  const unsigned int hi[3]);
+
+/**
+ * @brief Remesh the dirty chunks and write them into their slots.
+ * @param[in,out] vertices, indices arrays from `voxelchunks_build`
+ * @param[out] vertex_ranges, index_ranges the entries that changed,
+ *   sorted and merged
+ * @param threads threads to mesh with, zero for one per core
+ * @return chunks remeshed
+ * @note Dirty chunks are meshed as tasks on `workpool_shared()`; the
+ *   work depends on the edited chunks, not on the size of the volume.
+ */
+std::size_t voxelchunks_update(voxelchunks& mesh, const voxelbricks& voxels,
+  const voxeloccupancy& occupancy,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices,
+  std::vector<voxelchunks_range>& vertex_ranges,
+  std::vector<voxelchunks_range>& index_ranges, unsigned int threads = 0);
+
+#endif //hg_VOXELCHUNKS_h_
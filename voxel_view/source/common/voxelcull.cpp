@@ -0,0 +1,183 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelcull.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelcull.h"
+#include <algorithm>
+
+static
+std::size_t voxelcull_index(const void* indices, unsigned int index_size,
+  std::size_t i);
+static
+void voxelcull_grow(voxelcull_chunk& c, const voxelmesh_packed_vertex& v);
+
+
+std::size_t voxelcull_index(const void* indices, unsigned int index_size,
+  std::size_t i)
+{
+  if (index_size == 2)
+    return static_cast<const unsigned short*>(indices)[i];
+  return static_cast<const unsigned int*>(indices)[i];
+}
+
+void voxelcull_grow(voxelcull_chunk& c, const voxelmesh_packed_vertex& v) {
+  const float p[3] = {static_cast<float>(v.x), static_cast<float>(v.y),
+    static_cast<float>(v.z)};
+  for (unsigned int a = 0; a < 3; ++a) {
+    c.lo[a] = (std::min)(c.lo[a], p[a]);
+    c.hi[a] = (std::max)(c.hi[a], p[a]);
+  }
+}
+
+void voxelcull_scan(const voxelmesh_packed_vertex* vertices,
+  const void* indices, std::size_t index_count, unsigned int index_size,
+  std::vector<voxelcull_chunk>& chunks)
+{
+  chunks.clear();
+  unsigned long long run_key = ~0ull;
+  for (std::size_t t = 0; t+2 < index_count; t += 3) {
+    const std::size_t i0 = voxelcull_index(indices, index_size, t);
+    const std::size_t i1 = voxelcull_index(indices, index_size, t+1);
+    const std::size_t i2 = voxelcull_index(indices, index_size, t+2);
+    if (i0 == i1 && i1 == i2) {
+      run_key = ~0ull;
+      continue;
+    }
+    const voxelmesh_packed_vertex* v[3] = {&vertices[i0], &vertices[i1],
+      &vertices[i2]};
+    //the centroid lies inside the quad, and quads never cross a chunk
+    const unsigned int d = v[0]->face/2;
+    unsigned int voxel[3];
+    for (unsigned int a = 0; a < 3; ++a) {
+      const unsigned int p[3] = {v[0]->x, v[0]->y, v[0]->z};
+      const unsigned int q[3] = {v[1]->x, v[1]->y, v[1]->z};
+      const unsigned int r[3] = {v[2]->x, v[2]->y, v[2]->z};
+      voxel[a] = (p[a] + q[a] + r[a])/3;
+      if (a == d && (v[0]->face&1) == 0 && voxel[a] > 0)
+        voxel[a] -= 1;
+    }
+    unsigned int cell[3];
+    for (unsigned int a = 0; a < 3; ++a)
+      cell[a] = voxel[a]/VoxelMesh_ChunkEdge;
+    const unsigned long long key = static_cast<unsigned long long>(cell[0])
+      | (static_cast<unsigned long long>(cell[1]) << 21)
+      | (static_cast<unsigned long long>(cell[2]) << 42);
+    if (key != run_key) {
+      voxelcull_chunk c;
+      for (unsigned int a = 0; a < 3; ++a) {
+        c.lo[a] = 65536.0f;
+        c.hi[a] = 0.0f;
+        c.cell[a] = cell[a];
+      }
+      c.span = 1;
+      c.first = t;
+      c.count = 0;
+      chunks.push_back(c);
+      run_key = key;
+    }
+    voxelcull_chunk& c = chunks.back();
+    for (unsigned int k = 0; k < 3; ++k)
+      voxelcull_grow(c, *v[k]);
+    c.count += 3;
+  }
+}
+
+void voxelcull_slots(const voxelchunks& mesh, const unsigned int dims[3],
+  std::vector<voxelcull_chunk>& chunks)
+{
+  chunks.clear();
+  for (std::size_t s = 0; s < mesh.slots.size(); ++s) {
+    const voxelchunks_slot& slot = mesh.slots[s];
+    if (slot.index_count == 0)
+      continue;
+    const std::size_t cell[3] = {s % mesh.count[0],
+      (s / mesh.count[0]) % mesh.count[1],
+      s / (static_cast<std::size_t>(mesh.count[0])*mesh.count[1])};
+    voxelcull_chunk c;
+    for (unsigned int a = 0; a < 3; ++a) {
+      c.lo[a] = static_cast<float>(cell[a]*VoxelMesh_ChunkEdge);
+      c.hi[a] = static_cast<float>((std::min)(
+        (cell[a]+1)*VoxelMesh_ChunkEdge, static_cast<std::size_t>(dims[a])));
+      c.cell[a] = static_cast<unsigned int>(cell[a]);
+    }
+    c.span = 1;
+    c.first = slot.index_first;
+    c.count = slot.index_count;
+    chunks.push_back(c);
+  }
+}
+
+//Gribb and Hartmann: each plane is the last row of the matrix plus or
+//minus one of the others.
+void voxelcull_frustum_from(voxelcull_frustum& f, const float m[16]) {
+  for (unsigned int p = 0; p < 6; ++p) {
+    const unsigned int row = p/2;
+    const float sign = (p&1) ? -1.0f : 1.0f;
+    for (unsigned int c = 0; c < 4; ++c)
+      f.planes[p][c] = m[12 + c] + sign*m[row*4 + c];
+  }
+}
+
+//A box is outside when its corner farthest along a plane's normal is
+//behind that plane.
+bool voxelcull_box_visible(const voxelcull_frustum& f, const float lo[3],
+  const float hi[3])
+{
+  for (unsigned int p = 0; p < 6; ++p) {
+    const float* n = f.planes[p];
+    const float x = n[0] >= 0.0f ? hi[0] : lo[0];
+    const float y = n[1] >= 0.0f ? hi[1] : lo[1];
+    const float z = n[2] >= 0.0f ? hi[2] : lo[2];
+    if (n[0]*x + n[1]*y + n[2]*z + n[3] < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+void voxelcull_test(const voxelcull_frustum& f,
+  const std::vector<voxelcull_chunk>& chunks, std::vector<char>& visible)
+{
+  visible.resize(chunks.size());
+  for (std::size_t i = 0; i < chunks.size(); ++i)
+    visible[i] = voxelcull_box_visible(f, chunks[i].lo, chunks[i].hi) ? 1 : 0;
+}
+
+void voxelcull_draws(const std::vector<voxelcull_chunk>& chunks,
+  const std::vector<char>& visible,
+  std::vector<std::size_t>& first, std::vector<std::size_t>& count,
+  voxelcull_stats* stats)
+{
+  first.clear();
+  count.clear();
+  voxelcull_stats local = {chunks.size(), 0, 0, 0, 0};
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    const voxelcull_chunk& c = chunks[i];
+    local.triangles += c.count/3;
+    if (i >= visible.size() || !visible[i]) {
+      local.culled_chunks += 1;
+      local.culled_triangles += c.count/3;
+      continue;
+    }
+    if (!first.empty() && first.back() + count.back() == c.first) {
+      count.back() += c.count;
+    } else {
+      first.push_back(c.first);
+      count.push_back(c.count);
+    }
+  }
+  local.draws = first.size();
+  if (stats != NULL)
+    *stats = local;
+}
+
+void voxelcull_select(const voxelcull_frustum& f,
+  const std::vector<voxelcull_chunk>& chunks,
+  std::vector<std::size_t>& first, std::vector<std::size_t>& count,
+  voxelcull_stats* stats)
+{
+  std::vector<char> visible;
+  voxelcull_test(f, chunks, visible);
+  voxelcull_draws(chunks, visible, first, count, stats);
+}
@@ -0,0 +1,122 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelcull.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELCULL_h_
+#define hg_VOXELCULL_h_
+
+#include "voxelchunks.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief A run of triangles from one mesh chunk, with its bounds.
+ */
+struct voxelcull_chunk {
+  /**
+   * @brief Lattice bounds of the run's vertices.
+   */
+  float lo[3], hi[3];
+  /**
+   * @brief First index of the run and number of indices, a multiple of 3.
+   */
+  std::size_t first, count;
+  /**
+   * @brief Mesh chunk of the run, in chunks of the volume it was meshed
+   *   from, and the full-detail chunks along each edge of that chunk:
+   *   1, or `2^k` for a run of level of detail k.
+   */
+  unsigned int cell[3], span;
+};
+
+/**
+ * @brief Six planes `a*x + b*y + c*z + d >= 0` bounding a view volume.
+ */
+struct voxelcull_frustum {
+  float planes[6][4];
+};
+
+/**
+ * @brief Per-frame culling counts.
+ */
+struct voxelcull_stats {
+  std::size_t chunks, culled_chunks;
+  unsigned long long triangles, culled_triangles;
+  /**
+   * @brief Draws left after joining visible runs that touch.
+   */
+  std::size_t draws;
+};
+
+/**
+ * @brief Split a packed, indexed mesh into runs of triangles that came
+ *   from the same mesh chunk.
+ * @param vertices packed vertices
+ * @param indices `index_count` indices, `index_size` bytes each (2 or 4)
+ * @param[out] chunks one entry per run, replacing any previous content
+ * @note The chunk of a triangle is that of the voxel behind its centroid,
+ *   kept in `cell` since bounds alone cannot tell it: a face on a chunk's
+ *   upper plane lies on its neighbor's lower one. `voxelmesh_build` writes
+ *   chunks one after another, so each chunk makes a single run.
+ *   Degenerate triangles end a run and are skipped.
+ */
+void voxelcull_scan(const voxelmesh_packed_vertex* vertices,
+  const void* indices, std::size_t index_count, unsigned int index_size,
+  std::vector<voxelcull_chunk>& chunks);
+
+/**
+ * @brief List the slots of a chunked mesh, bounded by their chunk cells.
+ * @param mesh chunk layout
+ * @param dims size of the volume in voxels
+ * @param[out] chunks one entry per slot holding triangles
+ */
+void voxelcull_slots(const voxelchunks& mesh, const unsigned int dims[3],
+  std::vector<voxelcull_chunk>& chunks);
+
+/**
+ * @brief Planes of the view volume of a transform.
+ * @param m row-major matrix taking lattice points to clip space
+ */
+void voxelcull_frustum_from(voxelcull_frustum& f, const float m[16]);
+
+/**
+ * @brief Whether a box is at least partly inside a view volume.
+ * @note Conservative: a box near a frustum corner may pass while outside.
+ */
+bool voxelcull_box_visible(const voxelcull_frustum& f, const float lo[3],
+  const float hi[3]);
+
+/**
+ * @brief Test every run against a view volume.
+ * @param[out] visible one entry per run, nonzero when it may be seen
+ */
+void voxelcull_test(const voxelcull_frustum& f,
+  const std::vector<voxelcull_chunk>& chunks, std::vector<char>& visible);
+
+/**
+ * @brief Join the visible runs that touch into draws.
+ * @param visible one entry per run, from `voxelcull_test` and any later
+ *   culling
+ * @param[out] first, count first index and index count of each draw
+ * @param[out] stats counts for this call (optional); every run not
+ *   visible counts as culled
+ */
+void voxelcull_draws(const std::vector<voxelcull_chunk>& chunks,
+  const std::vector<char>& visible,
+  std::vector<std::size_t>& first, std::vector<std::size_t>& count,
+  voxelcull_stats* stats = NULL);
+
+/**
+ * @brief Find the visible runs and join neighbors into draws; the same
+ *   as `voxelcull_test` followed by `voxelcull_draws`.
+ * @param[out] first, count first index and index count of each draw
+ * @param[out] stats counts for this call (optional)
+ */
+void voxelcull_select(const voxelcull_frustum& f,
+  const std::vector<voxelcull_chunk>& chunks,
+  std::vector<std::size_t>& first, std::vector<std::size_t>& count,
+  voxelcull_stats* stats = NULL);
+
+#endif //hg_VOXELCULL_h_
@@ -0,0 +1,224 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxellod.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxellod.h"
+#include <algorithm>
+#include <cmath>
+#include <new>
+
+static
+void voxellod_chunks(voxellod_level& level, const unsigned int dims[3]);
+static
+bool voxellod_mesh(voxellod_level& level, const voxelbricks& voxels,
+  const unsigned int dims[3], std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices, unsigned int threads);
+static
+void voxellod_visit(const voxellod& lod, voxellod_view& view,
+  unsigned int k, std::size_t c, const float eye[3], float pixels,
+  float target, float hysteresis, std::vector<voxelcull_chunk>& chunks);
+
+
+//Size the chunk grid of a level `dims` voxels wide, and point each chunk
+//at its run. Runs come from one chunk each, whose cell in the level's own
+//chunks they carry.
+void voxellod_chunks(voxellod_level& level, const unsigned int dims[3]) {
+  for (unsigned int a = 0; a < 3; ++a) {
+    level.count[a] = dims[a]/VoxelMesh_ChunkEdge
+      + ((dims[a]%VoxelMesh_ChunkEdge) ? 1 : 0);
+  }
+  level.chunk_run.assign(static_cast<std::size_t>(level.count[0])
+    *level.count[1]*level.count[2], level.runs.size());
+  for (std::size_t r = 0; r < level.runs.size(); ++r) {
+    const voxelcull_chunk& run = level.runs[r];
+    const unsigned int cx = run.cell[0]/run.span, cy = run.cell[1]/run.span,
+      cz = run.cell[2]/run.span;
+    if (cx < level.count[0] && cy < level.count[1] && cz < level.count[2]) {
+      level.chunk_run[cx + (cy + static_cast<std::size_t>(cz)
+        *level.count[1])*level.count[0]] = r;
+    }
+  }
+}
+
+//Mesh a coarse level and append it to the shared arrays, in full-detail
+//lattice units.
+bool voxellod_mesh(voxellod_level& level, const voxelbricks& voxels,
+  const unsigned int dims[3], std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices, unsigned int threads)
+{
+  std::vector<voxelmesh_quad> quads;
+  std::vector<voxelmesh_packed_vertex> level_vertices;
+  std::vector<unsigned int> level_indices;
+  voxelmesh_build(voxels, level.occupancy, quads, NULL, threads);
+  if (!voxelmesh_pack(quads, level_vertices, level_indices))
+    return false;
+  const unsigned int level_dims[3] = {voxels.width, voxels.height,
+    voxels.depth};
+  if (!level_indices.empty()) {
+    voxelcull_scan(&level_vertices[0], &level_indices[0],
+      level_indices.size(), sizeof(unsigned int), level.runs);
+  }
+  voxellod_chunks(level, level_dims);
+
+  level.vertex_first = vertices.size();
+  level.vertex_count = level_vertices.size();
+  level.index_first = indices.size();
+  level.index_count = level_indices.size();
+  level.mesh_bytes = level.vertex_count*sizeof(voxelmesh_packed_vertex)
+    + level.index_count*sizeof(unsigned int);
+  for (std::size_t i = 0; i < level_vertices.size(); ++i) {
+    voxelmesh_packed_vertex& v = level_vertices[i];
+    v.x = static_cast<unsigned short>((std::min)(v.x*level.scale, dims[0]));
+    v.y = static_cast<unsigned short>((std::min)(v.y*level.scale, dims[1]));
+    v.z = static_cast<unsigned short>((std::min)(v.z*level.scale, dims[2]));
+  }
+  for (std::size_t r = 0; r < level.runs.size(); ++r) {
+    voxelcull_chunk& run = level.runs[r];
+    for (unsigned int a = 0; a < 3; ++a) {
+      run.lo[a] = (std::min)(run.lo[a]*level.scale,
+        static_cast<float>(dims[a]));
+      run.hi[a] = (std::min)(run.hi[a]*level.scale,
+        static_cast<float>(dims[a]));
+      run.cell[a] *= level.scale;
+    }
+    run.span = level.scale;
+    run.first += level.index_first;
+  }
+  const unsigned int base = static_cast<unsigned int>(level.vertex_first);
+  try {
+    vertices.insert(vertices.end(), level_vertices.begin(),
+      level_vertices.end());
+    indices.reserve(indices.size() + level_indices.size());
+  } catch (const std::bad_alloc& ) {
+    return false;
+  }
+  for (std::size_t i = 0; i < level_indices.size(); ++i)
+    indices.push_back(base + level_indices[i]);
+  return true;
+}
+
+void voxellod_clear(voxellod& lod) {
+  std::vector<voxellod_level>().swap(lod.levels);
+}
+
+bool voxellod_build(voxellod& lod, const voxelbricks& volume,
+  const voxeloccupancy& occupancy, const std::vector<voxelcull_chunk>& runs,
+  unsigned int levels, std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices, unsigned int threads)
+{
+  voxellod_clear(lod);
+  const unsigned int dims[3] = {volume.width, volume.height, volume.depth};
+  const std::size_t vertex_count = vertices.size();
+  const std::size_t index_count = indices.size();
+
+  lod.levels.resize(1);
+  voxellod_level& full = lod.levels[0];
+  full.scale = 1;
+  full.runs = runs;
+  voxellod_chunks(full, dims);
+  full.vertex_first = full.index_first = 0;
+  full.vertex_count = vertex_count;
+  full.index_count = index_count;
+  full.volume_bytes = voxelbricks_measure(volume).bytes
+    + voxeloccupancy_bytes(occupancy);
+  full.mesh_bytes = vertex_count*sizeof(voxelmesh_packed_vertex)
+    + index_count*sizeof(unsigned int);
+
+  //each level only needs the one before it
+  voxelbricks fine, coarse;
+  const voxelbricks* from = &volume;
+  bool ok = true;
+  for (unsigned int k = 1; k <= levels && k < VoxelLod_MaxLevels; ++k) {
+    if (from->width <= 1 && from->height <= 1 && from->depth <= 1)
+      break;
+    voxellod_level level;
+    level.scale = 1u << k;
+    if (!voxelbricks_downsample(coarse, *from, threads)
+    ||  !voxeloccupancy_build(level.occupancy, coarse, threads)) {
+      ok = false;
+      break;
+    }
+    level.volume_bytes = voxelbricks_measure(coarse).bytes
+      + voxeloccupancy_bytes(level.occupancy);
+    if (!voxellod_mesh(level, coarse, dims, vertices, indices, threads)) {
+      ok = false;
+      break;
+    }
+    lod.levels.push_back(level);
+    std::swap(fine, coarse);
+    from = &fine;
+  }
+  if (!ok) {
+    voxellod_clear(lod);
+    vertices.resize(vertex_count);
+    indices.resize(index_count);
+  }
+  return ok;
+}
+
+//Draw chunk `c` of level `k`, or walk its children when its voxels look
+//too big. The distance is to the nearest point of the chunk's cell.
+void voxellod_visit(const voxellod& lod, voxellod_view& view,
+  unsigned int k, std::size_t c, const float eye[3], float pixels,
+  float target, float hysteresis, std::vector<voxelcull_chunk>& chunks)
+{
+  const voxellod_level& level = lod.levels[k];
+  const unsigned int cell[3] = {static_cast<unsigned int>(c % level.count[0]),
+    static_cast<unsigned int>((c / level.count[0]) % level.count[1]),
+    static_cast<unsigned int>(c / (static_cast<std::size_t>(level.count[0])
+      *level.count[1]))};
+  bool split = false;
+  if (k > 0) {
+    const float edge = static_cast<float>(level.scale*VoxelMesh_ChunkEdge);
+    float d2 = 0.0f;
+    for (unsigned int a = 0; a < 3; ++a) {
+      const float lo = cell[a]*edge, hi = lo + edge;
+      const float d = (eye[a] < lo) ? lo - eye[a]
+        : (eye[a] > hi) ? eye[a] - hi : 0.0f;
+      d2 += d*d;
+    }
+    //the finest level whose voxels stay within the target here
+    const float ideal = (d2 > 0.0f)
+      ? std::log2(target*std::sqrt(d2)/pixels) : -1.0e30f;
+    char& was_split = view.split[k][c];
+    split = was_split ? ideal < k + hysteresis : ideal < k - hysteresis;
+    was_split = split ? 1 : 0;
+  }
+  if (!split) {
+    if (level.chunk_run[c] < level.runs.size())
+      chunks.push_back(level.runs[level.chunk_run[c]]);
+    return;
+  }
+  const voxellod_level& finer = lod.levels[k-1];
+  for (unsigned int dz = 0; dz < 2; ++dz)
+  for (unsigned int dy = 0; dy < 2; ++dy)
+  for (unsigned int dx = 0; dx < 2; ++dx) {
+    const unsigned int child[3] = {2*cell[0] + dx, 2*cell[1] + dy,
+      2*cell[2] + dz};
+    if (child[0] >= finer.count[0] || child[1] >= finer.count[1]
+    ||  child[2] >= finer.count[2])
+      continue;
+    voxellod_visit(lod, view, k-1, child[0] + (child[1]
+      + static_cast<std::size_t>(child[2])*finer.count[1])*finer.count[0],
+      eye, pixels, target, hysteresis, chunks);
+  }
+}
+
+void voxellod_select(const voxellod& lod, voxellod_view& view,
+  const float eye[3], float pixels, std::vector<voxelcull_chunk>& chunks,
+  float target, float hysteresis)
+{
+  chunks.clear();
+  if (lod.levels.empty())
+    return;
+  view.split.resize(lod.levels.size());
+  for (std::size_t k = 0; k < lod.levels.size(); ++k)
+    view.split[k].resize(lod.levels[k].chunk_run.size(), 0);
+  const unsigned int top = static_cast<unsigned int>(lod.levels.size() - 1);
+  for (std::size_t c = 0; c < lod.levels[top].chunk_run.size(); ++c) {
+    voxellod_visit(lod, view, top, c, eye, pixels, target, hysteresis,
+      chunks);
+  }
+}
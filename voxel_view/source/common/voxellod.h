@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxellod.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELLOD_h_
+#define hg_VOXELLOD_h_
+
+#include "voxelcull.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Most levels of detail, the full-detail one included.
+ */
+static const unsigned int VoxelLod_MaxLevels = 8;
+
+/**
+ * @brief Default largest screen size of a drawn voxel, in pixels.
+ */
+static const float VoxelLod_Pixels = 2.0f;
+
+/**
+ * @brief Default hysteresis of level selection, in levels.
+ */
+static const float VoxelLod_Hysteresis = 0.25f;
+
+/**
+ * @brief One level of detail of a volume and its mesh.
+ * @note Level k has voxels `2^k` full-detail voxels wide. Its mesh is
+ *   greedy-meshed in chunks of `VoxelMesh_ChunkEdge` of its own voxels,
+ *   so each chunk covers eight chunks of the level below.
+ */
+struct voxellod_level {
+  /**
+   * @brief Full-detail voxels per voxel edge.
+   */
+  unsigned int scale;
+  /**
+   * @brief Solid voxels of the level; empty for level 0, whose occupancy
+   *   is the volume's own.
+   */
+  voxeloccupancy occupancy;
+  /**
+   * @brief Mesh chunks along each axis.
+   */
+  unsigned int count[3];
+  /**
+   * @brief Index runs of the level's chunks, with full-detail lattice
+   *   bounds and chunk cells.
+   */
+  std::vector<voxelcull_chunk> runs;
+  /**
+   * @brief Entry of `runs` for each chunk, `cx + (cy + cz*count[1])*count[0]`
+   *   ordered; `runs.size()` for a chunk without triangles.
+   */
+  std::vector<std::size_t> chunk_run;
+  /**
+   * @brief Vertices and indices of the level in the shared arrays.
+   */
+  std::size_t vertex_first, vertex_count;
+  std::size_t index_first, index_count;
+  /**
+   * @brief Bytes of the level's voxels and occupancy before they were
+   *   meshed, and of its packed vertices and 32-bit indices.
+   */
+  std::size_t volume_bytes, mesh_bytes;
+};
+
+/**
+ * @brief Levels of detail of a volume, level 0 the full detail.
+ */
+struct voxellod {
+  std::vector<voxellod_level> levels;
+};
+
+/**
+ * @brief Level choices of one view, kept from frame to frame for
+ *   hysteresis.
+ */
+struct voxellod_view {
+  /**
+   * @brief For each level, whether each chunk was drawn by its children.
+   */
+  std::vector< std::vector<char> > split;
+};
+
+/**
+ * @brief Release every level.
+ */
+void voxellod_clear(voxellod& lod);
+
+/**
+ * @brief Build coarser levels of a meshed volume.
+ * @param[out] lod level 0 from `runs`, then up to `levels` coarser ones;
+ *   stops early when a level would be one voxel in every direction
+ * @param volume full-detail voxels
+ * @param occupancy `voxeloccupancy_build` of `volume`
+ * @param runs `voxelcull_scan` of the full-detail mesh in `vertices` and
+ *   `indices`
+ * @param[in,out] vertices, indices the full-detail mesh; the coarser
+ *   meshes are appended
+ * @param threads threads to work with, zero for one per core
+ * @return false when out of memory or a coarse mesh cannot be packed;
+ *   the arrays are then as they were and `lod` is empty
+ * @note Each level is `voxelbricks_downsample` of the one before, meshed
+ *   with `voxelmesh_build`. Its positions are scaled to the full-detail
+ *   lattice and clamped to the volume, so every level draws with the
+ *   same transform. Only occupancy is kept of the coarse voxels.
+ */
+bool voxellod_build(voxellod& lod, const voxelbricks& volume,
+  const voxeloccupancy& occupancy, const std::vector<voxelcull_chunk>& runs,
+  unsigned int levels, std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices, unsigned int threads = 0);
+
+/**
+ * @brief Pick a level for each part of the volume and list its runs.
+ * @param lod levels to pick from
+ * @param[in,out] view choices of the last call for the same volume
+ * @param eye eye position in the full-detail lattice
+ * @param pixels screen pixels covered by one lattice unit one lattice
+ *   unit from the eye, `P[1][1]*height/2` for a projection `P`
+ * @param[out] chunks runs to draw, replacing any previous content
+ * @param target largest screen size of a drawn voxel, in pixels
+ * @param hysteresis how far past the switching distance, in levels, a
+ *   chunk must go before it changes level
+ * @note Chunks are walked from the coarsest level down. A chunk is drawn
+ *   when its voxels, at its nearest point to the eye, cover at most
+ *   `target` pixels; otherwise its eight children are walked. Coarse
+ *   voxels bulge past fine ones, so seams between levels are mostly
+ *   covered, but may show a crack seen edge on.
+ */
+void voxellod_select(const voxellod& lod, voxellod_view& view,
+  const float eye[3], float pixels, std::vector<voxelcull_chunk>& chunks,
+  float target = VoxelLod_Pixels, float hysteresis = VoxelLod_Hysteresis);
+
+#endif //hg_VOXELLOD_h_
@@ -0,0 +1,424 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelmesh.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelmesh.h"
+#include "workpool.h"
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+
+struct voxelmesh_volume {
+  const unsigned int* data;
+  unsigned int dims[3];
+  std::size_t stride[3];
+  unsigned int origin[3];
+  //Per face, one word per (y, z) row of the chunk: bit `x` is set when
+  //that voxel's face is exposed
+  const unsigned int* exposed[6];
+};
+
+struct voxelmesh_corner_key {
+  unsigned int x, y, z;
+  unsigned long int face_color;
+  bool operator==(const voxelmesh_corner_key& o) const {
+    return x == o.x && y == o.y && z == o.z && face_color == o.face_color;
+  }
+};
+
+struct voxelmesh_corner_hash {
+  std::size_t operator()(const voxelmesh_corner_key& k) const {
+    std::size_t h = k.x;
+    h = h*0x9E3779B1u + k.y;
+    h = h*0x9E3779B1u + k.z;
+    h = h*0x9E3779B1u + k.face_color;
+    return h ^ (h >> 15);
+  }
+};
+
+struct voxelmesh_task {
+  unsigned int chunk[3];
+  unsigned long long faces;
+  std::vector<voxelmesh_quad> quads;
+};
+
+static
+bool voxelmesh_chunk_empty(const voxelbricks& voxels,
+  const unsigned int chunk[3]);
+static
+void voxelmesh_gather(const voxelbricks& voxels, voxelmesh_volume& vol,
+  std::vector<unsigned int>& data);
+static
+bool voxelmesh_exposed(const voxeloccupancy& occupancy, voxelmesh_volume& vol,
+  std::vector<unsigned int> (&exposed)[6], std::vector<char> (&busy)[6]);
+static
+void voxelmesh_slice(const voxelmesh_volume& vol, unsigned int face,
+  unsigned int k, std::vector<unsigned long int>& mask,
+  std::vector<voxelmesh_quad>& quads, unsigned long long& faces);
+
+
+//A chunk is empty when every brick it covers is uniform and empty.
+bool voxelmesh_chunk_empty(const voxelbricks& voxels,
+  const unsigned int chunk[3])
+{
+  const unsigned int per = VoxelMesh_ChunkEdge >> VoxelBricks_Shift;
+  unsigned int lo[3], hi[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    lo[a] = chunk[a]*per;
+    hi[a] = (std::min)(lo[a] + per, voxels.count[a]);
+  }
+  for (unsigned int bz = lo[2]; bz < hi[2]; ++bz)
+  for (unsigned int by = lo[1]; by < hi[1]; ++by)
+  for (unsigned int bx = lo[0]; bx < hi[0]; ++bx) {
+    const std::size_t b = bx + (by + static_cast<std::size_t>(bz)
+      *voxels.count[1])*voxels.count[0];
+    if (!voxels.dense[b].empty() || voxels.uniform[b] != 0)
+      return false;
+  }
+  return true;
+}
+
+//Copy the voxels of one chunk into `data`.
+void voxelmesh_gather(const voxelbricks& voxels, voxelmesh_volume& vol,
+  std::vector<unsigned int>& data)
+{
+  vol.stride[0] = 1;
+  vol.stride[1] = vol.dims[0];
+  vol.stride[2] = static_cast<std::size_t>(vol.dims[0])*vol.dims[1];
+  data.resize(vol.stride[2]*vol.dims[2]);
+  std::size_t pos = 0;
+  for (unsigned int z = 0; z < vol.dims[2]; ++z)
+  for (unsigned int y = 0; y < vol.dims[1]; ++y)
+  for (unsigned int x = 0; x < vol.dims[0]; ++x, ++pos) {
+    data[pos] = voxelbricks_get(voxels, vol.origin[0]+x,
+      vol.origin[1]+y, vol.origin[2]+z);
+  }
+  vol.data = &data[0];
+}
+
+//Cut the chunk's rows out of the occupancy face masks. `busy[face][k]`
+//is set when slice `k` along the face axis has any exposed face; false
+//when no slice has one.
+bool voxelmesh_exposed(const voxeloccupancy& occupancy, voxelmesh_volume& vol,
+  std::vector<unsigned int> (&exposed)[6], std::vector<char> (&busy)[6])
+{
+  //a chunk starts on a multiple of its edge, so each of its rows is one
+  //aligned part of an occupancy word. Whole rows from the AVX2 kernel
+  //of voxeloccupancy_faces would be redone for every chunk along x, so
+  //that kernel only serves face counting.
+  static_assert(VoxelOccupancy_WordBits%VoxelMesh_ChunkEdge == 0
+    && VoxelMesh_ChunkEdge <= 32, "chunk rows must fit an unsigned int");
+  const std::size_t w = vol.origin[0]/VoxelOccupancy_WordBits;
+  const unsigned int shift = vol.origin[0]%VoxelOccupancy_WordBits;
+  const std::size_t rows = static_cast<std::size_t>(vol.dims[1])*vol.dims[2];
+  unsigned int any = 0;
+  for (unsigned int face = 0; face < 6; ++face) {
+    exposed[face].resize(rows);
+    busy[face].assign(vol.dims[face/2], 0);
+    unsigned int any_x = 0;
+    std::size_t r = 0;
+    for (unsigned int z = 0; z < vol.dims[2]; ++z)
+    for (unsigned int y = 0; y < vol.dims[1]; ++y, ++r) {
+      const unsigned int bits = static_cast<unsigned int>(
+        voxeloccupancy_face_word(occupancy, face, vol.origin[1]+y,
+          vol.origin[2]+z, w) >> shift);
+      exposed[face][r] = bits;
+      any_x |= bits;
+      if (bits != 0 && face/2 == 1)
+        busy[face][y] = 1;
+      else if (bits != 0 && face/2 == 2)
+        busy[face][z] = 1;
+    }
+    if (face/2 == 0) {
+      for (unsigned int x = 0; x < vol.dims[0]; ++x)
+        busy[face][x] = static_cast<char>((any_x >> x) & 1);
+    }
+    vol.exposed[face] = &exposed[face][0];
+    any |= any_x;
+  }
+  return any != 0;
+}
+
+//Build the face mask of one slice perpendicular to the face axis, then
+//cover the mask with maximal rectangles: grow each rectangle along u
+//first, then along v while the whole row still matches.
+void voxelmesh_slice(const voxelmesh_volume& vol, unsigned int face,
+  unsigned int k, std::vector<unsigned long int>& mask,
+  std::vector<voxelmesh_quad>& quads, unsigned long long& faces)
+{
+  const unsigned int d = face/2;
+  const unsigned int u = (d+1)%3;
+  const unsigned int v = (d+2)%3;
+  const bool negative = (face&1) != 0;
+  const unsigned int nu = vol.dims[u];
+  const unsigned int nv = vol.dims[v];
+  const unsigned int* exposed = vol.exposed[face];
+
+  unsigned int at[3];
+  at[d] = k;
+  for (unsigned int j = 0; j < nv; ++j) {
+    at[v] = j;
+    for (unsigned int i = 0; i < nu; ++i) {
+      at[u] = i;
+      unsigned long int key = 0;
+      if ((exposed[at[1] + at[2]*vol.dims[1]] >> at[0]) & 1) {
+        key = 0x1000000ul | (vol.data[at[0] + at[1]*vol.stride[1]
+          + at[2]*vol.stride[2]] & 0xFFFFFFul);
+        faces += 1;
+      }
+      mask[i + j*nu] = key;
+    }
+  }
+
+  for (unsigned int j = 0; j < nv; ++j) {
+    for (unsigned int i = 0; i < nu; ) {
+      const unsigned long int key = mask[i + j*nu];
+      if (key == 0) {
+        ++i;
+        continue;
+      }
+      unsigned int w = 1;
+      while (i+w < nu && mask[i+w + j*nu] == key)
+        ++w;
+      unsigned int h = 1;
+      for (; j+h < nv; ++h) {
+        unsigned int t = 0;
+        while (t < w && mask[i+t + (j+h)*nu] == key)
+          ++t;
+        if (t < w)
+          break;
+      }
+      for (unsigned int y = 0; y < h; ++y) {
+        for (unsigned int x = 0; x < w; ++x) {
+          mask[i+x + (j+y)*nu] = 0;
+        }
+      }
+
+      unsigned int origin[3];
+      origin[d] = vol.origin[d] + (negative ? k : k+1);
+      origin[u] = vol.origin[u] + i;
+      origin[v] = vol.origin[v] + j;
+      voxelmesh_quad q;
+      q.x = origin[0];
+      q.y = origin[1];
+      q.z = origin[2];
+      q.du = w;
+      q.dv = h;
+      q.face = static_cast<unsigned char>(face);
+      q.r = static_cast<unsigned char>(key&255);
+      q.g = static_cast<unsigned char>((key>>8)&255);
+      q.b = static_cast<unsigned char>((key>>16)&255);
+      quads.push_back(q);
+      i += w;
+    }
+  }
+}
+
+unsigned long long voxelmesh_build_chunk(const voxelbricks& voxels,
+  const voxeloccupancy& occupancy, const unsigned int chunk[3],
+  std::vector<voxelmesh_quad>& quads)
+{
+  if (voxelmesh_chunk_empty(voxels, chunk))
+    return 0;
+  const unsigned int dims[3] = {voxels.width, voxels.height, voxels.depth};
+  voxelmesh_volume vol;
+  for (unsigned int a = 0; a < 3; ++a) {
+    vol.origin[a] = chunk[a]*VoxelMesh_ChunkEdge;
+    if (vol.origin[a] >= dims[a])
+      return 0;
+    vol.dims[a] = (std::min)(dims[a] - vol.origin[a], VoxelMesh_ChunkEdge);
+  }
+  std::vector<unsigned int> exposed[6];
+  std::vector<char> busy[6];
+  if (!voxelmesh_exposed(occupancy, vol, exposed, busy))
+    return 0;
+  std::vector<unsigned int> data;
+  voxelmesh_gather(voxels, vol, data);
+  std::vector<unsigned long int> mask(
+    static_cast<std::size_t>(VoxelMesh_ChunkEdge)*VoxelMesh_ChunkEdge);
+  unsigned long long faces = 0;
+  for (unsigned int face = 0; face < 6; ++face) {
+    for (unsigned int k = 0; k < vol.dims[face/2]; ++k) {
+      if (busy[face][k])
+        voxelmesh_slice(vol, face, k, mask, quads, faces);
+    }
+  }
+  return faces;
+}
+
+void voxelmesh_build(const voxelbricks& voxels,
+  const voxeloccupancy& occupancy, std::vector<voxelmesh_quad>& quads,
+  voxelmesh_stats* stats, unsigned int threads)
+{
+  quads.clear();
+  voxelmesh_stats local = {0,0,0};
+  if (voxels.uniform.empty() || occupancy.width != voxels.width
+  ||  occupancy.height != voxels.height || occupancy.depth != voxels.depth)
+  {
+    if (stats != NULL)
+      *stats = local;
+    return;
+  }
+
+  //Solid voxels per brick: uniform bricks count without a scan.
+  std::vector<unsigned long long> solid(voxels.uniform.size(), 0);
+  workpool_shared().parallel_for(voxels.uniform.size(), [&](std::size_t b) {
+    solid[b] = voxelbricks_solid(voxels, b);
+  }, threads);
+  for (std::size_t b = 0; b < solid.size(); ++b)
+    local.naive_triangles += solid[b]*12;
+
+  //One task per chunk that holds any solid brick. Each task writes its
+  //own quad list, and the lists are joined in task order, so the result
+  //does not depend on how many threads ran the tasks.
+  const unsigned int dims[3] = {voxels.width, voxels.height, voxels.depth};
+  unsigned int chunks[3];
+  for (unsigned int a = 0; a < 3; ++a)
+    chunks[a] = dims[a]/VoxelMesh_ChunkEdge
+      + ((dims[a]%VoxelMesh_ChunkEdge) ? 1 : 0);
+  std::vector<voxelmesh_task> tasks;
+  for (unsigned int cz = 0; cz < chunks[2]; ++cz)
+  for (unsigned int cy = 0; cy < chunks[1]; ++cy)
+  for (unsigned int cx = 0; cx < chunks[0]; ++cx) {
+    voxelmesh_task t;
+    t.chunk[0] = cx;
+    t.chunk[1] = cy;
+    t.chunk[2] = cz;
+    t.faces = 0;
+    if (!voxelmesh_chunk_empty(voxels, t.chunk))
+      tasks.push_back(t);
+  }
+  workpool_shared().parallel_for(tasks.size(), [&](std::size_t ti) {
+    voxelmesh_task& t = tasks[ti];
+    t.faces = voxelmesh_build_chunk(voxels, occupancy, t.chunk, t.quads);
+  }, threads);
+
+  std::size_t total = 0;
+  unsigned long long faces = 0;
+  for (std::size_t ti = 0; ti < tasks.size(); ++ti) {
+    total += tasks[ti].quads.size();
+    faces += tasks[ti].faces;
+  }
+  quads.reserve(total);
+  for (std::size_t ti = 0; ti < tasks.size(); ++ti) {
+    quads.insert(quads.end(), tasks[ti].quads.begin(), tasks[ti].quads.end());
+  }
+  local.culled_triangles = faces*2;
+  local.merged_triangles = static_cast<unsigned long long>(quads.size())*2;
+  if (stats != NULL)
+    *stats = local;
+}
+
+//Give every distinct (corner, face, color) an index, in order of first
+//use. `emit(x, y, z, quad)` is called once per new vertex.
+template <typename Emit>
+static
+void voxelmesh_index_corners(const std::vector<voxelmesh_quad>& quads,
+  std::vector<unsigned int>& indices, Emit emit)
+{
+  indices.clear();
+  indices.reserve(quads.size()*6);
+  std::unordered_map<voxelmesh_corner_key, unsigned int,
+    voxelmesh_corner_hash> seen(quads.size()*2);
+  unsigned int count = 0;
+  for (std::size_t i = 0; i < quads.size(); ++i) {
+    const voxelmesh_quad& q = quads[i];
+    float corners[4][3];
+    voxelmesh_quad_corners(q, corners);
+    unsigned int id[4];
+    for (unsigned int c = 0; c < 4; ++c) {
+      voxelmesh_corner_key k;
+      k.x = static_cast<unsigned int>(corners[c][0]);
+      k.y = static_cast<unsigned int>(corners[c][1]);
+      k.z = static_cast<unsigned int>(corners[c][2]);
+      k.face_color = (static_cast<unsigned long int>(q.face)<<24) | q.r
+        | (static_cast<unsigned long int>(q.g)<<8)
+        | (static_cast<unsigned long int>(q.b)<<16);
+      std::pair<std::unordered_map<voxelmesh_corner_key, unsigned int,
+        voxelmesh_corner_hash>::iterator, bool> found =
+        seen.insert(std::make_pair(k, count));
+      if (found.second) {
+        emit(k.x, k.y, k.z, static_cast<unsigned int>(i));
+        count += 1;
+      }
+      id[c] = found.first->second;
+    }
+    static const unsigned int tri[6] = {0, 1, 2, 0, 2, 3};
+    for (unsigned int t = 0; t < 6; ++t)
+      indices.push_back(id[tri[t]]);
+  }
+}
+
+void voxelmesh_index(const std::vector<voxelmesh_quad>& quads,
+  std::vector<voxelmesh_vertex>& vertices,
+  std::vector<unsigned int>& indices)
+{
+  vertices.clear();
+  voxelmesh_index_corners(quads, indices,
+    [&](unsigned int x, unsigned int y, unsigned int z, unsigned int quad) {
+      voxelmesh_vertex v = {x, y, z, quad};
+      vertices.push_back(v);
+    });
+}
+
+bool voxelmesh_pack(const std::vector<voxelmesh_quad>& quads,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices)
+{
+  vertices.clear();
+  indices.clear();
+  for (std::size_t i = 0; i < quads.size(); ++i) {
+    const voxelmesh_quad& q = quads[i];
+    const unsigned int d = q.face/2;
+    unsigned int far[3] = {q.x, q.y, q.z};
+    far[(d+1)%3] += q.du;
+    far[(d+2)%3] += q.dv;
+    if (far[0] > 65535 || far[1] > 65535 || far[2] > 65535)
+      return false;
+  }
+  voxelmesh_index_corners(quads, indices,
+    [&](unsigned int x, unsigned int y, unsigned int z, unsigned int quad) {
+      const voxelmesh_quad& q = quads[quad];
+      voxelmesh_packed_vertex v;
+      v.x = static_cast<unsigned short>(x);
+      v.y = static_cast<unsigned short>(y);
+      v.z = static_cast<unsigned short>(z);
+      v.face = q.face;
+      v.r = q.r;
+      v.g = q.g;
+      v.b = q.b;
+      v.a = 255;
+      vertices.push_back(v);
+    });
+  return true;
+}
+
+void voxelmesh_quad_corners(const voxelmesh_quad& q, float corners[4][3]) {
+  const unsigned int d = q.face/2;
+  const unsigned int u = (d+1)%3;
+  const unsigned int v = (d+2)%3;
+  float o[3] = { static_cast<float>(q.x), static_cast<float>(q.y),
+    static_cast<float>(q.z) };
+  float eu[3] = {0.f, 0.f, 0.f};
+  float ev[3] = {0.f, 0.f, 0.f};
+  eu[u] = static_cast<float>(q.du);
+  ev[v] = static_cast<float>(q.dv);
+  //(u, v, axis) is right-handed, so o -> o+eu -> o+eu+ev winds
+  //counter-clockwise about the positive axis
+  const bool negative = (q.face&1) != 0;
+  const float* first = negative ? ev : eu;
+  const float* second = negative ? eu : ev;
+  for (unsigned int c = 0; c < 3; ++c) {
+    corners[0][c] = o[c];
+    corners[1][c] = o[c] + first[c];
+    corners[2][c] = o[c] + eu[c] + ev[c];
+    corners[3][c] = o[c] + second[c];
+  }
+}
+
+void voxelmesh_face_normal(unsigned int face, float n[3]) {
+  n[0] = n[1] = n[2] = 0.f;
+  n[(face/2)%3] = (face&1) ? -1.f : 1.f;
+}
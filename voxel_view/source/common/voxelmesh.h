@@ -0,0 +1,189 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelmesh.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELMESH_h_
+#define hg_VOXELMESH_h_
+
+#include "voxelbricks.h"
+#include "voxeloccupancy.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Edge of the cubic chunks meshed as one task, in voxels.
+ * @note A multiple of `VoxelBricks_Edge`. Quads never cross a chunk
+ *   boundary.
+ */
+static const unsigned int VoxelMesh_ChunkEdge = 2*VoxelBricks_Edge;
+
+/**
+ * @brief Axis-aligned face directions of a voxel.
+ * @note The face id is `axis*2 + (negative ? 1 : 0)`.
+ */
+enum voxelmesh_face {
+  VoxelMesh_PosX = 0,
+  VoxelMesh_NegX = 1,
+  VoxelMesh_PosY = 2,
+  VoxelMesh_NegY = 3,
+  VoxelMesh_PosZ = 4,
+  VoxelMesh_NegZ = 5
+};
+
+/**
+ * @brief A rectangle of coplanar, same-colored voxel faces.
+ */
+struct voxelmesh_quad {
+  /**
+   * @brief Lattice corner of the rectangle with the lowest coordinates.
+   */
+  unsigned int x, y, z;
+  /**
+   * @brief Extent along the face's first tangent axis (`(axis+1)%3`).
+   */
+  unsigned int du;
+  /**
+   * @brief Extent along the face's second tangent axis (`(axis+2)%3`).
+   */
+  unsigned int dv;
+  /**
+   * @brief Face direction, one of `voxelmesh_face`.
+   */
+  unsigned char face;
+  /**
+   * @brief Face color.
+   */
+  unsigned char r, g, b;
+};
+
+/**
+ * @brief A shared corner of an indexed mesh.
+ */
+struct voxelmesh_vertex {
+  /**
+   * @brief Lattice position of the corner.
+   */
+  unsigned int x, y, z;
+  /**
+   * @brief First quad using this corner; gives its face and color.
+   */
+  unsigned int quad;
+};
+
+/**
+ * @brief Compact corner of an indexed mesh, 12 bytes.
+ * @note Drawn with `shaders/vshader_packed.glsl`: `x, y, z, face` feed
+ *   `vPosition` as four unsigned shorts and `r, g, b, a` feed `vColor` as
+ *   four normalized unsigned bytes.
+ */
+struct voxelmesh_packed_vertex {
+  /**
+   * @brief Lattice position of the corner.
+   */
+  unsigned short x, y, z;
+  /**
+   * @brief Face direction, one of `voxelmesh_face`.
+   */
+  unsigned short face;
+  /**
+   * @brief Face color; alpha is always 255.
+   */
+  unsigned char r, g, b, a;
+};
+
+/**
+ * @brief Triangle counts gathered while meshing.
+ */
+struct voxelmesh_stats {
+  /**
+   * @brief Triangles for twelve triangles per solid voxel.
+   */
+  unsigned long long naive_triangles;
+  /**
+   * @brief Triangles after dropping faces between two solid voxels.
+   */
+  unsigned long long culled_triangles;
+  /**
+   * @brief Triangles after greedy merging of coplanar faces.
+   */
+  unsigned long long merged_triangles;
+};
+
+/**
+ * @brief Build a greedy mesh of the exposed faces of a voxel volume.
+ * @param voxels brick volume
+ * @param occupancy `voxeloccupancy_build` of `voxels`; decides which faces
+ *   are exposed
+ * @param[out] quads merged rectangles, replacing any previous content
+ * @param[out] stats triangle counts (optional)
+ * @param threads number of threads to mesh with, zero for one per core
+ * @note A voxel is solid when it is nonzero. Faces merge when their RGB
+ *   channels match.
+ * @note Chunks of `VoxelMesh_ChunkEdge` voxels are meshed as tasks on
+ *   `workpool_shared()`, skipping chunks of empty bricks; the output is
+ *   the same for every thread count.
+ * @note Slices of a chunk with no exposed face are skipped without
+ *   reading any voxel.
+ */
+void voxelmesh_build(const voxelbricks& voxels,
+  const voxeloccupancy& occupancy, std::vector<voxelmesh_quad>& quads, voxelmesh_stats* stats = NULL,
+  unsigned int threads = 0);
+
+/**
+ * @brief Greedy-mesh one chunk, as `voxelmesh_build` does for each.
+ * @param voxels brick volume
+ * @param occupancy `voxeloccupancy_build` of `voxels`
+ * @param chunk chunk coordinates, in units of `VoxelMesh_ChunkEdge`
+ * @param[out] quads the chunk's rectangles are appended here
+ * @return exposed voxel faces of the chunk, before merging
+ * @note Reads only the chunk's voxels and the occupancy rows around it.
+ */
+unsigned long long voxelmesh_build_chunk(const voxelbricks& voxels,
+  const voxeloccupancy& occupancy, const unsigned int chunk[3],
+  std::vector<voxelmesh_quad>& quads);
+
+/**
+ * @brief Index the corners of a quad list.
+ * @param quads merged rectangles
+ * @param[out] vertices one entry per distinct corner, replacing any
+ *   previous content
+ * @param[out] indices six per quad, two counter-clockwise triangles
+ * @note Quads share a corner only when they also share face direction
+ *   and color, so every vertex has a single normal and color.
+ */
+void voxelmesh_index(const std::vector<voxelmesh_quad>& quads,
+  std::vector<voxelmesh_vertex>& vertices,
+  std::vector<unsigned int>& indices);
+
+/**
+ * @brief Index the corners of a quad list as packed vertices.
+ * @param quads merged rectangles
+ * @param[out] vertices one entry per distinct corner, replacing any
+ *   previous content
+ * @param[out] indices six per quad, two counter-clockwise triangles
+ * @return false when a corner lies past 65535 on some axis; the outputs
+ *   are then empty
+ * @note Vertices and indices match `voxelmesh_index` entry for entry.
+ */
+bool voxelmesh_pack(const std::vector<voxelmesh_quad>& quads,
+  std::vector<voxelmesh_packed_vertex>& vertices,
+  std::vector<unsigned int>& indices);
+
+/**
+ * @brief Compute the corners of a quad.
+ * @param q the quad
+ * @param[out] corners four lattice points, counter-clockwise when viewed
+ *   from outside the face
+ */
+void voxelmesh_quad_corners(const voxelmesh_quad& q, float corners[4][3]);
+
+/**
+ * @brief Unit normal of a face direction.
+ * @param face one of `voxelmesh_face`
+ * @param[out] n normal vector
+ */
+void voxelmesh_face_normal(unsigned int face, float n[3]);
+
+#endif //hg_VOXELMESH_h_
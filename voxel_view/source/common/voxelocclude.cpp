@@ -0,0 +1,738 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelocclude.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelocclude.h"
+#include "workpool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif //__SSE2__
+
+typedef std::chrono::steady_clock voxelocclude_clock;
+
+/**
+ * @brief Where the camera sits in lattice space, when it is a point.
+ */
+struct voxelocclude_eye {
+  float at[3];
+  bool valid;
+};
+
+static
+unsigned int voxelocclude_ctz(unsigned long long w);
+static
+unsigned long long voxelocclude_bits(const voxeloccupancy& occupancy,
+  unsigned int y, unsigned int z, unsigned int x);
+static
+void voxelocclude_cell_boxes(const voxeloccupancy& occupancy,
+  const unsigned int count[3], std::size_t c,
+  std::vector<voxelocclude_box>& boxes);
+static
+bool voxelocclude_project(const voxelocclude& occ, const float m[16],
+  float x, float y, float z, float out[3]);
+static
+bool voxelocclude_project_box(const voxelocclude& occ, const float m[16],
+  const float lo[3], const float hi[3], float rect[4], float& z_near);
+static
+void voxelocclude_find_eye(const float m[16], voxelocclude_eye& eye);
+static
+unsigned int voxelocclude_hull(const float p[8][3], float hull[8][2]);
+static
+bool voxelocclude_setup(const voxelocclude& occ, const float m[16],
+  const voxelocclude_eye& eye, const voxelocclude_box& box,
+  voxelocclude_shape& s);
+static
+std::size_t voxelocclude_cell_of(const voxelocclude_occluders& o,
+  const voxelcull_chunk& c);
+static
+void voxelocclude_draw(voxelocclude& occ, const voxelocclude_shape& s,
+  int row_first, int row_last);
+static
+void voxelocclude_build_pyramid(voxelocclude& occ);
+static
+double voxelocclude_ms(voxelocclude_clock::time_point start,
+  voxelocclude_clock::time_point stop);
+
+
+unsigned int voxelocclude_ctz(unsigned long long w) {
+#if defined(__GNUC__)
+  return static_cast<unsigned int>(__builtin_ctzll(w));
+#else
+  unsigned int n = 0;
+  while ((w & 1) == 0) {
+    w >>= 1;
+    n += 1;
+  }
+  return n;
+#endif //__GNUC__
+}
+
+//64 bits of an occupancy row from bit `x` on; bits past the row are 0.
+unsigned long long voxelocclude_bits(const voxeloccupancy& occupancy,
+  unsigned int y, unsigned int z, unsigned int x)
+{
+  const unsigned long long* row = voxeloccupancy_row(occupancy, y, z);
+  const std::size_t w = x/VoxelOccupancy_WordBits;
+  const unsigned int shift = x%VoxelOccupancy_WordBits;
+  unsigned long long bits = row[w] >> shift;
+  if (shift != 0 && w+1 < occupancy.words)
+    bits |= row[w+1] << (VoxelOccupancy_WordBits - shift);
+  return bits;
+}
+
+//Greedy boxes seeded in one cell. Each seed's run along x is grown
+//along y and then z, both ways, over solid voxels up to
+//`VoxelOcclude_Reach` past the cell, so boxes of neighboring cells
+//overlap and no seam is left between them. Seeds already inside a box
+//are skipped.
+void voxelocclude_cell_boxes(const voxeloccupancy& occupancy,
+  const unsigned int count[3], std::size_t c,
+  std::vector<voxelocclude_box>& boxes)
+{
+  boxes.clear();
+  const unsigned int cell[3] = {static_cast<unsigned int>(c % count[0]),
+    static_cast<unsigned int>((c / count[0]) % count[1]),
+    static_cast<unsigned int>(c / (static_cast<std::size_t>(count[0])
+      *count[1]))};
+  const unsigned int dims[3] = {occupancy.width, occupancy.height,
+    occupancy.depth};
+  //the region around the cell, and where the cell sits in it
+  unsigned int base[3], size[3], first[3], last[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    const unsigned int lo = cell[a]*VoxelMesh_ChunkEdge;
+    const unsigned int hi = (std::min)(lo + VoxelMesh_ChunkEdge, dims[a]);
+    base[a] = lo >= VoxelOcclude_Reach ? lo - VoxelOcclude_Reach : 0;
+    size[a] = (std::min)(hi + VoxelOcclude_Reach, dims[a]) - base[a];
+    first[a] = lo - base[a];
+    last[a] = hi - base[a];
+  }
+  const unsigned long long keep = (size[0] >= 64) ? ~0ull
+    : ((1ull << size[0]) - 1);
+  const unsigned long long cell_bits = (((last[0] - first[0] >= 64) ? ~0ull
+    : ((1ull << (last[0] - first[0])) - 1)) << first[0]);
+  std::vector<unsigned long long> rows(
+    static_cast<std::size_t>(size[1])*size[2]);
+  std::vector<unsigned long long> seeds(rows.size(), 0);
+  for (unsigned int z = 0; z < size[2]; ++z) {
+    for (unsigned int y = 0; y < size[1]; ++y) {
+      const std::size_t r = y + z*size[1];
+      rows[r] = voxelocclude_bits(occupancy, base[1] + y, base[2] + z,
+        base[0]) & keep;
+      if (y >= first[1] && y < last[1] && z >= first[2] && z < last[2])
+        seeds[r] = rows[r] & cell_bits;
+    }
+  }
+
+  for (unsigned int z = first[2]; z < last[2]; ++z) {
+    for (unsigned int y = first[1]; y < last[1]; ++y) {
+      while (seeds[y + z*size[1]] != 0) {
+        const unsigned long long r = rows[y + z*size[1]];
+        const unsigned int seed = voxelocclude_ctz(seeds[y + z*size[1]]);
+        unsigned int x0 = seed, x1 = seed + 1;
+        while (x0 > 0 && ((r >> (x0-1)) & 1))
+          --x0;
+        while (x1 < 64 && ((r >> x1) & 1))
+          ++x1;
+        const unsigned long long run = ((x1 - x0 >= 64) ? ~0ull
+          : ((1ull << (x1 - x0)) - 1)) << x0;
+        unsigned int y0 = y, y1 = y + 1;
+        while (y0 > 0 && (rows[y0-1 + z*size[1]] & run) == run)
+          --y0;
+        while (y1 < size[1] && (rows[y1 + z*size[1]] & run) == run)
+          ++y1;
+        unsigned int z0 = z, z1 = z + 1;
+        for (int step = -1; step <= 1; step += 2) {
+          for (;;) {
+            const unsigned int zz = (step < 0) ? z0 - 1 : z1;
+            if ((step < 0 && z0 == 0) || (step > 0 && z1 == size[2]))
+              break;
+            unsigned int yy = y0;
+            while (yy < y1 && (rows[yy + zz*size[1]] & run) == run)
+              ++yy;
+            if (yy < y1)
+              break;
+            if (step < 0)
+              --z0;
+            else
+              ++z1;
+          }
+        }
+        for (unsigned int zz = z0; zz < z1; ++zz) {
+          for (unsigned int yy = y0; yy < y1; ++yy)
+            seeds[yy + zz*size[1]] &= ~run;
+        }
+        voxelocclude_box b;
+        b.lo[0] = static_cast<unsigned short>(base[0] + x0);
+        b.lo[1] = static_cast<unsigned short>(base[1] + y0);
+        b.lo[2] = static_cast<unsigned short>(base[2] + z0);
+        b.hi[0] = static_cast<unsigned short>(base[0] + x1);
+        b.hi[1] = static_cast<unsigned short>(base[1] + y1);
+        b.hi[2] = static_cast<unsigned short>(base[2] + z1);
+        boxes.push_back(b);
+      }
+    }
+  }
+  std::stable_sort(boxes.begin(), boxes.end(),
+    [](const voxelocclude_box& a, const voxelocclude_box& b) {
+      return static_cast<unsigned long>(a.hi[0] - a.lo[0])*(a.hi[1] - a.lo[1])
+        *(a.hi[2] - a.lo[2]) > static_cast<unsigned long>(b.hi[0] - b.lo[0])
+        *(b.hi[1] - b.lo[1])*(b.hi[2] - b.lo[2]);
+    });
+}
+
+//Screen position and depth of a lattice point; false unless it lies in
+//front of the near plane.
+bool voxelocclude_project(const voxelocclude& occ, const float m[16],
+  float x, float y, float z, float out[3])
+{
+  const float cx = m[0]*x + m[1]*y + m[2]*z + m[3];
+  const float cy = m[4]*x + m[5]*y + m[6]*z + m[7];
+  const float cz = m[8]*x + m[9]*y + m[10]*z + m[11];
+  const float cw = m[12]*x + m[13]*y + m[14]*z + m[15];
+  if (!(cw > 1e-6f) || cz < -cw)
+    return false;
+  out[0] = (cx/cw*0.5f + 0.5f)*occ.width;
+  out[1] = (cy/cw*0.5f + 0.5f)*occ.height;
+  out[2] = cz/cw;
+  return true;
+}
+
+//Screen rectangle and nearest depth of a box. View depth is linear over
+//the box, so the nearest corner is its nearest point.
+bool voxelocclude_project_box(const voxelocclude& occ, const float m[16],
+  const float lo[3], const float hi[3], float rect[4], float& z_near)
+{
+  for (unsigned int c = 0; c < 8; ++c) {
+    float p[3];
+    if (!voxelocclude_project(occ, m, (c&1) ? hi[0] : lo[0],
+        (c&2) ? hi[1] : lo[1], (c&4) ? hi[2] : lo[2], p))
+      return false;
+    if (c == 0) {
+      rect[0] = rect[2] = p[0];
+      rect[1] = rect[3] = p[1];
+      z_near = p[2];
+      continue;
+    }
+    rect[0] = (std::min)(rect[0], p[0]);
+    rect[1] = (std::min)(rect[1], p[1]);
+    rect[2] = (std::max)(rect[2], p[0]);
+    rect[3] = (std::max)(rect[3], p[1]);
+    z_near = (std::min)(z_near, p[2]);
+  }
+  return true;
+}
+
+//The eye is the point with clip x, y and w all zero. An orthographic
+//matrix has none.
+void voxelocclude_find_eye(const float m[16], voxelocclude_eye& eye) {
+  const float* r0 = m;
+  const float* r1 = m + 4;
+  const float* r3 = m + 12;
+  const float c[3] = {r1[1]*r3[2] - r1[2]*r3[1], r1[2]*r3[0] - r1[0]*r3[2],
+    r1[0]*r3[1] - r1[1]*r3[0]};
+  const float det = r0[0]*c[0] + r0[1]*c[1] + r0[2]*c[2];
+  eye.valid = std::fabs(det) > 1e-12f;
+  if (!eye.valid)
+    return;
+  const float rhs[3] = {-r0[3], -r1[3], -r3[3]};
+  for (unsigned int a = 0; a < 3; ++a) {
+    float col[3][3] = {{r0[0], r0[1], r0[2]}, {r1[0], r1[1], r1[2]},
+      {r3[0], r3[1], r3[2]}};
+    for (unsigned int k = 0; k < 3; ++k)
+      col[k][a] = rhs[k];
+    eye.at[a] = (col[0][0]*(col[1][1]*col[2][2] - col[1][2]*col[2][1])
+      - col[0][1]*(col[1][0]*col[2][2] - col[1][2]*col[2][0])
+      + col[0][2]*(col[1][0]*col[2][1] - col[1][1]*col[2][0]))/det;
+  }
+}
+
+//Counter-clockwise convex hull of the screen positions of the corners,
+//by monotone chain. Returns the number of hull points.
+unsigned int voxelocclude_hull(const float p[8][3], float hull[8][2]) {
+  unsigned int order[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  std::sort(order, order + 8, [&](unsigned int a, unsigned int b) {
+    return p[a][0] < p[b][0] || (p[a][0] == p[b][0] && p[a][1] < p[b][1]);
+  });
+  float chain[17][2];
+  unsigned int n = 0;
+  for (unsigned int pass = 0; pass < 2; ++pass) {
+    const unsigned int first = n;
+    for (unsigned int k = 0; k < 8; ++k) {
+      const float* q = p[order[pass ? 7-k : k]];
+      while (n >= first + 2) {
+        const float* a = chain[n-2];
+        const float* b = chain[n-1];
+        if ((b[0] - a[0])*(q[1] - a[1]) - (b[1] - a[1])*(q[0] - a[0]) > 0.0f)
+          break;
+        --n;
+      }
+      chain[n][0] = q[0];
+      chain[n][1] = q[1];
+      ++n;
+    }
+    //the last point of each chain starts the other
+    --n;
+  }
+  const unsigned int count = (std::min)(n, 8u);
+  for (unsigned int k = 0; k < count; ++k) {
+    hull[k][0] = chain[k][0];
+    hull[k][1] = chain[k][1];
+  }
+  return n;
+}
+
+//Outline and depth planes of a box. Outline edges are shifted to the
+//pixel corner that enters last and pulled in a little for rounding. A
+//ray through the outline enters the box at the farthest of the faces
+//turned to the eye, so the depth is the largest of their planes, each
+//shifted to the corner that is farthest. False when nothing can be
+//drawn.
+bool voxelocclude_setup(const voxelocclude& occ, const float m[16],
+  const voxelocclude_eye& eye, const voxelocclude_box& box,
+  voxelocclude_shape& s)
+{
+  //far outside the screen, edge rounding outgrows the pull-in
+  const float guard = 8.0f*(std::max)(occ.width, occ.height);
+  float p[8][3];
+  for (unsigned int c = 0; c < 8; ++c) {
+    if (!voxelocclude_project(occ, m, (c&1) ? box.hi[0] : box.lo[0],
+        (c&2) ? box.hi[1] : box.lo[1], (c&4) ? box.hi[2] : box.lo[2], p[c])
+    ||  std::fabs(p[c][0]) > guard || std::fabs(p[c][1]) > guard)
+      return false;
+    if (c == 0) {
+      s.z_lo = s.z_hi = p[0][2];
+      continue;
+    }
+    s.z_lo = (std::min)(s.z_lo, p[c][2]);
+    s.z_hi = (std::max)(s.z_hi, p[c][2]);
+  }
+
+  float hull[8][2];
+  const unsigned int n = voxelocclude_hull(p, hull);
+  if (n < 3 || n > 6)
+    return false;
+  float xmin = hull[0][0], xmax = hull[0][0];
+  float ymin = hull[0][1], ymax = hull[0][1];
+  float edge[6][3];
+  for (unsigned int e = 0; e < n; ++e) {
+    const float* a = hull[e];
+    const float* b = hull[(e+1)%n];
+    const float ea = a[1] - b[1];
+    const float eb = b[0] - a[0];
+    edge[e][0] = ea;
+    edge[e][1] = eb;
+    edge[e][2] = -(ea*a[0] + eb*a[1]) + (std::min)(ea, 0.0f)
+      + (std::min)(eb, 0.0f) - (std::fabs(ea) + std::fabs(eb))/256.0f;
+    xmin = (std::min)(xmin, a[0]);
+    xmax = (std::max)(xmax, a[0]);
+    ymin = (std::min)(ymin, a[1]);
+    ymax = (std::max)(ymax, a[1]);
+  }
+  //an outline less than a pixel across covers no pixel whole
+  if (xmax - xmin < 1.0f || ymax - ymin < 1.0f)
+    return false;
+  s.x0 = (std::max)(0, static_cast<int>(std::floor(xmin)));
+  s.y0 = (std::max)(0, static_cast<int>(std::floor(ymin)));
+  s.x1 = (std::min)(static_cast<int>(occ.width),
+    static_cast<int>(std::ceil(xmax)));
+  s.y1 = (std::min)(static_cast<int>(occ.height),
+    static_cast<int>(std::ceil(ymax)));
+  //A pixel passes an edge when a*x + b*y + c > 0; solved for x this
+  //bounds the run of a row from the left or right, or for a flat edge
+  //bounds the rows.
+  s.lefts = s.rights = 0;
+  for (unsigned int e = 0; e < n; ++e) {
+    const float a = edge[e][0], b = edge[e][1], c = edge[e][2];
+    if (a > 0.0f) {
+      s.left[s.lefts][0] = -b/a;
+      s.left[s.lefts][1] = -c/a;
+      s.lefts += 1;
+    } else if (a < 0.0f) {
+      s.right[s.rights][0] = -b/a;
+      s.right[s.rights][1] = -c/a;
+      s.rights += 1;
+    } else if (b > 0.0f) {
+      s.y0 = (std::max)(s.y0, static_cast<int>(std::floor(-c/b)) + 1);
+    } else if (b < 0.0f) {
+      s.y1 = (std::min)(s.y1, static_cast<int>(std::ceil(-c/b)));
+    }
+  }
+  if (s.x0 >= s.x1 || s.y0 >= s.y1)
+    return false;
+
+  unsigned int planes = 0;
+  bool exact = eye.valid;
+  for (unsigned int a = 0; a < 3 && exact; ++a) {
+    unsigned int side;
+    if (eye.at[a] < box.lo[a])
+      side = 0;
+    else if (eye.at[a] > box.hi[a])
+      side = 1u << a;
+    else
+      continue;
+    const unsigned int u = 1u << ((a+1)%3), v = 1u << ((a+2)%3);
+    const float* c0 = p[side];
+    const float* c1 = p[side | u];
+    const float* c2 = p[side | v];
+    const float ex1 = c1[0] - c0[0], ey1 = c1[1] - c0[1], ez1 = c1[2] - c0[2];
+    const float ex2 = c2[0] - c0[0], ey2 = c2[1] - c0[1], ez2 = c2[2] - c0[2];
+    const float area = ex1*ey2 - ex2*ey1;
+    //a face seen edge on gives no usable plane
+    if (std::fabs(area) < 1e-3f) {
+      exact = false;
+      break;
+    }
+    const float da = (ez1*ey2 - ez2*ey1)/area;
+    const float db = (ex1*ez2 - ex2*ez1)/area;
+    s.plane[planes][0] = da;
+    s.plane[planes][1] = db;
+    s.plane[planes][2] = c0[2] - da*c0[0] - db*c0[1] + (std::max)(da, 0.0f)
+      + (std::max)(db, 0.0f) + 1e-6f + (s.z_hi - s.z_lo)/4096.0f;
+    planes += 1;
+  }
+  if (!exact || planes == 0) {
+    s.plane[0][0] = s.plane[0][1] = 0.0f;
+    s.plane[0][2] = s.z_hi;
+    planes = 1;
+  }
+  for (; planes < 3; ++planes) {
+    s.plane[planes][0] = s.plane[planes][1] = 0.0f;
+    s.plane[planes][2] = -2.0f;
+  }
+  return true;
+}
+
+//Mesh runs come from one chunk each and carry its cell. A coarse run
+//covers `span` cells along each edge and takes the boxes of the middle
+//one; any solid voxels under it occlude.
+std::size_t voxelocclude_cell_of(const voxelocclude_occluders& o,
+  const voxelcull_chunk& c)
+{
+  std::size_t cell[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    cell[a] = (std::min)(static_cast<std::size_t>(c.cell[a] + c.span/2),
+      static_cast<std::size_t>(o.count[a] - 1));
+  }
+  return cell[0] + (cell[1] + cell[2]*o.count[1])*o.count[0];
+}
+
+//Keep the nearer of the stored depth and the box's over every pixel of
+//rows [row_first, row_last) the outline wholly covers. The outline is
+//convex, so those pixels make one run per row. The pull-in of the edges
+//is far wider than the rounding of the run ends.
+void voxelocclude_draw(voxelocclude& occ, const voxelocclude_shape& s,
+  int row_first, int row_last)
+{
+  const int y0 = (std::max)(s.y0, row_first);
+  const int y1 = (std::min)(s.y1, row_last);
+  for (int y = y0; y < y1; ++y) {
+    const float fy = static_cast<float>(y);
+    float left = static_cast<float>(s.x0) - 1.0f;
+    float right = static_cast<float>(s.x1);
+    for (unsigned int e = 0; e < s.lefts; ++e)
+      left = (std::max)(left, s.left[e][0]*fy + s.left[e][1]);
+    for (unsigned int e = 0; e < s.rights; ++e)
+      right = (std::min)(right, s.right[e][0]*fy + s.right[e][1]);
+    const int x0 = static_cast<int>(std::floor(left)) + 1;
+    const int x1 = static_cast<int>(std::ceil(right));
+    if (x0 >= x1)
+      continue;
+    float zc[3];
+    for (unsigned int k = 0; k < 3; ++k)
+      zc[k] = s.plane[k][1]*fy + s.plane[k][2];
+    float* row = &occ.levels[0][static_cast<std::size_t>(y)*occ.width];
+    int x = x0;
+#ifdef __SSE2__
+    const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    __m128 za[3], zb[3];
+    for (unsigned int k = 0; k < 3; ++k) {
+      za[k] = _mm_set1_ps(s.plane[k][0]);
+      zb[k] = _mm_set1_ps(zc[k]);
+    }
+    const __m128 zlo = _mm_set1_ps(s.z_lo), zhi = _mm_set1_ps(s.z_hi);
+    for (; x + 4 <= x1; x += 4) {
+      const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane);
+      __m128 z = _mm_add_ps(_mm_mul_ps(za[0], px), zb[0]);
+      z = _mm_max_ps(z, _mm_add_ps(_mm_mul_ps(za[1], px), zb[1]));
+      z = _mm_max_ps(z, _mm_add_ps(_mm_mul_ps(za[2], px), zb[2]));
+      z = _mm_min_ps(_mm_max_ps(z, zlo), zhi);
+      _mm_storeu_ps(row + x, _mm_min_ps(_mm_loadu_ps(row + x), z));
+    }
+#endif //__SSE2__
+    for (; x < x1; ++x) {
+      const float px = static_cast<float>(x);
+      float z = s.plane[0][0]*px + zc[0];
+      z = (std::max)(z, s.plane[1][0]*px + zc[1]);
+      z = (std::max)(z, s.plane[2][0]*px + zc[2]);
+      z = (std::min)((std::max)(z, s.z_lo), s.z_hi);
+      row[x] = (std::min)(row[x], z);
+    }
+  }
+}
+
+//Each texel takes the farthest of the up to four below it; odd edges
+//have fewer.
+void voxelocclude_build_pyramid(voxelocclude& occ) {
+  for (std::size_t k = 1; k < occ.levels.size(); ++k) {
+    const std::vector<float>& below = occ.levels[k-1];
+    std::vector<float>& level = occ.levels[k];
+    const unsigned int bw = occ.widths[k-1], bh = occ.heights[k-1];
+    for (unsigned int y = 0; y < occ.heights[k]; ++y) {
+      const unsigned int y0 = 2*y, y1 = (std::min)(2*y + 1, bh - 1);
+      for (unsigned int x = 0; x < occ.widths[k]; ++x) {
+        const unsigned int x0 = 2*x, x1 = (std::min)(2*x + 1, bw - 1);
+        level[y*occ.widths[k] + x] = (std::max)(
+          (std::max)(below[y0*bw + x0], below[y0*bw + x1]),
+          (std::max)(below[y1*bw + x0], below[y1*bw + x1]));
+      }
+    }
+  }
+}
+
+double voxelocclude_ms(voxelocclude_clock::time_point start,
+  voxelocclude_clock::time_point stop)
+{
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+void voxelocclude_occluders_clear(voxelocclude_occluders& o) {
+  o.count[0] = o.count[1] = o.count[2] = 0;
+  std::vector< std::vector<voxelocclude_box> >().swap(o.cells);
+}
+
+void voxelocclude_occluders_build(voxelocclude_occluders& o,
+  const voxeloccupancy& occupancy, unsigned int threads)
+{
+  const unsigned int dims[3] = {occupancy.width, occupancy.height,
+    occupancy.depth};
+  for (unsigned int a = 0; a < 3; ++a) {
+    o.count[a] = dims[a]/VoxelMesh_ChunkEdge
+      + ((dims[a]%VoxelMesh_ChunkEdge) ? 1 : 0);
+  }
+  const std::size_t cells = static_cast<std::size_t>(o.count[0])
+    *o.count[1]*o.count[2];
+  o.cells.assign(cells, std::vector<voxelocclude_box>());
+  workpool_shared().parallel_for(cells, [&](std::size_t c) {
+    voxelocclude_cell_boxes(occupancy, o.count, c, o.cells[c]);
+  }, threads);
+}
+
+void voxelocclude_occluders_update(voxelocclude_occluders& o,
+  const voxeloccupancy& occupancy, const unsigned int lo[3],
+  const unsigned int hi[3])
+{
+  //boxes of cell c lie in [c*Edge - Reach, (c+1)*Edge + Reach)
+  unsigned int first[3], last[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    if (hi[a] <= lo[a] || o.count[a] == 0)
+      return;
+    const unsigned int reach = VoxelMesh_ChunkEdge + VoxelOcclude_Reach;
+    first[a] = lo[a] >= reach ? (lo[a] - reach)/VoxelMesh_ChunkEdge + 1 : 0;
+    last[a] = (std::min)((hi[a] - 1 + VoxelOcclude_Reach)/VoxelMesh_ChunkEdge,
+      o.count[a] - 1);
+    if (first[a] > last[a])
+      return;
+  }
+  for (unsigned int cz = first[2]; cz <= last[2]; ++cz)
+  for (unsigned int cy = first[1]; cy <= last[1]; ++cy)
+  for (unsigned int cx = first[0]; cx <= last[0]; ++cx) {
+    const std::size_t c = cx + (cy + static_cast<std::size_t>(cz)
+      *o.count[1])*o.count[0];
+    voxelocclude_cell_boxes(occupancy, o.count, c, o.cells[c]);
+  }
+}
+
+bool voxelocclude_init(voxelocclude& occ, unsigned int width,
+  unsigned int height, double budget_ms, std::size_t max_occluders)
+{
+  occ.width = width;
+  occ.height = height;
+  occ.widths.clear();
+  occ.heights.clear();
+  occ.levels.clear();
+  occ.setup.clear();
+  occ.budget_ms = budget_ms;
+  occ.max_occluders = max_occluders;
+  occ.stats = voxelocclude_stats();
+  if (occ.width == 0 || occ.height == 0)
+    return false;
+  unsigned int w = occ.width, h = occ.height;
+  for (;;) {
+    occ.widths.push_back(w);
+    occ.heights.push_back(h);
+    occ.levels.push_back(std::vector<float>(
+      static_cast<std::size_t>(w)*h, 1.0f));
+    if (w == 1 && h == 1)
+      break;
+    w = (w + 1)/2;
+    h = (h + 1)/2;
+  }
+  return true;
+}
+
+std::size_t voxelocclude_render(voxelocclude& occ, const float m[16],
+  const std::vector<voxelcull_chunk>& chunks,
+  const std::vector<char>& visible, const voxelocclude_occluders& o,
+  unsigned int threads)
+{
+  const voxelocclude_clock::time_point start = voxelocclude_clock::now();
+  const voxelocclude_clock::time_point deadline = start
+    + std::chrono::duration_cast<voxelocclude_clock::duration>(
+      std::chrono::duration<double, std::milli>(occ.budget_ms));
+  occ.stats.occluders = occ.stats.occluder_boxes = 0;
+  occ.stats.over_budget = false;
+  occ.stats.raster_ms = 0.0;
+  if (occ.levels.empty())
+    return 0;
+  std::fill(occ.levels[0].begin(), occ.levels[0].end(), 1.0f);
+
+  //Rank the chunks on screen by the area of their bounds.
+  std::vector< std::pair<float, std::size_t> > ranked;
+  for (std::size_t i = 0; i < chunks.size() && i < visible.size()
+      && !o.cells.empty(); ++i) {
+    if (!visible[i])
+      continue;
+    float rect[4], z_near;
+    if (!voxelocclude_project_box(occ, m, chunks[i].lo, chunks[i].hi, rect,
+        z_near))
+      continue;
+    const float w = (std::min)(rect[2], static_cast<float>(occ.width))
+      - (std::max)(rect[0], 0.0f);
+    const float h = (std::min)(rect[3], static_cast<float>(occ.height))
+      - (std::max)(rect[1], 0.0f);
+    if (w > 0.0f && h > 0.0f)
+      ranked.push_back(std::make_pair(w*h, i));
+  }
+  const std::size_t count = (std::min)(ranked.size(), occ.max_occluders);
+  std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(),
+    [](const std::pair<float, std::size_t>& a,
+       const std::pair<float, std::size_t>& b) {
+      return a.first > b.first;
+    });
+
+  voxelocclude_eye eye;
+  voxelocclude_find_eye(m, eye);
+  if (occ.setup.size() < count)
+    occ.setup.resize(count);
+  const std::size_t bands = (occ.height + VoxelOcclude_BandRows - 1)
+    / VoxelOcclude_BandRows;
+  std::vector<char> late(count + bands, 0);
+  workpool_shared().parallel_for(count, [&](std::size_t k) {
+    const std::vector<voxelocclude_box>& boxes =
+      o.cells[voxelocclude_cell_of(o, chunks[ranked[k].second])];
+    std::vector<voxelocclude_shape>& out = occ.setup[k];
+    out.clear();
+    for (std::size_t b = 0; b < boxes.size(); ++b) {
+      if ((b & 63) == 63 && voxelocclude_clock::now() > deadline) {
+        late[k] = 1;
+        break;
+      }
+      voxelocclude_shape s;
+      if (voxelocclude_setup(occ, m, eye, boxes[b], s))
+        out.push_back(s);
+    }
+  }, threads);
+
+  //Bands share no pixels, so they need no locks. Each stops on its own
+  //when time runs out; what it drew by then is still correct.
+  workpool_shared().parallel_for(bands, [&](std::size_t b) {
+    const int row_first = static_cast<int>(b*VoxelOcclude_BandRows);
+    const int row_last = (std::min)(static_cast<int>(occ.height),
+      row_first + static_cast<int>(VoxelOcclude_BandRows));
+    std::size_t drawn = 0;
+    for (std::size_t k = 0; k < count; ++k) {
+      const std::vector<voxelocclude_shape>& shapes = occ.setup[k];
+      for (std::size_t i = 0; i < shapes.size(); ++i) {
+        const voxelocclude_shape& s = shapes[i];
+        if (s.y1 <= row_first || s.y0 >= row_last)
+          continue;
+        if ((++drawn & 63) == 0 && voxelocclude_clock::now() > deadline) {
+          late[count + b] = 1;
+          return;
+        }
+        voxelocclude_draw(occ, s, row_first, row_last);
+      }
+    }
+  }, threads);
+  voxelocclude_build_pyramid(occ);
+
+  occ.stats.occluders = count;
+  for (std::size_t k = 0; k < count; ++k)
+    occ.stats.occluder_boxes += occ.setup[k].size();
+  occ.stats.over_budget = std::find(late.begin(), late.end(), 1)
+    != late.end();
+  occ.stats.raster_ms = voxelocclude_ms(start, voxelocclude_clock::now());
+  return count;
+}
+
+//The box is hidden when its nearest point is behind the farthest
+//occluder depth over its screen rectangle, read from the level where
+//the rectangle spans at most 4x4 texels.
+bool voxelocclude_box_visible(const voxelocclude& occ, const float m[16],
+  const float lo[3], const float hi[3])
+{
+  float rect[4], z_near;
+  if (occ.levels.empty()
+  ||  !voxelocclude_project_box(occ, m, lo, hi, rect, z_near))
+    return true;
+  if (rect[2] <= 0.0f || rect[3] <= 0.0f
+  ||  rect[0] >= static_cast<float>(occ.width)
+  ||  rect[1] >= static_cast<float>(occ.height))
+    return true;
+  const unsigned int x0 = static_cast<unsigned int>(
+    std::floor((std::max)(rect[0], 0.0f)));
+  const unsigned int y0 = static_cast<unsigned int>(
+    std::floor((std::max)(rect[1], 0.0f)));
+  const unsigned int x1 = (std::min)(occ.width - 1,
+    static_cast<unsigned int>(std::floor(rect[2])));
+  const unsigned int y1 = (std::min)(occ.height - 1,
+    static_cast<unsigned int>(std::floor(rect[3])));
+  std::size_t k = 0;
+  while (k+1 < occ.levels.size()
+    && ((x1 >> k) - (x0 >> k) >= 16 || (y1 >> k) - (y0 >> k) >= 16))
+    ++k;
+  const std::vector<float>& level = occ.levels[k];
+  const unsigned int w = occ.widths[k];
+  for (unsigned int y = (y0 >> k); y <= (y1 >> k); ++y) {
+    for (unsigned int x = (x0 >> k); x <= (x1 >> k); ++x) {
+      if (!(z_near > level[y*w + x]))
+        return true;
+    }
+  }
+  return false;
+}
+
+std::size_t voxelocclude_cull(voxelocclude& occ, const float m[16],
+  const std::vector<voxelcull_chunk>& chunks, std::vector<char>& visible,
+  const voxelocclude_occluders& o, unsigned int threads)
+{
+  voxelocclude_render(occ, m, chunks, visible, o, threads);
+  const voxelocclude_clock::time_point start = voxelocclude_clock::now();
+  const std::size_t count = (std::min)(chunks.size(), visible.size());
+  std::vector<char> hidden(count, 0);
+  workpool_shared().parallel_for(count, [&](std::size_t i) {
+    if (visible[i] && !voxelocclude_box_visible(occ, m, chunks[i].lo,
+        chunks[i].hi))
+      hidden[i] = 1;
+  }, threads);
+  occ.stats.tested = occ.stats.occluded = 0;
+  occ.stats.occluded_triangles = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!visible[i])
+      continue;
+    occ.stats.tested += 1;
+    if (hidden[i]) {
+      visible[i] = 0;
+      occ.stats.occluded += 1;
+      occ.stats.occluded_triangles += chunks[i].count/3;
+    }
+  }
+  occ.stats.test_ms = voxelocclude_ms(start, voxelocclude_clock::now());
+  return occ.stats.occluded;
+}
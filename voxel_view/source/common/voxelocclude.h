@@ -0,0 +1,208 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelocclude.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELOCCLUDE_h_
+#define hg_VOXELOCCLUDE_h_
+
+#include "voxelcull.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Default size of the occlusion depth buffer, in pixels.
+ */
+static const unsigned int VoxelOcclude_Width = 256;
+static const unsigned int VoxelOcclude_Height = 128;
+/**
+ * @brief Rows of the depth buffer drawn by one task.
+ */
+static const unsigned int VoxelOcclude_BandRows = 16;
+
+/**
+ * @brief How far, in voxels, the boxes of a cell reach past it.
+ * @note A box fits in one occupancy word across, so a cell plus twice
+ *   this must be at most 64 voxels wide.
+ */
+static const unsigned int VoxelOcclude_Reach = 16;
+
+/**
+ * @brief Box of solid voxels, first corner inclusive and last exclusive.
+ */
+struct voxelocclude_box {
+  unsigned short lo[3], hi[3];
+};
+
+/**
+ * @brief Solid boxes covering the voxels of each mesh chunk, the
+ *   occluders of `voxelocclude_render`.
+ * @note Cells are `VoxelMesh_ChunkEdge` voxels wide, like mesh chunks.
+ *   Boxes are seeded in their cell but may reach `VoxelOcclude_Reach`
+ *   voxels into the neighbors.
+ */
+struct voxelocclude_occluders {
+  /**
+   * @brief Cells along each axis.
+   */
+  unsigned int count[3];
+  /**
+   * @brief Boxes of each cell, `cx + (cy + cz*count[1])*count[0]` ordered,
+   *   largest first.
+   */
+  std::vector< std::vector<voxelocclude_box> > cells;
+};
+
+/**
+ * @brief Counts and timings of the last `voxelocclude_cull`.
+ */
+struct voxelocclude_stats {
+  /**
+   * @brief Chunks drawn as occluders, and their boxes set up for drawing.
+   */
+  std::size_t occluders, occluder_boxes;
+  /**
+   * @brief Chunks tested against the pyramid, and those found hidden.
+   */
+  std::size_t tested, occluded;
+  unsigned long long occluded_triangles;
+  /**
+   * @brief Set when the budget ran out before every occluder was drawn.
+   */
+  bool over_budget;
+  /**
+   * @brief Time spent drawing occluders and building the pyramid, and
+   *   time spent testing chunks.
+   */
+  double raster_ms, test_ms;
+};
+
+/**
+ * @brief Outline and depth of an occluder box in screen space, set up
+ *   for the conservative tests of `voxelocclude_render`.
+ * @note Pixels of row y whose lower corner x lies strictly between the
+ *   largest `k*y + c` of the left bounds and the smallest of the right
+ *   ones are wholly inside the outline. The depth is the largest of the
+ *   three planes, each shifted to its farthest over the pixel, clamped
+ *   to `z_lo` and `z_hi`.
+ */
+struct voxelocclude_shape {
+  float left[6][2], right[6][2];
+  unsigned int lefts, rights;
+  float plane[3][3];
+  float z_lo, z_hi;
+  /**
+   * @brief Pixel bounds, first inclusive and last exclusive.
+   */
+  int x0, y0, x1, y1;
+};
+
+/**
+ * @brief Software hierarchical-Z buffer of one view.
+ * @note Depths are normalized device z, -1 near and 1 far. Pixel (0,0) is
+ *   at the bottom left. Each pixel of level 0 holds the farthest depth
+ *   at which something solid is known to cover all of it; each texel of
+ *   level k+1 holds the largest of its four texels in level k.
+ */
+struct voxelocclude {
+  unsigned int width, height;
+  /**
+   * @brief Size and depths of each pyramid level, level 0 first.
+   */
+  std::vector<unsigned int> widths, heights;
+  std::vector< std::vector<float> > levels;
+  /**
+   * @brief Most occluder chunks drawn per view.
+   */
+  std::size_t max_occluders;
+  /**
+   * @brief Time allowed for drawing occluders, in milliseconds. Occluders
+   *   left over when it runs out are skipped.
+   */
+  double budget_ms;
+  /**
+   * @brief Set-up boxes of each occluder chunk, kept between calls.
+   */
+  std::vector< std::vector<voxelocclude_shape> > setup;
+  voxelocclude_stats stats;
+};
+
+/**
+ * @brief Release the boxes, leaving no cells.
+ */
+void voxelocclude_occluders_clear(voxelocclude_occluders& o);
+
+/**
+ * @brief Cover the solid voxels of every cell with boxes.
+ * @param[out] o boxes of each cell
+ * @param occupancy solid voxels
+ * @param threads threads to work with, zero for one per core
+ * @note Boxes are found greedily: a run along x is grown along y, then
+ *   along z, as far as every voxel it takes in is solid.
+ */
+void voxelocclude_occluders_build(voxelocclude_occluders& o,
+  const voxeloccupancy& occupancy, unsigned int threads = 0);
+
+/**
+ * @brief Redo the boxes of every cell that reaches into an edited box.
+ * @param lo first corner, inclusive
+ * @param hi last corner, exclusive
+ */
+void voxelocclude_occluders_update(voxelocclude_occluders& o,
+  const voxeloccupancy& occupancy, const unsigned int lo[3],
+  const unsigned int hi[3]);
+
+/**
+ * @brief Size the depth buffer and its pyramid, all cleared to far.
+ * @param width pixels across
+ * @param height pixels up
+ * @param budget_ms time allowed for drawing occluders per view
+ * @param max_occluders most occluder chunks drawn per view
+ * @return false when a size is zero
+ */
+bool voxelocclude_init(voxelocclude& occ,
+  unsigned int width = VoxelOcclude_Width,
+  unsigned int height = VoxelOcclude_Height, double budget_ms = 1.0,
+  std::size_t max_occluders = 16);
+
+/**
+ * @brief Draw the boxes of the largest visible chunks into the depth
+ *   buffer and build its pyramid.
+ * @param m row-major matrix taking lattice points to clip space
+ * @param chunks runs of triangles with their bounds
+ * @param visible one entry per chunk; only nonzero ones may occlude
+ * @param o boxes of the cells the chunks came from
+ * @param threads threads to draw with, zero for one per core
+ * @return occluder chunks drawn
+ * @note Occluders are the chunks covering the most screen area, drawn
+ *   in that order. Rows are split in bands drawn as tasks on
+ *   `workpool_shared()`; each band stops at `budget_ms` after the call
+ *   started. Skipped occluders only make culling weaker, never wrong.
+ * @note Boxes crossing the near plane are not drawn.
+ */
+std::size_t voxelocclude_render(voxelocclude& occ, const float m[16],
+  const std::vector<voxelcull_chunk>& chunks,
+  const std::vector<char>& visible, const voxelocclude_occluders& o,
+  unsigned int threads = 0);
+
+/**
+ * @brief Whether part of a box may be seen past the occluders drawn by
+ *   the last `voxelocclude_render`.
+ * @param m the matrix given to `voxelocclude_render`
+ * @note Conservative: boxes crossing the near plane or off screen pass.
+ */
+bool voxelocclude_box_visible(const voxelocclude& occ, const float m[16],
+  const float lo[3], const float hi[3]);
+
+/**
+ * @brief Clear the entries of `visible` whose chunks are hidden.
+ * @note Runs `voxelocclude_render`, then tests every visible chunk on
+ *   `workpool_shared()`. Updates `occ.stats`.
+ * @return chunks found hidden
+ */
+std::size_t voxelocclude_cull(voxelocclude& occ, const float m[16],
+  const std::vector<voxelcull_chunk>& chunks, std::vector<char>& visible,
+  const voxelocclude_occluders& o, unsigned int threads = 0);
+
+#endif //hg_VOXELOCCLUDE_h_
@@ -0,0 +1,228 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxeloccupancy.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxeloccupancy.h"
+#include "voxelmesh.h"
+#include "workpool.h"
+#include <algorithm>
+#include <new>
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif //__AVX2__
+
+static
+void voxeloccupancy_build_row(const voxelbricks& voxels, unsigned int y,
+  unsigned int z, unsigned long long* row);
+static
+unsigned int voxeloccupancy_popcount(unsigned long long w);
+
+
+//Set the bits of one row from the bricks it crosses.
+void voxeloccupancy_build_row(const voxelbricks& voxels, unsigned int y,
+  unsigned int z, unsigned long long* row)
+{
+  for (unsigned int x = 0; x < voxels.width; x += VoxelBricks_Edge) {
+    const std::size_t b = voxelbricks_index(voxels, x, y, z);
+    const unsigned int n = (std::min)(voxels.width - x, VoxelBricks_Edge);
+    //a brick run never crosses a word, since 64 is a multiple of 16
+    unsigned long long run = 0;
+    if (voxels.dense[b].empty()) {
+      if (voxels.uniform[b] != 0)
+        run = (1ull << n) - 1;
+    } else {
+      for (unsigned int i = 0; i < n; ++i) {
+        const std::size_t e = voxelbricks_entry(voxels, x+i, y, z);
+        if (voxelbricks_load(voxels, b, e) != 0)
+          run |= 1ull << i;
+      }
+    }
+    row[x/VoxelOccupancy_WordBits] |= run << (x%VoxelOccupancy_WordBits);
+  }
+}
+
+unsigned int voxeloccupancy_popcount(unsigned long long w) {
+#if defined(__GNUC__)
+  return static_cast<unsigned int>(__builtin_popcountll(w));
+#else
+  w = w - ((w >> 1) & 0x5555555555555555ull);
+  w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+  w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+  return static_cast<unsigned int>((w * 0x0101010101010101ull) >> 56);
+#endif //__GNUC__
+}
+
+void voxeloccupancy_clear(voxeloccupancy& occ) {
+  occ.width = occ.height = occ.depth = 0;
+  occ.words = 0;
+  std::vector<unsigned long long>().swap(occ.bits);
+}
+
+bool voxeloccupancy_build(voxeloccupancy& occ, const voxelbricks& voxels,
+  unsigned int threads)
+{
+  voxeloccupancy_clear(occ);
+  const std::size_t words = voxels.width/VoxelOccupancy_WordBits
+    + ((voxels.width%VoxelOccupancy_WordBits) ? 1 : 0);
+  const std::size_t rows = static_cast<std::size_t>(voxels.height)
+    *voxels.depth;
+  if (words != 0 && rows > occ.bits.max_size()/words)
+    return false;
+  try {
+    occ.bits.assign(words*rows, 0);
+  } catch (const std::bad_alloc& ) {
+    return false;
+  }
+  occ.width = voxels.width;
+  occ.height = voxels.height;
+  occ.depth = voxels.depth;
+  occ.words = words;
+  workpool_shared().parallel_for(occ.depth, [&](std::size_t z) {
+    for (unsigned int y = 0; y < occ.height; ++y) {
+      voxeloccupancy_build_row(voxels, y, static_cast<unsigned int>(z),
+        &occ.bits[(y + z*occ.height)*words]);
+    }
+  }, threads);
+  return true;
+}
+
+long long voxeloccupancy_fill(voxeloccupancy& occ, const unsigned int lo[3],
+  const unsigned int hi[3], bool solid)
+{
+  const unsigned int dims[3] = {occ.width, occ.height, occ.depth};
+  unsigned int box_hi[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    box_hi[a] = (std::min)(hi[a], dims[a]);
+    if (lo[a] >= box_hi[a])
+      return 0;
+  }
+  const std::size_t first = lo[0]/VoxelOccupancy_WordBits;
+  const std::size_t last = (box_hi[0]-1)/VoxelOccupancy_WordBits;
+  long long change = 0;
+  for (unsigned int z = lo[2]; z < box_hi[2]; ++z)
+  for (unsigned int y = lo[1]; y < box_hi[1]; ++y) {
+    unsigned long long* row = &occ.bits[(y + static_cast<std::size_t>(z)
+      *occ.height)*occ.words];
+    for (std::size_t w = first; w <= last; ++w) {
+      //bits of the box within word `w`
+      const unsigned int from = (w == first) ? lo[0]%VoxelOccupancy_WordBits
+        : 0;
+      const unsigned int to = (w == last)
+        ? (box_hi[0]-1)%VoxelOccupancy_WordBits + 1 : VoxelOccupancy_WordBits;
+      const unsigned long long mask = ~((1ull << from) - 1)
+        & ((to == VoxelOccupancy_WordBits) ? ~0ull : ((1ull << to) - 1));
+      const unsigned int before = voxeloccupancy_popcount(row[w] & mask);
+      if (solid) {
+        row[w] |= mask;
+        change += static_cast<long long>(to - from) - before;
+      } else {
+        row[w] &= ~mask;
+        change -= before;
+      }
+    }
+  }
+  return change;
+}
+
+unsigned long long voxeloccupancy_face_word(const voxeloccupancy& occ,
+  unsigned int face, unsigned int y, unsigned int z, std::size_t w)
+{
+  const unsigned long long* row = voxeloccupancy_row(occ, y, z);
+  const std::size_t n = occ.words;
+  switch (face) {
+  case VoxelMesh_PosX:
+    return row[w] & ~((row[w] >> 1) | ((w+1 < n) ? (row[w+1] << 63) : 0));
+  case VoxelMesh_NegX:
+    return row[w] & ~((row[w] << 1) | ((w > 0) ? (row[w-1] >> 63) : 0));
+  case VoxelMesh_PosY:
+    return (y+1 < occ.height) ? row[w] & ~voxeloccupancy_row(occ, y+1, z)[w]
+      : row[w];
+  case VoxelMesh_NegY:
+    return (y > 0) ? row[w] & ~voxeloccupancy_row(occ, y-1, z)[w] : row[w];
+  case VoxelMesh_PosZ:
+    return (z+1 < occ.depth) ? row[w] & ~voxeloccupancy_row(occ, y, z+1)[w]
+      : row[w];
+  default:
+    return (z > 0) ? row[w] & ~voxeloccupancy_row(occ, y, z-1)[w] : row[w];
+  }
+}
+
+void voxeloccupancy_faces(const voxeloccupancy& occ, unsigned int face,
+  unsigned int y, unsigned int z, unsigned long long* out)
+{
+  const std::size_t n = occ.words;
+  if (n == 0)
+    return;
+  const unsigned long long* row = voxeloccupancy_row(occ, y, z);
+  if (face == VoxelMesh_PosX || face == VoxelMesh_NegX) {
+    //neighbor along x is the same row shifted by one voxel
+    for (std::size_t w = 0; w < n; ++w) {
+      unsigned long long nb;
+      if (face == VoxelMesh_PosX)
+        nb = (row[w] >> 1) | ((w+1 < n) ? (row[w+1] << 63) : 0);
+      else
+        nb = (row[w] << 1) | ((w > 0) ? (row[w-1] >> 63) : 0);
+      out[w] = row[w] & ~nb;
+    }
+    return;
+  }
+
+  const unsigned long long* nb = NULL;
+  switch (face) {
+  case VoxelMesh_PosY:
+    if (y+1 < occ.height) nb = voxeloccupancy_row(occ, y+1, z);
+    break;
+  case VoxelMesh_NegY:
+    if (y > 0) nb = voxeloccupancy_row(occ, y-1, z);
+    break;
+  case VoxelMesh_PosZ:
+    if (z+1 < occ.depth) nb = voxeloccupancy_row(occ, y, z+1);
+    break;
+  default:
+    if (z > 0) nb = voxeloccupancy_row(occ, y, z-1);
+    break;
+  }
+  if (nb == NULL) {
+    std::copy(row, row + n, out);
+    return;
+  }
+  std::size_t w = 0;
+#ifdef __AVX2__
+  for (; w+4 <= n; w += 4) {
+    const __m256i a = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(row + w));
+    const __m256i b = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(nb + w));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + w),
+      _mm256_andnot_si256(b, a));
+  }
+#endif //__AVX2__
+  for (; w < n; ++w)
+    out[w] = row[w] & ~nb[w];
+}
+
+unsigned long long voxeloccupancy_count_faces(const voxeloccupancy& occ,
+  unsigned int threads)
+{
+  if (occ.words == 0)
+    return 0;
+  std::vector<unsigned long long> per_layer(occ.depth, 0);
+  workpool_shared().parallel_for(occ.depth, [&](std::size_t z) {
+    std::vector<unsigned long long> faces(occ.words);
+    unsigned long long n = 0;
+    for (unsigned int y = 0; y < occ.height; ++y)
+    for (unsigned int face = 0; face < 6; ++face) {
+      voxeloccupancy_faces(occ, face, y, static_cast<unsigned int>(z),
+        &faces[0]);
+      for (std::size_t w = 0; w < occ.words; ++w)
+        n += voxeloccupancy_popcount(faces[w]);
+    }
+    per_layer[z] = n;
+  }, threads);
+  unsigned long long total = 0;
+  for (std::size_t z = 0; z < per_layer.size(); ++z)
+    total += per_layer[z];
+  return total;
+}
@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxeloccupancy.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELOCCUPANCY_h_
+#define hg_VOXELOCCUPANCY_h_
+
+#include "voxelbricks.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Voxels per occupancy word.
+ */
+static const unsigned int VoxelOccupancy_WordBits = 64;
+
+/**
+ * @brief One bit per voxel: set when the voxel is solid.
+ * @note Each row of voxels along x is `words` 64-bit words; voxel `x` is
+ *   bit `x%64` of word `x/64`. Row `(y, z)` starts at word
+ *   `(y + z*height)*words`. Bits past `width` are always clear.
+ */
+struct voxeloccupancy {
+  /**
+   * @brief Size of the volume in voxels.
+   */
+  unsigned int width, height, depth;
+  /**
+   * @brief Words per row.
+   */
+  std::size_t words;
+  /**
+   * @brief All rows, `words*height*depth` entries.
+   */
+  std::vector<unsigned long long> bits;
+};
+
+/**
+ * @brief Release the bits, leaving an empty volume.
+ */
+void voxeloccupancy_clear(voxeloccupancy& occ);
+
+/**
+ * @brief Build the occupancy of a brick volume.
+ * @param[out] occ occupancy to fill
+ * @param voxels source volume
+ * @param threads threads to build with, zero for one per core
+ * @return false when memory runs out; `occ` is then empty
+ * @note Uniform bricks set whole 16-bit runs at once.
+ */
+bool voxeloccupancy_build(voxeloccupancy& occ, const voxelbricks& voxels,
+  unsigned int threads = 0);
+
+/**
+ * @brief Set or clear the bits of a box, after the same box of the
+ *   source volume was filled.
+ * @param lo first corner, inclusive
+ * @param hi last corner, exclusive; clipped to the volume
+ * @param solid whether the box is now solid
+ * @return change in the number of solid voxels
+ */
+long long voxeloccupancy_fill(voxeloccupancy& occ, const unsigned int lo[3],
+  const unsigned int hi[3], bool solid);
+
+/**
+ * @brief Visible faces of one row in one direction.
+ * @param face one of `voxelmesh_face`
+ * @param y,z the row
+ * @param[out] out `occ.words` words; bit set where a solid voxel has an
+ *   empty neighbor, or no neighbor, on that side
+ * @note X faces shift the row by one voxel, carrying between words; the
+ *   other faces AND-NOT the neighboring row, four words at a time when
+ *   built with AVX2.
+ */
+void voxeloccupancy_faces(const voxeloccupancy& occ, unsigned int face,
+  unsigned int y, unsigned int z, unsigned long long* out);
+
+/**
+ * @brief Visible faces of one word of a row, as `voxeloccupancy_faces`.
+ * @param w word of the row, below `occ.words`
+ * @note The mesher reads faces this way, since each of its chunks covers
+ *   part of one word of a row; whole rows, and the AVX2 kernel, serve
+ *   `voxeloccupancy_count_faces`.
+ */
+unsigned long long voxeloccupancy_face_word(const voxeloccupancy& occ,
+  unsigned int face, unsigned int y, unsigned int z, std::size_t w);
+
+/**
+ * @brief Count the visible faces of the whole volume.
+ * @param threads threads to count with, zero for one per core
+ * @return faces over all six directions
+ */
+unsigned long long voxeloccupancy_count_faces(const voxeloccupancy& occ,
+  unsigned int threads = 0);
+
+/**
+ * @brief First word of row `(y, z)`.
+ */
+inline const unsigned long long* voxeloccupancy_row(
+  const voxeloccupancy& occ, unsigned int y, unsigned int z)
+{
+  return &occ.bits[(y + static_cast<std::size_t>(z)*occ.height)*occ.words];
+}
+
+/**
+ * @brief Whether a voxel is solid; false outside the volume.
+ */
+inline bool voxeloccupancy_test(const voxeloccupancy& occ,
+  unsigned int x, unsigned int y, unsigned int z)
+{
+  if (x >= occ.width || y >= occ.height || z >= occ.depth)
+    return false;
+  return ((voxeloccupancy_row(occ, y, z)[x/VoxelOccupancy_WordBits]
+    >> (x%VoxelOccupancy_WordBits)) & 1) != 0;
+}
+
+/**
+ * @brief Bytes held by the bits.
+ */
+inline std::size_t voxeloccupancy_bytes(const voxeloccupancy& occ) {
+  return occ.bits.size()*sizeof(unsigned long long);
+}
+
+#endif //hg_VOXELOCCUPANCY_h_
@@ -0,0 +1,586 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxeloctree.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxeloctree.h"
+#include "workpool.h"
+#include "u8names.h"
+#include <qbvoxel/api.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <new>
+
+//File header: magic, version, width, height, depth, edge, node count
+static const unsigned char VoxelOctree_Magic[4] = {'V', 'X', 'O', 'T'};
+static const unsigned long int VoxelOctree_Version = 1;
+//Largest axis the tree can span
+static const unsigned int VoxelOctree_MaxEdge = 1u << 31;
+
+//A pyramid cell: a uniform value, or the mean color of a mixed region
+struct voxeloctree_cell {
+  unsigned int value;
+  bool uniform;
+};
+
+//Cells of one region, halved per level: `dims[3*k..3*k+2]` cells per axis
+//at level `k`. Cells past `dims` are empty.
+struct voxeloctree_pyramid {
+  std::vector<std::vector<voxeloctree_cell> > levels;
+  std::vector<unsigned int> dims;
+};
+
+struct voxeloctree_ray {
+  float origin[3];
+  float dir[3];
+};
+
+static
+voxeloctree_cell voxeloctree_reduce(const voxeloctree_cell c[8]);
+static
+voxeloctree_cell voxeloctree_cell_at(const voxeloctree_pyramid& pyr,
+  unsigned int level, unsigned int x, unsigned int y, unsigned int z);
+static
+void voxeloctree_shrink(voxeloctree_pyramid& pyr, unsigned int levels);
+template <typename Splice>
+static
+void voxeloctree_emit(const voxeloctree_pyramid& pyr, unsigned int level,
+  unsigned int x, unsigned int y, unsigned int z,
+  std::vector<voxeloctree_node>& out, std::size_t slot, Splice& splice);
+static
+void voxeloctree_brick_tree(const unsigned int* data,
+  std::vector<voxeloctree_node>& out);
+static
+bool voxeloctree_slab(const voxeloctree_ray& r, const float lo[3],
+  const float hi[3], float& t0, float& t1, unsigned int& axis);
+static
+bool voxeloctree_ray_node(const voxeloctree& tree, const voxeloctree_ray& r,
+  std::size_t index, const unsigned int lo[3], unsigned int size,
+  float t0, float t1, unsigned int axis, voxeloctree_hit& hit);
+static
+bool voxeloctree_little_endian();
+
+
+//Merge eight child cells: uniform when they all hold the same value.
+voxeloctree_cell voxeloctree_reduce(const voxeloctree_cell c[8]) {
+  voxeloctree_cell out = {c[0].value, true};
+  for (unsigned int i = 0; i < 8 && out.uniform; ++i)
+    out.uniform = c[i].uniform && c[i].value == c[0].value;
+  if (out.uniform)
+    return out;
+  unsigned long int sum[3] = {0, 0, 0};
+  unsigned long int n = 0;
+  for (unsigned int i = 0; i < 8; ++i) {
+    if (c[i].value == 0)
+      continue;
+    sum[0] += c[i].value & 255;
+    sum[1] += (c[i].value >> 8) & 255;
+    sum[2] += (c[i].value >> 16) & 255;
+    n += 1;
+  }
+  out.value = (n == 0) ? 0 : voxelbricks_pack(
+    static_cast<unsigned char>(sum[0]/n), static_cast<unsigned char>(sum[1]/n),
+    static_cast<unsigned char>(sum[2]/n), 255);
+  return out;
+}
+
+voxeloctree_cell voxeloctree_cell_at(const voxeloctree_pyramid& pyr,
+  unsigned int level, unsigned int x, unsigned int y, unsigned int z)
+{
+  const unsigned int* d = &pyr.dims[level*3];
+  if (x >= d[0] || y >= d[1] || z >= d[2]) {
+    voxeloctree_cell empty = {0, true};
+    return empty;
+  }
+  return pyr.levels[level][x + (y + static_cast<std::size_t>(z)*d[1])*d[0]];
+}
+
+//Add `levels` levels above the last one, halving each axis.
+void voxeloctree_shrink(voxeloctree_pyramid& pyr, unsigned int levels) {
+  for (unsigned int k = 0; k < levels; ++k) {
+    const unsigned int below = static_cast<unsigned int>(pyr.levels.size()-1);
+    unsigned int d[3];
+    for (unsigned int a = 0; a < 3; ++a)
+      d[a] = (pyr.dims[below*3+a] + 1) / 2;
+    pyr.dims.insert(pyr.dims.end(), d, d+3);
+    pyr.levels.push_back(std::vector<voxeloctree_cell>(
+      static_cast<std::size_t>(d[0])*d[1]*d[2]));
+    std::vector<voxeloctree_cell>& cells = pyr.levels.back();
+    std::size_t pos = 0;
+    for (unsigned int z = 0; z < d[2]; ++z)
+    for (unsigned int y = 0; y < d[1]; ++y)
+    for (unsigned int x = 0; x < d[0]; ++x, ++pos) {
+      voxeloctree_cell c[8];
+      for (unsigned int i = 0; i < 8; ++i)
+        c[i] = voxeloctree_cell_at(pyr, below,
+          x*2 + (i&1), y*2 + ((i>>1)&1), z*2 + ((i>>2)&1));
+      cells[pos] = voxeloctree_reduce(c);
+    }
+  }
+}
+
+//Write the node for one pyramid cell into `out[slot]`, appending its
+//children depth first. `splice(x, y, z, out, slot)` fills mixed cells of
+//level zero.
+template <typename Splice>
+void voxeloctree_emit(const voxeloctree_pyramid& pyr, unsigned int level,
+  unsigned int x, unsigned int y, unsigned int z,
+  std::vector<voxeloctree_node>& out, std::size_t slot, Splice& splice)
+{
+  const voxeloctree_cell cell = voxeloctree_cell_at(pyr, level, x, y, z);
+  out[slot].value = cell.value;
+  out[slot].children = 0;
+  if (cell.uniform)
+    return;
+  if (level == 0) {
+    splice(x, y, z, out, slot);
+    return;
+  }
+  const std::size_t base = out.size();
+  if (base > std::numeric_limits<unsigned int>::max() - 8)
+    throw std::bad_alloc();
+  voxeloctree_node blank = {0, 0};
+  out.resize(base + 8, blank);
+  out[slot].children = static_cast<unsigned int>(base);
+  for (unsigned int i = 0; i < 8; ++i) {
+    voxeloctree_emit(pyr, level-1, x*2 + (i&1), y*2 + ((i>>1)&1),
+      z*2 + ((i>>2)&1), out, base + i, splice);
+  }
+}
+
+struct voxeloctree_no_splice {
+  void operator()(unsigned int, unsigned int, unsigned int,
+    std::vector<voxeloctree_node>&, std::size_t) {}
+};
+
+//Subtree of one dense brick, root first.
+void voxeloctree_brick_tree(const unsigned int* data,
+  std::vector<voxeloctree_node>& out)
+{
+  voxeloctree_pyramid pyr;
+  pyr.levels.resize(1);
+  pyr.levels[0].resize(VoxelBricks_Size);
+  for (std::size_t i = 0; i < VoxelBricks_Size; ++i) {
+    pyr.levels[0][i].value = data[i];
+    pyr.levels[0][i].uniform = true;
+  }
+  pyr.dims.assign(3, VoxelBricks_Edge);
+  voxeloctree_shrink(pyr, VoxelBricks_Shift);
+  voxeloctree_node root = {0, 0};
+  out.assign(1, root);
+  voxeloctree_no_splice none;
+  voxeloctree_emit(pyr, VoxelBricks_Shift, 0, 0, 0, out, 0, none);
+}
+
+void voxeloctree_init(voxeloctree& tree) {
+  tree.width = tree.height = tree.depth = 0;
+  tree.edge = 0;
+  tree.count = 0;
+  tree.storage.clear();
+  tree.file.data = NULL;
+  tree.file.size = 0;
+#ifdef _WIN32
+  tree.file.file = NULL;
+  tree.file.mapping = NULL;
+#else
+  tree.file.fd = -1;
+#endif //_WIN32
+}
+
+void voxeloctree_clear(voxeloctree& tree) {
+  mapped_file_close(tree.file);
+  std::vector<voxeloctree_node>().swap(tree.storage);
+  voxeloctree_init(tree);
+}
+
+bool voxeloctree_build(voxeloctree& tree, const voxelbricks& voxels,
+  unsigned int threads)
+{
+  voxeloctree_clear(tree);
+  const unsigned int largest =
+    (std::max)(voxels.width, (std::max)(voxels.height, voxels.depth));
+  if (largest > VoxelOctree_MaxEdge)
+    return false;
+  unsigned int edge = VoxelBricks_Edge;
+  unsigned int levels = 0;
+  while (edge < largest) {
+    edge <<= 1;
+    levels += 1;
+  }
+
+  try {
+    //Subtrees of the dense bricks, in parallel
+    const std::size_t bricks = voxels.uniform.size();
+    std::vector<std::vector<voxeloctree_node> > subtrees(bricks);
+    std::vector<char> failed(bricks, 0);
+    workpool_shared().parallel_for(bricks, [&](std::size_t b) {
+      if (voxels.dense[b].empty())
+        return;
+      try {
+        std::vector<unsigned int> values(VoxelBricks_Size);
+        voxelbricks_read_brick(voxels, b, &values[0]);
+        voxeloctree_brick_tree(&values[0], subtrees[b]);
+      } catch (const std::bad_alloc& ) {
+        failed[b] = 1;
+      }
+    }, threads);
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end())
+      return false;
+
+    //Pyramid over the bricks, up to the root
+    voxeloctree_pyramid pyr;
+    pyr.levels.resize(1);
+    pyr.levels[0].resize(bricks);
+    for (std::size_t b = 0; b < bricks; ++b) {
+      voxeloctree_cell& c = pyr.levels[0][b];
+      if (subtrees[b].empty()) {
+        c.value = voxels.palette[voxels.uniform[b]];
+        c.uniform = true;
+      } else {
+        c.value = subtrees[b][0].value;
+        c.uniform = (subtrees[b][0].children == 0);
+      }
+    }
+    pyr.dims.assign(voxels.count, voxels.count+3);
+    voxeloctree_shrink(pyr, levels);
+
+    //Nodes above the bricks, then each brick subtree moved in place
+    auto splice = [&](unsigned int x, unsigned int y, unsigned int z,
+      std::vector<voxeloctree_node>& out, std::size_t slot)
+    {
+      const std::vector<voxeloctree_node>& sub = subtrees[x + (y
+        + static_cast<std::size_t>(z)*voxels.count[1])*voxels.count[0]];
+      const std::size_t base = out.size();
+      if (sub.size() - 1 > std::numeric_limits<unsigned int>::max() - base)
+        throw std::bad_alloc();
+      out.reserve(base + sub.size() - 1);
+      for (std::size_t i = 1; i < sub.size(); ++i) {
+        voxeloctree_node n = sub[i];
+        if (n.children != 0)
+          n.children = static_cast<unsigned int>(n.children - 1 + base);
+        out.push_back(n);
+      }
+      out[slot].children = static_cast<unsigned int>(sub[0].children - 1 + base);
+    };
+    voxeloctree_node root = {0, 0};
+    tree.storage.assign(1, root);
+    voxeloctree_emit(pyr, levels, 0, 0, 0, tree.storage, 0, splice);
+  } catch (const std::bad_alloc& ) {
+    voxeloctree_clear(tree);
+    return false;
+  }
+  tree.width = voxels.width;
+  tree.height = voxels.height;
+  tree.depth = voxels.depth;
+  tree.edge = edge;
+  tree.count = tree.storage.size();
+  return true;
+}
+
+unsigned int voxeloctree_get(const voxeloctree& tree,
+  unsigned int x, unsigned int y, unsigned int z)
+{
+  if (x >= tree.width || y >= tree.height || z >= tree.depth)
+    return 0;
+  const voxeloctree_node* nodes = voxeloctree_nodes(tree);
+  std::size_t i = 0;
+  unsigned int size = tree.edge;
+  while (nodes[i].children != 0) {
+    size >>= 1;
+    i = nodes[i].children + ((x & size) ? 1 : 0)
+      + ((y & size) ? 2 : 0) + ((z & size) ? 4 : 0);
+  }
+  return nodes[i].value;
+}
+
+void voxeloctree_query(const voxeloctree& tree, const unsigned int lo[3],
+  const unsigned int hi[3], std::vector<voxeloctree_leaf>& leaves)
+{
+  leaves.clear();
+  const unsigned int dims[3] = {tree.width, tree.height, tree.depth};
+  unsigned int box_hi[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    box_hi[a] = (std::min)(hi[a], dims[a]);
+    if (lo[a] >= box_hi[a])
+      return;
+  }
+  const voxeloctree_node* nodes = voxeloctree_nodes(tree);
+  struct entry {
+    std::size_t index;
+    unsigned int pos[3];
+    unsigned int size;
+  };
+  std::vector<entry> stack;
+  entry root = {0, {0, 0, 0}, tree.edge};
+  stack.push_back(root);
+  while (!stack.empty()) {
+    const entry e = stack.back();
+    stack.pop_back();
+    bool overlap = true;
+    for (unsigned int a = 0; a < 3 && overlap; ++a) {
+      overlap = e.pos[a] < box_hi[a]
+        && static_cast<unsigned long long>(e.pos[a]) + e.size > lo[a];
+    }
+    if (!overlap)
+      continue;
+    const voxeloctree_node& n = nodes[e.index];
+    if (n.children == 0) {
+      if (n.value != 0) {
+        voxeloctree_leaf leaf = {e.pos[0], e.pos[1], e.pos[2], e.size,
+          n.value};
+        leaves.push_back(leaf);
+      }
+      continue;
+    }
+    //push in reverse so children come out in index order
+    const unsigned int half = e.size >> 1;
+    for (unsigned int i = 8; i-- > 0; ) {
+      entry c = {n.children + i, {e.pos[0] + ((i&1) ? half : 0),
+        e.pos[1] + ((i&2) ? half : 0), e.pos[2] + ((i&4) ? half : 0)}, half};
+      stack.push_back(c);
+    }
+  }
+}
+
+//Ray interval inside a box; `axis` is the axis of the entry plane.
+bool voxeloctree_slab(const voxeloctree_ray& r, const float lo[3],
+  const float hi[3], float& t0, float& t1, unsigned int& axis)
+{
+  for (unsigned int a = 0; a < 3; ++a) {
+    if (r.dir[a] == 0.f) {
+      if (r.origin[a] < lo[a] || r.origin[a] >= hi[a])
+        return false;
+      continue;
+    }
+    float near_t = (lo[a] - r.origin[a]) / r.dir[a];
+    float far_t = (hi[a] - r.origin[a]) / r.dir[a];
+    if (near_t > far_t)
+      std::swap(near_t, far_t);
+    if (near_t > t0) {
+      t0 = near_t;
+      axis = a;
+    }
+    if (far_t < t1)
+      t1 = far_t;
+  }
+  return t0 < t1;
+}
+
+//Visit a node the ray crosses on [t0, t1], children nearest first.
+bool voxeloctree_ray_node(const voxeloctree& tree, const voxeloctree_ray& r,
+  std::size_t index, const unsigned int lo[3], unsigned int size,
+  float t0, float t1, unsigned int axis, voxeloctree_hit& hit)
+{
+  const voxeloctree_node& n = voxeloctree_nodes(tree)[index];
+  if (n.children == 0) {
+    if (n.value == 0)
+      return false;
+    const unsigned int dims[3] = {tree.width, tree.height, tree.depth};
+    unsigned int voxel[3];
+    for (unsigned int a = 0; a < 3; ++a) {
+      const unsigned int last = (std::min)(
+        static_cast<unsigned long long>(lo[a]) + size,
+        static_cast<unsigned long long>(dims[a])) - 1;
+      //clamping puts points on the leaf's faces into the leaf
+      const float p = r.origin[a] + r.dir[a]*t0;
+      if (p <= static_cast<float>(lo[a]))
+        voxel[a] = lo[a];
+      else
+        voxel[a] = (std::min)(static_cast<unsigned int>(p), last);
+    }
+    hit.t = t0;
+    hit.x = voxel[0];
+    hit.y = voxel[1];
+    hit.z = voxel[2];
+    hit.face = axis*2 + ((r.dir[axis] > 0.f) ? 1 : 0);
+    hit.value = n.value;
+    return true;
+  }
+
+  struct child {
+    unsigned int i;
+    float t0, t1;
+    unsigned int axis;
+  } order[8];
+  unsigned int count = 0;
+  const unsigned int half = size >> 1;
+  for (unsigned int i = 0; i < 8; ++i) {
+    unsigned int clo[3] = {lo[0] + ((i&1) ? half : 0),
+      lo[1] + ((i&2) ? half : 0), lo[2] + ((i&4) ? half : 0)};
+    float flo[3], fhi[3];
+    for (unsigned int a = 0; a < 3; ++a) {
+      flo[a] = static_cast<float>(clo[a]);
+      fhi[a] = static_cast<float>(clo[a]) + static_cast<float>(half);
+    }
+    child c = {i, t0, t1, axis};
+    if (!voxeloctree_slab(r, flo, fhi, c.t0, c.t1, c.axis))
+      continue;
+    unsigned int k = count++;
+    for (; k > 0 && order[k-1].t0 > c.t0; --k)
+      order[k] = order[k-1];
+    order[k] = c;
+  }
+  for (unsigned int k = 0; k < count; ++k) {
+    const child& c = order[k];
+    unsigned int clo[3] = {lo[0] + ((c.i&1) ? half : 0),
+      lo[1] + ((c.i&2) ? half : 0), lo[2] + ((c.i&4) ? half : 0)};
+    if (voxeloctree_ray_node(tree, r, n.children + c.i, clo, half,
+          c.t0, c.t1, c.axis, hit))
+      return true;
+  }
+  return false;
+}
+
+bool voxeloctree_raycast(const voxeloctree& tree, const float origin[3],
+  const float dir[3], float max_t, voxeloctree_hit& hit)
+{
+  if (tree.count == 0)
+    return false;
+  voxeloctree_ray r;
+  for (unsigned int a = 0; a < 3; ++a) {
+    r.origin[a] = origin[a];
+    r.dir[a] = dir[a];
+  }
+  //Only the volume itself; leaves may reach past its far sides.
+  const float lo[3] = {0.f, 0.f, 0.f};
+  const float hi[3] = {static_cast<float>(tree.width),
+    static_cast<float>(tree.height), static_cast<float>(tree.depth)};
+  float t0 = 0.f;
+  float t1 = max_t;
+  unsigned int axis = 0;
+  if (!voxeloctree_slab(r, lo, hi, t0, t1, axis))
+    return false;
+  const unsigned int root[3] = {0, 0, 0};
+  return voxeloctree_ray_node(tree, r, 0, root, tree.edge, t0, t1, axis, hit);
+}
+
+bool voxeloctree_little_endian() {
+  const unsigned int one = 1;
+  unsigned char first;
+  std::memcpy(&first, &one, 1);
+  return first == 1 && sizeof(voxeloctree_node) == 8;
+}
+
+unsigned int voxeloctree_save(const voxeloctree& tree, const char* path) {
+#ifdef _WIN32
+  std::FILE* fp ;
+  /* */{
+    std::wstring wcpath;
+    if (u8names_towc(path, wcpath) != 0)
+      return 9/* other io */;
+    fp = _wfopen(wcpath.c_str(), L"wb");
+  }
+#else
+  std::FILE* fp = std::fopen(path, "wb");
+#endif //_WIN32
+  if (fp == NULL)
+    return 9/* other io */;
+
+  unsigned char header[VoxelOctree_HeaderSize];
+  std::memcpy(header, VoxelOctree_Magic, 4);
+  qbvoxel_api_to_u32(header+4, VoxelOctree_Version);
+  qbvoxel_api_to_u32(header+8, tree.width);
+  qbvoxel_api_to_u32(header+12, tree.height);
+  qbvoxel_api_to_u32(header+16, tree.depth);
+  qbvoxel_api_to_u32(header+20, tree.edge);
+  qbvoxel_api_to_u32(header+24, static_cast<unsigned long int>(tree.count));
+  qbvoxel_api_to_u32(header+28, 0);
+  bool ok = std::fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+
+  unsigned char buf[8*1024];
+  std::size_t used = 0;
+  const voxeloctree_node* nodes = voxeloctree_nodes(tree);
+  for (std::size_t i = 0; i < tree.count && ok; ++i) {
+    qbvoxel_api_to_u32(buf+used, nodes[i].children);
+    qbvoxel_api_to_u32(buf+used+4, nodes[i].value);
+    used += 8;
+    if (used == sizeof(buf) || i+1 == tree.count) {
+      ok = std::fwrite(buf, 1, used, fp) == used;
+      used = 0;
+    }
+  }
+  if (std::fclose(fp) != 0)
+    ok = false;
+  return ok ? 0 : 9/* other io */;
+}
+
+unsigned int voxeloctree_map(voxeloctree& tree, const char* path) {
+  voxeloctree_clear(tree);
+  unsigned int error = mapped_file_open(tree.file, path);
+  if (error != 0)
+    return error;
+  const unsigned char* bytes = tree.file.data;
+  const std::size_t size = tree.file.size;
+  if (size < VoxelOctree_HeaderSize || std::memcmp(bytes, VoxelOctree_Magic, 4)
+  ||  qbvoxel_api_from_u32(bytes+4) != VoxelOctree_Version)
+  {
+    voxeloctree_clear(tree);
+    return QBVoxel_ErrData;
+  }
+  const unsigned long int dims[3] = {qbvoxel_api_from_u32(bytes+8),
+    qbvoxel_api_from_u32(bytes+12), qbvoxel_api_from_u32(bytes+16)};
+  const unsigned long int edge = qbvoxel_api_from_u32(bytes+20);
+  const std::size_t count = qbvoxel_api_from_u32(bytes+24);
+  bool ok = count > 0 && (size - VoxelOctree_HeaderSize)/8 == count
+    && (size - VoxelOctree_HeaderSize)%8 == 0
+    && edge >= VoxelBricks_Edge && edge <= VoxelOctree_MaxEdge
+    && (edge & (edge-1)) == 0;
+  for (unsigned int a = 0; a < 3 && ok; ++a)
+    ok = dims[a] <= edge;
+  if (!ok) {
+    voxeloctree_clear(tree);
+    return QBVoxel_ErrData;
+  }
+
+  //Children follow their parent and stay within the tree, and no leaf
+  //is smaller than a voxel, so every walk ends.
+  const unsigned char* data = bytes + VoxelOctree_HeaderSize;
+  std::vector<unsigned char> level;
+  try {
+    level.assign(count, 0);
+  } catch (const std::bad_alloc& ) {
+    voxeloctree_clear(tree);
+    return QBVoxel_ErrMemory;
+  }
+  unsigned int max_level = 0;
+  while ((1ul << max_level) < edge)
+    max_level += 1;
+  for (std::size_t i = 0; i < count && ok; ++i) {
+    const unsigned long int c = qbvoxel_api_from_u32(data + i*8);
+    if (c == 0)
+      continue;
+    ok = c > i && static_cast<unsigned long long>(c) + 8 <= count
+      && level[i] < max_level;
+    for (unsigned int k = 0; k < 8 && ok; ++k)
+      level[c+k] = static_cast<unsigned char>(level[i] + 1);
+  }
+  if (!ok) {
+    voxeloctree_clear(tree);
+    return QBVoxel_ErrData;
+  }
+
+  if (!voxeloctree_little_endian()) {
+    try {
+      tree.storage.resize(count);
+    } catch (const std::bad_alloc& ) {
+      voxeloctree_clear(tree);
+      return QBVoxel_ErrMemory;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      tree.storage[i].children =
+        static_cast<unsigned int>(qbvoxel_api_from_u32(data + i*8));
+      tree.storage[i].value =
+        static_cast<unsigned int>(qbvoxel_api_from_u32(data + i*8 + 4));
+    }
+    mapped_file_close(tree.file);
+  }
+  tree.width = static_cast<unsigned int>(dims[0]);
+  tree.height = static_cast<unsigned int>(dims[1]);
+  tree.depth = static_cast<unsigned int>(dims[2]);
+  tree.edge = static_cast<unsigned int>(edge);
+  tree.count = count;
+  return 0;
+}
@@ -0,0 +1,189 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxeloctree.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELOCTREE_h_
+#define hg_VOXELOCTREE_h_
+
+#include "voxelbricks.h"
+#include "mappedfile.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief One node of a sparse voxel octree, 8 bytes.
+ * @note Nodes hold no pointers: children are found by index, so a node
+ *   array can be written to disk and mapped back as is.
+ */
+struct voxeloctree_node {
+  /**
+   * @brief Index of the first of eight consecutive children, or zero for
+   *   a leaf. Child `c` covers the octant `(c&1, (c>>1)&1, (c>>2)&1)`.
+   */
+  unsigned int children;
+  /**
+   * @brief Packed voxel of a leaf (zero when empty); for other nodes the
+   *   mean color of the solid children, with full alpha.
+   */
+  unsigned int value;
+};
+
+/**
+ * @brief Sparse voxel octree over a cube of `edge` voxels.
+ * @note Subtrees whose voxels all match are stored as one leaf. Node 0 is
+ *   the root, and children always come after their parent.
+ * @note Nodes live in `storage`, or in `file` for a mapped tree; read
+ *   them through `voxeloctree_nodes`. A mapped tree must not be copied.
+ */
+struct voxeloctree {
+  /**
+   * @brief Size of the source volume in voxels; the rest of the cube is
+   *   empty.
+   */
+  unsigned int width, height, depth;
+  /**
+   * @brief Edge of the root cube, a power of two.
+   */
+  unsigned int edge;
+  /**
+   * @brief Number of nodes.
+   */
+  std::size_t count;
+  /**
+   * @brief Nodes of a built tree.
+   */
+  std::vector<voxeloctree_node> storage;
+  /**
+   * @brief Mapping of a tree loaded with `voxeloctree_map`.
+   */
+  mapped_file file;
+};
+
+/**
+ * @brief A solid leaf cube, as found by `voxeloctree_query`.
+ */
+struct voxeloctree_leaf {
+  unsigned int x, y, z;
+  unsigned int edge;
+  unsigned int value;
+};
+
+/**
+ * @brief First solid voxel along a ray.
+ */
+struct voxeloctree_hit {
+  /**
+   * @brief Ray parameter of the hit.
+   */
+  float t;
+  /**
+   * @brief The voxel hit.
+   */
+  unsigned int x, y, z;
+  /**
+   * @brief Face of the leaf the ray entered through, a `voxelmesh_face`
+   *   value.
+   */
+  unsigned int face;
+  /**
+   * @brief Packed voxel.
+   */
+  unsigned int value;
+};
+
+/**
+ * @brief Set up an empty tree.
+ */
+void voxeloctree_init(voxeloctree& tree);
+
+/**
+ * @brief Release the nodes and any mapping, leaving an empty tree.
+ */
+void voxeloctree_clear(voxeloctree& tree);
+
+/**
+ * @brief Build a tree from a brick volume.
+ * @param[out] tree tree to fill
+ * @param voxels source volume
+ * @param threads threads to build with, zero for one per core
+ * @return false when the volume is over 2^31 voxels on some axis or
+ *   memory runs out
+ * @note Dense bricks are turned into subtrees in parallel.
+ */
+bool voxeloctree_build(voxeloctree& tree, const voxelbricks& voxels,
+  unsigned int threads = 0);
+
+/**
+ * @brief Read one voxel.
+ * @return the packed voxel; zero outside the volume
+ */
+unsigned int voxeloctree_get(const voxeloctree& tree,
+  unsigned int x, unsigned int y, unsigned int z);
+
+/**
+ * @brief Find the solid leaves that overlap a box.
+ * @param lo first corner, inclusive
+ * @param hi last corner, exclusive
+ * @param[out] leaves whole leaf cubes, replacing any previous content
+ */
+void voxeloctree_query(const voxeloctree& tree, const unsigned int lo[3],
+  const unsigned int hi[3], std::vector<voxeloctree_leaf>& leaves);
+
+/**
+ * @brief Find the first solid voxel along a ray.
+ * @param origin ray start, in voxel units
+ * @param dir ray direction; need not be normalized
+ * @param max_t largest ray parameter to accept
+ * @param[out] hit the hit, when there is one
+ * @return true on a hit
+ */
+bool voxeloctree_raycast(const voxeloctree& tree, const float origin[3],
+  const float dir[3], float max_t, voxeloctree_hit& hit);
+
+/**
+ * @brief Write a tree to a file.
+ * @return zero on success, 9 on I/O error
+ * @note The file is a 32-byte header followed by the node array as
+ *   little-endian 32-bit words.
+ */
+unsigned int voxeloctree_save(const voxeloctree& tree, const char* path);
+
+/**
+ * @brief Load a tree written by `voxeloctree_save`.
+ * @param[out] tree tree to fill
+ * @param path UTF-8 path of the file
+ * @return zero on success, 8 if the file does not exist, 9 on I/O error,
+ *   `QBVoxel_ErrData` for a malformed file
+ * @note On little-endian hosts the nodes are used straight from the
+ *   mapped file; the file is checked once on load.
+ */
+unsigned int voxeloctree_map(voxeloctree& tree, const char* path);
+
+/**
+ * @brief Byte offset of the node array in a saved tree.
+ */
+static const std::size_t VoxelOctree_HeaderSize = 32;
+
+/**
+ * @brief The node array, `tree.count` entries.
+ */
+inline const voxeloctree_node* voxeloctree_nodes(const voxeloctree& tree) {
+  if (!tree.storage.empty())
+    return &tree.storage[0];
+  else if (tree.file.data != NULL)
+    return reinterpret_cast<const voxeloctree_node*>(
+      tree.file.data + VoxelOctree_HeaderSize);
+  else
+    return NULL;
+}
+
+/**
+ * @brief Bytes held by the node array.
+ */
+inline std::size_t voxeloctree_bytes(const voxeloctree& tree) {
+  return tree.count*sizeof(voxeloctree_node);
+}
+
+#endif //hg_VOXELOCTREE_h_
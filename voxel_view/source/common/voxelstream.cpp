@@ -0,0 +1,236 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelstream.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelstream.h"
+#include <algorithm>
+#include <cstring>
+
+//GL_ARB_buffer_storage; the bundled glad stops at GL 3.2
+#ifndef GL_MAP_PERSISTENT_BIT
+#  define GL_MAP_PERSISTENT_BIT 0x0040
+#endif //GL_MAP_PERSISTENT_BIT
+#ifndef GL_MAP_COHERENT_BIT
+#  define GL_MAP_COHERENT_BIT 0x0080
+#endif //GL_MAP_COHERENT_BIT
+
+typedef void (APIENTRYP voxelstream_buffer_storage_proc)(GLenum target,
+  GLsizeiptr size, const void* data, GLbitfield flags);
+
+static
+bool voxelstream_has_storage();
+static
+void voxelstream_wait(voxelstream& s, GLsync sync);
+static
+void voxelstream_fence_pending(voxelstream& s);
+
+
+//Buffer storage is core from 4.4 and an extension before that.
+bool voxelstream_has_storage() {
+  GLint major = 0, minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major > 4 || (major == 4 && minor >= 4))
+    return true;
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; ++i) {
+    const GLubyte* name = glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i));
+    if (name != NULL && std::strcmp(reinterpret_cast<const char*>(name),
+        "GL_ARB_buffer_storage") == 0)
+      return true;
+  }
+  return false;
+}
+
+//Block until the GPU passes `sync`. Only a fence that has not signaled
+//by the time we look counts as a stall.
+void voxelstream_wait(voxelstream& s, GLsync sync) {
+  GLenum status = glClientWaitSync(sync, 0, 0);
+  if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+    return;
+  s.stats.stalls += 1;
+  do {
+    status = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+  } while (status == GL_TIMEOUT_EXPIRED);
+}
+
+//Put the writes since the last fence behind a new one.
+void voxelstream_fence_pending(voxelstream& s) {
+  if (s.head == s.pending)
+    return;
+  if (s.mapped != NULL) {
+    voxelstream_fence f;
+    f.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    f.begin = s.pending;
+    f.end = s.head;
+    s.fences.push_back(f);
+  }
+  s.pending = s.head;
+}
+
+bool voxelstream_create(voxelstream& s, std::size_t bytes,
+  GLADloadproc load)
+{
+  s.buffer = 0;
+  s.size = bytes - bytes%VoxelStream_Align;
+  s.head = s.pending = 0;
+  s.mapped = NULL;
+  s.frame_bytes = 0;
+  s.fences.clear();
+  std::memset(&s.stats, 0, sizeof(s.stats));
+  if (s.size == 0)
+    return false;
+
+  glGenBuffers(1, &s.buffer);
+  glBindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+  voxelstream_buffer_storage_proc buffer_storage = NULL;
+  if (load != NULL && voxelstream_has_storage()) {
+    buffer_storage = reinterpret_cast<voxelstream_buffer_storage_proc>(
+      load("glBufferStorage"));
+  }
+  if (buffer_storage != NULL) {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+      | GL_MAP_COHERENT_BIT;
+    buffer_storage(GL_COPY_READ_BUFFER, static_cast<GLsizeiptr>(s.size),
+      NULL, flags);
+    s.mapped = static_cast<unsigned char*>(glMapBufferRange(
+      GL_COPY_READ_BUFFER, 0, static_cast<GLsizeiptr>(s.size), flags));
+    if (s.mapped == NULL) {
+      //immutable storage cannot fall back in place
+      glDeleteBuffers(1, &s.buffer);
+      glGenBuffers(1, &s.buffer);
+      glBindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+    }
+  }
+  if (s.mapped == NULL) {
+    glBufferData(GL_COPY_READ_BUFFER, static_cast<GLsizeiptr>(s.size), NULL,
+      GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  return glGetError() == GL_NO_ERROR;
+}
+
+void voxelstream_destroy(voxelstream& s) {
+  for (std::size_t i = 0; i < s.fences.size(); ++i) {
+    glClientWaitSync(s.fences[i].sync, GL_SYNC_FLUSH_COMMANDS_BIT,
+      1000000000ull);
+    glDeleteSync(s.fences[i].sync);
+  }
+  s.fences.clear();
+  if (s.buffer != 0) {
+    if (s.mapped != NULL) {
+      glBindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+      glUnmapBuffer(GL_COPY_READ_BUFFER);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &s.buffer);
+  }
+  s.buffer = 0;
+  s.mapped = NULL;
+  s.size = s.head = s.pending = 0;
+}
+
+void* voxelstream_reserve(voxelstream& s, std::size_t bytes,
+  std::size_t& offset)
+{
+  if (bytes == 0 || bytes > s.size)
+    return NULL;
+  std::size_t at = s.head;
+  if (at + bytes > s.size) {
+    voxelstream_fence_pending(s);
+    at = s.head = s.pending = 0;
+    if (s.mapped == NULL) {
+      //the driver hands back fresh storage while the GPU keeps the old
+      glBindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+      glBufferData(GL_COPY_READ_BUFFER, static_cast<GLsizeiptr>(s.size),
+        NULL, GL_STREAM_DRAW);
+      s.stats.orphans += 1;
+    }
+  }
+
+  //Fences signal in order, so waiting on the newest one overlapping the
+  //reservation releases every older one too.
+  std::size_t last = s.fences.size();
+  for (std::size_t i = 0; i < s.fences.size(); ++i) {
+    if (s.fences[i].begin < at + bytes && at < s.fences[i].end)
+      last = i;
+  }
+  if (last < s.fences.size()) {
+    voxelstream_wait(s, s.fences[last].sync);
+    for (std::size_t i = 0; i <= last; ++i)
+      glDeleteSync(s.fences[i].sync);
+    s.fences.erase(s.fences.begin(), s.fences.begin() + last + 1);
+  }
+
+  offset = at;
+  s.head = at + bytes;
+  s.head += (VoxelStream_Align - s.head%VoxelStream_Align)%VoxelStream_Align;
+  if (s.head > s.size)
+    s.head = s.size;
+  s.frame_bytes += bytes;
+  if (s.mapped != NULL)
+    return s.mapped + at;
+  glBindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+  return glMapBufferRange(GL_COPY_READ_BUFFER, static_cast<GLintptr>(at),
+    static_cast<GLsizeiptr>(bytes), GL_MAP_WRITE_BIT
+    | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+void voxelstream_commit(voxelstream& s, std::size_t bytes) {
+  (void)bytes;
+  if (s.mapped != NULL)
+    return;
+  glBindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+  glUnmapBuffer(GL_COPY_READ_BUFFER);
+}
+
+void voxelstream_write(voxelstream& s, GLuint target,
+  std::size_t target_offset, std::size_t bytes,
+  const std::function<void(void*, std::size_t, std::size_t)>& fill)
+{
+  std::size_t piece = s.size/2;
+  piece -= piece%VoxelStream_Align;
+  if (piece == 0)
+    piece = s.size;
+  glBindBuffer(GL_COPY_WRITE_BUFFER, target);
+  for (std::size_t done = 0; done < bytes; ) {
+    const std::size_t n = (std::min)(piece, bytes - done);
+    std::size_t offset = 0;
+    void* out = voxelstream_reserve(s, n, offset);
+    if (out == NULL)
+      break;
+    fill(out, done, n);
+    voxelstream_commit(s, n);
+    glBindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+      static_cast<GLintptr>(offset),
+      static_cast<GLintptr>(target_offset + done),
+      static_cast<GLsizeiptr>(n));
+    done += n;
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void voxelstream_upload(voxelstream& s, GLuint target,
+  std::size_t target_offset, const void* data, std::size_t bytes)
+{
+  const unsigned char* src = static_cast<const unsigned char*>(data);
+  voxelstream_write(s, target, target_offset, bytes,
+    [src](void* out, std::size_t done, std::size_t n) {
+      std::memcpy(out, src + done, n);
+    });
+}
+
+void voxelstream_frame(voxelstream& s) {
+  voxelstream_fence_pending(s);
+  s.stats.frames += 1;
+  s.stats.bytes += s.frame_bytes;
+  s.stats.last_frame_bytes = s.frame_bytes;
+  s.stats.peak_frame_bytes = (std::max)(s.stats.peak_frame_bytes,
+    s.frame_bytes);
+  s.frame_bytes = 0;
+}
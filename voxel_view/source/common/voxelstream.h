@@ -0,0 +1,170 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelstream.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELSTREAM_h_
+#define hg_VOXELSTREAM_h_
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <deque>
+#include <functional>
+
+/**
+ * @brief Alignment of every reservation in a stream ring, in bytes.
+ */
+static const std::size_t VoxelStream_Align = 16;
+
+/**
+ * @brief Transfer counters of a stream ring.
+ */
+struct voxelstream_stats {
+  /**
+   * @brief Frames closed by `voxelstream_frame`.
+   */
+  unsigned long long frames;
+  /**
+   * @brief Bytes written over all frames.
+   */
+  unsigned long long bytes;
+  /**
+   * @brief Bytes written in the last closed frame, and in the busiest one.
+   */
+  unsigned long long last_frame_bytes, peak_frame_bytes;
+  /**
+   * @brief Reservations that had to wait for the GPU to release their
+   *   part of the ring.
+   */
+  unsigned long long stalls;
+  /**
+   * @brief Times the fallback ring orphaned its storage on wrap.
+   */
+  unsigned long long orphans;
+};
+
+/**
+ * @brief Ring range the GPU may still read.
+ */
+struct voxelstream_fence {
+  GLsync sync;
+  std::size_t begin, end;
+};
+
+/**
+ * @brief Ring of GPU-visible memory that uploads are written into and
+ *   copied out of by the GPU.
+ * @note With `GL_ARB_buffer_storage` (or GL 4.4) the ring is mapped once,
+ *   persistent and coherent, and each frame's part is guarded by a fence.
+ *   Otherwise each reservation maps its range unsynchronized, and the
+ *   storage is orphaned when the ring wraps.
+ * @note A ring belongs to the context it was created in; it must only be
+ *   used while that context is current.
+ */
+struct voxelstream {
+  /**
+   * @brief Ring buffer object, bound to `GL_COPY_READ_BUFFER` while in use.
+   */
+  GLuint buffer;
+  /**
+   * @brief Ring size in bytes.
+   */
+  std::size_t size;
+  /**
+   * @brief Offset of the next reservation.
+   */
+  std::size_t head;
+  /**
+   * @brief Start of the writes not yet behind a fence.
+   */
+  std::size_t pending;
+  /**
+   * @brief Whole ring, persistently mapped; NULL for the orphaning ring.
+   */
+  unsigned char* mapped;
+  /**
+   * @brief Bytes written since the last `voxelstream_frame`.
+   */
+  unsigned long long frame_bytes;
+  /**
+   * @brief Fenced ranges still in flight, oldest first.
+   */
+  std::deque<voxelstream_fence> fences;
+  voxelstream_stats stats;
+};
+
+/**
+ * @brief Allocate a ring.
+ * @param[out] s ring to set up
+ * @param bytes ring size
+ * @param load loader for `glBufferStorage`, as passed to
+ *   `gladLoadGLLoader`; NULL always uses the orphaning ring
+ * @return false when the buffer cannot be created
+ */
+bool voxelstream_create(voxelstream& s, std::size_t bytes,
+  GLADloadproc load = NULL);
+
+/**
+ * @brief Wait for the ring's fences and free the buffer.
+ */
+void voxelstream_destroy(voxelstream& s);
+
+/**
+ * @brief Whether the ring is persistently mapped.
+ */
+inline bool voxelstream_persistent(const voxelstream& s) {
+  return s.mapped != NULL;
+}
+
+/**
+ * @brief Reserve part of the ring for writing.
+ * @param bytes size of the write, at most `s.size`
+ * @param[out] offset ring offset of the reservation
+ * @return memory to write to, NULL when `bytes` does not fit
+ * @note Waits when the GPU still reads that part of the ring; each wait
+ *   that did not find the fence already signaled counts as a stall.
+ * @note Commands that read a reservation must be issued before the next
+ *   `voxelstream_reserve`, since a wrap fences everything written so far.
+ */
+void* voxelstream_reserve(voxelstream& s, std::size_t bytes,
+  std::size_t& offset);
+
+/**
+ * @brief Finish writing the last reservation; unmaps its range on the
+ *   orphaning ring.
+ * @param bytes size passed to `voxelstream_reserve`
+ */
+void voxelstream_commit(voxelstream& s, std::size_t bytes);
+
+/**
+ * @brief Fill a range of a buffer through the ring.
+ * @param target buffer to write to; its storage must already hold
+ *   `target_offset + bytes`
+ * @param target_offset first byte of `target` to write
+ * @param bytes total bytes to write
+ * @param fill `fill(out, done, n)` writes bytes `done .. done+n-1` of the
+ *   data to `out`
+ * @note The data goes in pieces of up to half the ring, each copied into
+ *   `target` by the GPU, so `fill` writes straight into GPU-visible
+ *   memory. Pieces start on multiples of `VoxelStream_Align`. Binds
+ *   `GL_COPY_READ_BUFFER` and `GL_COPY_WRITE_BUFFER`.
+ */
+void voxelstream_write(voxelstream& s, GLuint target,
+  std::size_t target_offset, std::size_t bytes,
+  const std::function<void(void*, std::size_t, std::size_t)>& fill);
+
+/**
+ * @brief Fill a range of a buffer from memory through the ring.
+ */
+void voxelstream_upload(voxelstream& s, GLuint target,
+  std::size_t target_offset, const void* data, std::size_t bytes);
+
+/**
+ * @brief Close a frame: fence its writes and roll its byte count into
+ *   `s.stats`.
+ * @note Call after the commands reading this frame's writes are issued.
+ */
+void voxelstream_frame(voxelstream& s);
+
+#endif //hg_VOXELSTREAM_h_
@@ -0,0 +1,54 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelsynth.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "voxelsynth.h"
+
+void voxelsynth_terrain(unsigned int edge, voxelgrid_matrix& m) {
+  m.name = "synthetic";
+  m.pos_x = m.pos_y = m.pos_z = 0;
+  m.width = m.height = m.depth = edge;
+  voxelbricks_init(m.voxels, edge, edge, edge);
+  for (unsigned int z = 0; z < edge; ++z) {
+    for (unsigned int x = 0; x < edge; ++x) {
+      unsigned int top = edge/4 + ((x/8)*7 + (z/8)*13 + x%3) % (edge/2 + 1);
+      for (unsigned int y = 0; y < top && y < edge; ++y) {
+        unsigned int band = (y/4)%4;
+        voxelbricks_set(m.voxels, x, y, z, voxelbricks_pack(
+          static_cast<unsigned char>(60 + band*40),
+          static_cast<unsigned char>(160 - band*20),
+          static_cast<unsigned char>(40 + (x/16)%4*10), 255));
+      }
+    }
+  }
+}
+
+unsigned long long voxelsynth_faces(const voxelbricks& vb) {
+  unsigned long long faces = 0;
+  for (std::size_t b = 0; b < vb.dense.size(); ++b) {
+    if (vb.dense[b].empty() && vb.uniform[b] == 0)
+      continue;
+    voxelbricks_cursor corner;
+    voxelbricks_cursor_at(vb,
+      static_cast<unsigned int>(b % vb.count[0]) << VoxelBricks_Shift,
+      static_cast<unsigned int>((b / vb.count[0]) % vb.count[1])
+        << VoxelBricks_Shift,
+      static_cast<unsigned int>(b / (static_cast<std::size_t>(vb.count[0])
+        *vb.count[1])) << VoxelBricks_Shift, corner);
+    for (std::size_t i = 0; i < VoxelBricks_Size; ++i) {
+      voxelbricks_cursor c = corner;
+      if (!voxelbricks_cursor_seek(vb, c, i)
+      ||  voxelbricks_cursor_index(vb, c) == 0)
+        continue;
+      for (unsigned int face = 0; face < 6; ++face) {
+        voxelbricks_cursor n = c;
+        if (!voxelbricks_cursor_step(vb, n, face)
+        ||  voxelbricks_cursor_index(vb, n) == 0)
+          faces += 1;
+      }
+    }
+  }
+  return faces;
+}
@@ -0,0 +1,30 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxelsynth.h ---
+//
+//  Generated volumes and reference counts for voxel_bench and voxel_test.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_VOXELSYNTH_h_
+#define hg_VOXELSYNTH_h_
+
+#include "readvoxel.h"
+
+/**
+ * @brief Fill a matrix with a cube of rolling hills over empty space.
+ * @param edge edge of the cube in voxels
+ * @param[out] m matrix at the scene origin, named "synthetic"
+ * @note The hills are banded by height, so meshing sees both large flat
+ *   runs and plenty of small steps.
+ */
+void voxelsynth_terrain(unsigned int edge, voxelgrid_matrix& m);
+
+/**
+ * @brief Count visible faces by checking the six neighbors of every
+ *   solid voxel, visiting brick entries in storage order.
+ * @return faces over all six directions
+ */
+unsigned long long voxelsynth_faces(const voxelbricks& voxels);
+
+#endif //hg_VOXELSYNTH_h_
@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- workpool.cpp ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "workpool.h"
+#include <atomic>
+#include <memory>
+
+struct workpool_range {
+  std::atomic<std::size_t> next;
+  std::atomic<std::size_t> done;
+  std::size_t count;
+  const std::function<void(std::size_t)>* fn;
+  std::mutex lock;
+  std::condition_variable finished;
+};
+
+//Claim indices until the range runs dry. A helper that starts after the
+//caller returned finds no index left and never touches `fn`.
+static
+void workpool_drain(workpool_range& r) {
+  std::size_t i;
+  while ((i = r.next.fetch_add(1)) < r.count) {
+    (*r.fn)(i);
+    if (r.done.fetch_add(1) + 1 == r.count) {
+      std::lock_guard<std::mutex> guard(r.lock);
+      r.finished.notify_all();
+    }
+  }
+}
+
+
+WorkPool::WorkPool(unsigned int threads) : stopping(false) {
+  if (threads == 0) {
+    unsigned int cores = std::thread::hardware_concurrency();
+    threads = cores > 1 ? cores-1 : 0;
+  }
+  for (unsigned int i = 0; i < threads; ++i) {
+    workers.push_back(std::thread(&WorkPool::run, this));
+  }
+}
+
+WorkPool::~WorkPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::size_t i = 0; i < workers.size(); ++i) {
+    workers[i].join();
+  }
+}
+
+void WorkPool::post(const std::function<void()>& task) {
+  if (workers.empty()) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    tasks.push_back(task);
+  }
+  wake.notify_one();
+}
+
+void WorkPool::parallel_for(std::size_t count,
+  const std::function<void(std::size_t)>& fn, unsigned int threads)
+{
+  if (count == 0)
+    return;
+  std::size_t helpers = workers.size();
+  if (threads > 0 && threads-1 < helpers)
+    helpers = threads-1;
+  if (helpers >= count)
+    helpers = count-1;
+  if (helpers == 0) {
+    for (std::size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  std::shared_ptr<workpool_range> r = std::make_shared<workpool_range>();
+  r->next = 0;
+  r->done = 0;
+  r->count = count;
+  r->fn = &fn;
+  for (std::size_t h = 0; h < helpers; ++h) {
+    post([r]() { workpool_drain(*r); });
+  }
+  workpool_drain(*r);
+
+  std::unique_lock<std::mutex> guard(r->lock);
+  while (r->done.load() < count)
+    r->finished.wait(guard);
+}
+
+void WorkPool::run() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      while (!stopping && tasks.empty())
+        wake.wait(guard);
+      if (tasks.empty())
+        return;
+      task = tasks.front();
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+WorkPool& workpool_shared() {
+  static WorkPool pool;
+  return pool;
+}
@@ -0,0 +1,77 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- workpool.h ---
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef hg_WORKPOOL_h_
+#define hg_WORKPOOL_h_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads fed from a shared task queue.
+ */
+class WorkPool {
+public:
+  /**
+   * @brief Start the workers.
+   * @param threads number of worker threads, zero for one per core
+   *   (less the calling thread)
+   */
+  explicit WorkPool(unsigned int threads = 0);
+
+  /**
+   * @brief Finish queued tasks and join the workers.
+   */
+  ~WorkPool();
+
+  /**
+   * @brief Number of worker threads.
+   */
+  unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+  /**
+   * @brief Queue a task for the next free worker.
+   * @param task function to run
+   */
+  void post(const std::function<void()>& task);
+
+  /**
+   * @brief Run `fn(0) ... fn(count-1)`, spread over the calling thread and
+   *   the workers, and return when every call has finished.
+   * @param count number of calls
+   * @param fn function to call with each index
+   * @param threads maximum number of threads to use, including the caller;
+   *   zero uses every worker
+   * @note The calling thread takes part, so it is safe to call this from
+   *   inside a task.
+   */
+  void parallel_for(std::size_t count,
+    const std::function<void(std::size_t)>& fn, unsigned int threads = 0);
+
+private:
+  WorkPool(const WorkPool&);
+  WorkPool& operator=(const WorkPool&);
+
+  void run();
+
+  std::vector<std::thread> workers;
+  std::deque< std::function<void()> > tasks;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool stopping;
+};
+
+/**
+ * @brief Process-wide pool, created on first use with one worker per core.
+ */
+WorkPool& workpool_shared();
+
+#endif //hg_WORKPOOL_h_
@@ -0,0 +1,696 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxel_bench.cpp ---
+//
+//  Headless timing of the load and mesh stages of VoxelGrid.
+//
+//  usage: voxel_bench [--threads N] [--rounds N] [--format json|csv]
+//                     [--synthetic EDGE]... [--no-models] [--soup|--float]
+//                     [--face-ids]
+//                     [--layout linear|morton] [--edits N] [--views N]
+//                     [--lod N] [--math N] [file.qb]...
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "common.h"
+#include "SourcePath.h"
+#include "voxelsynth.h"
+#include <qbvoxel/api.h>
+#include <chrono>
+#include <sstream>
+#ifdef _WIN32
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN 1
+#  endif
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#endif //_WIN32
+
+struct voxel_bench_case {
+  std::string name;
+  std::string path;
+  bool synthetic;
+};
+
+struct voxel_bench_result {
+  std::string name;
+  unsigned int width, height, depth;
+  double decode_ms, mesh_ms, normals_ms, colors_ms, octree_ms;
+  voxelmesh_stats stats;
+  unsigned long long triangles;
+  unsigned long long volume_bytes;
+  unsigned long long mesh_bytes;
+  unsigned long long octree_bytes;
+  //six-neighbor face culling over a flat array, and over bricks in each
+  //layout
+  double cull_flat_ms, cull_linear_ms, cull_morton_ms;
+  //mean latency of one box edit plus remesh of a chunked mesh, and the
+  //mean bytes it patched
+  double edit_ms;
+  unsigned long long edit_patch_bytes;
+  //mean time of one occlusion cull, and over all views the chunks it
+  //hid
+  double occlude_ms;
+  unsigned long long occluded_chunks;
+  //time to build the coarser levels of detail, and the triangles and
+  //mesh bytes of each level, the full-detail one first
+  double lod_ms;
+  std::vector<unsigned long long> lod_triangles, lod_bytes;
+  //peak resident set size of the load-and-mesh rounds, read before the
+  //layout, occlusion and edit passes; on Linux the mark is reset for
+  //each case, elsewhere it is the peak of the process so far
+  unsigned long long peak_rss_kb;
+};
+
+//Start a new peak resident set size from the current one, where the
+//system allows it. False when the peak keeps counting from process start.
+static
+bool voxel_bench_peak_rss_reset() {
+#ifdef __linux__
+  std::FILE* fp = std::fopen("/proc/self/clear_refs", "w");
+  if (!fp)
+    return false;
+  const bool ok = std::fputs("5", fp) >= 0;
+  return std::fclose(fp) == 0 && ok;
+#else
+  return false;
+#endif //__linux__
+}
+
+//Peak resident set size since the last reset, or of the process so far,
+//in KiB.
+static
+unsigned long long voxel_bench_peak_rss_kb() {
+#ifdef __linux__
+  //VmHWM follows clear_refs; ru_maxrss does not
+  std::FILE* fp = std::fopen("/proc/self/status", "r");
+  if (fp) {
+    char line[256];
+    unsigned long long kb = 0;
+    bool found = false;
+    while (!found && std::fgets(line, sizeof(line), fp))
+      found = std::sscanf(line, "VmHWM: %llu kB", &kb) == 1;
+    std::fclose(fp);
+    if (found)
+      return kb;
+  }
+#endif //__linux__
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return 0;
+  return pmc.PeakWorkingSetSize/1024;
+#else
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0)
+    return 0;
+#  ifdef __APPLE__
+  return static_cast<unsigned long long>(ru.ru_maxrss)/1024;
+#  else
+  return static_cast<unsigned long long>(ru.ru_maxrss);
+#  endif //__APPLE__
+#endif //_WIN32
+}
+
+static
+double voxel_bench_ms(std::chrono::steady_clock::time_point start,
+  std::chrono::steady_clock::time_point stop)
+{
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+//Visible faces as `voxelsynth_faces` counts them, over one RGBA word
+//per voxel, `x + (y + z*height)*width` ordered: a step in z jumps a
+//whole slice.
+static
+unsigned long long voxel_bench_cull_flat(
+  const std::vector<unsigned int>& flat, unsigned int width,
+  unsigned int height, unsigned int depth)
+{
+  const std::size_t stride[3] = {1, width,
+    static_cast<std::size_t>(width)*height};
+  const unsigned int dims[3] = {width, height, depth};
+  unsigned long long faces = 0;
+  std::size_t pos = 0;
+  for (unsigned int z = 0; z < depth; ++z)
+  for (unsigned int y = 0; y < height; ++y)
+  for (unsigned int x = 0; x < width; ++x, ++pos) {
+    if (flat[pos] == 0)
+      continue;
+    const unsigned int at[3] = {x, y, z};
+    for (unsigned int a = 0; a < 3; ++a) {
+      if (at[a] == 0 || flat[pos - stride[a]] == 0)
+        faces += 1;
+      if (at[a]+1 == dims[a] || flat[pos + stride[a]] == 0)
+        faces += 1;
+    }
+  }
+  return faces;
+}
+
+//Time six-neighbor face culling in each layout; false when a layout
+//change runs out of memory.
+static
+bool voxel_bench_cull(const voxelbricks& volume, bool first,
+  voxel_bench_result& r)
+{
+  typedef std::chrono::steady_clock clock;
+  std::vector<unsigned int> flat(static_cast<std::size_t>(volume.width)
+    *volume.height*volume.depth);
+  std::size_t pos = 0;
+  for (unsigned int z = 0; z < volume.depth; ++z)
+  for (unsigned int y = 0; y < volume.height; ++y)
+  for (unsigned int x = 0; x < volume.width; ++x, ++pos)
+    flat[pos] = voxelbricks_get(volume, x, y, z);
+  voxelbricks linear = volume;
+  voxelbricks morton = volume;
+  if (!voxelbricks_set_layout(linear, VoxelBricks_Linear)
+  ||  !voxelbricks_set_layout(morton, VoxelBricks_Morton))
+    return false;
+
+  //the counts are summed into `faces` so no pass can be optimized away
+  volatile unsigned long long faces = 0;
+  clock::time_point t0 = clock::now();
+  faces += voxel_bench_cull_flat(flat, volume.width, volume.height,
+                                 volume.depth);
+  clock::time_point t1 = clock::now();
+  faces += voxelsynth_faces(linear);
+  clock::time_point t2 = clock::now();
+  faces += voxelsynth_faces(morton);
+  clock::time_point t3 = clock::now();
+
+  double flat_ms = voxel_bench_ms(t0, t1);
+  double linear_ms = voxel_bench_ms(t1, t2);
+  double morton_ms = voxel_bench_ms(t2, t3);
+  if (first || flat_ms < r.cull_flat_ms) r.cull_flat_ms = flat_ms;
+  if (first || linear_ms < r.cull_linear_ms) r.cull_linear_ms = linear_ms;
+  if (first || morton_ms < r.cull_morton_ms) r.cull_morton_ms = morton_ms;
+  return true;
+}
+
+//Time `edits` 4x4x4 box edits, each followed by a remesh, on a chunked
+//copy of a loaded grid. Boxes are centered on solid voxels picked by a
+//fixed sequence and alternately cleared and recolored.
+static
+void voxel_bench_edit(VoxelGrid& grid, unsigned int edits,
+  voxel_bench_result& r)
+{
+  typedef std::chrono::steady_clock clock;
+  r.edit_ms = 0.0;
+  r.edit_patch_bytes = 0;
+  if (edits == 0 || !grid.options.indexed || !grid.options.packed)
+    return;
+  grid.options.editable = true;
+  grid.createMesh();
+  if (!grid.chunked_mesh)
+    return;
+
+  unsigned long long seed = 12345;
+  std::vector<voxelchunks_range> vertex_ranges, index_ranges;
+  double total_ms = 0.0;
+  unsigned long long bytes = 0;
+  for (unsigned int e = 0; e < edits; ++e) {
+    unsigned int at[3] = {0, 0, 0};
+    for (unsigned int tries = 0; tries < 64; ++tries) {
+      const unsigned int dims[3] = {grid.width, grid.height, grid.depth};
+      for (unsigned int a = 0; a < 3; ++a) {
+        seed = seed*6364136223846793005ull + 1442695040888963407ull;
+        at[a] = static_cast<unsigned int>((seed >> 33) % dims[a]);
+      }
+      if (voxeloccupancy_test(grid.occupancy, at[0], at[1], at[2]))
+        break;
+    }
+    unsigned int lo[3], hi[3];
+    for (unsigned int a = 0; a < 3; ++a) {
+      lo[a] = at[a] >= 2 ? at[a]-2 : 0;
+      hi[a] = at[a] + 2;
+    }
+    const unsigned int v = (e&1) ? voxelbricks_pack(200, 40,
+      static_cast<unsigned char>(e), 255) : 0;
+
+    clock::time_point t0 = clock::now();
+    grid.fillBox(lo, hi, v);
+    grid.remesh(vertex_ranges, index_ranges);
+    clock::time_point t1 = clock::now();
+    total_ms += voxel_bench_ms(t0, t1);
+    for (std::size_t i = 0; i < vertex_ranges.size(); ++i)
+      bytes += vertex_ranges[i].count*sizeof(voxelmesh_packed_vertex);
+    for (std::size_t i = 0; i < index_ranges.size(); ++i)
+      bytes += index_ranges[i].count*sizeof(unsigned int);
+  }
+  r.edit_ms = total_ms/edits;
+  r.edit_patch_bytes = bytes/edits;
+}
+
+//Occlusion-cull `views` views circling the volume just above its middle.
+static
+void voxel_bench_occlude(const VoxelGrid& grid, unsigned int views,
+  voxel_bench_result& r)
+{
+  r.occlude_ms = 0.0;
+  r.occluded_chunks = 0;
+  if (views == 0 || grid.draw_chunks.empty() || grid.occluders.cells.empty())
+    return;
+  voxelocclude occ;
+  voxelocclude_init(occ);
+  const float size = static_cast<float>((std::max)(grid.width,
+    (std::max)(grid.height, grid.depth)));
+  const vec4 center(grid.width*0.5f, grid.height*0.5f, grid.depth*0.5f, 1.0f);
+  const mat4 projection = Perspective(60.0f, 2.0f, 0.5f, 4.0f*size);
+  std::vector<char> visible;
+  double total_ms = 0.0;
+  for (unsigned int v = 0; v < views; ++v) {
+    const float angle = 6.2831853f*v/views;
+    const vec4 eye = center + vec4(0.9f*size*std::cos(angle),
+      0.3f*grid.height, 0.9f*size*std::sin(angle), 0.0f);
+    const mat4 mvp = projection*LookAt(eye, center, vec4(0.0, 1.0, 0.0, 0.0));
+    const float* m = mvp;
+    voxelcull_frustum frustum;
+    voxelcull_frustum_from(frustum, m);
+    voxelcull_test(frustum, grid.draw_chunks, visible);
+    voxelocclude_cull(occ, m, grid.draw_chunks, visible, grid.occluders);
+    total_ms += occ.stats.raster_ms + occ.stats.test_ms;
+    r.occluded_chunks += occ.stats.occluded;
+  }
+  r.occlude_ms = total_ms/views;
+}
+
+//Best of `rounds` for each stage; every round starts from an empty grid.
+static
+bool voxel_bench_run(const voxel_bench_case& c, unsigned int rounds,
+  unsigned int edits, unsigned int views, const VoxelGridOptions& opt,
+  voxel_bench_result& r)
+{
+  typedef std::chrono::steady_clock clock;
+  r.name = c.name;
+  voxel_bench_peak_rss_reset();
+  for (unsigned int i = 0; i < rounds; ++i) {
+    VoxelGrid grid(opt);
+    clock::time_point t0 = clock::now();
+    if (!grid.loadVoxels(c.path.c_str()))
+      return false;
+    clock::time_point t1 = clock::now();
+    grid.createMesh();
+    clock::time_point t2 = clock::now();
+    grid.createNormals();
+    clock::time_point t3 = clock::now();
+    grid.createColors();
+    clock::time_point t4 = clock::now();
+    if (!grid.createOctree())
+      return false;
+    clock::time_point t5 = clock::now();
+    //measured before the coarse meshes are appended
+    r.triangles = grid.getNumTri();
+    r.mesh_bytes = grid.meshBytes();
+    clock::time_point t6 = clock::now();
+    grid.createLevels();
+    clock::time_point t7 = clock::now();
+
+    double decode = voxel_bench_ms(t0, t1);
+    double mesh = voxel_bench_ms(t1, t2);
+    double normals = voxel_bench_ms(t2, t3);
+    double colors = voxel_bench_ms(t3, t4);
+    double octree = voxel_bench_ms(t4, t5);
+    double lod = voxel_bench_ms(t6, t7);
+    if (i == 0 || decode < r.decode_ms) r.decode_ms = decode;
+    if (i == 0 || mesh < r.mesh_ms) r.mesh_ms = mesh;
+    if (i == 0 || normals < r.normals_ms) r.normals_ms = normals;
+    if (i == 0 || colors < r.colors_ms) r.colors_ms = colors;
+    if (i == 0 || octree < r.octree_ms) r.octree_ms = octree;
+    if (i == 0 || lod < r.lod_ms) r.lod_ms = lod;
+    r.width = grid.width;
+    r.height = grid.height;
+    r.depth = grid.depth;
+    r.stats = grid.mesh_stats;
+    r.volume_bytes = voxelbricks_measure(grid.volume).bytes;
+    r.octree_bytes = voxeloctree_bytes(grid.octree);
+    r.lod_triangles.clear();
+    r.lod_bytes.clear();
+    for (std::size_t k = 0; k < grid.lod.levels.size(); ++k) {
+      r.lod_triangles.push_back(grid.lod.levels[k].index_count/3);
+      r.lod_bytes.push_back(grid.lod.levels[k].mesh_bytes);
+    }
+    if (i+1 < rounds)
+      continue;
+
+    //The passes below copy the volume or remesh it, so the peak is read
+    //first, and they run on the grid of the last round.
+    r.peak_rss_kb = voxel_bench_peak_rss_kb();
+    for (unsigned int j = 0; j < rounds; ++j) {
+      if (!voxel_bench_cull(grid.volume, j == 0, r))
+        return false;
+    }
+    voxel_bench_occlude(grid, views, r);
+    voxel_bench_edit(grid, edits, r);
+  }
+  return true;
+}
+
+//Timings of the mat4 kernels against the scalar code they replaced, in
+//nanoseconds per call or per transformed vector
+struct voxel_bench_math {
+  double multiply_ns, multiply_scalar_ns;
+  double apply_ns, apply_scalar_ns;
+  double transpose_ns, transpose_scalar_ns;
+  double invert_ns, invert_scalar_ns;
+  double batch_ns, batch_scalar_ns;
+};
+
+static
+mat4 voxel_bench_scalar_multiply(const mat4& a, const mat4& b) {
+  mat4 c(0.0);
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 4; ++j)
+      for (int k = 0; k < 4; ++k)
+        c[i][j] += a[i][k]*b[k][j];
+  return c;
+}
+
+static
+vec4 voxel_bench_scalar_apply(const mat4& m, const vec4& v) {
+  return vec4(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z + m[0][3]*v.w,
+              m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z + m[1][3]*v.w,
+              m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z + m[2][3]*v.w,
+              m[3][0]*v.x + m[3][1]*v.y + m[3][2]*v.z + m[3][3]*v.w);
+}
+
+static
+mat4 voxel_bench_scalar_transpose(const mat4& a) {
+  return mat4(a[0][0], a[1][0], a[2][0], a[3][0],
+              a[0][1], a[1][1], a[2][1], a[3][1],
+              a[0][2], a[1][2], a[2][2], a[3][2],
+              a[0][3], a[1][3], a[2][3], a[3][3]);
+}
+
+//Time each mat4 kernel and its scalar version over `count` random,
+//well-conditioned matrices and vectors; voxel_test checks that they
+//agree.
+static
+void voxel_bench_math_run(std::size_t count, voxel_bench_math& r) {
+  typedef std::chrono::steady_clock clock;
+  unsigned long long seed = 12345;
+  std::vector<mat4> ms(count);
+  std::vector<vec4> vs(count), out(count), ref(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    for (int a = 0; a < 4; ++a) {
+      for (int b = 0; b < 4; ++b) {
+        seed = seed*6364136223846793005ull + 1442695040888963407ull;
+        ms[i][a][b] = static_cast<GLfloat>((seed >> 40) % 2001)/1000.0f - 1.0f
+          + (a == b ? 4.0f : 0.0f);
+      }
+      vs[i][a] = ms[i][a][(a+1)&3];
+    }
+  }
+  std::vector<mat4> got(count), want(count);
+#define VOXEL_BENCH_PASS(ns, body) do { \
+    clock::time_point t0 = clock::now(); \
+    for (std::size_t i = 0; i < count; ++i) { body; } \
+    r.ns = voxel_bench_ms(t0, clock::now())*1e6/count; \
+  } while (0)
+  VOXEL_BENCH_PASS(multiply_ns, got[i] = ms[i]*ms[count-1-i]);
+  VOXEL_BENCH_PASS(multiply_scalar_ns,
+    want[i] = voxel_bench_scalar_multiply(ms[i], ms[count-1-i]));
+  VOXEL_BENCH_PASS(apply_ns, out[i] = ms[i]*vs[i]);
+  VOXEL_BENCH_PASS(apply_scalar_ns, ref[i] = voxel_bench_scalar_apply(ms[i], vs[i]));
+  VOXEL_BENCH_PASS(transpose_ns, got[i] = transpose(ms[i]));
+  VOXEL_BENCH_PASS(transpose_scalar_ns, want[i] = voxel_bench_scalar_transpose(ms[i]));
+  VOXEL_BENCH_PASS(invert_ns, got[i] = invert(ms[i]));
+  VOXEL_BENCH_PASS(invert_scalar_ns, want[i] = invertCofactor(ms[i]));
+#undef VOXEL_BENCH_PASS
+
+  //one matrix over every vector, as when moving mesh data
+  const mat4 m = ms[0];
+  clock::time_point t0 = clock::now();
+  transform(m, &vs[0], &out[0], count);
+  clock::time_point t1 = clock::now();
+  for (std::size_t i = 0; i < count; ++i)
+    ref[i] = voxel_bench_scalar_apply(m, vs[i]);
+  clock::time_point t2 = clock::now();
+  r.batch_ns = voxel_bench_ms(t0, t1)*1e6/count;
+  r.batch_scalar_ns = voxel_bench_ms(t1, t2)*1e6/count;
+}
+
+static
+void voxel_bench_math_print(const voxel_bench_math& r, bool csv,
+  std::size_t count)
+{
+  static const char* names[5] = {"multiply", "apply", "transpose", "invert",
+                                 "batch"};
+  const double ns[5][2] = {{r.multiply_ns, r.multiply_scalar_ns},
+    {r.apply_ns, r.apply_scalar_ns}, {r.transpose_ns, r.transpose_scalar_ns},
+    {r.invert_ns, r.invert_scalar_ns}, {r.batch_ns, r.batch_scalar_ns}};
+  if (csv)
+    std::printf("kernel,count,ns,scalar_ns,speedup\n");
+  else
+    std::printf("{\"count\": %zu, \"kernels\": [", count);
+  for (unsigned int k = 0; k < 5; ++k) {
+    const double speedup = ns[k][0] > 0.0 ? ns[k][1]/ns[k][0] : 0.0;
+    if (csv) {
+      std::printf("%s,%zu,%.3f,%.3f,%.2f\n", names[k], count, ns[k][0],
+                  ns[k][1], speedup);
+    } else {
+      std::printf("%s\n  {\"kernel\": \"%s\", \"ns\": %.3f, "
+                  "\"scalar_ns\": %.3f, \"speedup\": %.2f}",
+                  k ? "," : "", names[k], ns[k][0], ns[k][1], speedup);
+    }
+  }
+  if (!csv)
+    std::printf("\n]}\n");
+}
+
+static
+std::string voxel_bench_json_string(const std::string& s) {
+  std::ostringstream out;
+  out << '"';
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    unsigned char ch = static_cast<unsigned char>(s[i]);
+    if (ch == '"' || ch == '\\')
+      out << '\\' << s[i];
+    else if (ch < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+      out << buf;
+    } else
+      out << s[i];
+  }
+  out << '"';
+  return out.str();
+}
+
+//Per-level values joined by `sep`
+static
+std::string voxel_bench_list(const std::vector<unsigned long long>& v,
+  const char* sep)
+{
+  std::ostringstream out;
+  for (std::size_t i = 0; i < v.size(); ++i)
+    out << (i ? sep : "") << v[i];
+  return out.str();
+}
+
+//Output triangles over the time of the whole load-and-mesh pipeline
+static
+double voxel_bench_rate(unsigned long long triangles, double ms) {
+  return ms > 0.0 ? triangles/(ms/1000.0) : 0.0;
+}
+
+static
+void voxel_bench_print(const std::vector<voxel_bench_result>& results,
+  bool csv, unsigned int threads, unsigned int rounds)
+{
+  if (csv) {
+    std::printf("name,width,height,depth,decode_ms,mesh_ms,normals_ms,"
+                "colors_ms,total_ms,naive_triangles,culled_triangles,"
+                "triangles,triangles_per_s,volume_bytes,mesh_bytes,octree_ms,"
+                "octree_bytes,cull_flat_ms,cull_linear_ms,cull_morton_ms,"
+                "edit_ms,edit_patch_bytes,occlude_ms,occluded_chunks,"
+                "lod_ms,lod_triangles,lod_bytes,peak_rss_kb\n");
+  } else {
+    std::printf("{\"threads\": %u, \"rounds\": %u, \"cases\": [",
+                threads, rounds);
+  }
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const voxel_bench_result& r = results[i];
+    double total = r.decode_ms + r.mesh_ms + r.normals_ms + r.colors_ms;
+    double rate = voxel_bench_rate(r.triangles, total);
+    if (csv) {
+      std::string name = r.name;
+      std::replace(name.begin(), name.end(), ',', '_');
+      std::printf("%s,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%llu,%llu,%llu,"
+                  "%.0f,%llu,%llu,%.3f,%llu,%.3f,%.3f,%.3f,%.3f,%llu,%.3f,"
+                  "%llu,%.3f,%s,%s,%llu\n",
+                  name.c_str(), r.width, r.height, r.depth, r.decode_ms,
+                  r.mesh_ms, r.normals_ms, r.colors_ms, total, r.stats.naive_triangles,
+                  r.stats.culled_triangles, r.triangles, rate, r.volume_bytes,
+                  r.mesh_bytes, r.octree_ms, r.octree_bytes, r.cull_flat_ms,
+                  r.cull_linear_ms, r.cull_morton_ms, r.edit_ms,
+                  r.edit_patch_bytes, r.occlude_ms, r.occluded_chunks,
+                  r.lod_ms,
+                  voxel_bench_list(r.lod_triangles, ";").c_str(),
+                  voxel_bench_list(r.lod_bytes, ";").c_str(), r.peak_rss_kb);
+    } else {
+      std::printf("%s\n  {\"name\": %s, \"dims\": [%u, %u, %u], "
+                  "\"decode_ms\": %.3f, \"mesh_ms\": %.3f, "
+                  "\"normals_ms\": %.3f, \"colors_ms\": %.3f, "
+                  "\"total_ms\": %.3f, \"naive_triangles\": %llu, "
+                  "\"culled_triangles\": %llu, \"triangles\": %llu, "
+                  "\"triangles_per_s\": %.0f, \"volume_bytes\": %llu, "
+                  "\"mesh_bytes\": %llu, "
+                  "\"octree_ms\": %.3f, \"octree_bytes\": %llu, "
+                  "\"cull_flat_ms\": %.3f, \"cull_linear_ms\": %.3f, "
+                  "\"cull_morton_ms\": %.3f, \"edit_ms\": %.3f, "
+                  "\"edit_patch_bytes\": %llu, \"occlude_ms\": %.3f, "
+                  "\"occluded_chunks\": %llu, "
+                  "\"lod_ms\": %.3f, \"lod_triangles\": [%s], "
+                  "\"lod_bytes\": [%s], \"peak_rss_kb\": %llu}",
+                  i ? "," : "", voxel_bench_json_string(r.name).c_str(),
+                  r.width, r.height, r.depth, r.decode_ms, r.mesh_ms,
+                  r.normals_ms, r.colors_ms, total,
+                  r.stats.naive_triangles, r.stats.culled_triangles,
+                  r.triangles, rate, r.volume_bytes, r.mesh_bytes, r.octree_ms,
+                  r.octree_bytes, r.cull_flat_ms, r.cull_linear_ms,
+                  r.cull_morton_ms, r.edit_ms, r.edit_patch_bytes,
+                  r.occlude_ms, r.occluded_chunks, r.lod_ms, voxel_bench_list(r.lod_triangles, ", ").c_str(),
+                  voxel_bench_list(r.lod_bytes, ", ").c_str(),
+                  r.peak_rss_kb);
+    }
+  }
+  if (!csv)
+    std::printf("\n]}\n");
+}
+
+static
+int voxel_bench_usage(const char* argv0) {
+  std::fprintf(stderr, "usage: %s [--threads N] [--rounds N] "
+               "[--format json|csv] [--synthetic EDGE]... [--no-models] "
+               "[--soup|--float] [--face-ids] [--layout linear|morton] [--edits N] "
+               "[--views N] [--lod N] [--math N] [file.qb]...\n",
+               argv0);
+  return EXIT_FAILURE;
+}
+
+
+int main(int argc, char** argv) {
+  VoxelGridOptions opt;
+  opt.verbose = false;
+  opt.lod_levels = 4;
+  unsigned int rounds = 3;
+  unsigned int edits = 64;
+  unsigned int views = 8;
+  bool csv = false;
+  bool models = true;
+  std::size_t math = 0;
+  std::vector<unsigned int> edges;
+  std::vector<voxel_bench_case> cases;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = (i+1 < argc);
+    if (arg == "--threads" && has_value) {
+      opt.threads = static_cast<unsigned int>(std::atoi(argv[++i]));
+    } else if (arg == "--rounds" && has_value) {
+      rounds = static_cast<unsigned int>(std::atoi(argv[++i]));
+    } else if (arg == "--format" && has_value) {
+      std::string f = argv[++i];
+      if (f != "json" && f != "csv")
+        return voxel_bench_usage(argv[0]);
+      csv = (f == "csv");
+    } else if (arg == "--synthetic" && has_value) {
+      int edge = std::atoi(argv[++i]);
+      if (edge < 1)
+        return voxel_bench_usage(argv[0]);
+      edges.push_back(static_cast<unsigned int>(edge));
+    } else if (arg == "--edits" && has_value) {
+      edits = static_cast<unsigned int>(std::atoi(argv[++i]));
+    } else if (arg == "--views" && has_value) {
+      views = static_cast<unsigned int>(std::atoi(argv[++i]));
+    } else if (arg == "--lod" && has_value) {
+      opt.lod_levels = static_cast<unsigned int>(std::atoi(argv[++i]));
+    } else if (arg == "--math" && has_value) {
+      int n = std::atoi(argv[++i]);
+      if (n < 1)
+        return voxel_bench_usage(argv[0]);
+      math = static_cast<std::size_t>(n);
+    } else if (arg == "--no-models") {
+      models = false;
+    } else if (arg == "--soup") {
+      opt.indexed = false;
+    } else if (arg == "--float") {
+      opt.packed = false;
+    } else if (arg == "--face-ids") {
+      opt.normals = false;
+    } else if (arg == "--layout" && has_value) {
+      std::string l = argv[++i];
+      if (l != "linear" && l != "morton")
+        return voxel_bench_usage(argv[0]);
+      opt.layout = (l == "morton") ? VoxelBricks_Morton : VoxelBricks_Linear;
+    } else if (!arg.empty() && arg[0] == '-') {
+      return voxel_bench_usage(argv[0]);
+    } else {
+      voxel_bench_case c = {arg, arg, false};
+      cases.push_back(c);
+      models = false;
+    }
+  }
+  if (rounds == 0)
+    return voxel_bench_usage(argv[0]);
+
+  //--math times the mat4 kernels alone
+  if (math > 0) {
+    voxel_bench_math r;
+    voxel_bench_math_run(math, r);
+    voxel_bench_math_print(r, csv, math);
+    return EXIT_SUCCESS;
+  }
+
+  if (models) {
+    static const char* bundled[3] = {"three.qb", "palmtree.qb", "goldisle.qb"};
+    for (unsigned int i = 0; i < 3; ++i) {
+      voxel_bench_case c = {bundled[i],
+                            source_path + "/models/" + bundled[i], false};
+      cases.push_back(c);
+    }
+  }
+  if (edges.empty() && models) {
+    edges.push_back(64);
+    edges.push_back(128);
+    //the layouts first differ once the volume outgrows the caches
+    edges.push_back(256);
+  }
+
+  //Synthetic volumes go through a .qb file so decode is timed too.
+  for (std::size_t i = 0; i < edges.size(); ++i) {
+    std::ostringstream name;
+    name << "synthetic_" << edges[i];
+    voxel_bench_case c = {name.str(), "voxel_bench_" + name.str() + ".qb",
+                          true};
+    std::vector<voxelgrid_matrix> scene(1);
+    voxelsynth_terrain(edges[i], scene[0]);
+    unsigned int error = voxelgrid_encode(scene, c.path.c_str(),
+                                          QBVoxel_FlagRightHand|QBVoxel_FlagRLE);
+    if (error) {
+      std::fprintf(stderr, "%s: %s\n", c.path.c_str(),
+                   voxelgrid_error_text(error));
+      return EXIT_FAILURE;
+    }
+    cases.push_back(c);
+  }
+
+  std::vector<voxel_bench_result> results;
+  int status = EXIT_SUCCESS;
+  for (std::size_t i = 0; i < cases.size(); ++i) {
+    voxel_bench_result r;
+    if (voxel_bench_run(cases[i], rounds, edits, views, opt, r)) {
+      results.push_back(r);
+    } else {
+      std::fprintf(stderr, "%s: failed to load\n", cases[i].path.c_str());
+      status = EXIT_FAILURE;
+    }
+    if (cases[i].synthetic)
+      std::remove(cases[i].path.c_str());
+  }
+  voxel_bench_print(results, csv, opt.threads, rounds);
+  return status;
+}
@@ -0,0 +1,1432 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- voxel_test.cpp ---
+//
+//  Headless checks of VoxelGrid and its helpers, one line of TAP output
+//  per test on stderr.
+//
+//  usage: voxel_test [name]...
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "common.h"
+#include "voxelsynth.h"
+#include <qbvoxel/api.h>
+#include <cstring>
+#include <new>
+
+//Load `scene` into `grid` through a `.qb` file, as the viewer would.
+static
+bool voxel_test_load(const std::vector<voxelgrid_matrix>& scene,
+  const char* name, VoxelGrid& grid)
+{
+  const std::string path = std::string("voxel_test_") + name + ".qb";
+  unsigned int error = voxelgrid_encode(scene, path.c_str(),
+                                        QBVoxel_FlagRightHand|QBVoxel_FlagRLE);
+  if (error) {
+    std::fprintf(stderr, "# %s: %s\n", path.c_str(),
+                 voxelgrid_error_text(error));
+    return false;
+  }
+  const bool ok = grid.loadVoxels(path.c_str());
+  std::remove(path.c_str());
+  return ok;
+}
+
+//Load a terrain cube of edge `edge` and mesh it.
+static
+bool voxel_test_terrain_grid(unsigned int edge, VoxelGrid& grid) {
+  std::vector<voxelgrid_matrix> scene(1);
+  voxelsynth_terrain(edge, scene[0]);
+  if (!voxel_test_load(scene, "terrain", grid))
+    return false;
+  grid.createMesh();
+  grid.createNormals();
+  grid.createColors();
+  return true;
+}
+
+//Visible faces from `voxelbricks_get`, `x + (y + z*height)*width`
+//ordered, as `voxelsynth_faces` counts them.
+static
+unsigned long long voxel_test_cull_flat(const voxelbricks& vb) {
+  const unsigned int dims[3] = {vb.width, vb.height, vb.depth};
+  unsigned long long faces = 0;
+  for (unsigned int z = 0; z < vb.depth; ++z)
+  for (unsigned int y = 0; y < vb.height; ++y)
+  for (unsigned int x = 0; x < vb.width; ++x) {
+    if (voxelbricks_get(vb, x, y, z) == 0)
+      continue;
+    const unsigned int at[3] = {x, y, z};
+    for (unsigned int a = 0; a < 3; ++a) {
+      unsigned int n[3] = {x, y, z};
+      n[a] = at[a] - 1;
+      if (at[a] == 0 || voxelbricks_get(vb, n[0], n[1], n[2]) == 0)
+        faces += 1;
+      n[a] = at[a] + 1;
+      if (at[a]+1 == dims[a] || voxelbricks_get(vb, n[0], n[1], n[2]) == 0)
+        faces += 1;
+    }
+  }
+  return faces;
+}
+
+//Morton entries of a brick match interleaving the bits one at a time,
+//and map back to their coordinates.
+static
+bool voxel_test_morton(void) {
+  for (unsigned int z = 0; z < VoxelBricks_Edge; ++z)
+  for (unsigned int y = 0; y < VoxelBricks_Edge; ++y)
+  for (unsigned int x = 0; x < VoxelBricks_Edge; ++x) {
+    const unsigned int at[3] = {x, y, z};
+    unsigned int want = 0;
+    for (unsigned int bit = 0; bit < VoxelBricks_Shift; ++bit)
+      for (unsigned int a = 0; a < 3; ++a)
+        want |= ((at[a] >> bit) & 1u) << (bit*3 + a);
+    unsigned int back[3];
+    const unsigned int i = voxelbricks_morton(x, y, z);
+    voxelbricks_unmorton(i, back);
+    if (i != want || back[0] != x || back[1] != y || back[2] != z) {
+      std::fprintf(stderr, "# (%u, %u, %u): entry %u, want %u\n", x, y, z,
+                   i, want);
+      return false;
+    }
+  }
+  return true;
+}
+
+//Face counts from occupancy rows match voxel by voxel lookups, on a
+//volume whose rows span several words.
+static
+bool voxel_test_occupancy(void) {
+  voxelbricks vb;
+  voxelbricks_init(vb, 300, 40, 24);
+  for (unsigned int z = 0; z < vb.depth; ++z)
+  for (unsigned int y = 0; y < vb.height; ++y)
+  for (unsigned int x = 0; x < vb.width; ++x) {
+    if ((x*7 + y*3 + z*5) % 11 < 6 || y < 4)
+      voxelbricks_set(vb, x, y, z, voxelbricks_pack(200, 200, 200, 255));
+  }
+  voxeloccupancy occ;
+  if (!voxeloccupancy_build(occ, vb))
+    return false;
+  const unsigned long long faces = voxeloccupancy_count_faces(occ);
+  const unsigned long long want = voxel_test_cull_flat(vb);
+  if (faces != want) {
+    std::fprintf(stderr, "# %llu faces, want %llu\n", faces, want);
+    return false;
+  }
+  return true;
+}
+
+//Allocations of `voxel_test_fail_size` bytes succeed
+//`voxel_test_fail_after` more times, then one throws and the size disarms.
+static std::size_t voxel_test_fail_size = 0;
+static unsigned int voxel_test_fail_after = 0;
+
+void* operator new(std::size_t size) {
+  if (size != 0 && size == voxel_test_fail_size) {
+    if (voxel_test_fail_after == 0) {
+      voxel_test_fail_size = 0;
+      throw std::bad_alloc();
+    }
+    --voxel_test_fail_after;
+  }
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" //new is malloc too
+#endif
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+//Packed voxel of the `n`-th distinct color, and the voxel it goes to;
+//the odd stride scatters consecutive colors over every brick.
+static
+unsigned int voxel_test_palette_color(unsigned int n) {
+  ++n;
+  return voxelbricks_pack(static_cast<unsigned char>(n),
+    static_cast<unsigned char>(n>>8), static_cast<unsigned char>(n>>16), 255);
+}
+
+//Write colors `first` up to `last` into a 64^3 volume, recording each
+//one written in `want`.
+static
+bool voxel_test_palette_fill(voxelbricks& vb, std::vector<unsigned int>& want,
+  unsigned int first, unsigned int last)
+{
+  for (unsigned int n = first; n < last; ++n) {
+    const unsigned int at = (n*40503u) & (64*64*64 - 1);
+    const unsigned int v = voxel_test_palette_color(n);
+    if (!voxelbricks_set(vb, at & 63, (at>>6) & 63, at>>12, v))
+      return false;
+    want[at] = v;
+  }
+  return true;
+}
+
+//Every voxel reads back as `want`, with `bytes` wide indices.
+static
+bool voxel_test_palette_check(const voxelbricks& vb,
+  const std::vector<unsigned int>& want, unsigned int bytes)
+{
+  if (vb.index_bytes != bytes) {
+    std::fprintf(stderr, "# %u byte indices, want %u\n", vb.index_bytes,
+                 bytes);
+    return false;
+  }
+  for (unsigned int at = 0; at < want.size(); ++at) {
+    const unsigned int v = voxelbricks_get(vb, at & 63, (at>>6) & 63, at>>12);
+    if (v != want[at]) {
+      std::fprintf(stderr, "# voxel %u: %08x, want %08x\n", at, v, want[at]);
+      return false;
+    }
+  }
+  return true;
+}
+
+//Indices widen from one to two to four bytes as the palette grows, and a
+//widening whose allocation fails leaves the volume as it was.
+static
+bool voxel_test_palette(void) {
+  voxelbricks vb;
+  std::vector<unsigned int> want(64*64*64, 0);
+  if (!voxelbricks_init(vb, 64, 64, 64)
+  ||  !voxel_test_palette_fill(vb, want, 0, 255)
+  ||  !voxel_test_palette_check(vb, want, 1))
+    return false;
+
+  //Fail part way through rewriting the bricks, then retry
+  voxel_test_fail_size = static_cast<std::size_t>(VoxelBricks_Size)*2;
+  voxel_test_fail_after = 3;
+  const bool failed = !voxel_test_palette_fill(vb, want, 255, 256);
+  voxel_test_fail_size = 0;
+  if (!failed) {
+    std::fprintf(stderr, "# widening to 2 bytes did not fail\n");
+    return false;
+  }
+  if (vb.palette.size() != 256 || !voxel_test_palette_check(vb, want, 1))
+    return false;
+
+  if (!voxel_test_palette_fill(vb, want, 255, 257)
+  ||  !voxel_test_palette_check(vb, want, 2)
+  ||  !voxel_test_palette_fill(vb, want, 257, 65535)
+  ||  !voxel_test_palette_check(vb, want, 2))
+    return false;
+
+  voxel_test_fail_size = static_cast<std::size_t>(VoxelBricks_Size)*4;
+  voxel_test_fail_after = 3;
+  const bool failed_wide = !voxel_test_palette_fill(vb, want, 65535, 65536);
+  voxel_test_fail_size = 0;
+  if (!failed_wide) {
+    std::fprintf(stderr, "# widening to 4 bytes did not fail\n");
+    return false;
+  }
+  if (vb.palette.size() != 65536 || !voxel_test_palette_check(vb, want, 2))
+    return false;
+
+  return voxel_test_palette_fill(vb, want, 65535, 65537)
+      && voxel_test_palette_check(vb, want, 4);
+}
+
+//Greedy mesh of the box `lo` to `hi`, split at `x = split` into two
+//cubes colored `left` and `right`. Every quad must lie on the surface of
+//the box and the quads must cover it exactly once.
+static
+bool voxel_test_greedy_box(const unsigned int lo[3], const unsigned int hi[3],
+  unsigned int split, unsigned int left, unsigned int right,
+  std::vector<voxelmesh_quad>& quads, voxelmesh_stats& stats)
+{
+  voxelbricks vb;
+  voxelbricks_init(vb, hi[0] + 3, hi[1] + 3, hi[2] + 3);
+  for (unsigned int z = lo[2]; z < hi[2]; ++z)
+  for (unsigned int y = lo[1]; y < hi[1]; ++y)
+  for (unsigned int x = lo[0]; x < hi[0]; ++x)
+    voxelbricks_set(vb, x, y, z, x < split ? left : right);
+  voxeloccupancy occ;
+  if (!voxeloccupancy_build(occ, vb))
+    return false;
+  voxelmesh_build(vb, occ, quads, &stats);
+  unsigned long long area = 0, surface = 0;
+  for (unsigned int a = 0; a < 3; ++a)
+    surface += 2ull*(hi[(a+1)%3] - lo[(a+1)%3])*(hi[(a+2)%3] - lo[(a+2)%3]);
+  for (std::size_t i = 0; i < quads.size(); ++i) {
+    const voxelmesh_quad& q = quads[i];
+    const unsigned int d = q.face/2;
+    float corners[4][3];
+    voxelmesh_quad_corners(q, corners);
+    const float plane = corners[0][d];
+    if (plane != static_cast<float>(lo[d])
+    &&  plane != static_cast<float>(hi[d]))
+    {
+      std::fprintf(stderr, "# quad %zu inside the box, face %u at %g\n", i,
+                   q.face, plane);
+      return false;
+    }
+    area += static_cast<unsigned long long>(q.du)*q.dv;
+  }
+  if (area != surface || stats.merged_triangles != quads.size()*2
+  ||  stats.culled_triangles != surface*2)
+  {
+    std::fprintf(stderr, "# %zu quads cover %llu faces of %llu\n",
+                 quads.size(), area, surface);
+    return false;
+  }
+  return true;
+}
+
+//A solid cube inside one chunk merges into one quad a side, touching
+//cubes keep no faces between them, and larger cubes split only at chunk
+//boundaries.
+static
+bool voxel_test_greedy(void) {
+  const unsigned int red = voxelbricks_pack(200, 40, 40, 255);
+  const unsigned int blue = voxelbricks_pack(40, 40, 200, 255);
+  std::vector<voxelmesh_quad> quads;
+  voxelmesh_stats stats;
+  static const unsigned int edges[3] = {1, 7, VoxelMesh_ChunkEdge};
+  for (unsigned int e = 0; e < 3; ++e) {
+    const unsigned int k = edges[e];
+    const unsigned int o = (VoxelMesh_ChunkEdge - k)/2;
+    const unsigned int lo[3] = {o, o, o};
+    const unsigned int hi[3] = {o + k, o + k, o + k};
+    if (!voxel_test_greedy_box(lo, hi, hi[0], red, red, quads, stats))
+      return false;
+    if (quads.size() != 6 || stats.merged_triangles != 12) {
+      std::fprintf(stderr, "# %u^3 cube: %zu quads\n", k, quads.size());
+      return false;
+    }
+  }
+
+  //Two 8^3 cubes side by side: one box when their colors match, else
+  //two with the faces between them gone
+  const unsigned int k = 8;
+  const unsigned int lo[3] = {4, 4, 4};
+  const unsigned int hi[3] = {4 + 2*k, 4 + k, 4 + k};
+  if (!voxel_test_greedy_box(lo, hi, 4 + k, red, red, quads, stats)
+  ||  quads.size() != 6)
+    return false;
+  if (!voxel_test_greedy_box(lo, hi, 4 + k, red, blue, quads, stats)
+  ||  quads.size() != 10)
+    return false;
+
+  //A cube over several chunks still covers its surface with no inner
+  //faces
+  const unsigned int big_lo[3] = {5, 9, 3};
+  const unsigned int big_hi[3] = {5 + VoxelMesh_ChunkEdge + 20,
+    9 + VoxelMesh_ChunkEdge + 20, 3 + VoxelMesh_ChunkEdge + 20};
+  return voxel_test_greedy_box(big_lo, big_hi, big_hi[0], red, red, quads,
+                               stats);
+}
+
+//Linear and Morton bricks agree with each other and with plain lookups
+//on every voxel and on the faces six-neighbor culling keeps.
+static
+bool voxel_test_layouts(void) {
+  std::vector<voxelgrid_matrix> scene(1);
+  voxelsynth_terrain(64, scene[0]);
+  const voxelbricks& volume = scene[0].voxels;
+  voxelbricks linear = volume;
+  voxelbricks morton = volume;
+  if (!voxelbricks_set_layout(linear, VoxelBricks_Linear)
+  ||  !voxelbricks_set_layout(morton, VoxelBricks_Morton))
+    return false;
+  for (unsigned int z = 0; z < volume.depth; ++z)
+  for (unsigned int y = 0; y < volume.height; ++y)
+  for (unsigned int x = 0; x < volume.width; ++x) {
+    if (voxelbricks_get(linear, x, y, z) != voxelbricks_get(morton, x, y, z))
+      return false;
+  }
+  const unsigned long long flat = voxel_test_cull_flat(volume);
+  const unsigned long long a = voxelsynth_faces(linear);
+  const unsigned long long b = voxelsynth_faces(morton);
+  if (flat != a || a != b) {
+    std::fprintf(stderr, "# faces: %llu flat, %llu linear, %llu morton\n",
+                 flat, a, b);
+    return false;
+  }
+  return flat > 0;
+}
+
+//Meshing on several threads gives the quads, packed vertices and indices
+//of meshing on one, entry for entry.
+static
+bool voxel_test_threads(void) {
+  std::vector<voxelgrid_matrix> scene(1);
+  voxelsynth_terrain(96, scene[0]);
+  const voxelbricks& volume = scene[0].voxels;
+  voxeloccupancy occupancy;
+  if (!voxeloccupancy_build(occupancy, volume))
+    return false;
+  std::vector<voxelmesh_quad> base_quads;
+  std::vector<voxelmesh_packed_vertex> base_vertices;
+  std::vector<unsigned int> base_indices;
+  voxelmesh_stats base;
+  voxelmesh_build(volume, occupancy, base_quads, &base, 1);
+  if (!voxelmesh_pack(base_quads, base_vertices, base_indices)
+  ||  base_indices.empty())
+    return false;
+
+  static const unsigned int threads[3] = {0, 4, 3};
+  for (unsigned int t = 0; t < 3; ++t) {
+    std::vector<voxelmesh_quad> quads;
+    std::vector<voxelmesh_packed_vertex> vertices;
+    std::vector<unsigned int> indices;
+    voxelmesh_stats stats;
+    voxelmesh_build(volume, occupancy, quads, &stats, threads[t]);
+    bool ok = voxelmesh_pack(quads, vertices, indices)
+      && stats.naive_triangles == base.naive_triangles
+      && stats.culled_triangles == base.culled_triangles
+      && stats.merged_triangles == base.merged_triangles
+      && quads.size() == base_quads.size()
+      && vertices.size() == base_vertices.size()
+      && indices == base_indices;
+    for (std::size_t i = 0; i < quads.size() && ok; ++i) {
+      const voxelmesh_quad& a = quads[i];
+      const voxelmesh_quad& b = base_quads[i];
+      ok = a.x == b.x && a.y == b.y && a.z == b.z && a.du == b.du
+        && a.dv == b.dv && a.face == b.face && a.r == b.r && a.g == b.g
+        && a.b == b.b;
+    }
+    for (std::size_t i = 0; i < vertices.size() && ok; ++i) {
+      const voxelmesh_packed_vertex& a = vertices[i];
+      const voxelmesh_packed_vertex& b = base_vertices[i];
+      ok = a.x == b.x && a.y == b.y && a.z == b.z && a.face == b.face
+        && a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+    }
+    if (!ok) {
+      std::fprintf(stderr, "# %u threads differ from one\n", threads[t]);
+      return false;
+    }
+  }
+  return true;
+}
+
+//Box edits with a remesh after each leave the chunked mesh equal to a
+//full rebuild. Boxes are centered on solid voxels picked by a fixed
+//sequence and alternately cleared and recolored.
+static
+bool voxel_test_edit(void) {
+  VoxelGridOptions opt;
+  opt.verbose = false;
+  opt.editable = true;
+  VoxelGrid grid(opt);
+  if (!voxel_test_terrain_grid(64, grid) || !grid.chunked_mesh)
+    return false;
+
+  unsigned long long seed = 12345;
+  std::vector<voxelchunks_range> vertex_ranges, index_ranges;
+  for (unsigned int e = 0; e < 64; ++e) {
+    unsigned int at[3] = {0, 0, 0};
+    for (unsigned int tries = 0; tries < 64; ++tries) {
+      const unsigned int dims[3] = {grid.width, grid.height, grid.depth};
+      for (unsigned int a = 0; a < 3; ++a) {
+        seed = seed*6364136223846793005ull + 1442695040888963407ull;
+        at[a] = static_cast<unsigned int>((seed >> 33) % dims[a]);
+      }
+      if (voxeloccupancy_test(grid.occupancy, at[0], at[1], at[2]))
+        break;
+    }
+    unsigned int lo[3], hi[3];
+    for (unsigned int a = 0; a < 3; ++a) {
+      lo[a] = at[a] >= 2 ? at[a]-2 : 0;
+      hi[a] = at[a] + 2;
+    }
+    const unsigned int v = (e&1) ? voxelbricks_pack(200, 40,
+      static_cast<unsigned char>(e), 255) : 0;
+    grid.fillBox(lo, hi, v);
+    grid.remesh(vertex_ranges, index_ranges);
+  }
+
+  std::vector<voxelmesh_quad> quads;
+  voxelmesh_stats full;
+  voxelmesh_build(grid.volume, grid.occupancy, quads, &full,
+                  grid.options.threads);
+  if (full.merged_triangles != grid.mesh_stats.merged_triangles
+  ||  full.culled_triangles != grid.mesh_stats.culled_triangles
+  ||  full.naive_triangles != grid.mesh_stats.naive_triangles)
+  {
+    std::fprintf(stderr, "# edited mesh: %llu triangles, rebuild: %llu\n",
+                 grid.mesh_stats.merged_triangles, full.merged_triangles);
+    return false;
+  }
+  return true;
+}
+
+//Winning chunk of each sample of a plain z-buffer, `scale` times the
+//size of the occlusion buffer, drawn from every visible chunk. Triangles
+//crossing the near plane are left out.
+static
+void voxel_test_reference(const voxelocclude& occ, const float m[16],
+  const voxelmesh_packed_vertex* vertices, const void* indices,
+  unsigned int index_size, const std::vector<voxelcull_chunk>& chunks,
+  const std::vector<char>& visible, unsigned int scale,
+  std::vector<char>& seen)
+{
+  const int w = static_cast<int>(occ.width*scale);
+  const int h = static_cast<int>(occ.height*scale);
+  std::vector<float> depth(static_cast<std::size_t>(w)*h, 1.0f);
+  std::vector<std::size_t> winner(depth.size(), chunks.size());
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    if (!visible[i])
+      continue;
+    const voxelcull_chunk& c = chunks[i];
+    for (std::size_t t = c.first; t+2 < c.first + c.count; t += 3) {
+      float p[3][3];
+      bool front = true;
+      for (unsigned int k = 0; k < 3 && front; ++k) {
+        std::size_t id = (index_size == 2)
+          ? static_cast<const unsigned short*>(indices)[t+k]
+          : static_cast<const unsigned int*>(indices)[t+k];
+        const float x = vertices[id].x, y = vertices[id].y, z = vertices[id].z;
+        const float cx = m[0]*x + m[1]*y + m[2]*z + m[3];
+        const float cy = m[4]*x + m[5]*y + m[6]*z + m[7];
+        const float cz = m[8]*x + m[9]*y + m[10]*z + m[11];
+        const float cw = m[12]*x + m[13]*y + m[14]*z + m[15];
+        front = cw > 1e-6f && cz >= -cw;
+        p[k][0] = (cx/cw*0.5f + 0.5f)*w;
+        p[k][1] = (cy/cw*0.5f + 0.5f)*h;
+        p[k][2] = cz/cw;
+      }
+      const float area = (p[1][0] - p[0][0])*(p[2][1] - p[0][1])
+        - (p[2][0] - p[0][0])*(p[1][1] - p[0][1]);
+      if (!front || area == 0.0f)
+        continue;
+      const int x0 = (std::max)(0, static_cast<int>(std::floor(
+        (std::min)((std::min)(p[0][0], p[1][0]), p[2][0]))));
+      const int x1 = (std::min)(w - 1, static_cast<int>(std::ceil(
+        (std::max)((std::max)(p[0][0], p[1][0]), p[2][0]))));
+      const int y0 = (std::max)(0, static_cast<int>(std::floor(
+        (std::min)((std::min)(p[0][1], p[1][1]), p[2][1]))));
+      const int y1 = (std::min)(h - 1, static_cast<int>(std::ceil(
+        (std::max)((std::max)(p[0][1], p[1][1]), p[2][1]))));
+      for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+          const float sx = x + 0.5f, sy = y + 0.5f;
+          float b[3];
+          for (unsigned int k = 0; k < 3; ++k) {
+            const float* a = p[(k+1)%3];
+            const float* e = p[(k+2)%3];
+            b[k] = ((e[0] - a[0])*(sy - a[1]) - (e[1] - a[1])*(sx - a[0]))
+              /area;
+          }
+          if (b[0] < 0.0f || b[1] < 0.0f || b[2] < 0.0f)
+            continue;
+          const float z = b[0]*p[0][2] + b[1]*p[1][2] + b[2]*p[2][2];
+          const std::size_t at = static_cast<std::size_t>(y)*w + x;
+          if (z < depth[at]) {
+            depth[at] = z;
+            winner[at] = i;
+          }
+        }
+      }
+    }
+  }
+  seen.assign(chunks.size(), 0);
+  for (std::size_t at = 0; at < winner.size(); ++at) {
+    if (winner[at] < chunks.size())
+      seen[winner[at]] = 1;
+  }
+}
+
+//View `v` of `views` circling the volume of `grid` just above its middle
+static
+mat4 voxel_test_view(const VoxelGrid& grid, unsigned int v,
+  unsigned int views)
+{
+  const float size = static_cast<float>((std::max)(grid.width,
+    (std::max)(grid.height, grid.depth)));
+  const vec4 center(grid.width*0.5f, grid.height*0.5f, grid.depth*0.5f, 1.0f);
+  const float angle = 6.2831853f*v/views;
+  const vec4 eye = center + vec4(0.9f*size*std::cos(angle),
+    0.3f*grid.height, 0.9f*size*std::sin(angle), 0.0f);
+  return Perspective(60.0f, 2.0f, 0.5f, 4.0f*size)
+    *LookAt(eye, center, vec4(0.0, 1.0, 0.0, 0.0));
+}
+
+//Occlusion culling never hides a chunk that wins a sample of
+//`voxel_test_reference`, over eight views of a terrain cube.
+static
+bool voxel_test_occlusion(void) {
+  VoxelGridOptions opt;
+  opt.verbose = false;
+  VoxelGrid grid(opt);
+  const voxelmesh_packed_vertex* vertices;
+  const void* indices;
+  unsigned int index_size;
+  if (!voxel_test_terrain_grid(96, grid) || grid.draw_chunks.empty()
+  ||  grid.occluders.cells.empty()
+  ||  !grid.packedMeshData(vertices, indices, index_size))
+    return false;
+  voxelocclude occ;
+  voxelocclude_init(occ);
+  std::vector<char> visible, seen;
+  unsigned long long occluded = 0, hidden = 0;
+  bool ok = true;
+  for (unsigned int v = 0; v < 8; ++v) {
+    const mat4 mvp = voxel_test_view(grid, v, 8);
+    const float* m = mvp;
+    voxelcull_frustum frustum;
+    voxelcull_frustum_from(frustum, m);
+    voxelcull_test(frustum, grid.draw_chunks, visible);
+    voxel_test_reference(occ, m, vertices, indices, index_size,
+                         grid.draw_chunks, visible, 4, seen);
+    std::vector<char> before = visible;
+
+    voxelocclude_cull(occ, m, grid.draw_chunks, visible, grid.occluders);
+    occluded += occ.stats.occluded;
+    for (std::size_t i = 0; i < visible.size(); ++i) {
+      if (before[i] && !seen[i])
+        hidden += 1;
+      if (before[i] && !visible[i] && seen[i]) {
+        std::fprintf(stderr, "# view %u: visible chunk %zu culled\n", v, i);
+        ok = false;
+      }
+    }
+  }
+  std::fprintf(stderr, "# %llu of %llu hidden chunks culled\n", occluded,
+               hidden);
+  return ok;
+}
+
+//Every voxel of each coarse level is solid exactly when one of its eight
+//voxels in the level below is, and each level has fewer triangles.
+static
+bool voxel_test_lodreduce(void) {
+  VoxelGridOptions opt;
+  opt.verbose = false;
+  opt.lod_levels = 4;
+  VoxelGrid grid(opt);
+  if (!voxel_test_terrain_grid(64, grid) || !grid.createLevels()
+  ||  grid.lod.levels.size() < 2)
+    return false;
+  for (std::size_t k = 1; k < grid.lod.levels.size(); ++k) {
+    const voxeloccupancy& fine = (k == 1) ? grid.occupancy
+      : grid.lod.levels[k-1].occupancy;
+    const voxeloccupancy& coarse = grid.lod.levels[k].occupancy;
+    if (coarse.width != (fine.width+1)/2 || coarse.height != (fine.height+1)/2
+    ||  coarse.depth != (fine.depth+1)/2)
+      return false;
+    if (grid.lod.levels[k].index_count >= grid.lod.levels[k-1].index_count)
+      return false;
+    for (unsigned int z = 0; z < coarse.depth; ++z)
+    for (unsigned int y = 0; y < coarse.height; ++y)
+    for (unsigned int x = 0; x < coarse.width; ++x) {
+      bool any = false;
+      for (unsigned int c = 0; c < 8 && !any; ++c) {
+        const unsigned int fx = 2*x + (c&1), fy = 2*y + ((c>>1)&1),
+          fz = 2*z + (c>>2);
+        any = fx < fine.width && fy < fine.height && fz < fine.depth
+          && voxeloccupancy_test(fine, fx, fy, fz);
+      }
+      if (any != voxeloccupancy_test(coarse, x, y, z)) {
+        std::fprintf(stderr, "# level %zu differs at (%u, %u, %u)\n", k,
+                     x, y, z);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//Three matrices: `a` and `b` overlap, with holes in `b` over solid
+//voxels of `a`, and `c` stands apart at negative z.
+static
+void voxel_test_scene(std::vector<voxelgrid_matrix>& scene) {
+  static const char* names[3] = {"a", "b", "c"};
+  static const long int pos[3][3] = {{-3, 2, 5}, {10, 0, -4}, {30, 5, -20}};
+  static const unsigned int dims[3][3] = {{20, 10, 12}, {8, 16, 19},
+    {5, 5, 5}};
+  scene.resize(3);
+  for (unsigned int k = 0; k < 3; ++k) {
+    voxelgrid_matrix& m = scene[k];
+    m.name = names[k];
+    m.pos_x = pos[k][0];
+    m.pos_y = pos[k][1];
+    m.pos_z = pos[k][2];
+    m.width = dims[k][0];
+    m.height = dims[k][1];
+    m.depth = dims[k][2];
+    voxelbricks_init(m.voxels, m.width, m.height, m.depth);
+    for (unsigned int z = 0; z < m.depth; ++z)
+    for (unsigned int y = 0; y < m.height; ++y)
+    for (unsigned int x = 0; x < m.width; ++x) {
+      const bool solid = (k == 0) ? (x + y + z)%3 != 0
+        : (k == 1) ? (x + 2*z)%4 != 0 : (x + y + z)%2 == 0;
+      if (solid) {
+        voxelbricks_set(m.voxels, x, y, z, voxelbricks_pack(
+          static_cast<unsigned char>(80*k + 10), static_cast<unsigned char>(x*8),
+          static_cast<unsigned char>(y*8 + z), 255));
+      }
+    }
+  }
+}
+
+//Multi-matrix files, raw and run-length encoded, decode to their
+//matrices, and flatten to one volume at the lowest corner in which later
+//matrices win where solid voxels overlap.
+static
+bool voxel_test_scene_load(void) {
+  std::vector<voxelgrid_matrix> scene;
+  voxel_test_scene(scene);
+  long int lo[3], hi[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    lo[a] = hi[a] = 0;
+    for (std::size_t k = 0; k < scene.size(); ++k) {
+      const voxelgrid_matrix& m = scene[k];
+      const long int pos[3] = {m.pos_x, m.pos_y, m.pos_z};
+      const unsigned int dims[3] = {m.width, m.height, m.depth};
+      if (k == 0 || pos[a] < lo[a])
+        lo[a] = pos[a];
+      if (k == 0 || pos[a] + static_cast<long int>(dims[a]) > hi[a])
+        hi[a] = pos[a] + dims[a];
+    }
+  }
+  //scene voxels painted by hand, in file order
+  const unsigned int size[3] = {static_cast<unsigned int>(hi[0] - lo[0]),
+    static_cast<unsigned int>(hi[1] - lo[1]),
+    static_cast<unsigned int>(hi[2] - lo[2])};
+  std::vector<unsigned int> want(static_cast<std::size_t>(size[0])*size[1]
+    *size[2], 0);
+  bool overlap = false;
+  for (std::size_t k = 0; k < scene.size(); ++k) {
+    const voxelgrid_matrix& m = scene[k];
+    for (unsigned int z = 0; z < m.depth; ++z)
+    for (unsigned int y = 0; y < m.height; ++y)
+    for (unsigned int x = 0; x < m.width; ++x) {
+      const unsigned int v = voxelbricks_get(m.voxels, x, y, z);
+      if (v == 0)
+        continue;
+      unsigned int& at = want[(x + m.pos_x - lo[0]) + ((y + m.pos_y - lo[1])
+        + static_cast<std::size_t>(z + m.pos_z - lo[2])*size[1])*size[0]];
+      overlap = overlap || at != 0;
+      at = v;
+    }
+  }
+  if (!overlap)
+    return false;
+
+  static const unsigned int flags[2] = {QBVoxel_FlagRightHand,
+    QBVoxel_FlagRightHand|QBVoxel_FlagRLE};
+  static const unsigned int threads[2] = {0, 1};
+  const char* path = "voxel_test_scene.qb";
+  bool ok = true;
+  for (unsigned int f = 0; f < 2 && ok; ++f)
+  for (unsigned int t = 0; t < 2 && ok; ++t) {
+    std::vector<voxelgrid_matrix> decoded;
+    unsigned int error = voxelgrid_encode(scene, path, flags[f]);
+    if (!error)
+      error = voxelgrid_decode_scene(decoded, path, threads[t]);
+    if (error) {
+      std::fprintf(stderr, "# %s: %s\n", f ? "rle" : "raw",
+                   voxelgrid_error_text(error));
+      ok = false;
+      break;
+    }
+    ok = decoded.size() == scene.size();
+    for (std::size_t k = 0; k < decoded.size() && ok; ++k) {
+      const voxelgrid_matrix& m = decoded[k];
+      const voxelgrid_matrix& s = scene[k];
+      ok = m.name == s.name && m.pos_x == s.pos_x && m.pos_y == s.pos_y
+        && m.pos_z == s.pos_z && m.width == s.width && m.height == s.height
+        && m.depth == s.depth;
+      for (unsigned int z = 0; z < m.depth && ok; ++z)
+      for (unsigned int y = 0; y < m.height && ok; ++y)
+      for (unsigned int x = 0; x < m.width && ok; ++x)
+        ok = voxelbricks_get(m.voxels, x, y, z)
+          == voxelbricks_get(s.voxels, x, y, z);
+    }
+    if (!ok) {
+      std::fprintf(stderr, "# %s: matrices differ\n", f ? "rle" : "raw");
+      break;
+    }
+
+    voxelbricks volume;
+    long int origin[3];
+    const unsigned int layout = t ? VoxelBricks_Morton : VoxelBricks_Linear;
+    ok = voxelgrid_flatten(decoded, volume, origin, threads[t], layout) == 0
+      && origin[0] == lo[0] && origin[1] == lo[1] && origin[2] == lo[2]
+      && volume.width == size[0] && volume.height == size[1]
+      && volume.depth == size[2];
+    std::size_t pos = 0;
+    for (unsigned int z = 0; z < size[2] && ok; ++z)
+    for (unsigned int y = 0; y < size[1] && ok; ++y)
+    for (unsigned int x = 0; x < size[0] && ok; ++x, ++pos) {
+      ok = voxelbricks_get(volume, x, y, z) == want[pos];
+      if (!ok) {
+        std::fprintf(stderr, "# %s: voxel (%u, %u, %u) differs\n",
+                     f ? "rle" : "raw", x, y, z);
+      }
+    }
+  }
+  std::remove(path);
+  return ok;
+}
+
+//Whether `chunks`, picked by `voxellod_select`, cover each full-detail
+//chunk with triangles exactly once and no chunk twice.
+static
+bool voxel_test_lodcover(const voxellod& lod,
+  const std::vector<voxelcull_chunk>& chunks)
+{
+  const voxellod_level& full = lod.levels[0];
+  std::vector<unsigned int> covered(full.chunk_run.size(), 0);
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    const voxelcull_chunk& c = chunks[i];
+    for (unsigned int dz = 0; dz < c.span; ++dz)
+    for (unsigned int dy = 0; dy < c.span; ++dy)
+    for (unsigned int dx = 0; dx < c.span; ++dx) {
+      const unsigned int at[3] = {c.cell[0] + dx, c.cell[1] + dy,
+        c.cell[2] + dz};
+      if (at[0] < full.count[0] && at[1] < full.count[1]
+      &&  at[2] < full.count[2])
+      {
+        covered[at[0] + (at[1] + static_cast<std::size_t>(at[2])
+          *full.count[1])*full.count[0]] += 1;
+      }
+    }
+  }
+  for (std::size_t c = 0; c < covered.size(); ++c) {
+    const bool has_run = full.chunk_run[c] < full.runs.size();
+    if (covered[c] > 1 || (has_run && covered[c] != 1)) {
+      std::fprintf(stderr, "# chunk %zu covered %u times\n", c, covered[c]);
+      return false;
+    }
+  }
+  return true;
+}
+
+//Levels of detail of `scene`: every run of each level belongs to one
+//chunk, full detail up close draws the whole full-detail mesh, and the
+//picks along a path out and back, which goes through hysteresis, cover
+//each full-detail chunk once.
+static
+bool voxel_test_lodselect_scene(const std::vector<voxelgrid_matrix>& scene) {
+  VoxelGridOptions opt;
+  opt.verbose = false;
+  opt.lod_levels = 3;
+  VoxelGrid grid(opt);
+  if (!voxel_test_load(scene, "lodselect", grid))
+    return false;
+  grid.createMesh();
+  if (!grid.createLevels() || grid.lod.levels.size() < 2)
+    return false;
+  const voxellod& lod = grid.lod;
+  for (std::size_t k = 0; k < lod.levels.size(); ++k) {
+    const voxellod_level& level = lod.levels[k];
+    std::vector<unsigned int> refs(level.runs.size(), 0);
+    for (std::size_t c = 0; c < level.chunk_run.size(); ++c) {
+      if (level.chunk_run[c] < level.runs.size())
+        refs[level.chunk_run[c]] += 1;
+    }
+    for (std::size_t r = 0; r < refs.size(); ++r) {
+      if (refs[r] != 1) {
+        std::fprintf(stderr, "# level %zu: run %zu has %u chunks\n", k, r,
+                     refs[r]);
+        return false;
+      }
+    }
+  }
+
+  const float size = static_cast<float>((std::max)(grid.width,
+    (std::max)(grid.height, grid.depth)));
+  const float center[3] = {grid.width*0.5f, grid.height*0.5f,
+    grid.depth*0.5f};
+  std::vector<voxelcull_chunk> chunks;
+  voxellod_view view;
+  voxellod_select(lod, view, center, 1.0e6f, chunks);
+  std::size_t indices = 0;
+  for (std::size_t i = 0; i < chunks.size(); ++i)
+    indices += chunks[i].span == 1 ? chunks[i].count : 0;
+  if (indices != lod.levels[0].index_count) {
+    std::fprintf(stderr, "# full detail draws %zu of %zu indices\n",
+                 indices, lod.levels[0].index_count);
+    return false;
+  }
+
+  //eye distances from the center, in volume edges, out and back again
+  static const float path[] = {0.0f, 0.6f, 1.0f, 1.6f, 2.5f, 4.0f, 8.0f,
+    4.0f, 2.5f, 1.6f, 1.0f, 0.6f, 0.0f};
+  const std::size_t steps = sizeof(path)/sizeof(path[0]);
+  bool mixed = false;
+  voxellod_view walk;
+  for (std::size_t i = 0; i < steps; ++i) {
+    const float eye[3] = {center[0] + 0.8f*path[i]*size,
+      center[1] + 0.3f*path[i]*size, center[2] + 0.5f*path[i]*size};
+    for (unsigned int again = 0; again < 2; ++again) {
+      voxellod_select(lod, walk, eye, 100.0f, chunks);
+      if (!voxel_test_lodcover(lod, chunks)) {
+        std::fprintf(stderr, "# eye at %g volume edges\n", path[i]);
+        return false;
+      }
+    }
+    bool fine = false, coarse = false;
+    for (std::size_t c = 0; c < chunks.size(); ++c)
+      (chunks[c].span == 1 ? fine : coarse) = true;
+    mixed = mixed || (fine && coarse);
+  }
+  if (!mixed)
+    std::fprintf(stderr, "# no view mixed levels\n");
+  return mixed;
+}
+
+//Level-of-detail picks on a terrain cube, and on a flat fill whose top
+//faces lie on a chunk boundary with one voxel above them, so the chunk
+//below holds only faces on its upper plane.
+static
+bool voxel_test_lodselect(void) {
+  std::vector<voxelgrid_matrix> scene(1);
+  voxelsynth_terrain(96, scene[0]);
+  if (!voxel_test_lodselect_scene(scene))
+    return false;
+  voxelgrid_matrix& m = scene[0];
+  voxelbricks_init(m.voxels, 96, 96, 96);
+  const unsigned int ground = voxelbricks_pack(90, 160, 60, 255);
+  for (unsigned int z = 0; z < 96; ++z)
+  for (unsigned int y = 0; y < 64; ++y)
+  for (unsigned int x = 0; x < 96; ++x)
+    voxelbricks_set(m.voxels, x, y, z, ground);
+  voxelbricks_set(m.voxels, 40, 70, 40, voxelbricks_pack(200, 40, 40, 255));
+  return voxel_test_lodselect_scene(scene);
+}
+
+//Whether `tree` matches `vb` voxel for voxel, over boxes, and along rays
+//parallel to each axis through every row.
+static
+bool voxel_test_octree_matches(const voxeloctree& tree,
+  const voxelbricks& vb)
+{
+  const unsigned int dims[3] = {vb.width, vb.height, vb.depth};
+  for (unsigned int z = 0; z < vb.depth; ++z)
+  for (unsigned int y = 0; y < vb.height; ++y)
+  for (unsigned int x = 0; x < vb.width; ++x) {
+    if (voxeloctree_get(tree, x, y, z) != voxelbricks_get(vb, x, y, z)) {
+      std::fprintf(stderr, "# get differs at (%u, %u, %u)\n", x, y, z);
+      return false;
+    }
+  }
+  if (voxeloctree_get(tree, vb.width, 0, 0) != 0)
+    return false;
+
+  //every solid voxel of a box lies in exactly one leaf of the query
+  std::vector<voxeloctree_leaf> leaves;
+  for (unsigned int b = 0; b < 8; ++b) {
+    unsigned int lo[3], hi[3];
+    for (unsigned int a = 0; a < 3; ++a) {
+      lo[a] = (b*7 + a*5) % dims[a];
+      hi[a] = (std::min)(dims[a], lo[a] + 3 + (b*11 + a*3) % dims[a]);
+    }
+    voxeloctree_query(tree, lo, hi, leaves);
+    unsigned long long solid = 0, covered = 0;
+    for (unsigned int z = lo[2]; z < hi[2]; ++z)
+    for (unsigned int y = lo[1]; y < hi[1]; ++y)
+    for (unsigned int x = lo[0]; x < hi[0]; ++x)
+      solid += voxelbricks_get(vb, x, y, z) != 0;
+    for (std::size_t i = 0; i < leaves.size(); ++i) {
+      const voxeloctree_leaf& l = leaves[i];
+      const unsigned int at[3] = {l.x, l.y, l.z};
+      unsigned long long volume = 1;
+      for (unsigned int a = 0; a < 3; ++a) {
+        const unsigned int from = (std::max)(at[a], lo[a]);
+        const unsigned int to = (std::min)(at[a] + l.edge, hi[a]);
+        volume *= to > from ? to - from : 0;
+      }
+      if (volume == 0 || l.value != voxelbricks_get(vb,
+          (std::max)(l.x, lo[0]), (std::max)(l.y, lo[1]),
+          (std::max)(l.z, lo[2])))
+        return false;
+      covered += volume;
+    }
+    if (covered != solid) {
+      std::fprintf(stderr, "# query %u: %llu of %llu solid voxels\n", b,
+                   covered, solid);
+      return false;
+    }
+  }
+
+  //from just outside each face, straight through voxel centers
+  for (unsigned int face = 0; face < 6; ++face) {
+    const unsigned int a = face/2, u = (a+1)%3, v = (a+2)%3;
+    const bool up = (face&1) == 0;
+    for (unsigned int j = 0; j < dims[v]; ++j)
+    for (unsigned int i = 0; i < dims[u]; ++i) {
+      float origin[3], dir[3] = {0.0f, 0.0f, 0.0f};
+      origin[a] = up ? -0.5f : dims[a] + 0.5f;
+      origin[u] = i + 0.5f;
+      origin[v] = j + 0.5f;
+      dir[a] = up ? 1.0f : -1.0f;
+      unsigned int at[3];
+      at[u] = i;
+      at[v] = j;
+      bool found = false;
+      for (unsigned int s = 0; s < dims[a] && !found; ++s) {
+        at[a] = up ? s : dims[a]-1 - s;
+        found = voxelbricks_get(vb, at[0], at[1], at[2]) != 0;
+      }
+      voxeloctree_hit hit;
+      const bool got = voxeloctree_raycast(tree, origin, dir,
+        static_cast<float>(dims[a]) + 1.0f, hit);
+      if (got != found || (found && (hit.x != at[0] || hit.y != at[1]
+      ||  hit.z != at[2] || hit.value != voxelbricks_get(vb, at[0], at[1],
+          at[2]))))
+      {
+        std::fprintf(stderr, "# ray %u through (%u, %u) differs\n", face,
+                     i, j);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//Write `size` bytes to `path`.
+static
+bool voxel_test_write(const char* path, const unsigned char* bytes,
+  std::size_t size)
+{
+  std::FILE* fp = std::fopen(path, "wb");
+  if (!fp)
+    return false;
+  const bool ok = std::fwrite(bytes, 1, size, fp) == size;
+  return std::fclose(fp) == 0 && ok;
+}
+
+//Read all of `path` into `bytes`.
+static
+bool voxel_test_read(const char* path, std::vector<unsigned char>& bytes) {
+  bytes.clear();
+  std::FILE* fp = std::fopen(path, "rb");
+  if (!fp)
+    return false;
+  unsigned char buf[4096];
+  std::size_t got;
+  while ((got = std::fread(buf, 1, sizeof(buf), fp)) > 0)
+    bytes.insert(bytes.end(), buf, buf + got);
+  return std::fclose(fp) == 0;
+}
+
+//An octree of a terrain cube with odd sizes and a few lone voxels agrees
+//with its bricks, both as built and saved then mapped; malformed files
+//are refused.
+static
+bool voxel_test_octree(void) {
+  voxelgrid_matrix m;
+  voxelsynth_terrain(48, m);
+  voxelbricks vb;
+  voxelbricks_init(vb, 45, 40, 37);
+  for (unsigned int z = 0; z < vb.depth; ++z)
+  for (unsigned int y = 0; y < vb.height; ++y)
+  for (unsigned int x = 0; x < vb.width; ++x)
+    voxelbricks_set(vb, x, y, z, voxelbricks_get(m.voxels, x, y, z));
+  voxelbricks_set(vb, 44, 39, 36, voxelbricks_pack(255, 0, 0, 255));
+  voxelbricks_set(vb, 3, 38, 20, voxelbricks_pack(0, 255, 0, 255));
+  voxelbricks_set(vb, 0, 0, 0, 0);
+
+  const char* path = "voxel_test_octree.svo";
+  voxeloctree built, mapped;
+  voxeloctree_init(built);
+  voxeloctree_init(mapped);
+  bool ok = voxeloctree_build(built, vb)
+    && voxel_test_octree_matches(built, vb)
+    && voxeloctree_save(built, path) == 0
+    && voxeloctree_map(mapped, path) == 0
+    && mapped.count == built.count
+    && voxel_test_octree_matches(mapped, vb);
+  voxeloctree_clear(mapped);
+
+  //a root whose children lie past the end, with fewer than eight nodes
+  std::vector<unsigned char> bytes(VoxelOctree_HeaderSize + 8);
+  std::FILE* fp = ok ? std::fopen(path, "rb") : NULL;
+  ok = fp && std::fread(&bytes[0], 1, VoxelOctree_HeaderSize, fp)
+    == VoxelOctree_HeaderSize;
+  if (fp)
+    std::fclose(fp);
+  qbvoxel_api_to_u32(&bytes[24], 1);
+  qbvoxel_api_to_u32(&bytes[VoxelOctree_HeaderSize], 1000);
+  qbvoxel_api_to_u32(&bytes[VoxelOctree_HeaderSize + 4], 0);
+  ok = ok && voxel_test_write(path, &bytes[0], bytes.size())
+    && voxeloctree_map(mapped, path) == QBVoxel_ErrData;
+  //children overlapping the end of the array
+  bytes.resize(VoxelOctree_HeaderSize + 9*8, 0);
+  qbvoxel_api_to_u32(&bytes[24], 9);
+  qbvoxel_api_to_u32(&bytes[VoxelOctree_HeaderSize], 2);
+  ok = ok && voxel_test_write(path, &bytes[0], bytes.size())
+    && voxeloctree_map(mapped, path) == QBVoxel_ErrData;
+  //a node array shorter than the header says
+  ok = ok && voxel_test_write(path, &bytes[0], bytes.size() - 4)
+    && voxeloctree_map(mapped, path) == QBVoxel_ErrData;
+  std::remove(path);
+  voxeloctree_clear(mapped);
+  voxeloctree_clear(built);
+  return ok;
+}
+
+//Float meshes with face ids leave `normals` empty and put the face of
+//each vertex's quad in w; the normals of that face are those a mesh with
+//normals carries, in both indexed and soup modes.
+static
+bool voxel_test_faceids(void) {
+  std::vector<voxelgrid_matrix> scene(1);
+  voxelsynth_terrain(32, scene[0]);
+  for (unsigned int indexed = 0; indexed < 2; ++indexed) {
+    VoxelGridOptions opt;
+    opt.verbose = false;
+    opt.packed = false;
+    opt.indexed = indexed != 0;
+    VoxelGrid with_normals(opt);
+    opt.normals = false;
+    VoxelGrid grid(opt);
+    if (!voxel_test_load(scene, "faceids", grid)
+    ||  !voxel_test_load(scene, "faceids", with_normals))
+      return false;
+    grid.createMesh();
+    grid.createNormals();
+    with_normals.createMesh();
+    with_normals.createNormals();
+    if (!grid.faceIds() || with_normals.faceIds() || !grid.normals.empty()
+    ||  grid.vertices.empty()
+    ||  grid.vertices.size() != with_normals.vertices.size()
+    ||  with_normals.normals.size() != grid.vertices.size())
+      return false;
+    for (std::size_t i = 0; i < grid.vertices.size(); ++i) {
+      const vec4& v = grid.vertices[i];
+      const std::size_t quad = indexed ? grid.vertex_quads[i] : i/6;
+      const unsigned int face = static_cast<unsigned int>(v.w);
+      float n[3];
+      voxelmesh_face_normal(face, n);
+      const vec3& want = with_normals.normals[i];
+      if (v.w != static_cast<GLfloat>(grid.quads[quad].face)
+      ||  n[0] != want.x || n[1] != want.y || n[2] != want.z
+      ||  v.x != with_normals.vertices[i].x
+      ||  v.y != with_normals.vertices[i].y
+      ||  v.z != with_normals.vertices[i].z)
+      {
+        std::fprintf(stderr, "# %s vertex %zu: face %g\n",
+                     indexed ? "indexed" : "soup", i, v.w);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//Corners of each triangle of `grid` as x, y, z, r, g, b and face,
+//rotated to start at the least corner so winding is kept, and sorted.
+static
+void voxel_test_triangles(const VoxelGrid& grid,
+  std::vector<std::vector<unsigned int> >& triangles)
+{
+  const std::size_t count = grid.packed_mesh ? grid.indices.size()
+    : grid.vertices.size();
+  triangles.assign(count/3, std::vector<unsigned int>(21));
+  for (std::size_t i = 0; i < count; ++i) {
+    unsigned int* c = &triangles[i/3][(i%3)*7];
+    if (grid.packed_mesh) {
+      const voxelmesh_packed_vertex& v = grid.packed[grid.indices[i]];
+      const unsigned int corner[7] = {v.x, v.y, v.z, v.r, v.g, v.b, v.face};
+      std::copy(corner, corner+7, c);
+    } else {
+      const vec4& v = grid.vertices[i];
+      const vec3& rgb = grid.colors[i];
+      const float corner[7] = {v.x, v.y, v.z, rgb.x*255.0f + 0.5f,
+        rgb.y*255.0f + 0.5f, rgb.z*255.0f + 0.5f, v.w};
+      for (unsigned int k = 0; k < 7; ++k)
+        c[k] = static_cast<unsigned int>(corner[k]);
+    }
+  }
+  for (std::size_t t = 0; t < triangles.size(); ++t) {
+    std::vector<unsigned int>& tri = triangles[t];
+    std::size_t least = 0;
+    for (std::size_t k = 1; k < 3; ++k) {
+      if (std::lexicographical_compare(tri.begin()+k*7, tri.begin()+k*7+7,
+            tri.begin()+least*7, tri.begin()+least*7+7))
+        least = k;
+    }
+    std::rotate(tri.begin(), tri.begin()+least*7, tri.end());
+  }
+  std::sort(triangles.begin(), triangles.end());
+}
+
+//Indexed packed meshes draw the same triangles, with the same corners,
+//colors and faces, as float triangle soup; volumes wider than 65535
+//voxels are refused by voxelmesh_pack and mesh with floats instead.
+static
+bool voxel_test_packed(void) {
+  std::vector<voxelgrid_matrix> scene(1);
+  voxelsynth_terrain(32, scene[0]);
+  VoxelGridOptions opt;
+  opt.verbose = false;
+  opt.indexed = false;
+  opt.packed = false;
+  opt.normals = false;
+  VoxelGrid soup(opt);
+  opt.indexed = true;
+  opt.packed = true;
+  VoxelGrid packed(opt);
+  if (!voxel_test_load(scene, "packed", soup)
+  ||  !voxel_test_load(scene, "packed", packed))
+    return false;
+  soup.createMesh();
+  soup.createColors();
+  packed.createMesh();
+  std::vector<std::vector<unsigned int> > a, b;
+  voxel_test_triangles(soup, a);
+  voxel_test_triangles(packed, b);
+  if (soup.packed_mesh || !packed.packed_mesh || a.empty() || a != b) {
+    std::fprintf(stderr, "# %zu soup triangles, %zu packed\n", a.size(),
+                 b.size());
+    return false;
+  }
+
+  std::vector<voxelmesh_quad> quads(1);
+  std::vector<voxelmesh_packed_vertex> vertices;
+  std::vector<unsigned int> indices;
+  voxelmesh_quad& q = quads[0];
+  q.x = 65535;
+  q.y = 65534;
+  q.z = 0;
+  q.du = 1;
+  q.dv = 1;
+  q.face = 0;
+  q.r = q.g = q.b = 255;
+  if (!voxelmesh_pack(quads, vertices, indices) || vertices.size() != 4)
+    return false;
+  q.y = 65535;
+  if (voxelmesh_pack(quads, vertices, indices))
+    return false;
+
+  //A row of voxels whose last corner lies at x = 65537
+  voxelgrid_matrix& row = scene[0];
+  row.width = 65537;
+  row.height = row.depth = 1;
+  voxelbricks_init(row.voxels, row.width, 1, 1);
+  for (unsigned int x = row.width - 4; x < row.width; ++x)
+    voxelbricks_set(row.voxels, x, 0, 0, voxelbricks_pack(90, 90, 90, 255));
+  VoxelGrid wide(opt);
+  if (!voxel_test_load(scene, "packed", wide))
+    return false;
+  wide.createMesh();
+  if (wide.packed_mesh || !wide.packed.empty() || wide.vertices.empty()
+  ||  wide.quads.empty() || wide.getNumTri() != wide.quads.size()*2)
+    return false;
+  return true;
+}
+
+//A saved mesh cache maps back as it was, and is refused with
+//`QBVoxel_ErrData` for another source, for a flipped byte in the payload
+//or in the header's size or origin, when truncated, and for an index
+//past the vertices.
+static
+bool voxel_test_meshcache(void) {
+  std::vector<voxelgrid_matrix> scene(1);
+  voxelsynth_terrain(32, scene[0]);
+  voxeloccupancy occupancy;
+  std::vector<voxelmesh_quad> quads;
+  std::vector<voxelmesh_packed_vertex> vertices;
+  std::vector<unsigned int> indices;
+  if (!voxeloccupancy_build(occupancy, scene[0].voxels))
+    return false;
+  voxelmesh_build(scene[0].voxels, occupancy, quads);
+  if (!voxelmesh_pack(quads, vertices, indices) || indices.empty())
+    return false;
+
+  voxelcache cache, mapped;
+  voxelcache_init(cache);
+  voxelcache_init(mapped);
+  cache.width = 32;
+  cache.height = 31;
+  cache.depth = 30;
+  cache.origin[0] = -5;
+  cache.origin[1] = 7;
+  cache.origin[2] = -70000;
+  cache.source_hash = 0x0123456789ABCDEFull;
+  cache.vertices = &vertices[0];
+  cache.vertex_count = vertices.size();
+  cache.indices = &indices[0];
+  cache.index_count = indices.size();
+  cache.index_size = sizeof(unsigned int);
+  const char* path = "voxel_test_mesh.meshcache";
+  std::vector<unsigned char> bytes;
+  bool ok = voxelcache_save(cache, path) == 0
+    && voxelcache_map(mapped, path, cache.source_hash) == 0
+    && mapped.width == cache.width && mapped.height == cache.height
+    && mapped.depth == cache.depth && mapped.origin[0] == cache.origin[0]
+    && mapped.origin[1] == cache.origin[1]
+    && mapped.origin[2] == cache.origin[2]
+    && mapped.vertex_count == vertices.size()
+    && mapped.index_count == indices.size() && mapped.index_size == 4
+    && std::memcmp(mapped.vertices, &vertices[0],
+                   vertices.size()*sizeof(vertices[0])) == 0
+    && std::memcmp(mapped.indices, &indices[0],
+                   indices.size()*sizeof(indices[0])) == 0;
+  voxelcache_close(mapped);
+  ok = ok && voxel_test_read(path, bytes)
+    && voxelcache_map(mapped, path, cache.source_hash + 1) == QBVoxel_ErrData;
+
+  //width, origin, a vertex and the last index byte in turn
+  const std::size_t flips[4] = {16, 36, VoxelCache_HeaderSize + 5,
+    bytes.size() - 1};
+  for (unsigned int f = 0; f < 4 && ok; ++f) {
+    std::vector<unsigned char> bad = bytes;
+    bad[flips[f]] ^= 0x10;
+    ok = voxel_test_write(path, &bad[0], bad.size())
+      && voxelcache_map(mapped, path, cache.source_hash) == QBVoxel_ErrData;
+  }
+  ok = ok && voxel_test_write(path, &bytes[0], bytes.size() - 6)
+    && voxelcache_map(mapped, path, cache.source_hash) == QBVoxel_ErrData;
+
+  //saving does not check indices, so the checksum matches here
+  indices[indices.size()/2] = static_cast<unsigned int>(vertices.size());
+  ok = ok && voxelcache_save(cache, path) == 0
+    && voxelcache_map(mapped, path, cache.source_hash) == QBVoxel_ErrData;
+  std::remove(path);
+  voxelcache_close(mapped);
+  return ok;
+}
+
+static
+mat4 voxel_test_scalar_multiply(const mat4& a, const mat4& b) {
+  mat4 c(0.0);
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 4; ++j)
+      for (int k = 0; k < 4; ++k)
+        c[i][j] += a[i][k]*b[k][j];
+  return c;
+}
+
+static
+vec4 voxel_test_scalar_apply(const mat4& m, const vec4& v) {
+  return vec4(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z + m[0][3]*v.w,
+              m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z + m[1][3]*v.w,
+              m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z + m[2][3]*v.w,
+              m[3][0]*v.x + m[3][1]*v.y + m[3][2]*v.z + m[3][3]*v.w);
+}
+
+//Largest difference from `want`, relative to its largest entry
+static
+double voxel_test_math_error(const GLfloat* got, const GLfloat* want,
+  unsigned int n)
+{
+  double diff = 0.0, scale = 1e-30;
+  for (unsigned int i = 0; i < n; ++i) {
+    diff = (std::max)(diff, static_cast<double>(std::fabs(got[i] - want[i])));
+    scale = (std::max)(scale, static_cast<double>(std::fabs(want[i])));
+  }
+  return diff/scale;
+}
+
+//The mat4 kernels match plain scalar code over random, well-conditioned
+//matrices and vectors.
+static
+bool voxel_test_math(void) {
+  const std::size_t count = 4096;
+  unsigned long long seed = 12345;
+  std::vector<mat4> ms(count);
+  std::vector<vec4> vs(count), out(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    for (int a = 0; a < 4; ++a) {
+      for (int b = 0; b < 4; ++b) {
+        seed = seed*6364136223846793005ull + 1442695040888963407ull;
+        ms[i][a][b] = static_cast<GLfloat>((seed >> 40) % 2001)/1000.0f - 1.0f
+          + (a == b ? 4.0f : 0.0f);
+      }
+      vs[i][a] = ms[i][a][(a+1)&3];
+    }
+  }
+  double error = 0.0;
+  for (std::size_t i = 0; i < count; ++i) {
+    const mat4& m = ms[i];
+    const mat4 product = m*ms[count-1-i];
+    const mat4 product_ref = voxel_test_scalar_multiply(m, ms[count-1-i]);
+    error = (std::max)(error, voxel_test_math_error(product, product_ref, 16));
+    const vec4 applied = m*vs[i];
+    const vec4 applied_ref = voxel_test_scalar_apply(m, vs[i]);
+    error = (std::max)(error, voxel_test_math_error(applied, applied_ref, 4));
+    const mat4 t = transpose(m);
+    for (int a = 0; a < 4; ++a)
+      for (int b = 0; b < 4; ++b)
+        error = (std::max)(error, static_cast<double>(t[a][b] != m[b][a]));
+    const mat4 inverse = invert(m);
+    const mat4 inverse_ref = invertCofactor(m);
+    error = (std::max)(error, voxel_test_math_error(inverse, inverse_ref, 16));
+  }
+  //one matrix over every vector, as when moving mesh data
+  transform(ms[0], &vs[0], &out[0], count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const vec4 ref = voxel_test_scalar_apply(ms[0], vs[i]);
+    error = (std::max)(error, voxel_test_math_error(out[i], ref, 4));
+  }
+  if (error > 1e-4) {
+    std::fprintf(stderr, "# mat4 kernels differ from scalar by %g\n", error);
+    return false;
+  }
+  return true;
+}
+
+
+static struct {
+  const char* name;
+  bool (*cb)(void);
+} const voxel_test_list[] = {
+  { "morton", voxel_test_morton },
+  { "occupancy", voxel_test_occupancy },
+  { "palette", voxel_test_palette },
+  { "greedy", voxel_test_greedy },
+  { "layouts", voxel_test_layouts },
+  { "threads", voxel_test_threads },
+  { "edit", voxel_test_edit },
+  { "occlusion", voxel_test_occlusion },
+  { "lodreduce", voxel_test_lodreduce },
+  { "lodselect", voxel_test_lodselect },
+  { "octree", voxel_test_octree },
+  { "faceids", voxel_test_faceids },
+  { "packed", voxel_test_packed },
+  { "meshcache", voxel_test_meshcache },
+  { "scene", voxel_test_scene_load },
+  { "math", voxel_test_math },
+};
+
+int main(int argc, char** argv) {
+  const std::size_t count = sizeof(voxel_test_list)/sizeof(voxel_test_list[0]);
+  std::vector<std::size_t> run;
+  for (std::size_t i = 0; i < count; ++i) {
+    bool named = (argc < 2);
+    for (int a = 1; a < argc && !named; ++a)
+      named = (std::strcmp(argv[a], voxel_test_list[i].name) == 0);
+    if (named)
+      run.push_back(i);
+  }
+  int status = EXIT_SUCCESS;
+  std::fprintf(stderr, "1..%u\n", static_cast<unsigned int>(run.size()));
+  //which optional kernels this build compiled in
+  std::fprintf(stderr, "# kernels:%s%s%s\n",
+#ifdef __AVX2__
+               " avx2",
+#else
+               "",
+#endif //__AVX2__
+#ifdef __BMI2__
+               " bmi2",
+#else
+               "",
+#endif //__BMI2__
+#ifdef __SSE2__
+               " sse2"
+#else
+               ""
+#endif //__SSE2__
+               );
+  for (std::size_t i = 0; i < run.size(); ++i) {
+    const bool ok = voxel_test_list[run[i]].cb();
+    if (!ok)
+      status = EXIT_FAILURE;
+    std::fprintf(stderr, "%s %u %s\n", ok ? "ok" : "not ok",
+                 static_cast<unsigned int>(i+1), voxel_test_list[run[i]].name);
+  }
+  return status;
+}
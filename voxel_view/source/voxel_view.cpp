@@ -1,5 +1,9 @@
 #include "common.h"
 #include "SourcePath.h"
+#include "workpool.h"
+#include "voxelstream.h"
+#include <deque>
+#include <mutex>
 
 
 using namespace Angel;
@@ -26,10 +30,81 @@ std::string files[_TOTAL_IMAGES] = {"/models/three.qb",
 
 
 
+//Models load the first time they are shown; at most _MAX_RESIDENT stay
+//on the GPU, the least recently shown one is dropped first
+const unsigned int _MAX_RESIDENT = 2;
+
 std::vector < VoxelGrid > voxelgrid;
 std::vector < GLuint > buffer;
+std::vector < GLuint > index_buffer;
+std::vector < GLenum > index_type;
+//Allocated bytes of each buffer; edits can outgrow them
+std::vector < std::size_t > buffer_bytes;
+std::vector < std::size_t > index_buffer_bytes;
 std::vector < GLuint > vao;
-GLuint ModelView_loc, NormalMatrix_loc, Projection_loc;
+enum{_UNLOADED, _LOADING, _RESIDENT};
+std::vector < int > model_state;
+std::vector < unsigned long > last_shown;
+unsigned long show_count;
+//Model on screen; it stays there while current_draw loads
+int shown_draw;
+//Models reloaded from voxels with a chunked mesh, so they can be edited
+std::vector < char > model_editable;
+//Models loaded with coarser levels of detail for far chunks, and the
+//level choices of each, kept between frames
+const unsigned int _LOD_LEVELS = 4;
+std::vector < char > model_lod;
+std::vector < voxellod_view > lod_views;
+bool pending_lod;
+
+//Loads run on one loader thread, which decodes and meshes, then uploads
+//through a hidden window whose context shares buffers with the main one.
+//The render thread takes them over once their fence has signaled.
+struct finished_load {
+  unsigned int model;
+  VoxelGrid* grid;
+  GLuint buffer, index_buffer;
+  GLenum index_type;
+  std::size_t buffer_bytes, index_buffer_bytes;
+  GLsync fence;
+  double start;
+  //Bytes the upload streamed and stalls it hit
+  unsigned long long streamed, stalls;
+};
+GLFWwindow* upload_window;
+WorkPool* loader;
+//Upload ring of the loader's context
+const std::size_t _UPLOAD_RING_BYTES = 4 << 20;
+voxelstream upload_stream;
+//Patch ring of the render context, for edits
+const std::size_t _PATCH_RING_BYTES = 1 << 20;
+voxelstream patch_stream;
+//Visible index runs of the shown model, rebuilt every frame
+std::vector < std::size_t > draw_first, draw_count;
+std::vector < GLsizei > draw_counts;
+std::vector < const GLvoid* > draw_offsets;
+//Runs of the levels picked for the shown model, when it has levels
+std::vector < voxelcull_chunk > lod_chunks;
+//Chunks inside the view volume and not hidden by nearer solid voxels
+std::vector < char > draw_visible;
+voxelocclude occlusion;
+bool occlusion_culling;
+enum{_EDIT_NONE, _EDIT_FILL, _EDIT_CLEAR};
+int pending_edit;
+unsigned long long edit_seed;
+std::mutex finished_lock;
+std::deque < finished_load > finished;
+//Longest frame since the last load request, in seconds
+double longest_frame;
+//Float meshes with normals draw with vshader.glsl; packed meshes, and
+//float meshes with face ids in w, with vshader_packed.glsl
+enum{_FLOAT_PROGRAM, _PACKED_PROGRAM, _TOTAL_PROGRAMS};
+//Per vertex attributes, at the same slots in both programs
+const GLuint vPosition = 0;
+const GLuint vColor = 1;
+const GLuint vNormal = 2;
+GLuint programs[_TOTAL_PROGRAMS];
+GLuint ModelView_loc[_TOTAL_PROGRAMS], NormalMatrix_loc[_TOTAL_PROGRAMS], Projection_loc[_TOTAL_PROGRAMS];
 bool wireframe;
 int current_draw;
 
@@ -66,6 +141,20 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
   if (key == GLFW_KEY_W && action == GLFW_PRESS){
     wireframe = !wireframe;
   }
+  if (key == GLFW_KEY_O && action == GLFW_PRESS){
+    occlusion_culling = !occlusion_culling;
+  }
+  //Reload the shown model with or without levels of detail
+  if (key == GLFW_KEY_L && action == GLFW_PRESS){
+    pending_lod = true;
+  }
+  //Edit a box of the shown model: 'e' fills it, 'c' clears it
+  if (key == GLFW_KEY_E && action == GLFW_PRESS){
+    pending_edit = _EDIT_FILL;
+  }
+  if (key == GLFW_KEY_C && action == GLFW_PRESS){
+    pending_edit = _EDIT_CLEAR;
+  }
 }
 
 //User interaction handler
@@ -133,119 +222,417 @@ void mouse_move(GLFWwindow* window, double x, double y){
 }
 
 
-void init(){
-  
-  std::string vshader = source_path + "/shaders/vshader.glsl";
-  std::string fshader = source_path + "/shaders/fshader.glsl";
-  
-  GLchar* vertex_shader_source = readShaderSource(vshader.c_str());
-  GLchar* fragment_shader_source = readShaderSource(fshader.c_str());
-
-  GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, (const GLchar**) &vertex_shader_source, NULL);
-  glCompileShader(vertex_shader);
-  check_shader_compilation(vshader, vertex_shader);
-  
-  GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, (const GLchar**) &fragment_shader_source, NULL);
-  glCompileShader(fragment_shader);
-  check_shader_compilation(fshader, fragment_shader);
-  
-  GLuint program = glCreateProgram();
-  glAttachShader(program, vertex_shader);
-  glAttachShader(program, fragment_shader);
-  
-  glLinkProgram(program);
-  check_program_link(program);
-  
-  glUseProgram(program);
-  
-  glBindFragDataLocation(program, 0, "fragColor");
-
-  //Per vertex attributes
-  GLuint vPosition = glGetAttribLocation( program, "vPosition" );
-  GLuint vColor = glGetAttribLocation( program, "vColor" );
-  GLuint vNormal = glGetAttribLocation( program, "vNormal" );
+//Drop the GPU buffers and mesh of model `i`
+static void unload_model(unsigned int i){
+  glDeleteVertexArrays( 1, &vao[i] );
+  glDeleteBuffers( 1, &buffer[i] );
+  glDeleteBuffers( 1, &index_buffer[i] );
+  vao[i] = buffer[i] = index_buffer[i] = 0;
+  buffer_bytes[i] = index_buffer_bytes[i] = 0;
+  voxelcache_close(voxelgrid[i].cache);
+  voxelgrid[i] = VoxelGrid(VoxelGridOptions());
+  model_state[i] = _UNLOADED;
+}
 
-  //Compute ambient, diffuse, and specular terms
-  color4 ambient_product  = light_ambient * material_ambient;
-  color4 diffuse_product  = light_diffuse * material_diffuse;
-  color4 specular_product = light_specular * material_specular;
-  
-  //Retrieve and set uniform variables
-  glUniform4fv( glGetUniformLocation(program, "Light"), 1, light);
-  glUniform4fv( glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product );
-  glUniform4fv( glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product );
-  glUniform4fv( glGetUniformLocation(program, "SpecularProduct"), 1, specular_product );
-  glUniform1f(  glGetUniformLocation(program, "Shininess"), material_shininess );
-  
-  //Matrix uniform variable locations
-  ModelView_loc = glGetUniformLocation( program, "ModelView" );
-  NormalMatrix_loc = glGetUniformLocation( program, "NormalMatrix" );
-  Projection_loc = glGetUniformLocation( program, "Projection" );
-  
-  //===== Send data to GPU ======
-  vao.resize(_TOTAL_IMAGES);
-  glGenVertexArrays( _TOTAL_IMAGES, &vao[0] );
+//Fill new vertex and index buffers from `load.grid`. Runs on the loader
+//thread with the upload context current. Each buffer gets its storage
+//once and is filled through `upload_stream`, so the data is written
+//straight into GPU-visible memory and copied by the GPU.
+static void upload_model(finished_load& load){
+  VoxelGrid& grid = *load.grid;
+  const voxelstream_stats before = upload_stream.stats;
+  glGenBuffers( 1, &load.buffer );
+  glBindBuffer( GL_ARRAY_BUFFER, load.buffer );
+  if (grid.packed_mesh) {
+    //12 bytes per vertex: position and face id as shorts, then RGBA8
+    const std::vector<voxelmesh_packed_vertex>& packed = grid.packed;
+    GLsizei stride = sizeof(voxelmesh_packed_vertex);
+    //straight from the mapped cache file when there is one
+    const void* vertices = grid.cached_mesh ? static_cast<const void*>(grid.cache.vertices)
+                         : packed.empty() ? NULL : static_cast<const void*>(&packed[0]);
+    std::size_t vertices_bytes = grid.getNumVertices()*stride;
+    glBufferData( GL_ARRAY_BUFFER, vertices_bytes, NULL, GL_STATIC_DRAW );
+    voxelstream_upload( upload_stream, load.buffer, 0, vertices, vertices_bytes );
+    load.buffer_bytes = vertices_bytes;
+  } else {
+    unsigned int vertices_bytes = grid.vertices.size()*sizeof(vec4);
+    unsigned int colors_bytes  = grid.colors.size()*sizeof(vec3);
+    unsigned int normals_bytes  = grid.normals.size()*sizeof(vec3);
   
-  buffer.resize(_TOTAL_IMAGES);
-  glGenBuffers( _TOTAL_IMAGES, &buffer[0] );
-  
-  for(unsigned int i=0; i < _TOTAL_IMAGES; i++){
-    voxelgrid.push_back((source_path + files[i]).c_str());
-
-    // match normal array size of vertices
-    if (voxelgrid[i].normals.size() < voxelgrid[i].vertices.size()) {
-      std::size_t oldsize = voxelgrid[i].normals.size();
-      std::size_t newsize = voxelgrid[i].vertices.size();
-      voxelgrid[i].normals.resize(newsize);
-      for (std::size_t j = oldsize; j < newsize; ++j) {
-        voxelgrid[i].normals[j] = vec3(0.f, -1.f, 0.f);
-      }
-    }
-    if (voxelgrid[i].colors.size() < voxelgrid[i].vertices.size()) {
-      std::size_t oldsize = voxelgrid[i].colors.size();
-      std::size_t newsize = voxelgrid[i].vertices.size();
-      voxelgrid[i].colors.resize(newsize);
-      for (std::size_t j = oldsize; j < newsize; ++j) {
-        voxelgrid[i].colors[j] = vec3(0.f, 0.f, 0.f);
-      }
-    }
-
-    glBindVertexArray( vao[i] );
-    glBindBuffer( GL_ARRAY_BUFFER, buffer[i] );
-    unsigned int vertices_bytes = voxelgrid[i].vertices.size()*sizeof(vec4);
-    unsigned int colors_bytes  = voxelgrid[i].colors.size()*sizeof(vec3);
-    unsigned int normals_bytes  = voxelgrid[i].normals.size()*sizeof(vec3);
-    
     glBufferData( GL_ARRAY_BUFFER, vertices_bytes + colors_bytes + normals_bytes, NULL, GL_STATIC_DRAW );
+    load.buffer_bytes = vertices_bytes + colors_bytes + normals_bytes;
     unsigned int offset = 0;
     if (vertices_bytes > 0) {
-      glBufferSubData( GL_ARRAY_BUFFER, offset, vertices_bytes, &voxelgrid[i].vertices[0] );
+      voxelstream_upload( upload_stream, load.buffer, offset, &grid.vertices[0], vertices_bytes );
     }
     offset += vertices_bytes;
     if (colors_bytes > 0) {
-      glBufferSubData( GL_ARRAY_BUFFER, offset, colors_bytes,  &voxelgrid[i].colors[0] );
+      voxelstream_upload( upload_stream, load.buffer, offset, &grid.colors[0], colors_bytes );
     }
     offset += colors_bytes;
     if (normals_bytes > 0) {
-      glBufferSubData( GL_ARRAY_BUFFER, offset, normals_bytes,  &voxelgrid[i].normals[0] );
+      voxelstream_upload( upload_stream, load.buffer, offset, &grid.normals[0], normals_bytes );
     }
-    
-    glEnableVertexAttribArray( vColor );
-    glEnableVertexAttribArray( vPosition );
-    glEnableVertexAttribArray( vNormal );
+  }
+
+  //16-bit indices when every vertex fits
+  const std::vector<unsigned int>& indices = grid.indices;
+  load.index_buffer = 0;
+  load.index_type = GL_UNSIGNED_INT;
+  load.index_buffer_bytes = grid.getNumIndices()*grid.indexSize();
+  if (grid.cached_mesh) {
+    //already stored in upload width
+    std::size_t indices_bytes = grid.cache.index_count*grid.cache.index_size;
+    glGenBuffers( 1, &load.index_buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, load.index_buffer );
+    load.index_type = (grid.cache.index_size == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    glBufferData( GL_ARRAY_BUFFER, indices_bytes, NULL, GL_STATIC_DRAW );
+    voxelstream_upload( upload_stream, load.index_buffer, 0, grid.cache.indices, indices_bytes );
+  } else if (!indices.empty()) {
+    glGenBuffers( 1, &load.index_buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, load.index_buffer );
+    if (grid.indexSize() == 2) {
+      //narrowed as they are written into the ring
+      const unsigned int* wide = &indices[0];
+      load.index_type = GL_UNSIGNED_SHORT;
+      glBufferData( GL_ARRAY_BUFFER, indices.size()*sizeof(GLushort), NULL, GL_STATIC_DRAW );
+      voxelstream_write( upload_stream, load.index_buffer, 0, indices.size()*sizeof(GLushort),
+        [wide](void* out, std::size_t done, std::size_t n) {
+          GLushort* narrow = static_cast<GLushort*>(out);
+          const unsigned int* from = wide + done/sizeof(GLushort);
+          for (std::size_t j = 0; j < n/sizeof(GLushort); ++j)
+            narrow[j] = static_cast<GLushort>(from[j]);
+        });
+    } else {
+      glBufferData( GL_ARRAY_BUFFER, indices.size()*sizeof(GLuint), NULL, GL_STATIC_DRAW );
+      voxelstream_upload( upload_stream, load.index_buffer, 0, &indices[0], indices.size()*sizeof(GLuint) );
+    }
+  }
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+  voxelstream_frame( upload_stream );
+  load.streamed = upload_stream.stats.last_frame_bytes;
+  load.stalls = upload_stream.stats.stalls - before.stalls;
+}
+
+//Loader thread: decode, mesh and upload model `i`, then queue it for
+//the render thread behind a fence
+static void load_model(unsigned int i, double start, bool editable, bool lod){
+  finished_load load;
+  load.model = i;
+  load.start = start;
+  VoxelGridOptions grid_options;
+  grid_options.mesh_cache = true;
+  grid_options.editable = editable;
+  grid_options.lod_levels = lod ? _LOD_LEVELS : 0;
+  grid_options.normals = false;
+  load.grid = new VoxelGrid((source_path + files[i]).c_str(), grid_options);
+  VoxelGrid& grid = *load.grid;
+
+  // match normal array size of vertices, unless they carry face ids
+  if (!grid.faceIds() && grid.normals.size() < grid.vertices.size()) {
+    std::size_t oldsize = grid.normals.size();
+    std::size_t newsize = grid.vertices.size();
+    grid.normals.resize(newsize);
+    for (std::size_t j = oldsize; j < newsize; ++j) {
+      grid.normals[j] = vec3(0.f, -1.f, 0.f);
+    }
+  }
+  if (grid.colors.size() < grid.vertices.size()) {
+    std::size_t oldsize = grid.colors.size();
+    std::size_t newsize = grid.vertices.size();
+    grid.colors.resize(newsize);
+    for (std::size_t j = oldsize; j < newsize; ++j) {
+      grid.colors[j] = vec3(0.f, 0.f, 0.f);
+    }
+  }
+
+  glfwMakeContextCurrent(upload_window);
+  upload_model(load);
+  load.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush();
+  glfwMakeContextCurrent(NULL);
+
+  std::lock_guard<std::mutex> hold(finished_lock);
+  finished.push_back(load);
+}
 
-    if (vertices_bytes > 0)
-      glVertexAttribPointer( vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0) );
-    if (colors_bytes > 0)
-      glVertexAttribPointer( vColor, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(static_cast<size_t>(vertices_bytes)) );
-    if (normals_bytes > 0)
-      glVertexAttribPointer( vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(static_cast<size_t>(vertices_bytes + colors_bytes)) );
+//Queue model `i` for loading unless it is loaded or on its way
+static void request_model(unsigned int i){
+  if (model_state[i] != _UNLOADED)
+    return;
+  model_state[i] = _LOADING;
+  longest_frame = 0.0;
+  double start = glfwGetTime();
+  bool editable = model_editable[i] != 0;
+  bool lod = model_lod[i] != 0;
+  loader->post([i, start, editable, lod]() { load_model(i, start, editable, lod); });
+}
+
+//Load model `i` again with a chunked mesh; the current one stays on
+//screen until the new one is adopted
+static void reload_editable(unsigned int i){
+  if (model_state[i] == _LOADING)
+    return;
+  std::cout << "Reloading " << files[i] << " for editing\n";
+  model_editable[i] = 1;
+  model_state[i] = _UNLOADED;
+  request_model(i);
+}
+
+//Load model `i` again with levels of detail switched on or off; an
+//editable model drops its chunked mesh, which levels do not support
+static void reload_lod(unsigned int i){
+  if (model_state[i] == _LOADING)
+    return;
+  model_lod[i] = !model_lod[i];
+  model_editable[i] = 0;
+  std::cout << "Reloading " << files[i]
+            << (model_lod[i] ? " with" : " without") << " levels of detail\n";
+  model_state[i] = _UNLOADED;
+  request_model(i);
+}
 
+//Make room for one more model, never dropping the one on screen
+static void evict_models(unsigned int keep){
+  for (;;) {
+    unsigned int count = 0;
+    unsigned int oldest = _TOTAL_IMAGES;
+    for(unsigned int j=0; j < _TOTAL_IMAGES; j++){
+      if (model_state[j] != _RESIDENT) continue;
+      ++count;
+      if (j != keep && static_cast<int>(j) != shown_draw
+      &&  (oldest == _TOTAL_IMAGES || last_shown[j] < last_shown[oldest]))
+        oldest = j;
+    }
+    if (count < _MAX_RESIDENT || oldest == _TOTAL_IMAGES)
+      return;
+    std::cout << "Unloading " << files[oldest] << "\n";
+    unload_model(oldest);
+  }
+}
+
+//Render thread: adopt loads whose uploads the GPU has finished. Only the
+//vertex array is made here, as those are not shared between contexts.
+static void finish_loads(){
+  for (;;) {
+    finished_load load;
+    {
+      std::lock_guard<std::mutex> hold(finished_lock);
+      if (finished.empty())
+        return;
+      load = finished.front();
+      GLenum status = glClientWaitSync(load.fence, 0, 0);
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+      finished.pop_front();
+    }
+    glDeleteSync(load.fence);
+
+    unsigned int i = load.model;
+    evict_models(i);
+    if (vao[i] != 0) {
+      //a reload replaces the model in place
+      glDeleteVertexArrays( 1, &vao[i] );
+      glDeleteBuffers( 1, &buffer[i] );
+      glDeleteBuffers( 1, &index_buffer[i] );
+      voxelcache_close(voxelgrid[i].cache);
+    }
+    voxelgrid[i] = std::move(*load.grid);
+    delete load.grid;
+    lod_views[i] = voxellod_view();
+    buffer[i] = load.buffer;
+    index_buffer[i] = load.index_buffer;
+    index_type[i] = load.index_type;
+    buffer_bytes[i] = load.buffer_bytes;
+    index_buffer_bytes[i] = load.index_buffer_bytes;
+
+    glGenVertexArrays( 1, &vao[i] );
+    glBindVertexArray( vao[i] );
+    glBindBuffer( GL_ARRAY_BUFFER, buffer[i] );
+    if (voxelgrid[i].packed_mesh) {
+      GLsizei stride = sizeof(voxelmesh_packed_vertex);
+      glEnableVertexAttribArray( vColor );
+      glEnableVertexAttribArray( vPosition );
+      glVertexAttribPointer( vPosition, 4, GL_UNSIGNED_SHORT, GL_FALSE, stride, BUFFER_OFFSET(offsetof(voxelmesh_packed_vertex, x)) );
+      glVertexAttribPointer( vColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, BUFFER_OFFSET(offsetof(voxelmesh_packed_vertex, r)) );
+    } else {
+      unsigned int vertices_bytes = voxelgrid[i].vertices.size()*sizeof(vec4);
+      unsigned int colors_bytes  = voxelgrid[i].colors.size()*sizeof(vec3);
+      unsigned int normals_bytes  = voxelgrid[i].normals.size()*sizeof(vec3);
+
+      glEnableVertexAttribArray( vColor );
+      glEnableVertexAttribArray( vPosition );
+      if (normals_bytes > 0)
+        glEnableVertexAttribArray( vNormal );
+
+      if (vertices_bytes > 0)
+        glVertexAttribPointer( vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0) );
+      if (colors_bytes > 0)
+        glVertexAttribPointer( vColor, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(static_cast<size_t>(vertices_bytes)) );
+      if (normals_bytes > 0)
+        glVertexAttribPointer( vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(static_cast<size_t>(vertices_bytes + colors_bytes)) );
+    }
+    //Indices stay bound to the vertex array
+    if (index_buffer[i] != 0)
+      glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, index_buffer[i] );
+    glBindVertexArray( 0 );
+
+    model_state[i] = _RESIDENT;
+    std::cout << "Loaded " << files[i] << " in "
+              << (glfwGetTime() - load.start)*1000.0 << " ms, longest frame meanwhile "
+              << longest_frame*1000.0 << " ms, streamed "
+              << load.streamed/1024.0 << " KiB with " << load.stalls << " stall(s)\n";
+  }
+}
+
+//Write the changed entries of one array into `target` through the patch
+//ring. When the array outgrew the buffer, the buffer gets half again as
+//much room and the whole array is written.
+static std::size_t patch_buffer(GLuint target, std::size_t& allocated, const void* data,
+                                std::size_t count, std::size_t size,
+                                const std::vector<voxelchunks_range>& ranges){
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  if (count*size > allocated) {
+    allocated = count*size + count*size/2;
+    glBindBuffer( GL_COPY_WRITE_BUFFER, target );
+    glBufferData( GL_COPY_WRITE_BUFFER, allocated, NULL, GL_STATIC_DRAW );
+    voxelstream_upload( patch_stream, target, 0, bytes, count*size );
+    return count*size;
+  }
+  std::size_t patched = 0;
+  for (std::size_t r = 0; r < ranges.size(); ++r) {
+    voxelstream_upload( patch_stream, target, ranges[r].first*size,
+                        bytes + ranges[r].first*size, ranges[r].count*size );
+    patched += ranges[r].count*size;
+  }
+  return patched;
+}
+
+//Fill or clear a box around a solid voxel of the shown model, remesh
+//the chunks it touched and patch just their ranges on the GPU
+static void edit_model(int edit){
+  if (shown_draw < 0)
+    return;
+  unsigned int d = shown_draw;
+  VoxelGrid& grid = voxelgrid[d];
+  if (!grid.chunked_mesh) {
+    reload_editable(d);
+    return;
+  }
+
+  unsigned int at[3] = {0, 0, 0};
+  const unsigned int dims[3] = {grid.width, grid.height, grid.depth};
+  for (unsigned int tries = 0; tries < 64; ++tries) {
+    for (unsigned int a = 0; a < 3; ++a) {
+      edit_seed = edit_seed*6364136223846793005ull + 1442695040888963407ull;
+      at[a] = static_cast<unsigned int>((edit_seed >> 33) % dims[a]);
+    }
+    if (voxeloccupancy_test(grid.occupancy, at[0], at[1], at[2]))
+      break;
+  }
+  unsigned int lo[3], hi[3];
+  for (unsigned int a = 0; a < 3; ++a) {
+    lo[a] = at[a] >= 3 ? at[a]-3 : 0;
+    hi[a] = at[a] + 3;
+  }
+  unsigned int color = 0;
+  if (edit == _EDIT_FILL) {
+    color = voxelbricks_pack(static_cast<unsigned char>(edit_seed >> 40),
+                             static_cast<unsigned char>(edit_seed >> 48),
+                             static_cast<unsigned char>(edit_seed >> 56), 255);
+  }
+
+  double start = glfwGetTime();
+  std::vector<voxelchunks_range> vertex_ranges, index_ranges;
+  grid.fillBox(lo, hi, color);
+  std::size_t chunks = grid.remesh(vertex_ranges, index_ranges);
+  double meshed = glfwGetTime();
+  std::size_t patched = 0;
+  if (!grid.packed.empty())
+    patched += patch_buffer(buffer[d], buffer_bytes[d], &grid.packed[0], grid.packed.size(),
+                            sizeof(voxelmesh_packed_vertex), vertex_ranges);
+  if (!grid.indices.empty())
+    patched += patch_buffer(index_buffer[d], index_buffer_bytes[d], &grid.indices[0],
+                            grid.indices.size(), sizeof(GLuint), index_ranges);
+  std::cout << "Edited " << files[d] << ": " << chunks << " chunk(s) remeshed in "
+            << (meshed - start)*1000.0 << " ms, " << patched/1024.0
+            << " KiB patched in " << (glfwGetTime() - meshed)*1000.0 << " ms\n";
+}
+
+
+void init(){
+  
+  std::string vshaders[_TOTAL_PROGRAMS] = {source_path + "/shaders/vshader.glsl",
+                                           source_path + "/shaders/vshader_packed.glsl"};
+  std::string fshader = source_path + "/shaders/fshader.glsl";
+
+  //Compute ambient, diffuse, and specular terms
+  color4 ambient_product  = light_ambient * material_ambient;
+  color4 diffuse_product  = light_diffuse * material_diffuse;
+  color4 specular_product = light_specular * material_specular;
+
+  for(unsigned int p=0; p < _TOTAL_PROGRAMS; p++){
+    GLchar* vertex_shader_source = readShaderSource(vshaders[p].c_str());
+    GLchar* fragment_shader_source = readShaderSource(fshader.c_str());
+
+    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertex_shader, 1, (const GLchar**) &vertex_shader_source, NULL);
+    glCompileShader(vertex_shader);
+    check_shader_compilation(vshaders[p], vertex_shader);
+    
+    GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment_shader, 1, (const GLchar**) &fragment_shader_source, NULL);
+    glCompileShader(fragment_shader);
+    check_shader_compilation(fshader, fragment_shader);
+    
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    
+    glBindAttribLocation(program, vPosition, "vPosition");
+    glBindAttribLocation(program, vColor, "vColor");
+    glBindAttribLocation(program, vNormal, "vNormal");
+    glBindFragDataLocation(program, 0, "fragColor");
+
+    glLinkProgram(program);
+    check_program_link(program);
+    
+    glUseProgram(program);
+    programs[p] = program;
+
+    //Retrieve and set uniform variables
+    glUniform4fv( glGetUniformLocation(program, "Light"), 1, light);
+    glUniform4fv( glGetUniformLocation(program, "AmbientProduct"), 1, ambient_product );
+    glUniform4fv( glGetUniformLocation(program, "DiffuseProduct"), 1, diffuse_product );
+    glUniform4fv( glGetUniformLocation(program, "SpecularProduct"), 1, specular_product );
+    glUniform1f(  glGetUniformLocation(program, "Shininess"), material_shininess );
+    
+    //Matrix uniform variable locations
+    ModelView_loc[p] = glGetUniformLocation( program, "ModelView" );
+    NormalMatrix_loc[p] = glGetUniformLocation( program, "NormalMatrix" );
+    Projection_loc[p] = glGetUniformLocation( program, "Projection" );
   }
   
-  //===== End: Send data to GPU ======
+  //===== GPU slots, filled as models load ======
+  vao.resize(_TOTAL_IMAGES, 0);
+  buffer.resize(_TOTAL_IMAGES, 0);
+  index_buffer.resize(_TOTAL_IMAGES, 0);
+  index_type.resize(_TOTAL_IMAGES, GL_UNSIGNED_INT);
+  buffer_bytes.resize(_TOTAL_IMAGES, 0);
+  index_buffer_bytes.resize(_TOTAL_IMAGES, 0);
+  
+  model_state.resize(_TOTAL_IMAGES, _UNLOADED);
+  model_editable.resize(_TOTAL_IMAGES, 0);
+  model_lod.resize(_TOTAL_IMAGES, 0);
+  lod_views.resize(_TOTAL_IMAGES);
+  last_shown.resize(_TOTAL_IMAGES, 0);
+  show_count = 0;
+  shown_draw = -1;
+  longest_frame = 0.0;
+  voxelgrid.resize(_TOTAL_IMAGES, VoxelGrid(VoxelGridOptions()));
+
+  //===== End: GPU slots ======
 
 
   // ====== Enable some opengl capabilitions ======
@@ -272,7 +659,12 @@ void init(){
   scalefactor = 1.0;
   
   wireframe = false;
+  occlusion_culling = true;
+  voxelocclude_init(occlusion);
   current_draw = 0;
+  pending_edit = _EDIT_NONE;
+  pending_lod = false;
+  edit_seed = 1;
   
   lbutton_down = false;
 
@@ -310,15 +702,43 @@ int main(void){
   glfwSetCursorPosCallback(window, mouse_move);
 
   
+  //Hidden window whose context the loader thread uploads through
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  upload_window = glfwCreateWindow(1, 1, "", NULL, window);
+  if (!upload_window){
+    glfwTerminate();
+    exit(EXIT_FAILURE);
+  }
+  
   glfwMakeContextCurrent(window);
   gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
   glfwSwapInterval(1);
   
+  //The upload ring lives in the loader's context
+  glfwMakeContextCurrent(upload_window);
+  if (!voxelstream_create(upload_stream, _UPLOAD_RING_BYTES, (GLADloadproc) glfwGetProcAddress)){
+    glfwTerminate();
+    exit(EXIT_FAILURE);
+  }
+  std::cout << "Upload ring: " << (_UPLOAD_RING_BYTES >> 20) << " MiB, "
+            << (voxelstream_persistent(upload_stream) ? "persistently mapped" : "orphaned on wrap")
+            << "\n";
+  glfwMakeContextCurrent(window);
+  
   init();
+  loader = new WorkPool(1);
+  if (!voxelstream_create(patch_stream, _PATCH_RING_BYTES, (GLADloadproc) glfwGetProcAddress)){
+    glfwTerminate();
+    exit(EXIT_FAILURE);
+  }
   
-
+  bool first_frame_shown = false;
+  bool first_model_shown = false;
+  //Culling counts of the last frame, shown in the window title
+  voxelcull_stats shown_cull = {0, 0, 0, 0, 0};
   
   while (!glfwWindowShouldClose(window)){
+    double frame_start = glfwGetTime();
     
     //Display as wirfram, boolean tied to keystoke 'w'
     if(wireframe){
@@ -355,22 +775,101 @@ int main(void){
     
 
     // ====== Draw ======
-    glBindVertexArray(vao[current_draw]);
-    //glBindBuffer( GL_ARRAY_BUFFER, buffer[current_draw] );
-    
-    glUniformMatrix4fv( ModelView_loc, 1, GL_TRUE, user_MV*voxelgrid[current_draw].model_view);
-    glUniformMatrix4fv( Projection_loc, 1, GL_TRUE, projection );
-    glUniformMatrix4fv( NormalMatrix_loc, 1, GL_TRUE, transpose(invert(user_MV*voxelgrid[current_draw].model_view)));
+    request_model(current_draw);
+    finish_loads();
+    if (model_state[current_draw] == _RESIDENT)
+      shown_draw = current_draw;
+    if (pending_edit != _EDIT_NONE) {
+      edit_model(pending_edit);
+      pending_edit = _EDIT_NONE;
+    }
+    if (pending_lod) {
+      if (shown_draw >= 0)
+        reload_lod(shown_draw);
+      pending_lod = false;
+    }
 
-    glDrawArrays( GL_TRIANGLES, 0, voxelgrid[current_draw].vertices.size() );
+    if (shown_draw >= 0) {
+      unsigned int d = shown_draw;
+      last_shown[d] = ++show_count;
+      glBindVertexArray(vao[d]);
+      
+      unsigned int p = (voxelgrid[d].packed_mesh || voxelgrid[d].faceIds()) ? _PACKED_PROGRAM : _FLOAT_PROGRAM;
+      glUseProgram(programs[p]);
+      mat4 model_MV = user_MV*voxelgrid[d].model_view;
+      glUniformMatrix4fv( ModelView_loc[p], 1, GL_TRUE, model_MV);
+      glUniformMatrix4fv( Projection_loc[p], 1, GL_TRUE, projection );
+      glUniformMatrix4fv( NormalMatrix_loc[p], 1, GL_TRUE, transpose(invert(model_MV)));
+
+      if (!voxelgrid[d].draw_chunks.empty()) {
+        //Only the chunks inside the view volume and not hidden, in one call
+        mat4 model_MVP = projection*model_MV;
+        const std::vector < voxelcull_chunk >* chunks = &voxelgrid[d].draw_chunks;
+        if (voxelgrid[d].lod.levels.size() > 1) {
+          //Far chunks from coarser levels; the model-view scale is uniform,
+          //so lattice units keep their screen size at lattice distances
+          vec4 eye = invert(model_MV)*vec4(0.0, 0.0, 0.0, 1.0);
+          const float eye_lattice[3] = {eye.x/eye.w, eye.y/eye.w, eye.z/eye.w};
+          voxellod_select(voxelgrid[d].lod, lod_views[d], eye_lattice,
+                          projection[1][1]*height*0.5f, lod_chunks);
+          chunks = &lod_chunks;
+        }
+        voxelcull_stats cull;
+        voxelcull_frustum frustum;
+        voxelcull_frustum_from(frustum, model_MVP);
+        voxelcull_test(frustum, *chunks, draw_visible);
+        if (occlusion_culling && !voxelgrid[d].occluders.cells.empty())
+          voxelocclude_cull(occlusion, model_MVP, *chunks, draw_visible, voxelgrid[d].occluders);
+        voxelcull_draws(*chunks, draw_visible, draw_first, draw_count, &cull);
+        GLsizei index_bytes = (index_type[d] == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+        draw_counts.resize(draw_first.size());
+        draw_offsets.resize(draw_first.size());
+        for (std::size_t j = 0; j < draw_first.size(); ++j) {
+          draw_counts[j] = static_cast<GLsizei>(draw_count[j]);
+          draw_offsets[j] = BUFFER_OFFSET(draw_first[j]*index_bytes);
+        }
+        if (!draw_counts.empty())
+          glMultiDrawElements( GL_TRIANGLES, &draw_counts[0], index_type[d], &draw_offsets[0], static_cast<GLsizei>(draw_counts.size()) );
+        if (cull.culled_chunks != shown_cull.culled_chunks || cull.chunks != shown_cull.chunks
+        ||  cull.culled_triangles != shown_cull.culled_triangles || cull.triangles != shown_cull.triangles) {
+          char title[160];
+          std::snprintf(title, sizeof(title), "Assignment 5 - Volumetric Models - "
+                        "culled %zu/%zu chunks, %llu/%llu triangles",
+                        cull.culled_chunks, cull.chunks, cull.culled_triangles, cull.triangles);
+          glfwSetWindowTitle(window, title);
+        }
+        shown_cull = cull;
+      } else if (voxelgrid[d].getNumIndices() > 0)
+        glDrawElements( GL_TRIANGLES, voxelgrid[d].getNumIndices(), index_type[d], BUFFER_OFFSET(0) );
+      else
+        glDrawArrays( GL_TRIANGLES, 0, voxelgrid[d].vertices.size() );
+    }
     // ====== End: Draw ======
+    voxelstream_frame(patch_stream);
 
     
     glfwSwapBuffers(window);
+    //glfwGetTime counts from glfwInit
+    if (!first_frame_shown) {
+      std::cout << "First frame after " << glfwGetTime()*1000.0 << " ms\n";
+      first_frame_shown = true;
+    }
+    if (!first_model_shown && shown_draw >= 0) {
+      std::cout << "First model on screen after " << glfwGetTime()*1000.0 << " ms\n";
+      first_model_shown = true;
+    }
     glfwPollEvents();
+    longest_frame = (std::max)(longest_frame, glfwGetTime() - frame_start);
     
   }
   
+  //Let the loader finish before its context goes away
+  delete loader;
+  voxelstream_destroy(patch_stream);
+  glfwMakeContextCurrent(upload_window);
+  voxelstream_destroy(upload_stream);
+  glfwMakeContextCurrent(window);
+  glfwDestroyWindow(upload_window);
   glfwDestroyWindow(window);
   
   glfwTerminate();